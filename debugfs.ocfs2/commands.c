@@ -261,7 +261,7 @@ static struct command commands[] = {
 	},
 	{ "rdump",
 		do_rdump,
-		"rdump [-v] <filespec> <outdir>",
+		"rdump [-v] [-j n] [-m file] <filespec> <outdir>",
 		"Recursively dumps from src to a dir on a mounted filesystem",
 	},
 	{ "refcount",
@@ -1559,24 +1559,42 @@ static void do_rdump(char **args)
 	uint64_t blkno;
 	struct stat st;
 	char *p;
-	char *usage = "usage: rdump [-v] <srcdir> <dstdir>";
+	char *usage = "usage: rdump [-v] [-j <jobs>] [-m <manifest>] "
+		"<srcdir> <dstdir>";
 	errcode_t ret;
-	int ind = 1;
+	int ind;
 	int verbose = 0;
-	char tmp_str[40];
+	int jobs = 1;
+	char *manifest = NULL;
+	char tmp_str[PATH_MAX];
+	int c, argc;
 
 	if (check_device_open())
 		return ;
 
-	if (!args[1]) {
-		fprintf(stderr, "%s\n", usage);
-		return ;
-	}
-
-	if (!strcmp(args[1], "-v")) {
-		++ind;
-		++verbose;
+	for (argc = 0; (args[argc]); ++argc);
+	optind = 0;
+	while ((c = getopt(argc, args, "vj:m:")) != -1) {
+		switch (c) {
+		case 'v':
+			++verbose;
+			break;
+		case 'j':
+			jobs = strtol(optarg, &p, 0);
+			if (*p || jobs < 1) {
+				fprintf(stderr, "%s\n", usage);
+				return ;
+			}
+			break;
+		case 'm':
+			manifest = optarg;
+			break;
+		default:
+			fprintf(stderr, "%s\n", usage);
+			return ;
+		}
 	}
+	ind = optind;
 
 	if (!args[ind] || !args[ind+1]) {
 		fprintf(stderr, "%s\n", usage);
@@ -1614,13 +1632,20 @@ static void do_rdump(char **args)
 		time_t tt;
 		struct tm *tm;
 
-		time(&tt);
-		tm = localtime(&tt);
-		/* YYYY-MM-DD_HH:MI:SS */
-		snprintf(tmp_str, sizeof(tmp_str), "%4d-%2d-%2d_%02d:%02d:%02d",
-			 1900 + tm->tm_year, tm->tm_mon, tm->tm_mday,
-			 tm->tm_hour, tm->tm_min, tm->tm_sec);
-		p = tmp_str;
+		/* A resumed copy goes where the first run put it */
+		if (manifest && rdump_manifest_root(manifest, tmp_str,
+						    sizeof(tmp_str)))
+			p = tmp_str;
+		else {
+			time(&tt);
+			tm = localtime(&tt);
+			/* YYYY-MM-DD_HH:MI:SS */
+			snprintf(tmp_str, sizeof(tmp_str),
+				 "%4d-%2d-%2d_%02d:%02d:%02d",
+				 1900 + tm->tm_year, tm->tm_mon, tm->tm_mday,
+				 tm->tm_hour, tm->tm_min, tm->tm_sec);
+			p = tmp_str;
+		}
 	}
 
 	/* drop the trailing '/' in destination */
@@ -1633,7 +1658,8 @@ static void do_rdump(char **args)
 
 	fprintf(stdout, "Copying to %s/%s\n", args[ind+1], p);
 
-	ret = rdump_inode(gbls.fs, blkno, p, args[ind+1], verbose);
+	ret = rdump_tree(gbls.fs, blkno, p, args[ind+1], verbose, jobs,
+			 manifest);
 	if (ret)
 		com_err(args[0], ret, "while recursively dumping "
 			"inode %"PRIu64, blkno);
@@ -1891,20 +1917,16 @@ bail:
 	return;
 }
 
-static void do_icheck(char **args)
+/* Returns the number of blocks parsed into blkno, or -1 on error */
+static int parse_icheck_args(char **args, uint64_t *blkno)
 {
 	const char *testb_usage = "usage: icheck block# ...";
 	char *endptr;
-	uint64_t blkno[MAX_BLOCKS];
 	int i;
-	FILE *out;
-
-	if (check_device_open())
-		return;
 
 	if (!args[1]) {
 		fprintf(stderr, "%s\n", testb_usage);
-		return;
+		return -1;
 	}
 
 	for (i = 0; i < MAX_BLOCKS && args[i + 1]; ++i) {
@@ -1912,25 +1934,109 @@ static void do_icheck(char **args)
 		if (*endptr) {
 			com_err(args[0], OCFS2_ET_BAD_BLKNO, "- %s",
 				args[i + 1]);
-			return;
+			return -1;
 		}
 
 		if (blkno[i] >= gbls.max_blocks) {
 			com_err(args[0], OCFS2_ET_BAD_BLKNO, "- %"PRIu64"",
 				blkno[i]);
-			return;
+			return -1;
 		}
 	}
 
+	return i;
+}
+
+static void do_icheck(char **args)
+{
+	uint64_t blkno[MAX_BLOCKS];
+	int count;
+	FILE *out;
+
+	if (check_device_open())
+		return;
+
+	count = parse_icheck_args(args, blkno);
+	if (count < 0)
+		return;
+
 	out = open_pager(gbls.interactive);
 
-	find_block_inode(gbls.fs, blkno, i, out);
+	find_block_inode(gbls.fs, blkno, count, out);
 
 	close_pager(out);
 
 	return;
 }
 
+struct icheck_batch {
+	char **lines;
+	const char *prompt;
+};
+
+static void show_icheck_line(int query, FILE *out, void *data)
+{
+	struct icheck_batch *batch = data;
+
+	if (batch->prompt)
+		fprintf(out, "%s%s\n", batch->prompt, batch->lines[query]);
+}
+
+/*
+ * Runs a run of icheck commands read from a command file.  Each icheck
+ * scans every inode, so one scan answers all of them.  Each answer is
+ * printed after its command line, which is echoed if prompt is set.
+ */
+void do_icheck_batch(char **lines, int count, const char *prompt)
+{
+	struct icheck_batch batch = {
+		.lines = lines,
+		.prompt = prompt,
+	};
+	uint64_t *blkno = NULL;
+	int *counts = NULL;
+	char **args;
+	int i, nr_blocks = 0;
+	FILE *out;
+
+	if (gbls.fs && count > 1) {
+		blkno = calloc(count * MAX_BLOCKS, sizeof(uint64_t));
+		counts = calloc(count, sizeof(int));
+	}
+
+	if (!blkno || !counts) {
+		for (i = 0; i < count; ++i) {
+			if (prompt)
+				fprintf(stdout, "%s%s\n", prompt, lines[i]);
+			do_command(lines[i]);
+		}
+		goto bail;
+	}
+
+	gbls.cmd = "icheck";
+	for (i = 0; i < count; ++i) {
+		args = g_strsplit(lines[i], " ", -1);
+		crunch_strsplit(args);
+		counts[i] = parse_icheck_args(args, blkno + nr_blocks);
+		if (counts[i] < 0)
+			counts[i] = 0;
+		nr_blocks += counts[i];
+		g_strfreev(args);
+	}
+
+	fflush(stdout);
+	out = open_pager(gbls.interactive);
+
+	find_block_inode_batch(gbls.fs, blkno, counts, count, out,
+			       show_icheck_line, &batch);
+
+	close_pager(out);
+
+bail:
+	free(blkno);
+	free(counts);
+}
+
 static void do_xattr(char **args)
 {
 	struct ocfs2_dinode *inode;
@@ -82,6 +82,10 @@ void dump_super_block(FILE *out, struct ocfs2_super_block *sb)
 	fprintf(out, "\tExtended Attributes Inline Size: %u\n",
 		sb->s_xattr_inline_size);
 
+	if (sb->s_raid_stride || sb->s_raid_stripe_width)
+		fprintf(out, "\tRAID Stride: %u   RAID Stripe Width: %u\n",
+			sb->s_raid_stride, sb->s_raid_stripe_width);
+
 	fprintf(out, "\tLabel: %.*s\n", OCFS2_MAX_VOL_LABEL_LEN, sb->s_label);
 	fprintf(out, "\tUUID: ");
 	for (i = 0; i < 16; i++)
@@ -335,6 +339,8 @@ void dump_inode(FILE *out, struct ocfs2_dinode *in)
 		fprintf(out, "\tJournal Flags: ");
 		if (in->id1.journal1.ij_flags & OCFS2_JOURNAL_DIRTY_FL)
 			fprintf(out, "Dirty ");
+		if (in->id1.journal1.ij_flags & OCFS2_JOURNAL_UNZEROED_FL)
+			fprintf(out, "Unzeroed ");
 		fprintf(out, "\n");
 		fprintf(out, "\tRecovery Generation: %u\n",
 			in->id1.journal1.ij_recovery_generation);
@@ -312,29 +312,84 @@ static void check_computed_blocks(ocfs2_filesys *fs, uint64_t gb_blkno,
 	return;
 }
 
-errcode_t find_block_inode(ocfs2_filesys *fs, uint64_t *blkno, int count,
-			   FILE *out)
+struct find_block_ctxt {
+	struct block_array *ba;
+	int count;
+	int found;
+	uint64_t gb_blkno;
+};
+
+static errcode_t find_block_func(ocfs2_filesys *fs, uint64_t blkno,
+				 struct ocfs2_dinode *di, void *priv_data)
+{
+	struct find_block_ctxt *ctxt = priv_data;
+	struct block_array *ba = ctxt->ba;
+	errcode_t ret;
+	int i;
+
+	for (i = 0; i < ctxt->count; ++i) {
+		if (ba[i].status != STATUS_UNKNOWN)
+			continue;
+		if (ba[i].blkno == di->i_blkno) {
+			ba[i].status = STATUS_USED;
+			ba[i].inode = di->i_blkno;
+			ctxt->found++;
+		}
+	}
+
+	if (ctxt->found >= ctxt->count)
+		return OCFS2_ET_ITERATION_COMPLETE;
+
+	if (S_ISLNK(di->i_mode) && !di->i_clusters)
+		return 0;
+
+	if (di->i_flags & (OCFS2_LOCAL_ALLOC_FL | OCFS2_DEALLOC_FL))
+		return 0;
+
+	if (di->i_blkno == ctxt->gb_blkno)
+		return 0;
+
+	if (di->i_flags & OCFS2_CHAIN_FL)
+		ret = lookup_chain(fs, di, ba, ctxt->count, &ctxt->found);
+	else
+		ret = lookup_regular(fs, di->i_blkno, &(di->id2.i_list),
+				     ba, ctxt->count, &ctxt->found);
+	if (ret)
+		return ret;
+
+	if (ctxt->found >= ctxt->count)
+		return OCFS2_ET_ITERATION_COMPLETE;
+
+	return 0;
+}
+
+/*
+ * Answers nr_queries icheck queries with one pass over the volume.
+ * Query i asks about counts[i] blocks, taken in turn from blkno.  The
+ * answers are printed query by query, and show() is called before each
+ * one if it is set.
+ */
+errcode_t find_block_inode_batch(ocfs2_filesys *fs, uint64_t *blkno,
+				 int *counts, int nr_queries, FILE *out,
+				 void (*show)(int query, FILE *out,
+					      void *data),
+				 void *data)
 {
 	errcode_t ret = 0;
-	uint64_t inode_num;
 	struct block_array *ba = NULL;
-	char *buf = NULL;
-	struct ocfs2_dinode *di;
-	ocfs2_inode_scan *scan = NULL;
-	int i;
+	ocfs2_scan_bus *bus = NULL;
+	struct find_block_ctxt ctxt;
+	int i, j, q;
+	int count = 0;
 	int found = 0;
 	uint64_t gb_blkno;
 
-	ret = ocfs2_malloc_block(fs->fs_io, &buf);
-	if (ret) {
-		com_err(gbls.cmd, ret, "while allocating a block");
-		goto out;
-	}
-	di = (struct ocfs2_dinode *)buf;
+	for (q = 0; q < nr_queries; ++q)
+		count += counts[q];
 
 	ba = calloc(count, sizeof(struct block_array));
 	if (!ba) {
-		com_err(gbls.cmd, ret, "while allocating memory");
+		com_err(gbls.cmd, OCFS2_ET_NO_MEMORY, "while allocating memory");
 		goto out;
 	}
 
@@ -359,82 +414,47 @@ errcode_t find_block_inode(ocfs2_filesys *fs, uint64_t *blkno, int count,
 	if (found >= count)
 		goto output;
 
-	ret = ocfs2_open_inode_scan(fs, &scan);
+	ret = ocfs2_open_scan_bus(fs, &bus);
 	if (ret) {
 		com_err(gbls.cmd, ret, "while opening inode scan");
 		goto out_free;
 	}
 
-	for (;;) {
-		ret = ocfs2_get_next_inode(scan, &inode_num, (char *)di);
-		if (ret) {
-			com_err(gbls.cmd, ret, "while scanning next inode");
-			goto out_close_scan;
-		}
-
-		if (!inode_num)
-			break;
-
-		if (memcmp(di->i_signature, OCFS2_INODE_SIGNATURE,
-			   strlen(OCFS2_INODE_SIGNATURE)))
-			continue;
-
-		ocfs2_swap_inode_to_cpu(fs, di);
-
-		if (di->i_fs_generation != fs->fs_super->i_fs_generation)
-			continue;
-
-		if (!(di->i_flags & OCFS2_VALID_FL))
-			continue;
-
-		for (i = 0; i < count; ++i) {
-			if (ba[i].status != STATUS_UNKNOWN)
-				continue;
-			if (ba[i].blkno == di->i_blkno) {
-				ba[i].status = STATUS_USED;
-				ba[i].inode = di->i_blkno;
-				found++;
-			}
-		}
-
-		if (found >= count)
-			break;
+	ctxt.ba = ba;
+	ctxt.count = count;
+	ctxt.found = found;
+	ctxt.gb_blkno = gb_blkno;
 
-		if (S_ISLNK(di->i_mode) && !di->i_clusters)
-			continue;
-
-		if (di->i_flags & (OCFS2_LOCAL_ALLOC_FL | OCFS2_DEALLOC_FL))
-			continue;
-
-		if (di->i_blkno == gb_blkno)
-			continue;
-
-		if (di->i_flags & OCFS2_CHAIN_FL)
-			ret = lookup_chain(fs, di, ba, count, &found);
-		else
-			ret = lookup_regular(fs, di->i_blkno, &(di->id2.i_list),
-					     ba, count, &found);
-		if (ret)
-			goto out_close_scan;
-
-		if (found >= count)
-			break;
+	ret = ocfs2_scan_bus_add(bus, 0, find_block_func, &ctxt);
+	if (!ret)
+		ret = ocfs2_scan_bus_run(bus);
+	if (ret) {
+		com_err(gbls.cmd, ret, "while scanning inodes");
+		goto out_close_bus;
 	}
 
 output:
-	for (i = 0; i < count; ++i)
-		dump_icheck(out, (i == 0), ba[i].blkno, ba[i].inode,
-			    ba[i].data, ba[i].offset, ba[i].status);
+	for (q = 0, i = 0; q < nr_queries; i += counts[q], ++q) {
+		if (show)
+			show(q, out, data);
+		for (j = i; j < i + counts[q]; ++j)
+			dump_icheck(out, (j == i), ba[j].blkno, ba[j].inode,
+				    ba[j].data, ba[j].offset, ba[j].status);
+	}
 
-out_close_scan:
-	if (scan)
-		ocfs2_close_inode_scan(scan);
+out_close_bus:
+	if (bus)
+		ocfs2_close_scan_bus(bus);
 
 out_free:
-	if (buf)
-		ocfs2_free(&buf);
 	if (ba)
 		free(ba);
 out:
 	return 0;
 }
+
+errcode_t find_block_inode(ocfs2_filesys *fs, uint64_t *blkno, int count,
+			   FILE *out)
+{
+	return find_block_inode_batch(fs, blkno, &count, 1, out, NULL, NULL);
+}
@@ -27,6 +27,7 @@
 #define __COMMANDS_H__
 
 void  do_command (char *cmd);
+void do_icheck_batch(char **lines, int count, const char *prompt);
 void handle_signal (int sig);
 
 #endif /* __COMMANDS_H__ */
@@ -27,5 +27,10 @@
 
 errcode_t find_block_inode(ocfs2_filesys *fs, uint64_t *blkno, int count,
 			   FILE *out);
+errcode_t find_block_inode_batch(ocfs2_filesys *fs, uint64_t *blkno,
+				 int *counts, int nr_queries, FILE *out,
+				 void (*show)(int query, FILE *out,
+					      void *data),
+				 void *data);
 
 #endif		/* _FIND_BLOCK_INODE_ */
@@ -25,11 +25,13 @@
 #ifndef __UTILS_H__
 #define __UTILS_H__
 
+struct rdump_ctxt;
+
 struct rdump_opts {
 	ocfs2_filesys *fs;
 	char *fullname;
 	char *buf;
-	int verbose;
+	struct rdump_ctxt *ctxt;
 };
 
 struct strings {
@@ -60,8 +62,10 @@ errcode_t read_whole_file(ocfs2_filesys *fs, uint64_t ino, char **buf,
 			  uint32_t *buflen);
 void inode_perms_to_str(uint16_t mode, char *str, int len);
 void inode_time_to_str(uint64_t mtime, char *str, int len);
-errcode_t rdump_inode(ocfs2_filesys *fs, uint64_t blkno, const char *name,
-		      const char *dumproot, int verbose);
+int rdump_manifest_root(const char *manifest, char *root, int len);
+errcode_t rdump_tree(ocfs2_filesys *fs, uint64_t blkno, const char *name,
+		     const char *dumproot, int verbose, int jobs,
+		     char *manifest);
 void crunch_strsplit(char **args);
 void find_max_contig_free_bits(struct ocfs2_group_desc *gd, int *max_contig_free_bits);
 void print_contig_bits(FILE *out, struct ocfs2_group_desc *gd);
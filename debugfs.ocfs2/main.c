@@ -320,6 +320,39 @@ static char *get_line(FILE *stream, int no_prompt)
 	return line;
 }
 
+#define MAX_ICHECK_BATCH	64
+
+static int is_icheck(const char *line)
+{
+	return !strncmp(line, "icheck", 6) &&
+		(line[6] == ' ' || line[6] == '\0');
+}
+
+/*
+ * Command files often run icheck once per block of interest.  Rather
+ * than scan every inode for each one, a run of icheck lines is handed
+ * to do_icheck_batch() to be answered together.  Returns the line that
+ * ended the run, or NULL at the end of the file.
+ */
+static char *run_icheck_batch(FILE *stream, char *line, int no_prompt)
+{
+	char *lines[MAX_ICHECK_BATCH];
+	int count = 0;
+	int i;
+
+	do {
+		lines[count++] = g_strdup(line);
+		line = get_line(stream, no_prompt);
+	} while (line && is_icheck(line) && (count < MAX_ICHECK_BATCH));
+
+	do_icheck_batch(lines, count, no_prompt ? NULL : PROMPT);
+
+	for (i = 0; i < count; i++)
+		g_free(lines[i]);
+
+	return line;
+}
+
 #define LOG_CTL_PROC "/proc/fs/ocfs2_nodemanager/log_mask"
 static int set_logmode_proc(struct log_entry *entry)
 {
@@ -511,6 +544,8 @@ int main(int argc, char **argv)
 
 	while (1) {
 		line = get_line(cmd, opts.no_prompt);
+		while (cmd && line && is_icheck(line))
+			line = run_icheck_batch(cmd, line, opts.no_prompt);
 
 		if (line) {
 			if (!gbls.interactive && !opts.no_prompt)
@@ -24,6 +24,10 @@
  *
  */
 
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
 #include "main.h"
 #include "ocfs2/bitops.h"
 
@@ -376,16 +380,68 @@ bail:
 static errcode_t dump_symlink(ocfs2_filesys *fs, uint64_t blkno, char *name,
 			      struct ocfs2_dinode *inode);
 
+#define DUMP_ZERO_BYTES		(1024 * 1024)
+
+struct dump_file_context {
+	int		fd;
+	int		sparse;		/* seek over holes, don't write them */
+	char		*zero_buf;	/* DUMP_ZERO_BYTES of zeroes */
+};
+
+static errcode_t dump_write(int fd, char *buf, uint64_t len)
+{
+	ssize_t wrote;
+
+	while (len) {
+		wrote = write(fd, buf, len);
+		if (wrote < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		if (!wrote)
+			return EIO;
+		buf += wrote;
+		len -= wrote;
+	}
+
+	return 0;
+}
+
+static errcode_t dump_file_run(ocfs2_filesys *fs, uint64_t offset,
+			       char *buf, uint64_t len, void *priv_data)
+{
+	struct dump_file_context *ctxt = priv_data;
+	uint64_t chunk;
+	errcode_t ret = 0;
+
+	if (buf)
+		return dump_write(ctxt->fd, buf, len);
+
+	if (ctxt->sparse) {
+		if (lseek64(ctxt->fd, len, SEEK_CUR) == -1)
+			ret = errno;
+		return ret;
+	}
+
+	while (!ret && len) {
+		chunk = ocfs2_min(len, (uint64_t)DUMP_ZERO_BYTES);
+		ret = dump_write(ctxt->fd, ctxt->zero_buf, chunk);
+		len -= chunk;
+	}
+
+	return ret;
+}
+
 errcode_t dump_file(ocfs2_filesys *fs, uint64_t ino, int fd, char *out_file,
 		    int preserve)
 {
 	errcode_t ret;
-	char *buf = NULL;
-	int buflen;
-	uint32_t got;
-	uint32_t wrote;
 	ocfs2_cached_inode *ci = NULL;
-	uint64_t offset = 0;
+	struct stat st;
+	struct dump_file_context ctxt = {
+		.fd = fd,
+	};
 
 	ret = ocfs2_read_cached_inode(fs, ino, &ci);
 	if (ret) {
@@ -403,39 +459,35 @@ errcode_t dump_file(ocfs2_filesys *fs, uint64_t ino, int fd, char *out_file,
 		goto bail;
 	}
 
-	buflen = 1024 * 1024;
-
-	ret = ocfs2_malloc_blocks(fs->fs_io,
-				  (buflen >>
-				   OCFS2_RAW_SB(fs->fs_super)->s_blocksize_bits),
-				  &buf);
-	if (ret) {
-		com_err(gbls.cmd, ret, "while allocating %u bytes", buflen);
-		goto bail;
-	}
-
-	while (1) {
-		ret = ocfs2_file_read(ci, buf, buflen, offset, &got);
+	/*
+	 * Holes in a file we created are skipped with lseek() and the
+	 * size is set with ftruncate(), so the copy stays sparse.
+	 * Anything else, like stdout for cat, gets the zeroes.
+	 */
+	if (fd != fileno(stdout) && !fstat(fd, &st) && S_ISREG(st.st_mode))
+		ctxt.sparse = 1;
+	else {
+		ret = ocfs2_malloc0(DUMP_ZERO_BYTES, &ctxt.zero_buf);
 		if (ret) {
-			com_err(gbls.cmd, ret, "while reading file %"PRIu64" "
-				"at offset %"PRIu64, ci->ci_blkno, offset);
+			com_err(gbls.cmd, ret, "while allocating %u bytes",
+				DUMP_ZERO_BYTES);
 			goto bail;
 		}
+	}
 
-		if (!got)
-			break;
-
-		wrote = write(fd, buf, got);
-		if (wrote != got) {
-			com_err(gbls.cmd, errno, "while writing file");
-			ret = errno;
-			goto bail;
-		}
+	/* The file is read ahead while the last runs are being written */
+	ret = ocfs2_file_stream(ci, 0, dump_file_run, &ctxt);
+	if (ret) {
+		com_err(gbls.cmd, ret, "while dumping file %"PRIu64,
+			ci->ci_blkno);
+		goto bail;
+	}
 
-		if (got < buflen)
-			break;
-		else
-			offset += got;
+	if (ctxt.sparse && ftruncate64(fd, ci->ci_inode->i_size) == -1) {
+		ret = errno;
+		com_err(gbls.cmd, ret, "while setting the size of %s",
+			out_file);
+		goto bail;
 	}
 
 	if (preserve)
@@ -444,8 +496,8 @@ errcode_t dump_file(ocfs2_filesys *fs, uint64_t ino, int fd, char *out_file,
 bail:
 	if (fd > 0 && fd != fileno(stdout))
 		close(fd);
-	if (buf)
-		ocfs2_free(&buf);
+	if (ctxt.zero_buf)
+		ocfs2_free(&ctxt.zero_buf);
 	if (ci)
 		ocfs2_free_cached_inode(fs, ci);
 	return ret;
@@ -616,6 +668,416 @@ bail:
 	return ret;
 }
 
+/*
+ * rdump
+ *
+ * The source tree is walked first.  Directories and symlinks are
+ * created as they are found, regular files are only queued.  The
+ * queue is then sorted by the first physical block of each file and
+ * extracted, by up to rc_jobs worker processes, so the device is swept
+ * in one direction rather than seeking back and forth.  Directory
+ * permissions are fixed last, once nothing more will be written into
+ * them.
+ *
+ * The workers are processes rather than threads because libocfs2 is
+ * not thread safe.  Each reopens the device read-only and pulls the
+ * next file off a shared counter.  Results come back to the parent on
+ * a pipe, and only the parent prints and writes the manifest.
+ */
+#define RDUMP_MAX_JOBS		64
+
+struct rdump_file {
+	uint64_t	rf_blkno;
+	uint64_t	rf_pblk;	/* first data block, the sort key */
+	uint64_t	rf_size;
+	int		rf_done;
+	char		*rf_name;
+};
+
+struct rdump_ctxt {
+	int			rc_verbose;
+	int			rc_jobs;
+	FILE			*rc_manifest;
+	GHashTable		*rc_done;	/* files in the manifest */
+	int			rc_has_root;	/* manifest names the top dir */
+	int			rc_root_len;	/* of dumproot/name */
+	struct rdump_file	*rc_files;
+	int			rc_nr_files;
+	int			rc_max_files;
+	struct rdump_file	*rc_dirs;	/* in the order to fix */
+	int			rc_nr_dirs;
+	int			rc_max_dirs;
+	int			rc_copied;
+	int			rc_skipped;
+	int			rc_failed;
+	errcode_t		rc_ret;		/* of the first failure */
+	uint64_t		rc_bytes;
+};
+
+struct rdump_result {
+	int		rr_index;
+	errcode_t	rr_ret;
+	uint64_t	rr_usecs;
+};
+
+static uint64_t rdump_usecs(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static double rdump_mbps(uint64_t bytes, uint64_t usecs)
+{
+	if (!usecs)
+		usecs = 1;
+	return (double)bytes / usecs * 1000000 / (1024 * 1024);
+}
+
+static errcode_t rdump_add(struct rdump_file **list, int *nr, int *max,
+			   uint64_t blkno, uint64_t pblk, uint64_t size,
+			   char *name)
+{
+	errcode_t ret;
+	int new_max;
+
+	if (*nr == *max) {
+		new_max = *max ? *max * 2 : 256;
+		ret = ocfs2_realloc(new_max * sizeof(struct rdump_file), list);
+		if (ret)
+			return ret;
+		*max = new_max;
+	}
+
+	(*list)[*nr].rf_blkno = blkno;
+	(*list)[*nr].rf_pblk = pblk;
+	(*list)[*nr].rf_size = size;
+	(*list)[*nr].rf_done = 0;
+	(*list)[*nr].rf_name = name;
+	(*nr)++;
+
+	return 0;
+}
+
+static int rdump_pblk_cmp(const void *a, const void *b)
+{
+	const struct rdump_file *l = a, *r = b;
+
+	if (l->rf_pblk < r->rf_pblk)
+		return -1;
+	return l->rf_pblk > r->rf_pblk;
+}
+
+/*
+ * The first block of data in the file, found by walking down the left
+ * edge of its extent tree.  Files without any data sort by their inode.
+ */
+static uint64_t rdump_first_pblk(ocfs2_filesys *fs, struct ocfs2_dinode *di)
+{
+	struct ocfs2_extent_list *el = &di->id2.i_list;
+	char *buf = NULL;
+	uint64_t pblk = di->i_blkno;
+	int i;
+
+	if (di->i_dyn_features & OCFS2_INLINE_DATA_FL)
+		return pblk;
+
+	while (el->l_tree_depth) {
+		if (!el->l_next_free_rec)
+			goto out;
+		if (!buf && ocfs2_malloc_block(fs->fs_io, &buf))
+			goto out;
+		if (ocfs2_read_extent_block(fs, el->l_recs[0].e_blkno, buf))
+			goto out;
+		el = &((struct ocfs2_extent_block *)buf)->h_list;
+	}
+
+	for (i = 0; i < el->l_next_free_rec; i++) {
+		if (el->l_recs[i].e_blkno) {
+			pblk = el->l_recs[i].e_blkno;
+			break;
+		}
+	}
+
+out:
+	if (buf)
+		ocfs2_free(&buf);
+	return pblk;
+}
+
+/*
+ * Each finished file is appended to the manifest as "<inode> ./<path>",
+ * the path being relative to the top of the copy.  A later rdump with
+ * the same manifest skips them.  The first line, "root <name>", is the
+ * name of the top directory, so that a resumed copy of "." or "/"
+ * goes into the same timestamped directory as the first run.
+ */
+#define RDUMP_MANIFEST_ROOT	"root "
+
+static int rdump_manifest_is_root(const char *line)
+{
+	return !strncmp(line, RDUMP_MANIFEST_ROOT,
+			strlen(RDUMP_MANIFEST_ROOT));
+}
+
+/*
+ * Copies the top directory name recorded in manifest into root.
+ * Returns 1 if there was one.
+ */
+int rdump_manifest_root(const char *manifest, char *root, int len)
+{
+	FILE *fp;
+	char *line = NULL;
+	size_t linelen = 0;
+	ssize_t got;
+	int found = 0;
+
+	fp = fopen(manifest, "r");
+	if (!fp)
+		return 0;
+
+	while (!found && (got = getline(&line, &linelen, fp)) != -1) {
+		if (got && line[got - 1] == '\n')
+			line[got - 1] = '\0';
+		if (!rdump_manifest_is_root(line))
+			continue;
+		if (strlen(line) - strlen(RDUMP_MANIFEST_ROOT) < len) {
+			strcpy(root, line + strlen(RDUMP_MANIFEST_ROOT));
+			found = 1;
+		}
+		break;
+	}
+
+	free(line);
+	fclose(fp);
+	return found;
+}
+
+static errcode_t rdump_open_manifest(struct rdump_ctxt *ctxt, char *path)
+{
+	FILE *fp;
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t got;
+	errcode_t ret = 0;
+
+	fp = fopen(path, "r");
+	if (fp) {
+		ctxt->rc_done = g_hash_table_new_full(g_str_hash, g_str_equal,
+						      g_free, NULL);
+		while ((got = getline(&line, &len, fp)) != -1) {
+			if (got && line[got - 1] == '\n')
+				line[got - 1] = '\0';
+			if (rdump_manifest_is_root(line)) {
+				ctxt->rc_has_root = 1;
+				continue;
+			}
+			g_hash_table_insert(ctxt->rc_done, g_strdup(line),
+					    GINT_TO_POINTER(1));
+		}
+		free(line);
+		fclose(fp);
+	} else if (errno != ENOENT) {
+		ret = errno;
+		com_err(gbls.cmd, ret, "while reading manifest %s", path);
+		return ret;
+	}
+
+	ctxt->rc_manifest = fopen(path, "a");
+	if (!ctxt->rc_manifest) {
+		ret = errno;
+		com_err(gbls.cmd, ret, "while opening manifest %s", path);
+	}
+
+	return ret;
+}
+
+static int rdump_in_manifest(struct rdump_ctxt *ctxt, uint64_t blkno,
+			     const char *name)
+{
+	char *key;
+	int found;
+
+	if (!ctxt->rc_done)
+		return 0;
+
+	key = g_strdup_printf("%"PRIu64" .%s", blkno,
+			      name + ctxt->rc_root_len);
+	found = !!g_hash_table_lookup(ctxt->rc_done, key);
+	g_free(key);
+
+	return found;
+}
+
+static errcode_t rdump_extract_file(ocfs2_filesys *fs, struct rdump_file *rf)
+{
+	int fd;
+
+	fd = open64(rf->rf_name, O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU);
+	if (fd == -1) {
+		com_err(gbls.cmd, errno, "while opening file %s", rf->rf_name);
+		return errno;
+	}
+
+	return dump_file(fs, rf->rf_blkno, fd, rf->rf_name, 1);
+}
+
+static void rdump_file_done(struct rdump_ctxt *ctxt, struct rdump_file *rf,
+			    errcode_t ret, uint64_t usecs)
+{
+	rf->rf_done = 1;
+
+	if (ret) {
+		if (!ctxt->rc_failed++)
+			ctxt->rc_ret = ret;
+		return;
+	}
+
+	ctxt->rc_copied++;
+	ctxt->rc_bytes += rf->rf_size;
+
+	if (ctxt->rc_verbose)
+		fprintf(stdout, "%s: %"PRIu64" bytes in %.3f secs, %.1f MB/s\n",
+			rf->rf_name, rf->rf_size, (double)usecs / 1000000,
+			rdump_mbps(rf->rf_size, usecs));
+
+	if (ctxt->rc_manifest) {
+		fprintf(ctxt->rc_manifest, "%"PRIu64" .%s\n", rf->rf_blkno,
+			rf->rf_name + ctxt->rc_root_len);
+		fflush(ctxt->rc_manifest);
+	}
+}
+
+static void rdump_worker(ocfs2_filesys *parent, struct rdump_ctxt *ctxt,
+			 int *next, int out)
+{
+	ocfs2_filesys *fs;
+	struct rdump_result rr;
+	uint64_t start;
+	ssize_t got;
+	int flags;
+	unsigned int superblock = 0;
+	errcode_t ret;
+
+	flags = OCFS2_FLAG_RO | OCFS2_FLAG_HEARTBEAT_DEV_OK |
+		OCFS2_FLAG_NO_ECC_CHECKS;
+	flags |= parent->fs_flags &
+		(OCFS2_FLAG_IMAGE_FILE | OCFS2_FLAG_BUFFERED);
+	if (!(flags & OCFS2_FLAG_IMAGE_FILE))
+		superblock = parent->fs_super->i_blkno;
+
+	/* The parent picks up whatever we leave undone */
+	ret = ocfs2_open(parent->fs_devname, flags, superblock,
+			 parent->fs_blocksize, &fs);
+	if (ret) {
+		com_err(gbls.cmd, ret, "while opening device %s",
+			parent->fs_devname);
+		return;
+	}
+
+	while ((rr.rr_index = __sync_fetch_and_add(next, 1)) <
+	       ctxt->rc_nr_files) {
+		start = rdump_usecs();
+		rr.rr_ret = rdump_extract_file(fs,
+					       &ctxt->rc_files[rr.rr_index]);
+		rr.rr_usecs = rdump_usecs() - start;
+		do {
+			got = write(out, &rr, sizeof(rr));
+		} while (got == -1 && errno == EINTR);
+		if (got != sizeof(rr))
+			break;
+	}
+
+	ocfs2_close(fs);
+}
+
+static void rdump_extract_parallel(ocfs2_filesys *fs,
+				   struct rdump_ctxt *ctxt)
+{
+	struct rdump_result rr;
+	ssize_t got;
+	int *next;
+	int pfd[2];
+	int i, workers = 0;
+	pid_t pid;
+
+	next = mmap(NULL, sizeof(*next), PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (next == MAP_FAILED)
+		return;
+	*next = 0;
+
+	if (pipe(pfd) == -1)
+		goto out;
+
+	/* Nothing buffered may be written twice */
+	fflush(stdout);
+	fflush(stderr);
+
+	for (i = 0; i < ctxt->rc_jobs; i++) {
+		pid = fork();
+		if (pid == -1)
+			break;
+		if (!pid) {
+			close(pfd[0]);
+			rdump_worker(fs, ctxt, next, pfd[1]);
+			fflush(stdout);
+			fflush(stderr);
+			_exit(0);
+		}
+		workers++;
+	}
+	close(pfd[1]);
+
+	while (workers) {
+		got = read(pfd[0], &rr, sizeof(rr));
+		/* A stop signal must not end the copy early */
+		if (got == -1 && errno == EINTR)
+			continue;
+		if (got != sizeof(rr))
+			break;
+		if (rr.rr_index >= 0 && rr.rr_index < ctxt->rc_nr_files)
+			rdump_file_done(ctxt, &ctxt->rc_files[rr.rr_index],
+					rr.rr_ret, rr.rr_usecs);
+	}
+	close(pfd[0]);
+
+	while (workers--)
+		wait(NULL);
+
+out:
+	munmap(next, sizeof(*next));
+}
+
+static void rdump_extract(ocfs2_filesys *fs, struct rdump_ctxt *ctxt)
+{
+	struct rdump_file *rf;
+	uint64_t start;
+	errcode_t ret;
+	int i;
+
+	qsort(ctxt->rc_files, ctxt->rc_nr_files, sizeof(struct rdump_file),
+	      rdump_pblk_cmp);
+
+	if (ctxt->rc_jobs > 1 && ctxt->rc_nr_files > 1)
+		rdump_extract_parallel(fs, ctxt);
+
+	/* Everything when there are no workers, else what they missed */
+	for (i = 0; i < ctxt->rc_nr_files; i++) {
+		rf = &ctxt->rc_files[i];
+		if (rf->rf_done)
+			continue;
+		start = rdump_usecs();
+		ret = rdump_extract_file(fs, rf);
+		rdump_file_done(ctxt, rf, ret, rdump_usecs() - start);
+	}
+}
+
+static errcode_t rdump_inode(ocfs2_filesys *fs, uint64_t blkno,
+			     const char *name, const char *dumproot,
+			     struct rdump_ctxt *ctxt);
+
 /*
  * rdump_dirent()
  *
@@ -637,7 +1099,7 @@ static int rdump_dirent(struct ocfs2_dir_entry *rec, uint64_t blocknr,
 		goto bail;
 
 	ret = rdump_inode(rd->fs, rec->inode, rec->name, rd->fullname,
-			  rd->verbose);
+			  rd->ctxt);
 
 bail:
 	rec->name[rec->name_len] = tmp;
@@ -653,8 +1115,9 @@ bail:
  * Copyright (C) 1994 Theodore Ts'o.  This file may be redistributed
  * under the terms of the GNU Public License.
  */
-errcode_t rdump_inode(ocfs2_filesys *fs, uint64_t blkno, const char *name,
-		      const char *dumproot, int verbose)
+static errcode_t rdump_inode(ocfs2_filesys *fs, uint64_t blkno,
+			     const char *name, const char *dumproot,
+			     struct rdump_ctxt *ctxt)
 {
 	char *fullname = NULL;
 	int len;
@@ -662,8 +1125,7 @@ errcode_t rdump_inode(ocfs2_filesys *fs, uint64_t blkno, const char *name,
 	char *buf = NULL;
 	char *dirbuf = NULL;
 	struct ocfs2_dinode *di;
-	int fd;
-	struct rdump_opts rd_opts = { NULL, NULL, NULL, 0 };
+	struct rdump_opts rd_opts = { NULL, NULL, NULL, NULL };
 
 	len = strlen(dumproot) + strlen(name) + 2;
 	ret = ocfs2_malloc(len, &fullname);
@@ -691,31 +1153,38 @@ errcode_t rdump_inode(ocfs2_filesys *fs, uint64_t blkno, const char *name,
 
 	if (S_ISLNK(di->i_mode)) {
 		ret = dump_symlink(fs, blkno, fullname, di);
+		/* Already there from the run we are resuming */
+		if (ret == EEXIST && ctxt->rc_done)
+			ret = 0;
 		if (ret)
 			goto bail;
 	} else if (S_ISREG(di->i_mode)) {
-		if (verbose)
-			fprintf(stdout, "%s\n", fullname);
-		fd = open64(fullname, O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU);
-		if (fd == -1) {
-			com_err(gbls.cmd, errno, "while opening file %s",
-				fullname);
-			ret = errno;
+		if (rdump_in_manifest(ctxt, blkno, fullname)) {
+			ctxt->rc_skipped++;
 			goto bail;
 		}
 
-		ret = dump_file(fs, blkno, fd, fullname, 1);
-		if (ret)
+		/* Extracted once the whole tree is known */
+		ret = rdump_add(&ctxt->rc_files, &ctxt->rc_nr_files,
+				&ctxt->rc_max_files, blkno,
+				rdump_first_pblk(fs, di), di->i_size,
+				fullname);
+		if (ret) {
+			com_err(gbls.cmd, ret, "while queueing file %s",
+				fullname);
 			goto bail;
+		}
+		fullname = NULL;
 	} else if (S_ISDIR(di->i_mode) && strcmp(name, ".") &&
 		   strcmp(name, "..")) {
 
-		if (verbose)
+		if (ctxt->rc_verbose)
 			fprintf(stdout, "%s\n", fullname);
 		/* Create the directory with 0700 permissions, because we
 		 * expect to have to create entries it.  Then fix its perms
 		 * once we've done the traversal. */
-		if (mkdir(fullname, S_IRWXU) == -1) {
+		if (mkdir(fullname, S_IRWXU) == -1 &&
+		    (errno != EEXIST || !ctxt->rc_done)) {
 			com_err(gbls.cmd, errno, "while making directory %s",
 				fullname);
 			ret = errno;
@@ -731,7 +1200,7 @@ errcode_t rdump_inode(ocfs2_filesys *fs, uint64_t blkno, const char *name,
 		rd_opts.fs = fs;
 		rd_opts.buf = dirbuf;
 		rd_opts.fullname = fullname;
-		rd_opts.verbose = verbose;
+		rd_opts.ctxt = ctxt;
 
 		ret = ocfs2_dir_iterate(fs, blkno, 0, NULL,
 					rdump_dirent, (void *)&rd_opts);
@@ -741,10 +1210,15 @@ errcode_t rdump_inode(ocfs2_filesys *fs, uint64_t blkno, const char *name,
 			goto bail;
 		}
 
-		fd = -1;
-		ret = fix_perms(di, &fd, fullname);
-		if (ret)
+		/* Children first, so the perms are fixed bottom up */
+		ret = rdump_add(&ctxt->rc_dirs, &ctxt->rc_nr_dirs,
+				&ctxt->rc_max_dirs, blkno, 0, 0, fullname);
+		if (ret) {
+			com_err(gbls.cmd, ret, "while queueing directory %s",
+				fullname);
 			goto bail;
+		}
+		fullname = NULL;
 	}
 	/* else do nothing (don't dump device files, sockets, fifos, etc.) */
 
@@ -759,6 +1233,116 @@ bail:
 	return ret;
 }
 
+static errcode_t rdump_fix_dirs(ocfs2_filesys *fs, struct rdump_ctxt *ctxt)
+{
+	struct rdump_file *rd;
+	char *buf = NULL;
+	errcode_t ret;
+	int i, fd;
+
+	ret = ocfs2_malloc_block(fs->fs_io, &buf);
+	if (ret) {
+		com_err(gbls.cmd, ret, "while allocating a block");
+		return ret;
+	}
+
+	for (i = 0; i < ctxt->rc_nr_dirs; i++) {
+		rd = &ctxt->rc_dirs[i];
+		ret = ocfs2_read_inode(fs, rd->rf_blkno, buf);
+		if (ret) {
+			com_err(gbls.cmd, ret, "while reading inode %"PRIu64,
+				rd->rf_blkno);
+			break;
+		}
+
+		fd = -1;
+		ret = fix_perms((struct ocfs2_dinode *)buf, &fd, rd->rf_name);
+		if (ret) {
+			com_err(gbls.cmd, ret, "while fixing permissions of %s",
+				rd->rf_name);
+			break;
+		}
+	}
+
+	ocfs2_free(&buf);
+	return ret;
+}
+
+/*
+ * rdump_tree()
+ *
+ * Copies the inode at blkno, and everything under it if it is a
+ * directory, to dumproot/name.  Files are extracted by up to jobs
+ * processes.  If manifest is set, the files it lists are skipped and
+ * the ones copied now are added to it.  Resuming a copy whose name was
+ * made up, like that of ".", should pass the name from
+ * rdump_manifest_root().
+ */
+errcode_t rdump_tree(ocfs2_filesys *fs, uint64_t blkno, const char *name,
+		     const char *dumproot, int verbose, int jobs,
+		     char *manifest)
+{
+	struct rdump_ctxt ctxt;
+	uint64_t start, usecs;
+	errcode_t ret, fix_ret;
+	int i;
+
+	memset(&ctxt, 0, sizeof(ctxt));
+	ctxt.rc_verbose = verbose;
+	ctxt.rc_jobs = ocfs2_min(ocfs2_max(jobs, 1), RDUMP_MAX_JOBS);
+	ctxt.rc_root_len = strlen(dumproot) + 1 + strlen(name);
+
+	if (manifest) {
+		ret = rdump_open_manifest(&ctxt, manifest);
+		if (ret)
+			goto bail;
+		if (!ctxt.rc_has_root) {
+			fprintf(ctxt.rc_manifest, RDUMP_MANIFEST_ROOT"%s\n",
+				name);
+			fflush(ctxt.rc_manifest);
+		}
+	}
+
+	start = rdump_usecs();
+
+	ret = rdump_inode(fs, blkno, name, dumproot, &ctxt);
+
+	/* Whatever was found before a failure is still worth having */
+	rdump_extract(fs, &ctxt);
+	fix_ret = rdump_fix_dirs(fs, &ctxt);
+	if (!ret)
+		ret = fix_ret;
+
+	usecs = rdump_usecs() - start;
+	fprintf(stdout, "Copied %d files, %"PRIu64" bytes in %.3f secs, "
+		"%.1f MB/s\n", ctxt.rc_copied, ctxt.rc_bytes,
+		(double)usecs / 1000000, rdump_mbps(ctxt.rc_bytes, usecs));
+	if (ctxt.rc_skipped)
+		fprintf(stdout, "Skipped %d files already in the manifest\n",
+			ctxt.rc_skipped);
+	if (ctxt.rc_failed) {
+		fprintf(stdout, "Failed to copy %d files\n", ctxt.rc_failed);
+		if (!ret)
+			ret = ctxt.rc_ret;
+	}
+
+bail:
+	for (i = 0; i < ctxt.rc_nr_files; i++)
+		ocfs2_free(&ctxt.rc_files[i].rf_name);
+	for (i = 0; i < ctxt.rc_nr_dirs; i++)
+		ocfs2_free(&ctxt.rc_dirs[i].rf_name);
+	if (ctxt.rc_files)
+		ocfs2_free(&ctxt.rc_files);
+	if (ctxt.rc_dirs)
+		ocfs2_free(&ctxt.rc_dirs);
+	if (ctxt.rc_manifest)
+		fclose(ctxt.rc_manifest);
+	if (ctxt.rc_done)
+		g_hash_table_destroy(ctxt.rc_done);
+
+	return ret;
+}
+
 /*
  * crunch_strsplit()
  *
@@ -47,6 +47,7 @@ struct walk_extents {
 	ocfs2_filesys *fs;
 	uint64_t blkno;
 	int has_dups;
+	int test;
 	ocfs2_bitmap *extent_map;
 	ocfs2_bitmap *dup_map;
 };
@@ -133,92 +134,57 @@ static int extent_test_func(ocfs2_filesys *fs,
 }
 
 
+static errcode_t walk_inode(ocfs2_filesys *fs, uint64_t blkno,
+			    struct ocfs2_dinode *di, void *priv_data)
+{
+	errcode_t ret;
+	struct walk_extents *we = priv_data;
+
+	if ((di->i_flags & OCFS2_SYSTEM_FL) &&
+	    (di->i_flags & (OCFS2_SUPER_BLOCK_FL |
+			    OCFS2_LOCAL_ALLOC_FL |
+			    OCFS2_CHAIN_FL)))
+		return 0;
+
+	if (!di->i_clusters && S_ISLNK(di->i_mode))
+		return 0;
+
+	we->blkno = blkno;
+	ret = ocfs2_extent_iterate(fs, blkno, OCFS2_EXTENT_FLAG_DATA_ONLY,
+				   NULL,
+				   we->test ? extent_test_func :
+					      extent_set_func,
+				   we);
+	if (ret)
+		com_err(we->argv0, ret,
+			"while walking inode %"PRIu64, blkno);
+
+	return ret;
+}
+
 static errcode_t run_scan(struct walk_extents *we, int test)
 {
 	errcode_t ret;
-	uint64_t blkno;
-	char *buf;
-	int done;
-	struct ocfs2_dinode *di;
-	ocfs2_inode_scan *scan;
-	int (*extent_func)(ocfs2_filesys *fs,
-			   struct ocfs2_extent_rec *rec,
-			   int tree_depth,
-			   uint32_t ccount,
-			   uint64_t ref_blkno,
-			   int ref_recno,
-			   void *priv_data);
+	ocfs2_scan_bus *bus;
 
-	if (test)
-		extent_func = extent_test_func;
-	else
-		extent_func = extent_set_func;
+	we->test = test;
 
-	ret = ocfs2_malloc_block(we->fs->fs_io, &buf);
+	ret = ocfs2_open_scan_bus(we->fs, &bus);
 	if (ret) {
 		com_err(we->argv0, ret,
-			"while allocating inode buffer");
+			"while opening inode scan");
 		return ret;
 	}
 
-	di = (struct ocfs2_dinode *)buf;
-
-	ret = ocfs2_open_inode_scan(we->fs, &scan);
-	if (ret) {
+	ret = ocfs2_scan_bus_add(bus, OCFS2_SCAN_BUS_ANY_GENERATION,
+				 walk_inode, we);
+	if (ret)
 		com_err(we->argv0, ret,
 			"while opening inode scan");
-		goto out_free;
-	}
-
-	done = 0;
-	while (!done) {
-		ret = ocfs2_get_next_inode(scan, &blkno, buf);
-		if (ret) {
-			com_err(we->argv0, ret,
-				"while getting next inode");
-			goto out_close_scan;
-		}
-		if (blkno) {
-			if (memcmp(di->i_signature,
-				   OCFS2_INODE_SIGNATURE,
-				   strlen(OCFS2_INODE_SIGNATURE)))
-				continue;
-
-			ocfs2_swap_inode_to_cpu(we->fs, di);
-
-			if (!(di->i_flags & OCFS2_VALID_FL))
-				continue;
-
-			if ((di->i_flags & OCFS2_SYSTEM_FL) &&
-			    (di->i_flags & (OCFS2_SUPER_BLOCK_FL |
-					    OCFS2_LOCAL_ALLOC_FL |
-					    OCFS2_CHAIN_FL)))
-				continue;
-
-			if (!di->i_clusters && S_ISLNK(di->i_mode))
-				continue;
-
-			we->blkno = blkno;
-			ret = ocfs2_extent_iterate(we->fs, blkno,
-						   OCFS2_EXTENT_FLAG_DATA_ONLY,
-						   NULL,
-						   extent_func,
-						   we);
-			if (ret) {
-				com_err(we->argv0, ret,
-					"while walking inode %"PRIu64, blkno);
-				goto out_close_scan;
-			}
-		}
-		else
-			done = 1;
-	}
-
-out_close_scan:
-	ocfs2_close_inode_scan(scan);
+	else
+		ret = ocfs2_scan_bus_run(bus);
 
-out_free:
-	ocfs2_free(&buf);
+	ocfs2_close_scan_bus(bus);
 
 	return ret;
 }
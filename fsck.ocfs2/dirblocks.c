@@ -19,8 +19,7 @@
  *
  * --
  *
- * Just a simple rbtree wrapper to record directory blocks and the inodes
- * that own them.
+ * Records directory blocks and the inodes that own them.
  */
 #include <unistd.h>
 #include <stdlib.h>
@@ -35,102 +34,206 @@
 #include "dirblocks.h"
 #include "util.h"
 #include "extent.h"
+#include "mem.h"
+#include "perf.h"
 
 #define NUM_RA_BLOCKS		1024
-static void o2fsck_readahead_dirblocks(o2fsck_state *ost, struct rb_node *node,
-				       struct rb_node **last_read_node)
+
+/* 4096 entries, or 96K, per chunk */
+#define DB_CHUNK_BITS		12
+#define DB_CHUNK_ENTRIES	(1 << DB_CHUNK_BITS)
+#define DB_CHUNK_SIZE		(DB_CHUNK_ENTRIES * sizeof(o2fsck_dirblock_entry))
+
+static inline o2fsck_dirblock_entry *db_entry(o2fsck_dirblock_entry **chunks,
+					      uint64_t i)
+{
+	return &chunks[i >> DB_CHUNK_BITS][i & (DB_CHUNK_ENTRIES - 1)];
+}
+
+static inline uint64_t db_used_chunks(o2fsck_dirblocks *db)
+{
+	return (db->db_numblocks + DB_CHUNK_ENTRIES - 1) >> DB_CHUNK_BITS;
+}
+
+/*
+ * Reads the blocks of the entries starting at 'start' into the cache.
+ * The entries are sorted, so runs of adjacent blocks go down as a single
+ * request.  Returns the index of the first entry it didn't read.
+ */
+static uint64_t o2fsck_readahead_dirblocks(o2fsck_state *ost, char *buf,
+					   struct io_vec_unit *ivus,
+					   uint64_t start)
 {
 	ocfs2_filesys *fs = ost->ost_fs;
+	o2fsck_dirblocks *db = &ost->ost_dirblocks;
 	o2fsck_dirblock_entry *dbe;
-	struct io_vec_unit *ivus = NULL;
-	char *buf = NULL;
-	int buflen =  NUM_RA_BLOCKS * fs->fs_blocksize;
+	uint64_t i, prev = 0;
 	uint32_t offset = 0;
-	int i;
+	int count = 0;
+
+	for (i = start; (i < db->db_numblocks) &&
+	     ((i - start) < NUM_RA_BLOCKS); i++) {
+		dbe = db_entry(db->db_chunks, i);
+		if (count && (dbe->e_blkno == prev + 1)) {
+			ivus[count - 1].ivu_buflen += fs->fs_blocksize;
+		} else {
+			ivus[count].ivu_blkno = dbe->e_blkno;
+			ivus[count].ivu_buf = buf + offset;
+			ivus[count].ivu_buflen = fs->fs_blocksize;
+			count++;
+		}
+		offset += fs->fs_blocksize;
+		prev = dbe->e_blkno;
+	}
+
+	io_vec_read_blocks(fs->fs_io, ivus, count);
+
+	return i;
+}
+
+errcode_t o2fsck_add_dir_block(o2fsck_dirblocks *db, uint64_t ino,
+			       uint64_t blkno, uint64_t blkcount)
+{
+	uint64_t chunk = db->db_numblocks >> DB_CHUNK_BITS;
+	uint64_t nr_chunks;
+	o2fsck_dirblock_entry *dbe;
 	errcode_t ret;
 
-	*last_read_node = NULL;
+	if (chunk == db->db_nr_chunks) {
+		nr_chunks = db->db_nr_chunks ? db->db_nr_chunks * 2 : 16;
+		ret = ocfs2_realloc0(nr_chunks * sizeof(o2fsck_dirblock_entry *),
+				     &db->db_chunks,
+				     db->db_nr_chunks *
+				     sizeof(o2fsck_dirblock_entry *));
+		if (ret)
+			return ret;
+		db->db_nr_chunks = nr_chunks;
+	}
 
-	if (!fs->fs_io)
-		return;
+	if (!db->db_chunks[chunk]) {
+		ret = o2fsck_mem_alloc0(O2FSCK_MEM_DIRBLOCKS, DB_CHUNK_SIZE,
+					&db->db_chunks[chunk]);
+		if (ret)
+			return ret;
+	}
 
-	if (buflen > io_get_cache_size(fs->fs_io))
-		return;
+	/* Pass1 mostly hands us blocks in order; then we never sort */
+	if (db->db_numblocks &&
+	    (blkno < db_entry(db->db_chunks, db->db_numblocks - 1)->e_blkno))
+		db->db_unsorted = 1;
 
-	ret = ocfs2_malloc_blocks(fs->fs_io, NUM_RA_BLOCKS, &buf);
-	if (ret)
-		goto out;
-	 memset(buf, 0, buflen);
+	dbe = db_entry(db->db_chunks, db->db_numblocks);
+	dbe->e_ino = ino;
+	dbe->e_blkno = blkno;
+	dbe->e_blkcount = blkcount;
+	db->db_numblocks++;
 
-	ret = ocfs2_malloc(sizeof(struct io_vec_unit) * NUM_RA_BLOCKS, &ivus);
-	if (ret)
-		goto out;
+	return 0;
+}
 
-	for (i = 0; node && (i < NUM_RA_BLOCKS); ++i, node = rb_next(node)) {
-		dbe = rb_entry(node, o2fsck_dirblock_entry, e_node);
-		ivus[i].ivu_blkno = dbe->e_blkno;
-		ivus[i].ivu_buf = buf + offset;
-		ivus[i].ivu_buflen = fs->fs_blocksize;
-		offset += fs->fs_blocksize;
-		*last_read_node = node;
-	}
+static void free_dir_block_chunks(o2fsck_dirblock_entry ***chunks,
+				  uint64_t nr_chunks)
+{
+	uint64_t i;
 
-	ret = io_vec_read_blocks(fs->fs_io, ivus, i);
+	if (!*chunks)
+		return;
 
-out:
-	ocfs2_free(&ivus);
-	ocfs2_free(&buf);
+	for (i = 0; i < nr_chunks; i++)
+		o2fsck_mem_free(O2FSCK_MEM_DIRBLOCKS, DB_CHUNK_SIZE,
+				&(*chunks)[i]);
+	ocfs2_free(chunks);
 }
 
-errcode_t o2fsck_add_dir_block(o2fsck_dirblocks *db, uint64_t ino,
-			       uint64_t blkno, uint64_t blkcount)
+void o2fsck_free_dir_blocks(o2fsck_dirblocks *db)
 {
-	struct rb_node ** p = &db->db_root.rb_node;
-	struct rb_node * parent = NULL;
-	o2fsck_dirblock_entry *dbe, *tmp_dbe;
-	errcode_t ret = 0;
+	free_dir_block_chunks(&db->db_chunks, db->db_nr_chunks);
+	memset(db, 0, sizeof(o2fsck_dirblocks));
+}
 
-	ret = ocfs2_malloc0(sizeof(o2fsck_dirblock_entry), &dbe);
+/*
+ * An LSD radix sort on e_blkno, a byte at a time.  It is stable, so
+ * entries for the same block keep the order pass1 found them in.  Every
+ * byte is counted up front so that bytes which are the same in every
+ * entry, like the high bytes of all but the largest devices, are skipped.
+ */
+static errcode_t o2fsck_sort_dir_blocks(o2fsck_dirblocks *db)
+{
+	uint64_t (*counts)[256] = NULL;
+	uint64_t offsets[256];
+	o2fsck_dirblock_entry **src = db->db_chunks, **dst = NULL, **tmp;
+	o2fsck_dirblock_entry *dbe;
+	uint64_t i, sum, nr_used = db_used_chunks(db);
+	unsigned int byte, key;
+	errcode_t ret;
+
+	ret = ocfs2_malloc0(sizeof(*counts) * sizeof(uint64_t), &counts);
 	if (ret)
 		goto out;
 
-	dbe->e_ino = ino;
-	dbe->e_blkno = blkno;
-	dbe->e_blkcount = blkcount;
+	ret = ocfs2_malloc0(db->db_nr_chunks * sizeof(o2fsck_dirblock_entry *),
+			    &dst);
+	if (ret)
+		goto out;
 
-	while (*p)
-	{
-		parent = *p;
-		tmp_dbe = rb_entry(parent, o2fsck_dirblock_entry, e_node);
+	for (i = 0; i < nr_used; i++) {
+		ret = o2fsck_mem_alloc0(O2FSCK_MEM_DIRBLOCKS, DB_CHUNK_SIZE,
+					&dst[i]);
+		if (ret)
+			goto out;
+	}
 
-		if (dbe->e_blkno < tmp_dbe->e_blkno)
-			p = &(*p)->rb_left;
-		else if (dbe->e_blkno > tmp_dbe->e_blkno)
-			p = &(*p)->rb_right;
+	for (i = 0; i < db->db_numblocks; i++) {
+		dbe = db_entry(src, i);
+		for (byte = 0; byte < sizeof(uint64_t); byte++)
+			counts[byte][(dbe->e_blkno >> (byte * 8)) & 0xff]++;
 	}
 
-	rb_link_node(&dbe->e_node, parent, p);
-	rb_insert_color(&dbe->e_node, &db->db_root);
-	db->db_numblocks++;
+	for (byte = 0; byte < sizeof(uint64_t); byte++) {
+		key = (db_entry(src, 0)->e_blkno >> (byte * 8)) & 0xff;
+		if (counts[byte][key] == db->db_numblocks)
+			continue;
+
+		for (key = 0, sum = 0; key < 256; key++) {
+			offsets[key] = sum;
+			sum += counts[byte][key];
+		}
+
+		for (i = 0; i < db->db_numblocks; i++) {
+			dbe = db_entry(src, i);
+			key = (dbe->e_blkno >> (byte * 8)) & 0xff;
+			*db_entry(dst, offsets[key]++) = *dbe;
+		}
+
+		tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+
+	/* src holds the sorted entries, dst is the scratch copy */
+	db->db_chunks = src;
+	db->db_unsorted = 0;
 
 out:
+	free_dir_block_chunks(&dst, db->db_nr_chunks);
+	ocfs2_free(&counts);
 	return ret;
 }
 
 uint64_t o2fsck_search_reidx_dir(struct rb_root *root, uint64_t dino)
 {
 	struct rb_node *node = root->rb_node;
-	o2fsck_dirblock_entry *dbe;
+	o2fsck_reidx_dir *rd;
 
 	while (node) {
-		dbe = rb_entry(node, o2fsck_dirblock_entry, e_node);
+		rd = rb_entry(node, o2fsck_reidx_dir, r_node);
 
-		if (dino < dbe->e_ino)
+		if (dino < rd->r_ino)
 			node = node->rb_left;
-		else if (dino > dbe->e_ino)
+		else if (dino > rd->r_ino)
 			node = node->rb_right;
 		else
-			return dbe->e_ino;
+			return rd->r_ino;
 	}
 	return 0;
 }
@@ -139,23 +242,23 @@ static errcode_t o2fsck_add_reidx_dir_ino(struct rb_root *root, uint64_t dino)
 {
 	struct rb_node **p = &root->rb_node;
 	struct rb_node *parent = NULL;
-	o2fsck_dirblock_entry *dp, *tmp_dp;
+	o2fsck_reidx_dir *dp, *tmp_dp;
 	errcode_t ret = 0;
 
-	ret = ocfs2_malloc0(sizeof (o2fsck_dirblock_entry), &dp);
+	ret = ocfs2_malloc0(sizeof (o2fsck_reidx_dir), &dp);
 	if (ret)
 		goto out;
 
-	dp->e_ino = dino;
+	dp->r_ino = dino;
 
 	while(*p)
 	{
 		parent = *p;
-		tmp_dp = rb_entry(parent, o2fsck_dirblock_entry, e_node);
+		tmp_dp = rb_entry(parent, o2fsck_reidx_dir, r_node);
 
-		if (dp->e_ino < tmp_dp->e_ino)
+		if (dp->r_ino < tmp_dp->r_ino)
 			p = &(*p)->rb_left;
-		else if (dp->e_ino > tmp_dp->e_ino)
+		else if (dp->r_ino > tmp_dp->r_ino)
 			p = &(*p)->rb_right;
 		else {
 			ret = OCFS2_ET_INTERNAL_FAILURE;
@@ -164,8 +267,8 @@ static errcode_t o2fsck_add_reidx_dir_ino(struct rb_root *root, uint64_t dino)
 		}
 	}
 
-	rb_link_node(&dp->e_node, parent, p);
-	rb_insert_color(&dp->e_node, root);
+	rb_link_node(&dp->r_node, parent, p);
+	rb_insert_color(&dp->r_node, root);
 
 out:
 	return ret;
@@ -187,25 +290,50 @@ out:
 void o2fsck_dir_block_iterate(o2fsck_state *ost, dirblock_iterator func,
 			      void *priv_data)
 {
+	ocfs2_filesys *fs = ost->ost_fs;
 	o2fsck_dirblocks *db = &ost->ost_dirblocks;
-	o2fsck_dirblock_entry *dbe;
-	struct rb_node *node, *last_read_node = NULL;
+	struct io_vec_unit *ivus = NULL;
+	char *buf = NULL;
+	uint64_t i, ra_next = 0, start;
 	unsigned ret;
-	int readahead = 1;
-
-	for (node = rb_first(&db->db_root); node; node = rb_next(node)) {
-		dbe = rb_entry(node, o2fsck_dirblock_entry, e_node);
-		if (readahead)
-			o2fsck_readahead_dirblocks(ost, node, &last_read_node);
-		readahead = 0;
-		ret = func(dbe, priv_data);
+	errcode_t err;
+
+	if (db->db_unsorted) {
+		err = o2fsck_sort_dir_blocks(db);
+		/* We can still walk them, just not as quickly */
+		if (err)
+			com_err("dirblocks", err, "while sorting directory "
+				"blocks");
+	}
+
+	if (fs->fs_io && (NUM_RA_BLOCKS * fs->fs_blocksize <=
+			  io_get_cache_size(fs->fs_io))) {
+		if (ocfs2_malloc_blocks(fs->fs_io, NUM_RA_BLOCKS, &buf) ||
+		    ocfs2_malloc(sizeof(struct io_vec_unit) * NUM_RA_BLOCKS,
+				 &ivus))
+			ocfs2_free(&buf);
+	}
+
+	for (i = 0; i < db->db_numblocks; i++) {
+		if (buf && (i == ra_next)) {
+			start = o2fsck_perf_start();
+			ra_next = o2fsck_readahead_dirblocks(ost, buf, ivus, i);
+			o2fsck_perf_stop(O2FSCK_PERF_DIR_READAHEAD, start);
+		}
+		start = o2fsck_perf_start();
+		ret = func(db_entry(db->db_chunks, i), priv_data);
+		o2fsck_perf_stop(O2FSCK_PERF_DIR_VERIFY, start);
+		o2fsck_perf_count(O2FSCK_PERF_DIRBLOCKS, 1);
 		if (ret & OCFS2_DIRENT_ABORT)
 			break;
 		if (ost->ost_prog)
 			tools_progress_step(ost->ost_prog, 1);
-		if (last_read_node == node)
-			readahead = 1;
 	}
+
+	if (ivus)
+		ocfs2_free(&ivus);
+	if (buf)
+		ocfs2_free(&buf);
 }
 
 static errcode_t ocfs2_rebuild_indexed_dir(ocfs2_filesys *fs, uint64_t ino)
@@ -243,13 +371,13 @@ out:
 errcode_t o2fsck_rebuild_indexed_dirs(ocfs2_filesys *fs, struct rb_root *root)
 {
 	struct rb_node *node;
-	o2fsck_dirblock_entry *dbe;
+	o2fsck_reidx_dir *rd;
 	uint64_t ino;
 	errcode_t ret = 0;
 
 	for (node = rb_first(root); node; node = rb_next(node)) {
-		dbe = rb_entry(node, o2fsck_dirblock_entry, e_node);
-		ino = dbe->e_ino;
+		rd = rb_entry(node, o2fsck_reidx_dir, r_node);
+		ino = rd->r_ino;
 		ret = ocfs2_rebuild_indexed_dir(fs, ino);
 		if (ret)
 			goto out;
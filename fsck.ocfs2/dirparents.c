@@ -35,6 +35,7 @@
 #include "fsck.h"
 #include "dirparents.h"
 #include "util.h"
+#include "mem.h"
 
 /* XXX callers are supposed to make sure they don't call with dup inodes.
  * we'll see. */
@@ -46,20 +47,17 @@ errcode_t o2fsck_add_dir_parent(struct rb_root *root,
 {
 	struct rb_node ** p = &root->rb_node;
 	struct rb_node * parent = NULL;
-	o2fsck_dir_parent *dp, *tmp_dp;
+	o2fsck_dir_parent *dp = NULL, *tmp_dp;
 	errcode_t ret = 0;
 
-	dp = calloc(1, sizeof(*dp));
-	if (dp == NULL) {
-		ret = OCFS2_ET_NO_MEMORY;
+	ret = o2fsck_mem_alloc0(O2FSCK_MEM_DIR_PARENTS, sizeof(*dp), &dp);
+	if (ret)
 		goto out;
-	}
 
 	dp->dp_ino = ino;
 	dp->dp_dot_dot = dot_dot;
 	dp->dp_dirent = dirent;
 	dp->dp_connected = 0;
-	dp->dp_loop_no = 0;
 	dp->dp_in_orphan_dir = in_orphan_dir ? 1 : 0;
 
 	while (*p)
@@ -81,7 +79,7 @@ errcode_t o2fsck_add_dir_parent(struct rb_root *root,
 	rb_insert_color(&dp->dp_node, root);
 out:
 	if (ret && dp)
-		free(dp);
+		o2fsck_mem_free(O2FSCK_MEM_DIR_PARENTS, sizeof(*dp), &dp);
 
 	return ret;
 }
@@ -147,7 +145,7 @@ void ocfsck_remove_dir_parent(struct rb_root *root, uint64_t ino)
 		goto out;
 
 	rb_erase(&dp->dp_node, root);
-	free(dp);
+	o2fsck_mem_free(O2FSCK_MEM_DIR_PARENTS, sizeof(*dp), &dp);
 out:
 	return;
 }
@@ -0,0 +1,485 @@
+/* -*- mode: c; c-basic-offset: 8; -*-
+ * vim: noexpandtab sw=8 ts=8 sts=0:
+ *
+ * estimate.c
+ *
+ * Copyright (C) 2026 Oracle.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * --
+ *
+ * --estimate guesses how long a full check will take without doing one.
+ *
+ * It walks the inode allocators' group descriptors, which tells it how
+ * many inode groups there are and how full each is.  It then reads a
+ * handful of those groups, spread across the volume, and looks at the
+ * inodes in them: how many are directories, how big the directories
+ * are, which have extent blocks, xattr blocks or directory indexes.
+ * Scaling that up gives the metadata a full check has to read.
+ *
+ * The sample reads double as a device benchmark.  Whole inode groups
+ * are read in large requests, like pass 1 does, and give us a streaming
+ * rate.  Group descriptors and index roots are single block reads
+ * scattered over the disk, and give us the cost of a random read.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "ocfs2/ocfs2.h"
+
+#include "fsck.h"
+#include "estimate.h"
+#include "util.h"
+
+static const char *whoami = "estimate";
+
+/* We read at most this many inode groups, or this many bytes of them */
+#define EST_SAMPLE_GROUPS	64
+#define EST_SAMPLE_BYTES	(256ULL * 1024 * 1024)
+/* Inode groups are read this many blocks at a time */
+#define EST_READ_BLOCKS		256
+/* Enough cache for collect_group() to find each descriptor again */
+#define EST_CACHE_BLOCKS	1024
+
+struct est_group {
+	uint64_t	eg_blkno;
+	uint32_t	eg_used;	/* Inodes in use */
+};
+
+struct est_state {
+	ocfs2_filesys		*es_fs;
+	char			*es_buf;	/* EST_READ_BLOCKS */
+	char			*es_gd_buf;
+	char			*es_dx_buf;
+
+	struct est_group	*es_groups;
+	uint64_t		es_num_groups;
+	uint64_t		es_groups_alloced;
+
+	uint64_t		es_group_blocks;	/* All inode groups */
+	uint64_t		es_used_inodes;
+
+	/* What the sample saw */
+	uint64_t		es_sampled_groups;
+	uint64_t		es_sampled_used;
+	uint64_t		es_inodes;
+	uint64_t		es_dirs;
+	uint64_t		es_dirblocks;
+	uint64_t		es_indexed_dirs;
+	uint64_t		es_dx_blocks;
+	uint64_t		es_extent_blocks;
+	uint64_t		es_xattr_blocks;
+
+	/* Device timings */
+	uint64_t		es_seq_bytes;
+	double			es_seq_secs;
+	uint64_t		es_rand_reads;
+	double			es_rand_secs;
+};
+
+static double now_secs(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + ((double)tv.tv_usec / 1000000);
+}
+
+static int collect_group(ocfs2_filesys *fs, uint64_t gd_blkno, int chain_num,
+			 void *priv_data)
+{
+	struct est_state *es = priv_data;
+	struct ocfs2_group_desc *gd;
+	struct est_group *eg;
+	uint64_t alloced;
+	errcode_t ret;
+
+	if (es->es_num_groups == es->es_groups_alloced) {
+		alloced = es->es_groups_alloced ? es->es_groups_alloced * 2 :
+			1024;
+		ret = ocfs2_realloc0(alloced * sizeof(struct est_group),
+				     &es->es_groups,
+				     es->es_groups_alloced *
+				     sizeof(struct est_group));
+		if (ret)
+			return OCFS2_CHAIN_ABORT;
+		es->es_groups_alloced = alloced;
+	}
+
+	/* chain_iterate() read this already, so it's cached */
+	ret = ocfs2_read_group_desc(fs, gd_blkno, es->es_gd_buf);
+	if (ret)
+		return 0;
+	gd = (struct ocfs2_group_desc *)es->es_gd_buf;
+
+	eg = &es->es_groups[es->es_num_groups++];
+	eg->eg_blkno = gd_blkno;
+	/* Bit 0 is the descriptor itself */
+	eg->eg_used = gd->bg_bits - gd->bg_free_bits_count;
+	if (eg->eg_used)
+		eg->eg_used--;
+
+	es->es_group_blocks += gd->bg_bits;
+	es->es_used_inodes += eg->eg_used;
+
+	return 0;
+}
+
+static errcode_t collect_inode_groups(struct est_state *es)
+{
+	ocfs2_filesys *fs = es->es_fs;
+	uint16_t max_slots = OCFS2_RAW_SB(fs->fs_super)->s_max_slots;
+	uint64_t blkno, before = es->es_num_groups;
+	double start;
+	errcode_t ret;
+	int slot;
+
+	start = now_secs();
+	for (slot = -1; slot < max_slots; slot++) {
+		ret = ocfs2_lookup_system_inode(fs,
+						slot < 0 ?
+						GLOBAL_INODE_ALLOC_SYSTEM_INODE :
+						INODE_ALLOC_SYSTEM_INODE,
+						slot < 0 ? 0 : slot, &blkno);
+		if (ret)
+			return ret;
+
+		ret = ocfs2_chain_iterate(fs, blkno, collect_group, es);
+		if (ret)
+			return ret;
+	}
+
+	/* Each descriptor was a read of its own */
+	es->es_rand_secs += now_secs() - start;
+	es->es_rand_reads += es->es_num_groups - before;
+
+	return 0;
+}
+
+static void sample_dx_root(struct est_state *es, struct ocfs2_dinode *di)
+{
+	ocfs2_filesys *fs = es->es_fs;
+	struct ocfs2_dx_root_block *dx_root;
+	char *buf = es->es_dx_buf;
+	double start;
+
+	es->es_indexed_dirs++;
+
+	start = now_secs();
+	if (ocfs2_read_dx_root(fs, di->i_dx_root, buf))
+		return;
+	es->es_rand_secs += now_secs() - start;
+	es->es_rand_reads++;
+
+	dx_root = (struct ocfs2_dx_root_block *)buf;
+	if (!(dx_root->dr_flags & OCFS2_DX_FLAG_INLINE))
+		es->es_dx_blocks += ocfs2_clusters_to_blocks(fs,
+							     dx_root->dr_clusters);
+}
+
+static void sample_inode(struct est_state *es, struct ocfs2_dinode *di)
+{
+	ocfs2_filesys *fs = es->es_fs;
+
+	if (memcmp(di->i_signature, OCFS2_INODE_SIGNATURE,
+		   strlen(OCFS2_INODE_SIGNATURE)))
+		return;
+
+	ocfs2_swap_inode_to_cpu(fs, di);
+	if (!(di->i_flags & OCFS2_VALID_FL) ||
+	    (di->i_fs_generation != fs->fs_super->i_fs_generation))
+		return;
+
+	es->es_inodes++;
+
+	if (di->i_xattr_loc)
+		es->es_xattr_blocks++;
+
+	if (di->i_flags & (OCFS2_CHAIN_FL | OCFS2_LOCAL_ALLOC_FL |
+			   OCFS2_DEALLOC_FL))
+		return;
+
+	if (S_ISDIR(di->i_mode))
+		es->es_dirs++;
+
+	if (di->i_dyn_features & OCFS2_INLINE_DATA_FL)
+		return;
+
+	if (S_ISLNK(di->i_mode) && !di->i_clusters)
+		return;
+
+	if (di->id2.i_list.l_tree_depth)
+		es->es_extent_blocks += di->id2.i_list.l_next_free_rec;
+
+	if (!S_ISDIR(di->i_mode))
+		return;
+
+	es->es_dirblocks += ocfs2_blocks_in_bytes(fs, di->i_size);
+
+	if (di->i_dyn_features & OCFS2_INDEXED_DIR_FL)
+		sample_dx_root(es, di);
+}
+
+static errcode_t sample_extent(struct est_state *es, uint64_t blkno,
+			       uint64_t count)
+{
+	ocfs2_filesys *fs = es->es_fs;
+	char *buf = es->es_buf;
+	uint64_t i, n;
+	double start;
+	errcode_t ret;
+
+	while (count) {
+		n = count > EST_READ_BLOCKS ? EST_READ_BLOCKS : count;
+
+		start = now_secs();
+		ret = ocfs2_read_blocks(fs, blkno, n, buf);
+		if (ret)
+			return ret;
+		es->es_seq_secs += now_secs() - start;
+		es->es_seq_bytes += n * fs->fs_blocksize;
+
+		for (i = 0; i < n; i++)
+			sample_inode(es, (struct ocfs2_dinode *)
+				     (buf + i * fs->fs_blocksize));
+
+		blkno += n;
+		count -= n;
+	}
+
+	return 0;
+}
+
+static errcode_t sample_group(struct est_state *es, struct est_group *eg)
+{
+	ocfs2_filesys *fs = es->es_fs;
+	struct ocfs2_group_desc *gd;
+	struct ocfs2_extent_rec *rec;
+	errcode_t ret;
+	int i;
+
+	ret = ocfs2_read_group_desc(fs, eg->eg_blkno, es->es_gd_buf);
+	if (ret)
+		return ret;
+	gd = (struct ocfs2_group_desc *)es->es_gd_buf;
+
+	es->es_sampled_groups++;
+	es->es_sampled_used += eg->eg_used;
+
+	if (!gd->bg_list.l_next_free_rec)
+		return sample_extent(es, eg->eg_blkno, gd->bg_bits);
+
+	/* A discontiguous group */
+	for (i = 0; i < gd->bg_list.l_next_free_rec; i++) {
+		rec = &gd->bg_list.l_recs[i];
+		ret = sample_extent(es, rec->e_blkno,
+				    ocfs2_clusters_to_blocks(fs,
+						rec->e_leaf_clusters));
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Pick groups that have inodes in them, evenly spaced through the list.
+ * The list is in chain order, which for a volume that grew over time is
+ * roughly the order the groups were added.
+ */
+static errcode_t sample_inode_groups(struct est_state *es)
+{
+	struct tools_progress *prog = NULL;
+	uint64_t i, used_groups = 0, stride, seen = 0;
+	errcode_t ret = 0;
+
+	for (i = 0; i < es->es_num_groups; i++)
+		if (es->es_groups[i].eg_used)
+			used_groups++;
+	if (!used_groups)
+		return 0;
+
+	stride = (used_groups + EST_SAMPLE_GROUPS - 1) / EST_SAMPLE_GROUPS;
+
+	if (tools_progress_enabled())
+		prog = tools_progress_start("Sampling inode groups", "sampling",
+					    (used_groups + stride - 1) / stride);
+
+	for (i = 0; i < es->es_num_groups; i++) {
+		if (!es->es_groups[i].eg_used)
+			continue;
+		if (seen++ % stride)
+			continue;
+
+		ret = sample_group(es, &es->es_groups[i]);
+		if (ret)
+			break;
+
+		if (prog)
+			tools_progress_step(prog, 1);
+
+		if (es->es_seq_bytes >= EST_SAMPLE_BYTES)
+			break;
+	}
+
+	if (prog)
+		tools_progress_stop(prog);
+
+	return ret;
+}
+
+static inline uint64_t scale(struct est_state *es, uint64_t sampled)
+{
+	if (!es->es_sampled_used)
+		return 0;
+
+	return (uint64_t)((double)sampled * es->es_used_inodes /
+			  es->es_sampled_used);
+}
+
+static void print_duration(double secs)
+{
+	uint64_t s = secs + 0.5;
+
+	if (s >= 3600)
+		printf("%"PRIu64"h%02"PRIu64"m%02"PRIu64"s\n", s / 3600,
+		       (s / 60) % 60, s % 60);
+	else if (s >= 60)
+		printf("%"PRIu64"m%02"PRIu64"s\n", s / 60, s % 60);
+	else
+		printf("%.1fs\n", secs);
+}
+
+static void print_estimate(o2fsck_state *ost, struct est_state *es)
+{
+	ocfs2_filesys *fs = ost->ost_fs;
+	struct ocfs2_dinode *di;
+	uint64_t bitmap_groups, dirs, cache_size, metadata;
+	uint64_t seq_bytes, rand_reads;
+	double seq_rate, rand_latency, runtime;
+	uint64_t blkno;
+	uint16_t cpg;
+
+	dirs = scale(es, es->es_dirs);
+
+	/* Pass 0 reads every group descriptor of the cluster bitmap too */
+	bitmap_groups = 0;
+	if (!ocfs2_lookup_system_inode(fs, GLOBAL_BITMAP_SYSTEM_INODE, 0,
+				       &blkno) &&
+	    !ocfs2_read_inode(fs, blkno, es->es_buf)) {
+		di = (struct ocfs2_dinode *)es->es_buf;
+		cpg = di->id2.i_chain.cl_cpg;
+		if (cpg)
+			bitmap_groups = (fs->fs_clusters + cpg - 1) / cpg;
+	}
+
+	/*
+	 * Pass 1 streams every inode group.  Everything else is read a
+	 * block at a time: descriptors, extent and xattr blocks,
+	 * directory blocks and indexes.
+	 */
+	seq_bytes = es->es_group_blocks * fs->fs_blocksize;
+	rand_reads = bitmap_groups + es->es_num_groups +
+		scale(es, es->es_extent_blocks) +
+		scale(es, es->es_xattr_blocks) +
+		scale(es, es->es_dirblocks) + scale(es, es->es_dx_blocks);
+	metadata = seq_bytes + rand_reads * fs->fs_blocksize;
+
+	/*
+	 * Pass 2 goes back to the directory inodes if they fell out.  The
+	 * cache is the one a full check would get; we only work out its
+	 * size.
+	 */
+	cache_size = o2fsck_cache_size(ost, O2FSCK_CACHE_MODE_FULL);
+	if (metadata > cache_size)
+		rand_reads += dirs;
+
+	seq_rate = es->es_seq_secs > 0 ?
+		es->es_seq_bytes / es->es_seq_secs : 0;
+	rand_latency = es->es_rand_reads ?
+		es->es_rand_secs / es->es_rand_reads : 0;
+	runtime = (seq_rate > 0 ? seq_bytes / seq_rate : 0) +
+		rand_reads * rand_latency;
+
+	printf("Estimate for a full check:\n");
+	printf("  Inodes:             %"PRIu64"\n", es->es_used_inodes);
+	printf("  Directories:        %"PRIu64"\n", dirs);
+	printf("  Directory blocks:   %"PRIu64"\n",
+	       scale(es, es->es_dirblocks));
+	printf("  Indexed dirs:       %"PRIu64"\n",
+	       scale(es, es->es_indexed_dirs));
+	printf("  Extent blocks:      %"PRIu64"\n",
+	       scale(es, es->es_extent_blocks));
+	printf("  Xattr blocks:       %"PRIu64"\n",
+	       scale(es, es->es_xattr_blocks));
+	printf("  Metadata to read:   %"PRIu64"MB (%"PRIu64"MB streamed, "
+	       "%"PRIu64" single block reads)\n", mbytes(metadata),
+	       mbytes(seq_bytes), rand_reads);
+	printf("  Cache size:         %"PRIu64"MB\n", mbytes(cache_size));
+	printf("  Device streaming:   %.1fMB/s\n", seq_rate / 1048576);
+	printf("  Device random read: %.3fms\n", rand_latency * 1000);
+	printf("  Sampled:            %"PRIu64" of %"PRIu64" inode groups\n",
+	       es->es_sampled_groups, es->es_num_groups);
+	printf("  Estimated run time: ");
+	print_duration(runtime);
+}
+
+errcode_t o2fsck_estimate(o2fsck_state *ost)
+{
+	ocfs2_filesys *fs = ost->ost_fs;
+	struct est_state es;
+	errcode_t ret;
+
+	memset(&es, 0, sizeof(struct est_state));
+	es.es_fs = fs;
+
+	/* Only an optimization, so a failure is not fatal */
+	io_init_cache(fs->fs_io, EST_CACHE_BLOCKS);
+
+	ret = ocfs2_malloc_blocks(fs->fs_io, EST_READ_BLOCKS, &es.es_buf);
+	if (!ret)
+		ret = ocfs2_malloc_block(fs->fs_io, &es.es_gd_buf);
+	if (!ret)
+		ret = ocfs2_malloc_block(fs->fs_io, &es.es_dx_buf);
+	if (ret) {
+		com_err(whoami, ret, "while allocating sample buffers");
+		goto out;
+	}
+
+	ret = collect_inode_groups(&es);
+	if (ret) {
+		com_err(whoami, ret, "while reading the inode allocators");
+		goto out;
+	}
+
+	ret = sample_inode_groups(&es);
+	if (ret) {
+		com_err(whoami, ret, "while sampling inode groups");
+		goto out;
+	}
+
+	print_estimate(ost, &es);
+
+out:
+	if (es.es_groups)
+		ocfs2_free(&es.es_groups);
+	if (es.es_dx_buf)
+		ocfs2_free(&es.es_dx_buf);
+	if (es.es_gd_buf)
+		ocfs2_free(&es.es_gd_buf);
+	if (es.es_buf)
+		ocfs2_free(&es.es_buf);
+	return ret;
+}
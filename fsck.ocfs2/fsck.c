@@ -71,6 +71,10 @@
 #include "problem.h"
 #include "util.h"
 #include "slot_recovery.h"
+#include "subtree.h"
+#include "mem.h"
+#include "perf.h"
+#include "estimate.h"
 
 int verbose = 0;
 
@@ -80,6 +84,15 @@ static int cluster_locked = 0;
 
 static void mark_magical_clusters(o2fsck_state *ost);
 
+enum {
+	MEMORY_LIMIT_OPTION = CHAR_MAX + 1,
+	SPILL_DIR_OPTION,
+	PERF_REPORT_OPTION,
+	ESTIMATE_OPTION,
+	SUBTREE_OPTION,
+	INODES_OPTION,
+};
+
 static void handle_signal(int sig)
 {
 	switch (sig) {
@@ -139,6 +152,17 @@ static void print_usage(void)
 		" -u		Access the device with buffering\n"
 		" -V		Output fsck.ocfs2's version\n"
 		" -v		Provide verbose debugging output\n"
+		" --memory-limit=size	Keep fsck's memory use under size,\n"
+		"			spilling to a scratch file if needed\n"
+		" --spill-dir=dir	Where to put the scratch file\n"
+		" --perf-report=file	Write per-pass timings and I/O\n"
+		"			statistics to file as JSON\n"
+		" --estimate		Estimate how long a full check would\n"
+		"			take, without doing one\n"
+		" --subtree=path		Check only path and what is below it,\n"
+		"			read-only\n"
+		" --inodes=list		Check only these inodes and what is\n"
+		"			below them, read-only\n"
 		);
 }
 
@@ -154,6 +178,42 @@ static uint64_t read_number(const char *num)
 	return val;
 }
 
+/* Like read_number(), but understands K, M, G and T suffixes */
+static uint64_t read_size(const char *num)
+{
+	uint64_t val;
+	char *ptr;
+
+	val = strtoull(num, &ptr, 0);
+	if (!ptr || ptr == num)
+		return 0;
+
+	switch (*ptr) {
+	case 't':
+	case 'T':
+		val *= 1024;
+		/* FALL THROUGH */
+	case 'g':
+	case 'G':
+		val *= 1024;
+		/* FALL THROUGH */
+	case 'm':
+	case 'M':
+		val *= 1024;
+		/* FALL THROUGH */
+	case 'k':
+	case 'K':
+		val *= 1024;
+		ptr++;
+		break;
+	}
+
+	if (*ptr)
+		return 0;
+
+	return val;
+}
+
 extern int opterr, optind;
 extern char *optarg;
 
@@ -483,6 +543,7 @@ static errcode_t maybe_replay_journals(o2fsck_state *ost, char *filename,
 				       uint64_t blksize)
 {	
 	int replayed = 0, should = 0, has_dirty = 0;
+	struct o2fsck_resource_track rt;
 	errcode_t ret = 0;
 
 	ret = o2fsck_should_replay_journals(ost->ost_fs, &should, &has_dirty);
@@ -508,7 +569,10 @@ static errcode_t maybe_replay_journals(o2fsck_state *ost, char *filename,
 	/* journal replay is careful not to use ost as we only really
 	 * build it up after spraying the journal all over the disk
 	 * and reopening */
+	o2fsck_init_resource_track(&rt, ost->ost_fs->fs_io);
 	ret = o2fsck_replay_journals(ost->ost_fs, &replayed);
+	o2fsck_compute_resource_track(&rt, ost->ost_fs->fs_io);
+	o2fsck_perf_add_pass("Journal replay", &rt, ost->ost_fs->fs_io);
 	if (ret)
 		goto out;
 
@@ -687,10 +751,23 @@ int main(int argc, char **argv)
 	errcode_t ret;
 	int mount_flags;
 	int proceed = 1;
+	uint64_t memory_limit = 0;
+	char *spill_dir = NULL;
+	char *perf_report = NULL;
+	int estimate = 0;
+	uint64_t subtree_problems = 0;
+	static struct option long_options[] = {
+		{ "memory-limit", 1, 0, MEMORY_LIMIT_OPTION },
+		{ "spill-dir", 1, 0, SPILL_DIR_OPTION },
+		{ "perf-report", 1, 0, PERF_REPORT_OPTION },
+		{ "estimate", 0, 0, ESTIMATE_OPTION },
+		{ "subtree", 1, 0, SUBTREE_OPTION },
+		{ "inodes", 1, 0, INODES_OPTION },
+		{ 0, 0, 0, 0}
+	};
 
 	memset(ost, 0, sizeof(o2fsck_state));
 	ost->ost_ask = 1;
-	ost->ost_dirblocks.db_root = RB_ROOT;
 	ost->ost_dir_parents = RB_ROOT;
 	ost->ost_refcount_trees = RB_ROOT;
 
@@ -706,7 +783,8 @@ int main(int argc, char **argv)
 
 	tools_progress_disable();
 
-	while ((c = getopt(argc, argv, "b:B:DfFGnupavVytPr:")) != EOF) {
+	while ((c = getopt_long(argc, argv, "b:B:DfFGnupavVytPr:",
+				long_options, NULL)) != EOF) {
 		switch (c) {
 			case 'b':
 				blkno = read_number(optarg);
@@ -799,6 +877,52 @@ int main(int argc, char **argv)
 				ost->ost_show_stats = 1;
 				break;
 
+			case MEMORY_LIMIT_OPTION:
+				memory_limit = read_size(optarg);
+				if (!memory_limit) {
+					fprintf(stderr,
+						"Invalid memory limit: %s\n",
+						optarg);
+					fsck_mask |= FSCK_USAGE;
+					print_usage();
+					goto out;
+				}
+				break;
+
+			case SPILL_DIR_OPTION:
+				spill_dir = optarg;
+				break;
+
+			case PERF_REPORT_OPTION:
+				perf_report = optarg;
+				break;
+
+			case ESTIMATE_OPTION:
+				estimate = 1;
+				break;
+
+			case SUBTREE_OPTION:
+				ret = o2fsck_subtree_add_path(optarg);
+				if (ret) {
+					com_err(whoami, ret, "while adding "
+						"\"%s\"", optarg);
+					fsck_mask |= FSCK_ERROR;
+					goto out;
+				}
+				break;
+
+			case INODES_OPTION:
+				ret = o2fsck_subtree_add_inodes(optarg);
+				if (ret) {
+					fprintf(stderr,
+						"Invalid inode list: %s\n",
+						optarg);
+					fsck_mask |= FSCK_USAGE;
+					print_usage();
+					goto out;
+				}
+				break;
+
 			default:
 				fsck_mask |= FSCK_USAGE;
 				print_usage();
@@ -807,6 +931,35 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* An estimate only reads, and never asks */
+	if (estimate) {
+		open_flags &= ~OCFS2_FLAG_RW;
+		ost->ost_ask = 0;
+		ost->ost_answer = 0;
+		ost->ost_compress_dirs = 0;
+	}
+
+	/* Checking part of a volume can't fix anything */
+	if (o2fsck_subtree_wanted()) {
+		if ((open_flags & OCFS2_FLAG_RW) && !ost->ost_ask) {
+			fprintf(stderr, "--subtree and --inodes are "
+				"read-only and can't be used with -y or -p\n");
+			fsck_mask |= FSCK_USAGE;
+			print_usage();
+			goto out;
+		}
+		if (estimate) {
+			fprintf(stderr, "--estimate can't be used with "
+				"--subtree or --inodes\n");
+			fsck_mask |= FSCK_USAGE;
+			print_usage();
+			goto out;
+		}
+		open_flags &= ~OCFS2_FLAG_RW;
+		ost->ost_ask = 0;
+		ost->ost_answer = 0;
+	}
+
 	if (!(open_flags & OCFS2_FLAG_RW) && ost->ost_compress_dirs) {
 		fprintf(stderr, "Compress directories (-D) incompatible with read-only mode\n");
 		fsck_mask |= FSCK_USAGE;
@@ -832,6 +985,23 @@ int main(int argc, char **argv)
 
 	print_version();
 
+	ret = o2fsck_mem_init(memory_limit, spill_dir);
+	if (ret) {
+		com_err(whoami, ret, "while setting up the memory limit");
+		fsck_mask |= FSCK_ERROR;
+		goto out;
+	}
+
+	if (perf_report) {
+		ret = o2fsck_perf_init(perf_report);
+		if (ret) {
+			com_err(whoami, ret, "while setting up the "
+				"performance report");
+			fsck_mask |= FSCK_ERROR;
+			goto out;
+		}
+	}
+
 	ret = ocfs2_check_if_mounted(filename, &mount_flags);
 	if (ret) {
 		com_err(whoami, ret, "while determining whether %s is mounted.",
@@ -840,7 +1010,7 @@ int main(int argc, char **argv)
 		goto out;
 	}
 
-	if (mount_flags & (OCFS2_MF_MOUNTED | OCFS2_MF_BUSY)) {
+	if ((mount_flags & (OCFS2_MF_MOUNTED | OCFS2_MF_BUSY)) && !estimate) {
 		if (!(open_flags & OCFS2_FLAG_RW))
 			fprintf(stdout, "\nWARNING!!! Running fsck.ocfs2 (read-"
 				"only) on a mounted filesystem may detect "
@@ -947,6 +1117,12 @@ int main(int argc, char **argv)
 	printf("  Number of slots:    %u\n\n", 
 	       OCFS2_RAW_SB(ost->ost_fs->fs_super)->s_max_slots);
 
+	if (estimate) {
+		ret = o2fsck_estimate(ost);
+		fsck_mask = ret ? FSCK_ERROR : FSCK_OK;
+		goto close;
+	}
+
 	/* Let's get enough of a cache to replay the journals */
 	o2fsck_init_cache(ost, O2FSCK_CACHE_MODE_JOURNAL);
 
@@ -978,6 +1154,17 @@ int main(int argc, char **argv)
 		goto unlock;
 	}
 
+	if (o2fsck_subtree_wanted()) {
+		ret = o2fsck_check_subtree(ost, &subtree_problems);
+		if (ret)
+			fsck_mask = FSCK_ERROR;
+		else if (subtree_problems)
+			fsck_mask = FSCK_UNCORRECTED;
+		else
+			fsck_mask = FSCK_OK;
+		goto unlock;
+	}
+
 	ret = o2fsck_slot_recovery(ost);
 	if (ret) {
 		printf("fsck encountered errors while recovering slot "
@@ -1003,36 +1190,46 @@ int main(int argc, char **argv)
 
 	/* XXX for now it is assumed that errors returned from a pass
 	 * are fatal.  these can be fixed over time. */
+	o2fsck_size_cache_for_pass(ost, 0);
 	ret = o2fsck_pass0(ost);
 	if (ret) {
 		com_err(whoami, ret, "while performing pass 0");
 		goto done;
 	}
 
+	ret = o2fsck_init_quota_usage(ost);
+	if (ret)
+		goto done;
+
+	o2fsck_size_cache_for_pass(ost, 1);
 	ret = o2fsck_pass1(ost);
 	if (ret) {
 		com_err(whoami, ret, "while performing pass 1");
 		goto done;
 	}
 
+	o2fsck_size_cache_for_pass(ost, 2);
 	ret = o2fsck_pass2(ost);
 	if (ret) {
 		com_err(whoami, ret, "while performing pass 2");
 		goto done;
 	}
 
+	o2fsck_size_cache_for_pass(ost, 3);
 	ret = o2fsck_pass3(ost);
 	if (ret) {
 		com_err(whoami, ret, "while performing pass 3");
 		goto done;
 	}
 
+	o2fsck_size_cache_for_pass(ost, 4);
 	ret = o2fsck_pass4(ost);
 	if (ret) {
 		com_err(whoami, ret, "while performing pass 4");
 		goto done;
 	}
 
+	o2fsck_size_cache_for_pass(ost, 5);
 	ret = o2fsck_pass5(ost);
 	if (ret) {
 		com_err(whoami, ret, "while performing pass 5");
@@ -1048,6 +1245,7 @@ done:
 		printf("All passes succeeded.\n\n");
 		o2fsck_print_resource_track(NULL, ost, &ost->ost_rt,
 					    ost->ost_fs->fs_io);
+		o2fsck_mem_print_stats(ost);
 		show_stats(ost);
 	}
 
@@ -1089,6 +1287,8 @@ unlock:
 	block_signals(SIG_UNBLOCK);
 
 close:
+	o2fsck_perf_write_report(ost, filename, fsck_mask);
+
 	block_signals(SIG_BLOCK);
 	if (ost->ost_fs->fs_dlm_ctxt)
 		ocfs2_shutdown_dlm(ost->ost_fs, whoami);
@@ -1102,5 +1302,6 @@ close:
 	} 
 
 out:
+	o2fsck_mem_exit();
 	return fsck_mask;
 }
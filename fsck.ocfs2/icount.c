@@ -34,6 +34,7 @@
 #include "fsck.h"
 #include "icount.h"
 #include "util.h"
+#include "mem.h"
 
 typedef struct _icount_node {
 	struct rb_node	in_node;
@@ -103,16 +104,14 @@ errcode_t o2fsck_icount_set(o2fsck_icount *icount, uint64_t blkno,
 	if (in) {
 		if (count < 2) {
 			rb_erase(&in->in_node, &icount->ic_multiple_tree);
-			free(in);
+			o2fsck_mem_free(O2FSCK_MEM_ICOUNT, sizeof(*in), &in);
 		} else {
 			in->in_icount = count;
 		}
 	} else if (count > 1) {
-		in = calloc(1, sizeof(*in));
-		if (in == NULL) {
-			ret = OCFS2_ET_NO_MEMORY;
+		ret = o2fsck_mem_alloc0(O2FSCK_MEM_ICOUNT, sizeof(*in), &in);
+		if (ret)
 			goto out;
-		}
 
 		in->in_blkno = blkno;
 		in->in_icount = count;
@@ -198,33 +197,73 @@ errcode_t o2fsck_icount_new(ocfs2_filesys *fs, o2fsck_icount **ret)
 	return 0;
 }
 
-errcode_t o2fsck_icount_next_blkno(o2fsck_icount *icount, uint64_t start,
-				   uint64_t *found)
+static void cursor_next_single(o2fsck_icount_cursor *cu, uint64_t start)
+{
+	uint64_t bit;
+
+	if (ocfs2_bitmap_find_next_set(cu->cu_icount->ic_single_bm, start,
+				       &bit))
+		bit = UINT64_MAX;
+	cu->cu_single = bit;
+}
+
+void o2fsck_icount_cursor_seek(o2fsck_icount_cursor *cu,
+			       o2fsck_icount *icount, uint64_t start)
 {
-	uint64_t next_bit;
-	errcode_t ret;
 	icount_node *in, *next = NULL;
 
-	ret = ocfs2_bitmap_find_next_set(icount->ic_single_bm, start,
-						  &next_bit);
+	cu->cu_icount = icount;
+	cursor_next_single(cu, start);
 
 	in = icount_search(icount, start, &next);
 	if (in == NULL)
 		in = next;
+	cu->cu_multiple = in ? &in->in_node : NULL;
+}
 
-	if (in) {
-		if (ret == OCFS2_ET_BIT_NOT_FOUND)
-			*found = in->in_blkno;
-		else
-			*found = next_bit < in->in_blkno ? next_bit :
-							   in->in_blkno;
-		ret = 0;
+/* The lowest blkno the cursor has yet to take */
+errcode_t o2fsck_icount_cursor_peek(o2fsck_icount_cursor *cu,
+				    uint64_t *found)
+{
+	uint64_t blkno = cu->cu_single;
+	icount_node *in;
+
+	if (cu->cu_multiple) {
+		in = rb_entry(cu->cu_multiple, icount_node, in_node);
+		if (in->in_blkno < blkno)
+			blkno = in->in_blkno;
+	}
+
+	if (blkno == UINT64_MAX)
+		return OCFS2_ET_BIT_NOT_FOUND;
+
+	*found = blkno;
+	return 0;
+}
+
+/*
+ * Returns the count for blkno and moves the cursor past it.  blkno must
+ * not be behind the cursor.  A blkno is either in the bitmap or in the
+ * tree, never both.
+ */
+uint16_t o2fsck_icount_cursor_take(o2fsck_icount_cursor *cu, uint64_t blkno)
+{
+	icount_node *in;
+
+	if (cu->cu_single == blkno) {
+		cursor_next_single(cu, blkno + 1);
+		return 1;
 	}
-	else {
-		if (ret != OCFS2_ET_BIT_NOT_FOUND)
-			*found = next_bit;
+
+	if (cu->cu_multiple) {
+		in = rb_entry(cu->cu_multiple, icount_node, in_node);
+		if (in->in_blkno == blkno) {
+			cu->cu_multiple = rb_next(cu->cu_multiple);
+			return in->in_icount;
+		}
 	}
-	return ret;
+
+	return 0;
 }
 
 void o2fsck_icount_free(o2fsck_icount *icount)
@@ -236,7 +275,7 @@ void o2fsck_icount_free(o2fsck_icount *icount)
 	while((node = rb_first(&icount->ic_multiple_tree)) != NULL) {
 		in = rb_entry(node, icount_node, in_node);
 		rb_erase(node, &icount->ic_multiple_tree);
-		free(in);
+		o2fsck_mem_free(O2FSCK_MEM_ICOUNT, sizeof(*in), &in);
 	}
 	free(icount);
 }
@@ -27,23 +27,34 @@
 #include "ocfs2/ocfs2.h"
 #include "ocfs2/kernel-rbtree.h"
 
-typedef struct _o2fsck_dirblocks {
-	struct rb_root	db_root;
-	uint64_t	db_numblocks;
-} o2fsck_dirblocks;
-
 typedef struct _o2fsck_dirblock_entry {
-	struct rb_node	e_node;
-	uint64_t	e_ino;
 	uint64_t	e_blkno;
+	uint64_t	e_ino;
 	uint64_t	e_blkcount;
 } o2fsck_dirblock_entry;
 
+/*
+ * Pass1 appends directory blocks in inode order to a chunked array.  It is
+ * sorted by block number, if it needs it, the first time it is iterated.
+ */
+typedef struct _o2fsck_dirblocks {
+	o2fsck_dirblock_entry	**db_chunks;
+	uint64_t		db_nr_chunks;	/* Slots in db_chunks */
+	uint64_t		db_numblocks;
+	int			db_unsorted;
+} o2fsck_dirblocks;
+
+typedef struct _o2fsck_reidx_dir {
+	struct rb_node	r_node;
+	uint64_t	r_ino;
+} o2fsck_reidx_dir;
+
 typedef unsigned (*dirblock_iterator)(o2fsck_dirblock_entry *,
 					void *priv_data);
 
 errcode_t o2fsck_add_dir_block(o2fsck_dirblocks *db, uint64_t ino,
 			       uint64_t blkno, uint64_t blkcount);
+void o2fsck_free_dir_blocks(o2fsck_dirblocks *db);
 
 struct _o2fsck_state;
 void o2fsck_dir_block_iterate(struct _o2fsck_state *ost, dirblock_iterator func,
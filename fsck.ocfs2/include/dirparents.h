@@ -38,7 +38,6 @@ typedef struct _o2fsck_dir_parent {
 
 	/* used by pass3 to walk the dir_parent structs and ensure 
 	 * connectivity */
-	uint64_t	dp_loop_no;
 	unsigned	dp_connected:1,
 			dp_in_orphan_dir:1;
 } o2fsck_dir_parent;
@@ -75,6 +75,9 @@ typedef struct _o2fsck_state {
 	struct rb_root	ost_refcount_trees;
 	struct refcount_file *ost_latest_file;
 
+	/* Quota usage summed up while pass 1 scans the inodes */
+	ocfs2_quota_hash	*ost_qusage[MAXQUOTAS];
+
 	unsigned	ost_ask:1,	/* confirm with the user */
 			ost_answer:1,	/* answer if we don't ask the user */
 			ost_force:1,	/* -f supplied; force check */
@@ -93,7 +96,9 @@ typedef struct _o2fsck_state {
 			ost_has_journal_dirty:1,
 			ost_compress_dirs:1,
 			ost_show_stats:1,
-			ost_show_extended_stats:1;
+			ost_show_extended_stats:1,
+			ost_qusage_stale:1; /* ost_qusage can't be
+					     * trusted, see pass5.c */
 	errcode_t ost_err;
 
 	struct o2fsck_resource_track	ost_rt;
@@ -114,6 +119,7 @@ typedef struct _o2fsck_state {
 	uint32_t	ost_fast_symlinks_count;
 	uint32_t	ost_orphan_count;
 	uint32_t	ost_orphan_deleted_count;
+	uint32_t	ost_prompts;	/* problems put to prompt_input() */
 #define OCFS2_MAX_PATH_DEPTH	5
 	uint32_t	ost_tree_depth_count[OCFS2_MAX_PATH_DEPTH + 1];
 } o2fsck_state;
@@ -32,6 +32,17 @@ typedef struct _o2fsck_icount {
 	struct rb_root	ic_multiple_tree;
 } o2fsck_icount;
 
+/*
+ * Walks an icount in blkno order without searching for every entry.  The
+ * icount may be changed behind the cursor, but a change at or past the
+ * cursor means it has to be seeked again.
+ */
+typedef struct _o2fsck_icount_cursor {
+	o2fsck_icount	*cu_icount;
+	uint64_t	cu_single;	/* next single bit, UINT64_MAX if none */
+	struct rb_node	*cu_multiple;	/* next tree node */
+} o2fsck_icount_cursor;
+
 errcode_t o2fsck_icount_set(o2fsck_icount *icount, uint64_t blkno, 
 			    uint16_t count);
 uint16_t o2fsck_icount_get(o2fsck_icount *icount, uint64_t blkno);
@@ -39,8 +50,11 @@ errcode_t o2fsck_icount_new(ocfs2_filesys *fs, o2fsck_icount **ret);
 void o2fsck_icount_free(o2fsck_icount *icount);
 void o2fsck_icount_delta(o2fsck_icount *icount, uint64_t blkno, 
 			 int delta);
-errcode_t o2fsck_icount_next_blkno(o2fsck_icount *icount, uint64_t start,
-				   uint64_t *found);
+void o2fsck_icount_cursor_seek(o2fsck_icount_cursor *cu,
+			       o2fsck_icount *icount, uint64_t start);
+errcode_t o2fsck_icount_cursor_peek(o2fsck_icount_cursor *cu,
+				    uint64_t *found);
+uint16_t o2fsck_icount_cursor_take(o2fsck_icount_cursor *cu, uint64_t blkno);
 
 #endif /* __O2FSCK_ICOUNT_H__ */
 
@@ -0,0 +1,59 @@
+/* -*- mode: c; c-basic-offset: 8; -*-
+ * vim: noexpandtab sw=8 ts=8 sts=0:
+ *
+ * mem.h
+ *
+ * Copyright (C) 2026 Oracle.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef __O2FSCK_MEM_H__
+#define __O2FSCK_MEM_H__
+
+#include "fsck.h"
+
+/* The run-time structures whose memory we account for */
+enum o2fsck_mem_type {
+	O2FSCK_MEM_DIRBLOCKS = 0,
+	O2FSCK_MEM_DIR_PARENTS,
+	O2FSCK_MEM_ICOUNT,
+	O2FSCK_MEM_REFCOUNT,
+	O2FSCK_MEM_NUM_TYPES,
+};
+
+errcode_t o2fsck_mem_init(uint64_t limit, const char *spill_dir);
+void o2fsck_mem_exit(void);
+
+/*
+ * Like ocfs2_malloc0()/ocfs2_free(), but the bytes are charged to
+ * 'type'.  When a memory limit is set and the in-core budget is used up,
+ * the allocation is carved out of the spill file instead.  The caller
+ * must pass the same size to _free() that it passed to _alloc0().
+ */
+errcode_t o2fsck_mem_alloc0(enum o2fsck_mem_type type, size_t size,
+			    void *ptr);
+void o2fsck_mem_free(enum o2fsck_mem_type type, size_t size, void *ptr);
+
+/* Bytes of I/O cache we may use; UINT64_MAX when there is no limit */
+uint64_t o2fsck_mem_cache_budget(ocfs2_filesys *fs);
+void o2fsck_mem_set_cache(uint64_t bytes);
+/* Free memory, honoring a cgroup v2 memory.max */
+uint64_t o2fsck_mem_available(void);
+
+const char *o2fsck_mem_type_name(enum o2fsck_mem_type type);
+uint64_t o2fsck_mem_peak(enum o2fsck_mem_type type);
+uint64_t o2fsck_mem_limit(void);
+uint64_t o2fsck_mem_spilled(void);
+uint64_t o2fsck_mem_peak_rss(void);
+
+void o2fsck_mem_print_stats(o2fsck_state *ost);
+
+#endif /* __O2FSCK_MEM_H__ */
@@ -26,7 +26,20 @@
 
 #include "fsck.h"
 
+/*
+ * Visitors see every inode pass 1 has finished checking and still thinks
+ * is valid, so that other passes needn't scan the inodes again.
+ */
+typedef errcode_t (*o2fsck_inode_visitor)(o2fsck_state *ost,
+					  uint64_t blkno,
+					  struct ocfs2_dinode *di,
+					  void *priv_data);
+errcode_t o2fsck_add_inode_visitor(o2fsck_inode_visitor func,
+				   void *priv_data);
+
 errcode_t o2fsck_pass1(o2fsck_state *ost);
+errcode_t o2fsck_check_inode(o2fsck_state *ost, uint64_t blkno,
+			     struct ocfs2_dinode *di);
 void o2fsck_free_inode_allocs(o2fsck_state *ost);
 
 #endif /* __O2FSCK_PASS1_H__ */
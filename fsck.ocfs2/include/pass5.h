@@ -20,6 +20,8 @@
 
 #include "fsck.h"
 
+errcode_t o2fsck_init_quota_usage(o2fsck_state *ost);
+void o2fsck_quota_drop_inode(o2fsck_state *ost, uint64_t blkno);
 errcode_t o2fsck_pass5(o2fsck_state *ost);
 
 #endif /* __O2FSCK_PASS4_H__ */
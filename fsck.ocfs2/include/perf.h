@@ -0,0 +1,79 @@
+/* -*- mode: c; c-basic-offset: 8; -*-
+ * vim: noexpandtab sw=8 ts=8 sts=0:
+ *
+ * perf.h
+ *
+ * Copyright (C) 2026 Oracle.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef __O2FSCK_PERF_H__
+#define __O2FSCK_PERF_H__
+
+#include "fsck.h"
+
+/* Parts of a pass that get their own time in the report */
+enum o2fsck_perf_timer {
+	O2FSCK_PERF_INODE_SCAN = 0,
+	O2FSCK_PERF_INODE_VERIFY,
+	O2FSCK_PERF_EXTENT_WALK,
+	O2FSCK_PERF_XATTR,
+	O2FSCK_PERF_DIR_READAHEAD,
+	O2FSCK_PERF_DIR_VERIFY,
+	O2FSCK_PERF_NUM_TIMERS,
+};
+
+/* Work done by a pass, reported as a count and a rate */
+enum o2fsck_perf_counter {
+	O2FSCK_PERF_INODES = 0,
+	O2FSCK_PERF_DIRBLOCKS,
+	O2FSCK_PERF_NUM_COUNTERS,
+};
+
+errcode_t o2fsck_perf_init(const char *filename);
+void o2fsck_perf_write_report(o2fsck_state *ost, const char *device,
+			      int fsck_mask);
+
+/*
+ * Timers and counters are charged to whatever pass is running.  They are
+ * handed to that pass when it is added, which happens when the pass
+ * prints its resource track.  A NULL name is the total for the run.
+ */
+void o2fsck_perf_add_pass(const char *name, struct o2fsck_resource_track *rt,
+			  io_channel *channel);
+
+uint64_t __o2fsck_perf_now(void);
+void __o2fsck_perf_stop(enum o2fsck_perf_timer timer, uint64_t start);
+void __o2fsck_perf_count(enum o2fsck_perf_counter counter, uint64_t n);
+
+extern int o2fsck_perf_enabled;
+
+/* Returns 0 when there is no report, so the matching _stop() does nothing */
+static inline uint64_t o2fsck_perf_start(void)
+{
+	return o2fsck_perf_enabled ? __o2fsck_perf_now() : 0;
+}
+
+static inline void o2fsck_perf_stop(enum o2fsck_perf_timer timer,
+				    uint64_t start)
+{
+	if (start)
+		__o2fsck_perf_stop(timer, start);
+}
+
+static inline void o2fsck_perf_count(enum o2fsck_perf_counter counter,
+				     uint64_t n)
+{
+	if (o2fsck_perf_enabled)
+		__o2fsck_perf_count(counter, n);
+}
+
+#endif /* __O2FSCK_PERF_H__ */
@@ -25,11 +25,18 @@
 #define __O2FSCK_STRINGS_H__
 
 #include "ocfs2/ocfs2.h"
-#include "ocfs2/kernel-rbtree.h"
+
+struct string_slot;
 
 typedef struct _o2fsck_strings {
-	struct rb_root	s_root;
-	size_t		s_allocated;
+	struct string_slot	*s_slots;
+	unsigned int		s_nr_slots;	/* power of two */
+	unsigned int		s_used;
+	uint32_t		s_gen;
+	char			*s_arena;
+	size_t			s_arena_size;
+	size_t			s_arena_used;
+	size_t			s_allocated;
 } o2fsck_strings;
 
 int o2fsck_strings_exists(o2fsck_strings *strings, char *string,
@@ -37,6 +44,7 @@ int o2fsck_strings_exists(o2fsck_strings *strings, char *string,
 errcode_t o2fsck_strings_insert(o2fsck_strings *strings, char *string,
 				size_t strlen, int *is_dup);
 void o2fsck_strings_init(o2fsck_strings *strings);
+void o2fsck_strings_reset(o2fsck_strings *strings);
 void o2fsck_strings_free(o2fsck_strings *strings);
 size_t o2fsck_strings_bytes_allocated(o2fsck_strings *strings);
 
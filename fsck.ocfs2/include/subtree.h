@@ -0,0 +1,30 @@
+/* -*- mode: c; c-basic-offset: 8; -*-
+ * vim: noexpandtab sw=8 ts=8 sts=0:
+ *
+ * subtree.h
+ *
+ * Copyright (C) 2026 Oracle.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef __O2FSCK_SUBTREE_H__
+#define __O2FSCK_SUBTREE_H__
+
+#include "fsck.h"
+
+errcode_t o2fsck_subtree_add_path(const char *path);
+errcode_t o2fsck_subtree_add_inodes(const char *list);
+int o2fsck_subtree_wanted(void);
+
+/* Read-only check of the named inodes and everything below them */
+errcode_t o2fsck_check_subtree(o2fsck_state *ost, uint64_t *problems);
+
+#endif /* __O2FSCK_SUBTREE_H__ */
@@ -46,6 +46,8 @@ enum o2fsck_cache_hint {
 					   filesystem */
 };
 void o2fsck_init_cache(o2fsck_state *ost, enum o2fsck_cache_hint hint);
+uint64_t o2fsck_cache_size(o2fsck_state *ost, enum o2fsck_cache_hint hint);
+void o2fsck_size_cache_for_pass(o2fsck_state *ost, int pass);
 int o2fsck_worth_caching(int blocks_to_read);
 void o2fsck_reset_blocks_cached(void);
 
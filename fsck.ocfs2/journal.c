@@ -33,6 +33,7 @@
  */
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
 
@@ -47,12 +48,49 @@
 
 static const char *whoami = "journal recovery";
 
+/*
+ * Maps a block number to what we know about it.  It is used for the
+ * revoke records of each journal, and for the final image of every block
+ * the journals will write.
+ */
+struct journal_block {
+	uint64_t	jb_blkno;
+	uint64_t	jb_src;		/* Physical block holding the image */
+	uint32_t	jb_seq;		/* Revoked up to this transaction */
+	uint16_t	jb_slot;	/* Journal the image comes from */
+	uint16_t	jb_flags;
+};
+
+#define JB_USED		0x0001
+#define JB_ESCAPE	0x0002
+
+struct journal_block_hash {
+	struct journal_block	*jh_table;
+	uint64_t		jh_size;	/* Always a power of two */
+	uint64_t		jh_count;
+};
+
+/*
+ * A window of one journal that is read with a few large requests rather
+ * than a block at a time.  See read_journal_block().
+ */
+#define JOURNAL_WINDOW_BLOCKS	256
+
+struct journal_window {
+	struct journal_info	*jw_ji;		/* NULL when empty */
+	uint64_t		jw_start;	/* Logical journal block */
+	uint64_t		jw_count;
+	char			*jw_buf;
+	struct io_vec_unit	*jw_ivus;
+};
+
 struct journal_info {
 	int			ji_slot;
-	unsigned		ji_replay:1;
+	unsigned		ji_replay:1,
+				ji_failed:1;
 
 	uint64_t		ji_ino;
-	struct rb_root		ji_revoke;
+	struct journal_block_hash ji_revoke;
 	journal_superblock_t	*ji_jsb;
 	uint64_t		ji_jsb_block;
 	ocfs2_cached_inode	*ji_cinode;
@@ -62,12 +100,10 @@ struct journal_info {
 
 	/* we keep our own bitmap for detecting overlapping journal blocks */
 	ocfs2_bitmap		*ji_used_blocks;
-};
 
-struct revoke_entry {
-	struct rb_node	r_node;
-	uint64_t	r_block;
-	uint32_t	r_seq;
+	/* Shared by all the slots */
+	struct journal_window	*ji_window;
+	struct journal_block_hash *ji_final;
 };
 
 static int seq_gt(uint32_t x, uint32_t y)
@@ -81,79 +117,129 @@ static int seq_geq(uint32_t x, uint32_t y)
 	return diff >= 0;
 }
 
-static errcode_t revoke_insert(struct rb_root *root, uint64_t block,
-				uint32_t seq)
+static inline uint64_t jb_hash(struct journal_block_hash *jh, uint64_t blkno)
 {
-	struct rb_node ** p = &root->rb_node;
-	struct rb_node * parent = NULL;
-	struct revoke_entry *re;
-
-	while (*p)
-	{
-		parent = *p;
-		re = rb_entry(parent, struct revoke_entry, r_node);
-
-		if (block < re->r_block)
-			p = &(*p)->rb_left;
-		else if (block > re->r_block)
-			p = &(*p)->rb_right;
-		else {
-			if (seq_gt(seq, re->r_seq))
-				re->r_seq = seq;
-			return 0;
-		}
+	return (blkno * 0x9E3779B97F4A7C15ULL) & (jh->jh_size - 1);
+}
+
+static struct journal_block *jb_find_slot(struct journal_block_hash *jh,
+					  uint64_t blkno)
+{
+	struct journal_block *jb;
+	uint64_t i;
+
+	for (i = jb_hash(jh, blkno); ; i = (i + 1) & (jh->jh_size - 1)) {
+		jb = &jh->jh_table[i];
+		if (!(jb->jb_flags & JB_USED) || (jb->jb_blkno == blkno))
+			return jb;
 	}
+}
 
-	re = malloc(sizeof(struct revoke_entry));
-	if (re == NULL)
-		return OCFS2_ET_NO_MEMORY;
+static struct journal_block *jb_lookup(struct journal_block_hash *jh,
+				       uint64_t blkno)
+{
+	struct journal_block *jb;
+
+	if (!jh->jh_count)
+		return NULL;
+
+	jb = jb_find_slot(jh, blkno);
+	return (jb->jb_flags & JB_USED) ? jb : NULL;
+}
+
+/* Kept at most half full */
+static errcode_t jb_grow(struct journal_block_hash *jh)
+{
+	struct journal_block_hash new_jh;
+	uint64_t i;
+	errcode_t ret;
 
-	re->r_block = block;
-	re->r_seq = seq;
+	new_jh.jh_size = jh->jh_size ? jh->jh_size * 2 : 1024;
+	new_jh.jh_count = jh->jh_count;
+	ret = ocfs2_malloc0(new_jh.jh_size * sizeof(struct journal_block),
+			    &new_jh.jh_table);
+	if (ret)
+		return ret;
 
-	rb_link_node(&re->r_node, parent, p);
-	rb_insert_color(&re->r_node, root);
+	for (i = 0; i < jh->jh_size; i++)
+		if (jh->jh_table[i].jb_flags & JB_USED)
+			*jb_find_slot(&new_jh, jh->jh_table[i].jb_blkno) =
+				jh->jh_table[i];
+
+	if (jh->jh_table)
+		ocfs2_free(&jh->jh_table);
+	*jh = new_jh;
 
 	return 0;
 }
 
-static int revoke_this_block(struct rb_root *root, uint64_t block, 
-		 	     uint32_t seq)
+/* Returns the entry for blkno, adding an empty one if needed */
+static errcode_t jb_insert(struct journal_block_hash *jh, uint64_t blkno,
+			   struct journal_block **ret_jb)
 {
-	struct rb_node *node = root->rb_node;
-	struct revoke_entry *re;
-
-	while (node) {
-		re = rb_entry(node, struct revoke_entry, r_node);
-
-		if (block < re->r_block)
-			node = node->rb_left;
-		else if (block > re->r_block)
-			node = node->rb_right;
-		else {
-			/* only revoke if we've recorded a revoke entry for
-			 * this block that is <= the seq that we're interested
-			 * in */
-			if (re && !seq_gt(seq, re->r_seq)) {
-				verbosef("%"PRIu64" is revoked\n", block);
-				return 1;
-			}
-		}
+	struct journal_block *jb;
+	errcode_t ret;
+
+	if ((jh->jh_count + 1) * 2 > jh->jh_size) {
+		ret = jb_grow(jh);
+		if (ret)
+			return ret;
 	}
 
+	jb = jb_find_slot(jh, blkno);
+	if (!(jb->jb_flags & JB_USED)) {
+		memset(jb, 0, sizeof(struct journal_block));
+		jb->jb_blkno = blkno;
+		jb->jb_flags = JB_USED;
+		jh->jh_count++;
+	}
+
+	*ret_jb = jb;
 	return 0;
 }
 
-static void revoke_free_all(struct rb_root *root)
+static void jb_free_all(struct journal_block_hash *jh)
+{
+	if (jh->jh_table)
+		ocfs2_free(&jh->jh_table);
+	memset(jh, 0, sizeof(struct journal_block_hash));
+}
+
+static errcode_t revoke_insert(struct journal_block_hash *jh, uint64_t block,
+			       uint32_t seq)
 {
-	struct revoke_entry *re;
-	struct rb_node *node;
+	struct journal_block *jb;
+	errcode_t ret;
 
-	while((node = rb_first(root)) != NULL) {
-		re = rb_entry(node, struct revoke_entry, r_node);
-		rb_erase(node, root);
-		free(re);
+	jb = jb_lookup(jh, block);
+	if (jb) {
+		if (seq_gt(seq, jb->jb_seq))
+			jb->jb_seq = seq;
+		return 0;
 	}
+
+	ret = jb_insert(jh, block, &jb);
+	if (ret)
+		return ret;
+	jb->jb_seq = seq;
+
+	return 0;
+}
+
+static int revoke_this_block(struct journal_block_hash *jh, uint64_t block,
+			     uint32_t seq)
+{
+	struct journal_block *jb;
+
+	/* only revoke if we've recorded a revoke entry for this block
+	 * that is <= the seq that we're interested in */
+	jb = jb_lookup(jh, block);
+	if (jb && !seq_gt(seq, jb->jb_seq)) {
+		verbosef("%"PRIu64" is revoked\n", block);
+		return 1;
+	}
+
+	return 0;
 }
 
 static errcode_t add_revoke_records(struct journal_info *ji, char *buf,
@@ -261,6 +347,53 @@ out:
 	return ret;
 }
 
+/*
+ * Map as much of the journal starting at blkoff as fits in the window and
+ * read it with one vectored request.  The window never wraps, so a walk
+ * that wraps around s_maxlen just refills it from s_first.
+ */
+static errcode_t fill_journal_window(ocfs2_filesys *fs,
+				     struct journal_info *ji, uint64_t blkoff)
+{
+	struct journal_window *jw = ji->ji_window;
+	uint64_t end, off, blkno, contig;
+	int nr_ivus = 0;
+	errcode_t ret;
+
+	jw->jw_ji = NULL;
+	end = blkoff + JOURNAL_WINDOW_BLOCKS;
+	if (end > ji->ji_jsb->s_maxlen)
+		end = ji->ji_jsb->s_maxlen;
+
+	for (off = blkoff; off < end; off += contig) {
+		ret = ocfs2_extent_map_get_blocks(ji->ji_cinode, off,
+						  end - off, &blkno, &contig,
+						  NULL);
+		if (ret)
+			return ret;
+		if (!blkno || !contig)
+			return OCFS2_ET_IO;
+		if (contig > end - off)
+			contig = end - off;
+
+		jw->jw_ivus[nr_ivus].ivu_blkno = blkno;
+		jw->jw_ivus[nr_ivus].ivu_buf = jw->jw_buf +
+			((off - blkoff) * fs->fs_blocksize);
+		jw->jw_ivus[nr_ivus].ivu_buflen = contig * fs->fs_blocksize;
+		nr_ivus++;
+	}
+
+	ret = io_vec_read_blocks(fs->fs_io, jw->jw_ivus, nr_ivus);
+	if (ret)
+		return ret;
+
+	jw->jw_ji = ji;
+	jw->jw_start = blkoff;
+	jw->jw_count = end - blkoff;
+
+	return 0;
+}
+
 static errcode_t read_journal_block(ocfs2_filesys *fs, 
 				    struct journal_info *ji, 
 				    uint64_t blkoff, 
@@ -269,11 +402,31 @@ static errcode_t read_journal_block(ocfs2_filesys *fs,
 {
 	errcode_t err;
 	uint64_t	blkno;
+	struct journal_window *jw = ji->ji_window;
 
 	err = lookup_journal_block(fs, ji, blkoff, &blkno, check_dup);
 	if (err)
 		return err;
 
+	/*
+	 * Walking a journal is a sequential read, so we read it a window
+	 * at a time.  Image files remap blocks underneath us, and any
+	 * trouble filling the window is left to the single block read to
+	 * report.
+	 */
+	if (jw && !(fs->fs_flags & OCFS2_FLAG_IMAGE_FILE)) {
+		if ((jw->jw_ji != ji) || (blkoff < jw->jw_start) ||
+		    (blkoff >= jw->jw_start + jw->jw_count))
+			fill_journal_window(fs, ji, blkoff);
+
+		if (jw->jw_ji == ji) {
+			memcpy(buf, jw->jw_buf +
+			       ((blkoff - jw->jw_start) * fs->fs_blocksize),
+			       fs->fs_blocksize);
+			return 0;
+		}
+	}
+
 	err = ocfs2_read_blocks(fs, blkno, 1, buf);
 	if (err)
 		com_err(whoami, err, "while reading block %"PRIu64" of slot "
@@ -282,28 +435,29 @@ static errcode_t read_journal_block(ocfs2_filesys *fs,
 	return err;
 }
 
+/*
+ * Rather than writing each block as we find it, we remember where its
+ * newest image lives in the journal.  A block that is logged many times,
+ * in one journal or in several, is then written only once.  Later
+ * transactions and later slots replace earlier ones, just as they would
+ * have overwritten them on disk.
+ */
 static errcode_t replay_blocks(ocfs2_filesys *fs, struct journal_info *ji,
 			       char *buf, uint64_t seq, uint64_t *next_block)
 {
 	char *tagp;
 	journal_block_tag_t *tag;
 	size_t i, num;
-	char *io_buf = NULL;
 	errcode_t err, ret = 0;
 	int tag_bytes = ocfs2_journal_tag_bytes(ji->ji_jsb);
 	uint32_t t_flags;
-	uint64_t block64;
+	uint64_t block64, src;
+	struct journal_block *jb;
 		
 	tagp = buf + sizeof(journal_header_t);
 	num = (ji->ji_jsb->s_blocksize - sizeof(journal_header_t)) / 
 		tag_bytes;
 
-	ret = ocfs2_malloc_blocks(fs->fs_io, 1, &io_buf);
-	if (ret) {
-		com_err(whoami, ret, "while allocating a block buffer");
-		goto out;
-	}
-
 	for(i = 0; i < num; i++, tagp += tag_bytes, (*next_block)++) {
 		tag = (journal_block_tag_t *)tagp;
 		t_flags = be32_to_cpu(tag->t_flags);
@@ -317,20 +471,24 @@ static errcode_t replay_blocks(ocfs2_filesys *fs, struct journal_info *ji,
 		if (revoke_this_block(&ji->ji_revoke, block64, seq))
 			goto skip_io;
 
-		err = read_journal_block(fs, ji, *next_block, io_buf, 1);
+		err = lookup_journal_block(fs, ji, *next_block, &src, 1);
 		if (err) {
 			ret = err;
 			goto skip_io;
 		}
 
-		if (t_flags & JBD2_FLAG_ESCAPE) {
-			uint32_t magic = cpu_to_be32(JBD2_MAGIC_NUMBER);
-			memcpy(io_buf, &magic, sizeof(magic));
-		}
-
-		err = io_write_block(fs->fs_io, block64, 1, io_buf);
-		if (err)
+		err = jb_insert(ji->ji_final, block64, &jb);
+		if (err) {
+			com_err(whoami, err, "while recording block %"PRIu64
+				" for replay", block64);
 			ret = err;
+			goto skip_io;
+		}
+		jb->jb_src = src;
+		jb->jb_slot = ji->ji_slot;
+		jb->jb_flags = JB_USED;
+		if (t_flags & JBD2_FLAG_ESCAPE)
+			jb->jb_flags |= JB_ESCAPE;
 
 	skip_io:
 		if (t_flags & JBD2_FLAG_LAST_TAG)
@@ -339,9 +497,6 @@ static errcode_t replay_blocks(ocfs2_filesys *fs, struct journal_info *ji,
 			tagp += 16;
 	}
 	
-out:
-	if (io_buf)
-		ocfs2_free(&io_buf);
 	return ret;
 }
 
@@ -597,6 +752,157 @@ out:
 	
 }
 
+static int jb_cmp(const void *a, const void *b)
+{
+	const struct journal_block *l = a, *r = b;
+
+	if (l->jb_blkno < r->jb_blkno)
+		return -1;
+	if (l->jb_blkno > r->jb_blkno)
+		return 1;
+	return 0;
+}
+
+/* How many blocks we read and write at a time while replaying */
+#define REPLAY_BATCH_BLOCKS	1024
+
+static void read_replay_batch(ocfs2_filesys *fs, struct journal_info *jis,
+			      struct journal_block *jbs, int nr, char *data,
+			      struct io_vec_unit *ivus)
+{
+	int i, nr_ivus = 0;
+	errcode_t ret;
+	char *p;
+
+	if (!(fs->fs_flags & OCFS2_FLAG_IMAGE_FILE)) {
+		for (i = 0; i < nr; i++) {
+			p = data + (i * fs->fs_blocksize);
+			if (nr_ivus &&
+			    (jbs[i].jb_src == jbs[i - 1].jb_src + 1)) {
+				ivus[nr_ivus - 1].ivu_buflen +=
+					fs->fs_blocksize;
+				continue;
+			}
+			ivus[nr_ivus].ivu_blkno = jbs[i].jb_src;
+			ivus[nr_ivus].ivu_buf = p;
+			ivus[nr_ivus].ivu_buflen = fs->fs_blocksize;
+			nr_ivus++;
+		}
+
+		ret = io_vec_read_blocks(fs->fs_io, ivus, nr_ivus);
+		if (!ret)
+			return;
+	}
+
+	/* Find out which blocks are the trouble */
+	for (i = 0; i < nr; i++) {
+		p = data + (i * fs->fs_blocksize);
+		ret = ocfs2_read_blocks(fs, jbs[i].jb_src, 1, p);
+		if (ret) {
+			com_err(whoami, ret, "while reading block %"PRIu64
+				" of slot %d's journal", jbs[i].jb_src,
+				jbs[i].jb_slot);
+			jis[jbs[i].jb_slot].ji_failed = 1;
+			jbs[i].jb_flags &= ~JB_USED;
+		}
+	}
+}
+
+static void write_replay_batch(ocfs2_filesys *fs, struct journal_info *jis,
+			       struct journal_block *jbs, int nr, char *data)
+{
+	uint32_t magic = cpu_to_be32(JBD2_MAGIC_NUMBER);
+	int i, j, run;
+	errcode_t ret;
+
+	for (i = 0; i < nr; i++)
+		if (jbs[i].jb_flags & JB_ESCAPE)
+			memcpy(data + (i * fs->fs_blocksize), &magic,
+			       sizeof(magic));
+
+	for (i = 0; i < nr; i += run) {
+		if (!(jbs[i].jb_flags & JB_USED)) {
+			run = 1;
+			continue;
+		}
+
+		for (run = 1; i + run < nr; run++)
+			if (!(jbs[i + run].jb_flags & JB_USED) ||
+			    (jbs[i + run].jb_blkno !=
+			     jbs[i].jb_blkno + run))
+				break;
+
+		ret = io_write_block(fs->fs_io, jbs[i].jb_blkno, run,
+				     data + (i * fs->fs_blocksize));
+		if (ret) {
+			com_err(whoami, ret, "while writing %d blocks at "
+				"%"PRIu64" during journal replay", run,
+				jbs[i].jb_blkno);
+			for (j = i; j < i + run; j++)
+				jis[jbs[j].jb_slot].ji_failed = 1;
+		}
+	}
+}
+
+/*
+ * Write the final image of every block the journals logged.  We go in
+ * block order so that neighbouring blocks, which are common in journals,
+ * turn into large writes.
+ */
+static errcode_t write_replayed_blocks(ocfs2_filesys *fs,
+				       struct journal_info *jis,
+				       struct journal_block_hash *final)
+{
+	struct journal_block *jbs = NULL;
+	struct io_vec_unit *ivus = NULL;
+	char *data = NULL;
+	uint64_t i, nr = 0;
+	int batch;
+	errcode_t ret;
+
+	if (!final->jh_count)
+		return 0;
+
+	ret = ocfs2_malloc0(final->jh_count * sizeof(struct journal_block),
+			    &jbs);
+	if (!ret)
+		ret = ocfs2_malloc0(REPLAY_BATCH_BLOCKS *
+				    sizeof(struct io_vec_unit), &ivus);
+	if (!ret)
+		ret = ocfs2_malloc_blocks(fs->fs_io, REPLAY_BATCH_BLOCKS,
+					  &data);
+	if (ret) {
+		com_err(whoami, ret, "while allocating room to replay "
+			"journal blocks");
+		goto out;
+	}
+
+	for (i = 0; i < final->jh_size; i++)
+		if (final->jh_table[i].jb_flags & JB_USED)
+			jbs[nr++] = final->jh_table[i];
+	qsort(jbs, nr, sizeof(struct journal_block), jb_cmp);
+
+	verbosef("writing %"PRIu64" replayed blocks\n", nr);
+
+	for (i = 0; i < nr; i += batch) {
+		batch = REPLAY_BATCH_BLOCKS;
+		if (batch > nr - i)
+			batch = nr - i;
+
+		read_replay_batch(fs, jis, jbs + i, batch, data, ivus);
+		write_replay_batch(fs, jis, jbs + i, batch, data);
+	}
+
+out:
+	if (data)
+		ocfs2_free(&data);
+	if (ivus)
+		ocfs2_free(&ivus);
+	if (jbs)
+		ocfs2_free(&jbs);
+	return ret;
+}
+
 /* Try and replay the slots journals if they're dirty.  This only returns
  * a non-zero error if the caller should not continue. */
 errcode_t o2fsck_replay_journals(ocfs2_filesys *fs, int *replayed)
@@ -608,6 +914,8 @@ errcode_t o2fsck_replay_journals(ocfs2_filesys *fs, int *replayed)
 	int journal_trouble = 0;
 	uint16_t i, max_slots;
 	ocfs2_bitmap *used_blocks = NULL;
+	struct journal_window jw = { .jw_ji = NULL, };
+	struct journal_block_hash final = { .jh_table = NULL, };
 
 	max_slots = OCFS2_RAW_SB(fs->fs_super)->s_max_slots;
 
@@ -625,6 +933,16 @@ errcode_t o2fsck_replay_journals(ocfs2_filesys *fs, int *replayed)
 		goto out;
 	}
 
+	/* Not fatal; we just read the journals a block at a time */
+	if (ocfs2_malloc_blocks(fs->fs_io, JOURNAL_WINDOW_BLOCKS,
+				&jw.jw_buf) ||
+	    ocfs2_malloc0(JOURNAL_WINDOW_BLOCKS * sizeof(struct io_vec_unit),
+			  &jw.jw_ivus)) {
+		if (jw.jw_buf)
+			ocfs2_free(&jw.jw_buf);
+		jw.jw_buf = NULL;
+	}
+
 	ret = ocfs2_malloc0(sizeof(struct journal_info) * max_slots, &jis);
 	if (ret) {
 		com_err(whoami, ret, "while allocating an array of block "
@@ -636,8 +954,10 @@ errcode_t o2fsck_replay_journals(ocfs2_filesys *fs, int *replayed)
 
 	for (i = 0, ji = jis; i < max_slots; i++, ji++) {
 		ji->ji_used_blocks = used_blocks;
-		ji->ji_revoke = RB_ROOT;
 		ji->ji_slot = i;
+		ji->ji_final = &final;
+		if (jw.jw_buf)
+			ji->ji_window = &jw;
 
 		/* sets ji->ji_replay */
 		err = prep_journal_info(fs, i, ji);
@@ -667,10 +987,23 @@ errcode_t o2fsck_replay_journals(ocfs2_filesys *fs, int *replayed)
 		printf("Replaying slot %d's journal.\n", i);
 
 		err = walk_journal(fs, i, ji, buf, 1);
-		if (err) {
+		if (err)
+			ji->ji_failed = 1;
+	}
+
+	/* Every slot has had its say; now write what they left behind */
+	ret = write_replayed_blocks(fs, jis, &final);
+	if (ret)
+		goto out;
+
+	for (i = 0, ji = jis; i < max_slots; i++, ji++) {
+		if (!ji->ji_replay)
+			continue;
+
+		if (ji->ji_failed) {
 			journal_trouble = 1;
 			continue;
-		} 
+		}
 
 		jsb = ji->ji_jsb;
 		/* reset the journal */
@@ -714,11 +1047,16 @@ out:
 			if (ji->ji_cinode)
 				ocfs2_free_cached_inode(fs, 
 							ji->ji_cinode);
-			revoke_free_all(&ji->ji_revoke);
+			jb_free_all(&ji->ji_revoke);
 		}
 		ocfs2_free(&jis);
 	}
 
+	jb_free_all(&final);
+	if (jw.jw_buf)
+		ocfs2_free(&jw.jw_buf);
+	if (jw.jw_ivus)
+		ocfs2_free(&jw.jw_ivus);
 	if (buf)
 		ocfs2_free(&buf);
 	if (used_blocks)
@@ -0,0 +1,513 @@
+/* -*- mode: c; c-basic-offset: 8; -*-
+ * vim: noexpandtab sw=8 ts=8 sts=0:
+ *
+ * mem.c
+ *
+ * Copyright (C) 2026 Oracle.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * --
+ *
+ * Accounting for the memory fsck spends on its run-time structures, and
+ * a spill store for when --memory-limit says they can't all live in core.
+ *
+ * The spill store is an unlinked scratch file mapped MAP_SHARED into one
+ * big address space reservation.  Its pages are backed by the scratch
+ * file rather than by swap, so the kernel can write them out and drop
+ * them when we are short of memory.  Pointers into it stay valid for the
+ * life of the process, which means the rbtrees built on top of it need
+ * no changes at all.  Freed objects go onto per-size free lists, and
+ * anything bigger than the largest class onto one list of free extents
+ * that later allocations of any size are carved from.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "ocfs2/ocfs2.h"
+
+#include "fsck.h"
+#include "mem.h"
+#include "util.h"
+
+/* Objects in the spill store are aligned and sized to this */
+#define SPILL_ALIGN		16
+/* Objects up to this size get their own free list, the rest share one */
+#define SPILL_MAX_CLASS		256
+#define SPILL_NUM_CLASSES	(SPILL_MAX_CLASS / SPILL_ALIGN)
+/* We grow the scratch file this much at a time */
+#define SPILL_CHUNK		(64ULL * 1024 * 1024)
+/* Address space we try to reserve for the spill store */
+#define SPILL_RESERVE		(1ULL << 40)
+
+struct mem_class {
+	const char	*mc_name;
+	uint64_t	mc_bytes;	/* In core right now */
+	uint64_t	mc_peak;	/* Most ever held, in core or spilled */
+	uint64_t	mc_spilled;	/* Spilled right now */
+};
+
+static struct mem_class mem_classes[O2FSCK_MEM_NUM_TYPES] = {
+	[O2FSCK_MEM_DIRBLOCKS]		= { .mc_name = "directory blocks" },
+	[O2FSCK_MEM_DIR_PARENTS]	= { .mc_name = "directory parents" },
+	[O2FSCK_MEM_ICOUNT]		= { .mc_name = "link counts" },
+	[O2FSCK_MEM_REFCOUNT]		= { .mc_name = "refcount trees" },
+};
+
+static uint64_t mem_limit;	/* 0 means no limit */
+static uint64_t mem_in_core;	/* Sum of mc_bytes */
+static uint64_t mem_cache;	/* Size of the I/O cache we got */
+static uint64_t mem_fixed;	/* Bitmaps we can't spill */
+
+static char *spill_dir;
+static int spill_fd = -1;
+static char *spill_base;
+static uint64_t spill_reserved;
+static uint64_t spill_mapped;	/* Size of the scratch file */
+static uint64_t spill_used;	/* High water mark of the bump pointer */
+static void *spill_free_list[SPILL_NUM_CLASSES];
+
+/* A free extent bigger than SPILL_MAX_CLASS, on spill_free_large */
+struct spill_extent {
+	struct spill_extent	*se_next;
+	size_t			se_size;
+};
+static struct spill_extent *spill_free_large;
+
+errcode_t o2fsck_mem_init(uint64_t limit, const char *dir)
+{
+	mem_limit = limit;
+	if (!limit)
+		return 0;
+
+	if (!dir) {
+		dir = getenv("TMPDIR");
+		if (!dir)
+			dir = "/tmp";
+	}
+
+	spill_dir = strdup(dir);
+	if (!spill_dir)
+		return OCFS2_ET_NO_MEMORY;
+
+	return 0;
+}
+
+void o2fsck_mem_exit(void)
+{
+	if (spill_base)
+		munmap(spill_base, spill_reserved);
+	if (spill_fd >= 0)
+		close(spill_fd);
+	spill_base = NULL;
+	spill_fd = -1;
+
+	if (spill_dir)
+		free(spill_dir);
+	spill_dir = NULL;
+}
+
+static errcode_t spill_open(void)
+{
+	char *template = NULL;
+	void *base;
+	uint64_t reserve;
+	errcode_t ret;
+
+	ret = ocfs2_malloc0(strlen(spill_dir) + sizeof("/o2fsck-spill.XXXXXX"),
+			    &template);
+	if (ret)
+		return ret;
+	sprintf(template, "%s/o2fsck-spill.XXXXXX", spill_dir);
+
+	spill_fd = mkstemp(template);
+	if (spill_fd < 0) {
+		ret = errno;
+		com_err("mem", ret, "while creating a spill file in %s",
+			spill_dir);
+		ret = OCFS2_ET_IO;
+		goto out;
+	}
+	/* Nobody else needs to see it, and it goes away when we do */
+	unlink(template);
+
+	/*
+	 * Ask for a lot of address space up front so that every chunk we
+	 * map lands in one range.  That keeps o2fsck_mem_free() a simple
+	 * bounds check.
+	 */
+	for (reserve = SPILL_RESERVE; reserve >= SPILL_CHUNK; reserve >>= 1) {
+		base = mmap(NULL, reserve, PROT_NONE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (base != MAP_FAILED)
+			break;
+	}
+	if (reserve < SPILL_CHUNK) {
+		close(spill_fd);
+		spill_fd = -1;
+		ret = OCFS2_ET_NO_MEMORY;
+		goto out;
+	}
+
+	spill_base = base;
+	spill_reserved = reserve;
+	verbosef("Spilling to %s, %"PRIu64" bytes reserved\n", template,
+		 reserve);
+
+out:
+	ocfs2_free(&template);
+	return ret;
+}
+
+static errcode_t spill_grow(void)
+{
+	void *p;
+
+	if (spill_mapped + SPILL_CHUNK > spill_reserved)
+		return OCFS2_ET_NO_MEMORY;
+
+	if (ftruncate(spill_fd, spill_mapped + SPILL_CHUNK)) {
+		com_err("mem", errno, "while growing the spill file");
+		return OCFS2_ET_IO;
+	}
+
+	p = mmap(spill_base + spill_mapped, SPILL_CHUNK,
+		 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, spill_fd,
+		 spill_mapped);
+	if (p == MAP_FAILED) {
+		com_err("mem", errno, "while mapping the spill file");
+		return OCFS2_ET_NO_MEMORY;
+	}
+
+	spill_mapped += SPILL_CHUNK;
+	return 0;
+}
+
+static inline int in_spill(void *p)
+{
+	return spill_base && ((char *)p >= spill_base) &&
+		((char *)p < spill_base + spill_reserved);
+}
+
+static inline size_t spill_size(size_t size)
+{
+	return (size + SPILL_ALIGN - 1) & ~((size_t)SPILL_ALIGN - 1);
+}
+
+static void spill_free(size_t size, void *p);
+
+/*
+ * First fit from the large free extents.  Whatever is left over goes
+ * back through spill_free(), so a small tail lands on its class list.
+ * Neighbours are never merged; the big users free and reallocate whole
+ * chunks of one size, which this reuses as is.
+ */
+static void *spill_take_large(size_t size)
+{
+	struct spill_extent **sep = &spill_free_large, *se;
+	size_t left;
+
+	for (se = *sep; se; sep = &se->se_next, se = *sep) {
+		if (se->se_size < size)
+			continue;
+
+		*sep = se->se_next;
+		left = se->se_size - size;
+		if (left)
+			spill_free(left, (char *)se + size);
+		return se;
+	}
+
+	return NULL;
+}
+
+static errcode_t spill_alloc0(size_t size, void **ptr)
+{
+	errcode_t ret;
+	size_t class;
+	void *p;
+
+	size = spill_size(size);
+	class = size / SPILL_ALIGN - 1;
+
+	if (size <= SPILL_MAX_CLASS && spill_free_list[class]) {
+		p = spill_free_list[class];
+		spill_free_list[class] = *(void **)p;
+		goto out;
+	}
+
+	p = spill_take_large(size);
+	if (p)
+		goto out;
+
+	if (!spill_base) {
+		ret = spill_open();
+		if (ret)
+			return ret;
+	}
+
+	while (spill_used + size > spill_mapped) {
+		ret = spill_grow();
+		if (ret)
+			return ret;
+	}
+
+	p = spill_base + spill_used;
+	spill_used += size;
+
+out:
+	memset(p, 0, size);
+	*ptr = p;
+	return 0;
+}
+
+static void spill_free(size_t size, void *p)
+{
+	struct spill_extent *se;
+	size_t class;
+
+	size = spill_size(size);
+	if (size > SPILL_MAX_CLASS) {
+		se = p;
+		se->se_size = size;
+		se->se_next = spill_free_large;
+		spill_free_large = se;
+		return;
+	}
+
+	class = size / SPILL_ALIGN - 1;
+	*(void **)p = spill_free_list[class];
+	spill_free_list[class] = p;
+}
+
+static int fits_in_core(size_t size)
+{
+	if (!mem_limit)
+		return 1;
+
+	return (mem_fixed + mem_cache + mem_in_core + size) <= mem_limit;
+}
+
+errcode_t o2fsck_mem_alloc0(enum o2fsck_mem_type type, size_t size,
+			    void *ptr)
+{
+	struct mem_class *mc = &mem_classes[type];
+	void **pp = (void **)ptr;
+	errcode_t ret;
+
+	if (fits_in_core(size)) {
+		ret = ocfs2_malloc0(size, pp);
+		if (ret)
+			return ret;
+		mc->mc_bytes += size;
+		mem_in_core += size;
+	} else {
+		ret = spill_alloc0(size, pp);
+		if (ret)
+			return ret;
+		mc->mc_spilled += size;
+	}
+
+	if ((mc->mc_bytes + mc->mc_spilled) > mc->mc_peak)
+		mc->mc_peak = mc->mc_bytes + mc->mc_spilled;
+
+	return 0;
+}
+
+void o2fsck_mem_free(enum o2fsck_mem_type type, size_t size, void *ptr)
+{
+	struct mem_class *mc = &mem_classes[type];
+	void **pp = (void **)ptr;
+
+	if (!*pp)
+		return;
+
+	if (in_spill(*pp)) {
+		spill_free(size, *pp);
+		mc->mc_spilled -= size;
+		*pp = NULL;
+	} else {
+		ocfs2_free(pp);
+		mc->mc_bytes -= size;
+		mem_in_core -= size;
+	}
+}
+
+uint64_t o2fsck_mem_cache_budget(ocfs2_filesys *fs)
+{
+	uint64_t avail, min_cache = 512 * (uint64_t)fs->fs_blocksize;
+
+	if (!mem_limit)
+		return UINT64_MAX;
+
+	/*
+	 * The allocated clusters bitmap is fully populated and lives for
+	 * the whole run.  The block bitmaps only grow regions where there
+	 * are inodes, so we just hold back an eighth of the limit for
+	 * them.  Half of what is left goes to the I/O cache and the rest
+	 * to the structures above.
+	 */
+	mem_fixed = (fs->fs_clusters + 7) / 8 + mem_limit / 8;
+	avail = mem_limit > mem_fixed ? mem_limit - mem_fixed : 0;
+	avail /= 2;
+
+	return avail > min_cache ? avail : min_cache;
+}
+
+/* Reads a cgroup v2 memory file; "max" and missing files are UINT64_MAX */
+static uint64_t cgroup_read(const char *cgroup, const char *file)
+{
+	char path[PATH_MAX], buf[32];
+	uint64_t val = UINT64_MAX;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/sys/fs/cgroup%s/%s", cgroup, file);
+	f = fopen(path, "r");
+	if (!f)
+		return UINT64_MAX;
+	if (fgets(buf, sizeof(buf), f) && strncmp(buf, "max", 3))
+		val = strtoull(buf, NULL, 10);
+	fclose(f);
+
+	return val;
+}
+
+/*
+ * How much more we may charge to our cgroup before memory.max in it or
+ * in any cgroup above it kicks in.  UINT64_MAX without cgroup v2 or
+ * without a limit.
+ */
+static uint64_t cgroup_headroom(void)
+{
+	char line[PATH_MAX], *cgroup = NULL, *p;
+	uint64_t headroom = UINT64_MAX, max, cur;
+	FILE *f;
+
+	f = fopen("/proc/self/cgroup", "r");
+	if (!f)
+		return UINT64_MAX;
+	while (fgets(line, sizeof(line), f)) {
+		/* The v2 hierarchy is "0::/path" */
+		if (!strncmp(line, "0::", 3)) {
+			cgroup = line + 3;
+			break;
+		}
+	}
+	fclose(f);
+	if (!cgroup)
+		return UINT64_MAX;
+
+	p = strchr(cgroup, '\n');
+	if (p)
+		*p = '\0';
+	if (!strcmp(cgroup, "/"))
+		cgroup[0] = '\0';
+
+	for (;;) {
+		max = cgroup_read(cgroup, "memory.max");
+		if (max != UINT64_MAX) {
+			cur = cgroup_read(cgroup, "memory.current");
+			if (cur == UINT64_MAX)
+				cur = 0;
+			cur = cur < max ? max - cur : 0;
+			if (cur < headroom)
+				headroom = cur;
+		}
+
+		if (!cgroup[0])
+			break;
+		p = strrchr(cgroup, '/');
+		if (!p)
+			break;
+		*p = '\0';
+	}
+
+	return headroom;
+}
+
+uint64_t o2fsck_mem_available(void)
+{
+	uint64_t avail, headroom;
+
+	avail = (uint64_t)sysconf(_SC_AVPHYS_PAGES) * getpagesize();
+	headroom = cgroup_headroom();
+	if (headroom < avail) {
+		verbosef("cgroup memory.max leaves %"PRIu64" bytes\n",
+			 headroom);
+		avail = headroom;
+	}
+
+	return avail;
+}
+
+void o2fsck_mem_set_cache(uint64_t bytes)
+{
+	mem_cache = bytes;
+}
+
+const char *o2fsck_mem_type_name(enum o2fsck_mem_type type)
+{
+	return mem_classes[type].mc_name;
+}
+
+uint64_t o2fsck_mem_peak(enum o2fsck_mem_type type)
+{
+	return mem_classes[type].mc_peak;
+}
+
+uint64_t o2fsck_mem_limit(void)
+{
+	return mem_limit;
+}
+
+uint64_t o2fsck_mem_spilled(void)
+{
+	return spill_used;
+}
+
+uint64_t o2fsck_mem_peak_rss(void)
+{
+	struct rusage r;
+
+	memset(&r, 0, sizeof(struct rusage));
+	getrusage(RUSAGE_SELF, &r);
+
+	/* ru_maxrss is in kilobytes */
+	return (uint64_t)r.ru_maxrss * 1024;
+}
+
+void o2fsck_mem_print_stats(o2fsck_state *ost)
+{
+	int i;
+
+	if (!ost->ost_show_stats)
+		return;
+
+	printf("  Memory peak RSS: %"PRIu64"MB", mbytes(o2fsck_mem_peak_rss()));
+	if (mem_limit)
+		printf(", limit: %"PRIu64"MB, spilled: %"PRIu64"MB",
+		       mbytes(mem_limit), mbytes(spill_used));
+	printf("\n");
+
+	if (!ost->ost_show_extended_stats)
+		return;
+
+	for (i = 0; i < O2FSCK_MEM_NUM_TYPES; i++)
+		printf("  Peak %s: %"PRIu64"KB\n", mem_classes[i].mc_name,
+		       kbytes(mem_classes[i].mc_peak));
+}
@@ -71,25 +71,11 @@ struct chain_state {
 	uint16_t	cs_cpg;
 };
 
+/* The clear bits are whatever isn't set; popcount the whole bitmap */
 static void find_max_free_bits(struct ocfs2_group_desc *gd, int *max_free_bits)
 {
-	int end = 0;
-	int start;
-	int free_bits;
-
-	*max_free_bits = 0;
-
-	while (end < gd->bg_bits) {
-		start = ocfs2_find_next_bit_clear(gd->bg_bitmap,
-						  gd->bg_bits, end);
-		if (start >= gd->bg_bits)
-			break;
-
-		end = ocfs2_find_next_bit_set(gd->bg_bitmap,
-					      gd->bg_bits, start);
-		free_bits = end - start;
-		*max_free_bits += free_bits;
-	}
+	*max_free_bits = gd->bg_bits -
+		ocfs2_get_bits_set(gd->bg_bitmap, gd->bg_bits, 0);
 }
 
 /* check whether the group really exists in the specified chain of
@@ -1299,6 +1285,80 @@ out:
 	return ret;
 }
 
+/*
+ * Pull the group descriptors of every allocator into the cache before
+ * any of them is checked.  The chains of the global bitmap and of all
+ * the slots' inode and extent allocators are walked together, one
+ * vectored read per step down the chains, instead of one allocator
+ * after another.  The checks below then run in their usual order and
+ * find their descriptors in the cache.  Anything that goes wrong here
+ * is left for those checks to report.
+ *
+ * Returns 1 if the groups of all the allocators fit in the cache.
+ */
+static int warm_allocator_chains(o2fsck_state *ost,
+				 struct ocfs2_dinode *bitmap_di)
+{
+	ocfs2_filesys *fs = ost->ost_fs;
+	int max_slots = OCFS2_RAW_SB(fs->fs_super)->s_max_slots;
+	int i, type, slot, nr_dis = 0, all_fit = 0;
+	struct ocfs2_dinode **dis = NULL;
+	char *buf = NULL;
+	uint64_t blkno, group_bytes = 0;
+	errcode_t ret;
+
+	ret = ocfs2_malloc_blocks(fs->fs_io, 2 * max_slots + 1, &buf);
+	if (!ret)
+		ret = ocfs2_malloc0(sizeof(struct ocfs2_dinode *) *
+				    (2 * max_slots + 2), &dis);
+	if (ret)
+		goto out;
+
+	dis[nr_dis++] = bitmap_di;
+
+	for (i = 0; i < 2 * max_slots + 1; i++) {
+		if (!i) {
+			type = GLOBAL_INODE_ALLOC_SYSTEM_INODE;
+			slot = 0;
+		} else if (i <= max_slots) {
+			type = INODE_ALLOC_SYSTEM_INODE;
+			slot = i - 1;
+		} else {
+			type = EXTENT_ALLOC_SYSTEM_INODE;
+			slot = i - max_slots - 1;
+		}
+
+		if (ocfs2_lookup_system_inode(fs, type, slot, &blkno))
+			continue;
+		dis[nr_dis] = (struct ocfs2_dinode *)
+			(buf + (nr_dis - 1) * fs->fs_blocksize);
+		if (ocfs2_read_inode(fs, blkno, (char *)dis[nr_dis]) ||
+		    !(dis[nr_dis]->i_flags & OCFS2_CHAIN_FL))
+			continue;
+		nr_dis++;
+	}
+
+	for (i = 0; i < nr_dis; i++) {
+		if (dis[i]->id2.i_chain.cl_cpg)
+			group_bytes += (uint64_t)fs->fs_blocksize *
+				(dis[i]->i_clusters /
+				 dis[i]->id2.i_chain.cl_cpg);
+	}
+	all_fit = (group_bytes <= io_get_cache_size(fs->fs_io));
+
+	ret = ocfs2_cache_chain_allocators_blocks(fs, dis, nr_dis);
+
+out:
+	if (ret)
+		verbosef("Caching the allocator chains failed, err %d\n",
+			 (int)ret);
+	if (dis)
+		ocfs2_free(&dis);
+	if (buf)
+		ocfs2_free(&buf);
+	return all_fit;
+}
+
 /* this returns an error if it didn't leave the allocators in a state that
  * the iterators will be able to work with.  There is probably some room
  * for more resiliance here. */
@@ -1312,7 +1372,7 @@ errcode_t o2fsck_pass0(o2fsck_state *ost)
 	ocfs2_filesys *fs = ost->ost_fs;
 	ocfs2_cached_inode **ci;
 	int max_slots = OCFS2_RAW_SB(fs->fs_super)->s_max_slots;
-	int i, type, bitmap_retried = 0;
+	int i, type, bitmap_retried = 0, all_warm;
 	struct o2fsck_resource_track rt;
 
 	printf("Pass 0a: Checking cluster allocation chains\n");
@@ -1387,10 +1447,8 @@ errcode_t o2fsck_pass0(o2fsck_state *ost)
 		}
 	}
 
-	/* Warm up the cache with the groups */
-	ret = ocfs2_cache_chain_allocator_blocks(fs, di);
-	if (ret)
-		verbosef("Caching global bitmap failed, err %d\n", (int)ret);
+	/* Warm up the cache with the groups of all the allocators */
+	all_warm = warm_allocator_chains(ost, di);
 
 retry_bitmap:
 	pre_repair_clusters = di->i_clusters;
@@ -1468,11 +1526,13 @@ retry_bitmap:
 		verbosef("found inode alloc %"PRIu64" at block %"PRIu64"\n",
 			 (uint64_t)di->i_blkno, blkno);
 
-		/* Warm up the cache with the groups */
-		ret = ocfs2_cache_chain_allocator_blocks(fs, di);
-		if (ret)
-			verbosef("Caching inode alloc failed, err %d\n",
-				 (int)ret);
+		/* Warm up the cache if the early walk couldn't hold it */
+		if (!all_warm) {
+			ret = ocfs2_cache_chain_allocator_blocks(fs, di);
+			if (ret)
+				verbosef("Caching inode alloc failed, err %d\n",
+					 (int)ret);
+		}
 
 		ret = verify_chain_alloc(ost, di,
 					 blocks + ost->ost_fs->fs_blocksize,
@@ -1533,11 +1593,13 @@ retry_bitmap:
 		verbosef("found extent alloc %"PRIu64" at block %"PRIu64"\n",
 			 (uint64_t)di->i_blkno, blkno);
 
-		/* Warm up the cache with the groups */
-		ret = ocfs2_cache_chain_allocator_blocks(fs, di);
-		if (ret)
-			verbosef("Caching extent alloc failed, err %d\n",
-				 (int)ret);
+		/* Warm up the cache if the early walk couldn't hold it */
+		if (!all_warm) {
+			ret = ocfs2_cache_chain_allocator_blocks(fs, di);
+			if (ret)
+				verbosef("Caching extent alloc failed, err %d\n",
+					 (int)ret);
+		}
 
 		ret = verify_chain_alloc(ost, di,
 					 blocks + ost->ost_fs->fs_blocksize,
@@ -72,9 +72,65 @@
 #include "util.h"
 #include "xattr.h"
 #include "refcount.h"
+#include "perf.h"
 
 static const char *whoami = "pass1";
 
+struct inode_visitor {
+	struct inode_visitor	*iv_next;
+	o2fsck_inode_visitor	iv_func;
+	void			*iv_priv;
+};
+
+static struct inode_visitor *inode_visitors;
+
+errcode_t o2fsck_add_inode_visitor(o2fsck_inode_visitor func,
+				   void *priv_data)
+{
+	struct inode_visitor *iv, **p;
+	errcode_t ret;
+
+	ret = ocfs2_malloc0(sizeof(struct inode_visitor), &iv);
+	if (ret)
+		return ret;
+
+	iv->iv_func = func;
+	iv->iv_priv = priv_data;
+
+	/* Called in the order they were added */
+	for (p = &inode_visitors; *p; p = &(*p)->iv_next)
+		;
+	*p = iv;
+
+	return 0;
+}
+
+static errcode_t visit_inode(o2fsck_state *ost, uint64_t blkno,
+			     struct ocfs2_dinode *di)
+{
+	struct inode_visitor *iv;
+	errcode_t ret;
+
+	for (iv = inode_visitors; iv; iv = iv->iv_next) {
+		ret = iv->iv_func(ost, blkno, di, iv->iv_priv);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static void free_inode_visitors(void)
+{
+	struct inode_visitor *iv;
+
+	while (inode_visitors) {
+		iv = inode_visitors;
+		inode_visitors = iv->iv_next;
+		ocfs2_free(&iv);
+	}
+}
+
 void o2fsck_free_inode_allocs(o2fsck_state *ost)
 {
 	uint16_t i;
@@ -1451,6 +1507,44 @@ static void write_inode_alloc(o2fsck_state *ost)
 	o2fsck_free_inode_allocs(ost);
 }
 
+/*
+ * Check one inode that claims to be in use: its fields first, and if it
+ * is still valid after that, its refcount tree, extent tree and extended
+ * attributes.  Whatever is found is recorded in ost for the later passes.
+ */
+errcode_t o2fsck_check_inode(o2fsck_state *ost, uint64_t blkno,
+			     struct ocfs2_dinode *di)
+{
+	ocfs2_filesys *fs = ost->ost_fs;
+	errcode_t ret;
+	uint64_t start;
+
+	start = o2fsck_perf_start();
+	if (di->i_flags & OCFS2_VALID_FL)
+		o2fsck_verify_inode_fields(fs, ost, blkno, di);
+	o2fsck_perf_stop(O2FSCK_PERF_INODE_VERIFY, start);
+
+	if (!(di->i_flags & OCFS2_VALID_FL))
+		return 0;
+
+	start = o2fsck_perf_start();
+	ret = o2fsck_check_refcount_tree(ost, di);
+	if (ret)
+		return ret;
+	ret = o2fsck_check_blocks(fs, ost, blkno, di);
+	if (ret)
+		return ret;
+	o2fsck_perf_stop(O2FSCK_PERF_EXTENT_WALK, start);
+
+	start = o2fsck_perf_start();
+	ret = o2fsck_check_xattr(ost, di);
+	if (ret)
+		return ret;
+	o2fsck_perf_stop(O2FSCK_PERF_XATTR, start);
+
+	return 0;
+}
+
 errcode_t o2fsck_pass1(o2fsck_state *ost)
 {
 	errcode_t ret;
@@ -1461,7 +1555,7 @@ errcode_t o2fsck_pass1(o2fsck_state *ost)
 	ocfs2_filesys *fs = ost->ost_fs;
 	int valid;
 	struct o2fsck_resource_track rt;
-	uint64_t numinodes;
+	uint64_t numinodes, start;
 
 	printf("Pass 1: Checking inodes and blocks\n");
 
@@ -1492,7 +1586,9 @@ errcode_t o2fsck_pass1(o2fsck_state *ost)
 	}
 
 	for(;;) {
+		start = o2fsck_perf_start();
 		ret = ocfs2_get_next_inode(scan, &blkno, buf);
+		o2fsck_perf_stop(O2FSCK_PERF_INODE_SCAN, start);
 		if (ret) {
 			/* we don't deal with corrupt inode allocation
 			 * files yet.  They won't be files for much longer.
@@ -1505,6 +1601,7 @@ errcode_t o2fsck_pass1(o2fsck_state *ost)
 		if (blkno == 0)
 			break;
 
+		o2fsck_perf_count(O2FSCK_PERF_INODES, 1);
 		valid = 0;
 
 		/* we never consider inodes who don't have a signature */
@@ -1518,22 +1615,9 @@ errcode_t o2fsck_pass1(o2fsck_state *ost)
 			if ((ost->ost_fix_fs_gen ||
 			    (di->i_fs_generation == ost->ost_fs_generation))) {
 
-				if (di->i_flags & OCFS2_VALID_FL)
-					o2fsck_verify_inode_fields(fs, ost,
-								   blkno, di);
-				if (di->i_flags & OCFS2_VALID_FL) {
-					ret = o2fsck_check_refcount_tree(ost,
-									 di);
-					if (ret)
-						goto out;
-					ret = o2fsck_check_blocks(fs, ost,
-								  blkno, di);
-					if (ret)
-						goto out;
-					ret = o2fsck_check_xattr(ost, di);
-					if (ret)
-						goto out;
-				}
+				ret = o2fsck_check_inode(ost, blkno, di);
+				if (ret)
+					goto out;
 
 				valid = di->i_flags & OCFS2_VALID_FL;
 			}
@@ -1541,6 +1625,12 @@ errcode_t o2fsck_pass1(o2fsck_state *ost)
 
 		update_inode_alloc(ost, di, blkno, valid);
 
+		if (valid) {
+			ret = visit_inode(ost, blkno, di);
+			if (ret)
+				goto out_close_scan;
+		}
+
 		if (ost->ost_prog)
 			tools_progress_step(ost->ost_prog, 1);
 	}
@@ -1558,14 +1648,18 @@ out_close_scan:
 out_free:
 	ocfs2_free(&buf);
 
-	if (!ret && ost->ost_duplicate_clusters)
+	if (!ret && ost->ost_duplicate_clusters) {
+		/* Cloning and deleting files changes quota usage */
+		ost->ost_qusage_stale = 1;
 		ret = ocfs2_pass1_dups(ost);
+	}
 
 	o2fsck_compute_resource_track(&rt, fs->fs_io);
 	o2fsck_print_resource_track("Pass 1", ost, &rt, fs->fs_io);
 	o2fsck_add_resource_track(&ost->ost_rt, &rt);
 
 out:
+	free_inode_visitors();
 	if (ost->ost_prog) {
 		tools_progress_stop(ost->ost_prog);
 		setlinebuf(stdout);
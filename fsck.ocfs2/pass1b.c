@@ -518,35 +518,47 @@ static errcode_t process_one_bucket_list(struct process_extents_context *pc,
 					 struct ocfs2_extent_rec *rec)
 {
 	int i;
-	errcode_t ret;
-	char *bucket;
+	errcode_t ret, read_ret;
+	char *buckets, *bucket;
 	struct ocfs2_xattr_header *xh;
-	uint64_t blkno = ocfs2_clusters_to_blocks(pc->ost->ost_fs,
-						  rec->e_cpos);
-	int bucket_count = rec->e_leaf_clusters *
-		ocfs2_xattr_buckets_per_cluster(pc->ost->ost_fs);
-
-	ret = ocfs2_malloc_blocks(pc->ost->ost_fs->fs_io,
-				  ocfs2_blocks_per_xattr_bucket(pc->ost->ost_fs),
-				  &bucket);
+	ocfs2_filesys *fs = pc->ost->ost_fs;
+	uint64_t blkno = rec->e_blkno;
+	uint32_t nr_read = rec->e_leaf_clusters *
+		ocfs2_xattr_buckets_per_cluster(fs);
+	int bucket_count = nr_read;
+
+	ret = ocfs2_malloc_blocks(fs->fs_io,
+				  nr_read * ocfs2_blocks_per_xattr_bucket(fs),
+				  &buckets);
 	if (ret) {
 		com_err(whoami, ret,
 			"while allocating an xattr bucket buffer");
 		return ret;
 	}
 
-	xh = (struct ocfs2_xattr_header *)bucket;
+	/* The whole run comes in with one read */
+	read_ret = ocfs2_read_xattr_buckets(fs, blkno, &nr_read, buckets);
+
+	/*
+	 * nr_read buckets came in before any error.  Those get processed,
+	 * and the error only matters if we need a bucket past them.
+	 */
+	ret = 0;
+	bucket = buckets;
 	for (i = 0; i < bucket_count; i++) {
-		ret = ocfs2_read_xattr_bucket(pc->ost->ost_fs,
-					      blkno, bucket);
-		if (ret) {
-			com_err(whoami, ret,
-				"while reading the xattr bucket at "
-				"%"PRIu64" on inode %"PRIu64,
-				blkno, (uint64_t)pc->di->i_blkno);
+		/* A bad first bucket may claim more than the run holds */
+		if (i == nr_read) {
+			if (read_ret) {
+				com_err(whoami, read_ret,
+					"while reading the xattr bucket at "
+					"%"PRIu64" on inode %"PRIu64,
+					blkno, (uint64_t)pc->di->i_blkno);
+				ret = read_ret;
+			}
 			break;
 		}
 
+		xh = (struct ocfs2_xattr_header *)bucket;
 		if (!i)
 			bucket_count = xh->xh_num_buckets;
 
@@ -554,10 +566,11 @@ static errcode_t process_one_bucket_list(struct process_extents_context *pc,
 		if (ret)
 			break;
 
-		blkno += ocfs2_blocks_per_xattr_bucket(pc->ost->ost_fs);
+		blkno += ocfs2_blocks_per_xattr_bucket(fs);
+		bucket += OCFS2_XATTR_BUCKET_SIZE;
 	}
 
-	ocfs2_free(&bucket);
+	ocfs2_free(&buckets);
 	return ret;
 }
 
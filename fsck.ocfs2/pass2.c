@@ -571,7 +571,7 @@ static errcode_t fix_dirent_dups(o2fsck_state *ost,
 
 	/* start over every N bytes of dirent */
 	if (o2fsck_strings_bytes_allocated(strings) > (4 * 1024 * 1024))
-		o2fsck_strings_free(strings);
+		o2fsck_strings_reset(strings);
 
 	ret = o2fsck_strings_insert(strings, dirent->name, dirent->name_len, 
 				    &was_set);
@@ -726,7 +726,7 @@ static unsigned pass2_dir_block_iterate(o2fsck_dirblock_entry *dbe,
 	}
 
 	if (dbe->e_ino != dd->last_ino) {
-		o2fsck_strings_free(&dd->strings);
+		o2fsck_strings_reset(&dd->strings);
 		dd->last_ino = dbe->e_ino;
 
 		ret = ocfs2_read_inode(dd->ost->ost_fs, dbe->e_ino,
@@ -955,11 +955,11 @@ out:
 static void release_re_idx_dirs_rbtree(struct rb_root * root)
 {
 	struct rb_node *node;
-	o2fsck_dirblock_entry *dp;
+	o2fsck_reidx_dir *dp;
 
 	while ((node = rb_first(root)) != NULL) {
-		dp = rb_entry(node, o2fsck_dirblock_entry, e_node);
-		rb_erase(&dp->e_node, root);
+		dp = rb_entry(node, o2fsck_reidx_dir, r_node);
+		rb_erase(&dp->r_node, root);
 		ocfs2_free(&dp);
 	}
 }
@@ -1022,6 +1022,8 @@ errcode_t o2fsck_pass2(o2fsck_state *ost)
 		dp->dp_dirent = ost->ost_fs->fs_sysdir_blkno;
 
 	o2fsck_dir_block_iterate(ost, pass2_dir_block_iterate, &dd);
+	/* Nobody walks the directory blocks after us */
+	o2fsck_free_dir_blocks(&ost->ost_dirblocks);
 
 	if (dd.re_idx_dirs.rb_node) {
 		ret = o2fsck_rebuild_indexed_dirs(ost->ost_fs, &dd.re_idx_dirs);
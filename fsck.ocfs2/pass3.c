@@ -24,7 +24,8 @@
  * the root and system directories in the filesystem as connected.  It then
  * iterates through the directories found in pass 1.  For each directory
  * it ascends to the root of the file system via the chain of parent dir
- * entries as built up by pass 2.  If a directory is found which doesn't have
+ * entries as built up by pass 2, using a flat index of the parents built at
+ * the start of the pass.  If a directory is found which doesn't have
  * a parent it is connected to lost+found.  connect_directory() is careful
  * to stop before following a parent that it has already seen.  This lets it
  * connect to lost+found instead and break cycles.
@@ -37,6 +38,7 @@
 
 #include "dirparents.h"
 #include "fsck.h"
+#include "mem.h"
 #include "pass2.h"
 #include "pass3.h"
 #include "problem.h"
@@ -74,6 +76,9 @@ static void check_root(o2fsck_state *ost)
 		return;
 	}
 
+	/* pass 5 has to count the new directory */
+	ost->ost_qusage_stale = 1;
+
 	ret = ocfs2_init_dir(ost->ost_fs, blkno, blkno);
 	if (ret) {
 		com_err(whoami, ret, "while trying to expand a new root "
@@ -141,6 +146,8 @@ static void check_lostfound(o2fsck_state *ost)
 		return;
 	}
 
+	ost->ost_qusage_stale = 1;
+
 	ret = ocfs2_init_dir(ost->ost_fs, blkno, ost->ost_fs->fs_root_blkno);
 	if (ret) {
 		com_err(whoami, ret, "while trying to expand a new "
@@ -281,6 +288,9 @@ void o2fsck_reconnect_file(o2fsck_state *ost, uint64_t inode)
 	if (ret)
 		goto out;
 
+	/* lost+found may have to grow */
+	ost->ost_qusage_stale = 1;
+
 	ret = ocfs2_link(ost->ost_fs, ost->ost_lostfound_ino, iname, inode,
 			 type);
 	if (ret) {
@@ -310,12 +320,99 @@ out:
 	return;
 }
 
+/*
+ * A flat copy of the dir parents tree for the connectivity walk.  Each
+ * directory's parent is resolved to an index once, up front, so walking
+ * up a chain of parents is array indexing rather than a tree search per
+ * step.
+ */
+#define DIR_NO_PARENT		((uint64_t)-1)	/* dp_dirent is 0 */
+#define DIR_PARENT_MISSING	((uint64_t)-2)	/* dp_dirent isn't a dir */
+
+struct dir_node {
+	o2fsck_dir_parent	*dn_dp;
+	uint64_t		dn_parent;	/* index, or one of the above */
+	uint64_t		dn_loop_no;
+};
+
+struct dir_index {
+	struct dir_node		*di_nodes;
+	uint64_t		di_count;
+};
+
+/* di_nodes is sorted by dp_ino, because the tree is */
+static uint64_t dir_index_find(struct dir_index *idx, uint64_t ino)
+{
+	uint64_t lo = 0, hi = idx->di_count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (idx->di_nodes[mid].dn_dp->dp_ino < ino)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if ((lo < idx->di_count) && (idx->di_nodes[lo].dn_dp->dp_ino == ino))
+		return lo;
+	return DIR_PARENT_MISSING;
+}
+
+static size_t dir_index_size(struct dir_index *idx)
+{
+	return idx->di_count * sizeof(struct dir_node);
+}
+
+static errcode_t dir_index_build(o2fsck_state *ost, struct dir_index *idx)
+{
+	o2fsck_dir_parent *dp;
+	struct dir_node *dn;
+	uint64_t i;
+	errcode_t ret;
+
+	idx->di_nodes = NULL;
+	idx->di_count = 0;
+	for (dp = o2fsck_dir_parent_first(&ost->ost_dir_parents);
+	     dp; dp = o2fsck_dir_parent_next(dp))
+		idx->di_count++;
+	if (!idx->di_count)
+		return 0;
+
+	ret = o2fsck_mem_alloc0(O2FSCK_MEM_DIR_PARENTS, dir_index_size(idx),
+				&idx->di_nodes);
+	if (ret)
+		return ret;
+
+	i = 0;
+	for (dp = o2fsck_dir_parent_first(&ost->ost_dir_parents);
+	     dp; dp = o2fsck_dir_parent_next(dp))
+		idx->di_nodes[i++].dn_dp = dp;
+
+	for (i = 0; i < idx->di_count; i++) {
+		dn = &idx->di_nodes[i];
+		if (dn->dn_dp->dp_dirent)
+			dn->dn_parent = dir_index_find(idx,
+						       dn->dn_dp->dp_dirent);
+		else
+			dn->dn_parent = DIR_NO_PARENT;
+	}
+
+	return 0;
+}
+
+static void dir_index_free(struct dir_index *idx)
+{
+	o2fsck_mem_free(O2FSCK_MEM_DIR_PARENTS, dir_index_size(idx),
+			&idx->di_nodes);
+}
+
 static uint64_t loop_no = 0;
 
 static errcode_t connect_directory(o2fsck_state *ost,
-				   o2fsck_dir_parent *dir)
+				   struct dir_index *idx, uint64_t i)
 {
-	o2fsck_dir_parent *dp = dir, *par;
+	o2fsck_dir_parent *dir = idx->di_nodes[i].dn_dp, *dp = dir;
+	struct dir_node *dn = &idx->di_nodes[i], *par;
 	errcode_t ret = 0;
 	int fix;
 
@@ -333,18 +430,18 @@ static errcode_t connect_directory(o2fsck_state *ost,
 
 		/* move on to the parent dir only if it exists and we haven't
 		 * already traversed it in this instance of parent walking */
-		if (dp->dp_dirent) {
-			par = o2fsck_dir_parent_lookup(&ost->ost_dir_parents, 
-							dp->dp_dirent);
-			if (par == NULL) {
+		if (dn->dn_parent != DIR_NO_PARENT) {
+			if (dn->dn_parent == DIR_PARENT_MISSING) {
 				ret = OCFS2_ET_INTERNAL_FAILURE;
 				com_err(whoami, ret, "no dir info for parent "
 					"%"PRIu64, dp->dp_dirent);
 				goto out;
 			}
-			if (par->dp_loop_no != loop_no) {
-				par->dp_loop_no = loop_no;
-				dp = par;
+			par = &idx->di_nodes[dn->dn_parent];
+			if (par->dn_loop_no != loop_no) {
+				par->dn_loop_no = loop_no;
+				dn = par;
+				dp = par->dn_dp;
 				continue;
 			}
 		}
@@ -356,8 +453,11 @@ static errcode_t connect_directory(o2fsck_state *ost,
 			     "Directory inode %"PRIu64" isn't "
 			     "connected to the filesystem.  Move it to "
 			     "lost+found?", dp->dp_ino);
-		if (fix)
+		if (fix) {
 			o2fsck_reconnect_file(ost, dp->dp_ino);
+			/* keep the index in step with dp_dirent */
+			dn->dn_parent = dir_index_find(idx, dp->dp_dirent);
+		}
 
 		break;
 	}
@@ -396,6 +496,8 @@ out:
 errcode_t o2fsck_pass3(o2fsck_state *ost)
 {
 	o2fsck_dir_parent *dp;
+	struct dir_index idx;
+	uint64_t i;
 	errcode_t ret = 0;
 	ocfs2_filesys *fs = ost->ost_fs;
 	struct o2fsck_resource_track rt;
@@ -431,13 +533,21 @@ errcode_t o2fsck_pass3(o2fsck_state *ost)
 	}
 	dp->dp_connected = 1;
 
-	for(dp = o2fsck_dir_parent_first(&ost->ost_dir_parents) ;
-	    dp; dp = o2fsck_dir_parent_next(dp)) {
+	ret = dir_index_build(ost, &idx);
+	if (ret) {
+		com_err(whoami, ret, "while indexing the directory parents");
+		goto out;
+	}
+
+	for (i = 0; i < idx.di_count; i++) {
 		/* XXX hmm, make sure dir->ino is in the dir map? */
-		ret = connect_directory(ost, dp);
+		ret = connect_directory(ost, &idx, i);
 		if (ret)
-			goto out;
+			break;
 	}
+	dir_index_free(&idx);
+	if (ret)
+		goto out;
 
 	o2fsck_compute_resource_track(&rt, fs->fs_io);
 	o2fsck_print_resource_track("Pass 3", ost, &rt, fs->fs_io);
@@ -35,6 +35,7 @@
 #include "icount.h"
 #include "pass3.h"
 #include "pass4.h"
+#include "pass5.h"
 #include "problem.h"
 #include "util.h"
 
@@ -45,27 +46,26 @@ struct orphan_dir_ctxt {
 
 static const char *whoami = "pass4";
 
-static void check_link_counts(o2fsck_state *ost,
-			      struct ocfs2_dinode *di,
-			      uint64_t blkno)
+/* Mismatched inodes are read ahead this many at a time */
+#define NUM_LINK_BATCH		256
+
+struct link_count_batch {
+	uint64_t		lb_blknos[NUM_LINK_BATCH];
+	int			lb_count;
+	char			*lb_buf;	/* NUM_LINK_BATCH blocks */
+	struct io_vec_unit	*lb_ivus;
+};
+
+static void fix_link_count(o2fsck_state *ost, struct ocfs2_dinode *di,
+			   uint64_t blkno)
 {
 	uint16_t refs, in_inode;
 	errcode_t ret;
 
+	/* Reconnecting later inodes may have changed these since */
 	refs = o2fsck_icount_get(ost->ost_icount_refs, blkno);
 	in_inode = o2fsck_icount_get(ost->ost_icount_in_inodes, blkno);
 
-	verbosef("ino %"PRIu64", refs %u in %u\n", blkno, refs, in_inode);
-
-	/* XXX offer to remove files/dirs with no data? */
-	if (refs == 0 &&
-	    prompt(ost, PY, PR_INODE_NOT_CONNECTED,
-		   "Inode %"PRIu64" isn't referenced by any "
-		   "directory entries.  Move it to lost+found?", blkno)) {
-		o2fsck_reconnect_file(ost, blkno);
-		refs = o2fsck_icount_get(ost->ost_icount_refs, blkno);
-	}
-
 	if (refs == in_inode)
 		goto out;
 
@@ -100,6 +100,68 @@ out:
 	return;
 }
 
+/*
+ * The batch is in blkno order, so runs of adjacent inodes are read into
+ * the cache with one request before we look at them one by one.
+ */
+static void flush_link_count_batch(o2fsck_state *ost,
+				   struct ocfs2_dinode *di,
+				   struct link_count_batch *lb)
+{
+	ocfs2_filesys *fs = ost->ost_fs;
+	uint64_t prev = 0;
+	int i, count = 0;
+
+	for (i = 0; i < lb->lb_count; i++) {
+		if (count && (lb->lb_blknos[i] == prev + 1)) {
+			lb->lb_ivus[count - 1].ivu_buflen += fs->fs_blocksize;
+		} else {
+			lb->lb_ivus[count].ivu_blkno = lb->lb_blknos[i];
+			lb->lb_ivus[count].ivu_buf = lb->lb_buf +
+				(uint64_t)i * fs->fs_blocksize;
+			lb->lb_ivus[count].ivu_buflen = fs->fs_blocksize;
+			count++;
+		}
+		prev = lb->lb_blknos[i];
+	}
+
+	if (count)
+		io_vec_read_blocks(fs->fs_io, lb->lb_ivus, count);
+
+	for (i = 0; i < lb->lb_count; i++)
+		fix_link_count(ost, di, lb->lb_blknos[i]);
+	lb->lb_count = 0;
+}
+
+/* Returns 1 if the inode was moved to lost+found */
+static int check_link_counts(o2fsck_state *ost,
+			     struct ocfs2_dinode *di,
+			     uint64_t blkno, uint16_t refs, uint16_t in_inode,
+			     struct link_count_batch *lb)
+{
+	int reconnected = 0;
+
+	verbosef("ino %"PRIu64", refs %u in %u\n", blkno, refs, in_inode);
+
+	/* XXX offer to remove files/dirs with no data? */
+	if (refs == 0 &&
+	    prompt(ost, PY, PR_INODE_NOT_CONNECTED,
+		   "Inode %"PRIu64" isn't referenced by any "
+		   "directory entries.  Move it to lost+found?", blkno)) {
+		o2fsck_reconnect_file(ost, blkno);
+		refs = o2fsck_icount_get(ost->ost_icount_refs, blkno);
+		reconnected = 1;
+	}
+
+	if (refs != in_inode) {
+		lb->lb_blknos[lb->lb_count++] = blkno;
+		if (lb->lb_count == NUM_LINK_BATCH)
+			flush_link_count_batch(ost, di, lb);
+	}
+
+	return reconnected;
+}
+
 static int replay_orphan_iterate(struct ocfs2_dir_entry *dirent,
 				 uint64_t blocknr,
 				 int	offset,
@@ -130,10 +192,13 @@ static int replay_orphan_iterate(struct ocfs2_dir_entry *dirent,
 			goto out;
 	}
 
+	o2fsck_quota_drop_inode(ost, dirent->inode);
+
 	ret = ocfs2_truncate(ost->ost_fs, dirent->inode, 0);
 	if (ret) {
 		com_err(whoami, ret, "while truncating orphan inode %"PRIu64,
 			(uint64_t)dirent->inode);
+		ost->ost_qusage_stale = 1;
 		ret_flags |= OCFS2_DIRENT_ABORT;
 		goto out;
 	}
@@ -142,6 +207,7 @@ static int replay_orphan_iterate(struct ocfs2_dir_entry *dirent,
 	if (ret) {
 		com_err(whoami, ret, "while deleting orphan inode %"PRIu64
 			"after truncating it", (uint64_t)dirent->inode);
+		ost->ost_qusage_stale = 1;
 		ret_flags |= OCFS2_DIRENT_ABORT;
 		goto out;
 	}
@@ -279,28 +345,24 @@ out:
 
 /* return the next inode that has either directory entries pointing to it or
  * that was valid and had a non-zero i_links_count.  OCFS2_ET_BIT_NOT_FOUND
- * will be bubbled up from the next_blkno() calls when there is no such next
- * inode.  It is expected that sometimes these won't match.  If a directory
- * has been lost there can be inodes with i_links_count and no directory
- * entries at all.  If an inode was lost but the user chose not to erase
- * the directory entries then there may be references to inodes that
- * we never saw the i_links_count for */
-static errcode_t next_inode_any_ref(o2fsck_state *ost, uint64_t start,
+ * is returned when there is no such next inode.  It is expected that
+ * sometimes these won't match.  If a directory has been lost there can be
+ * inodes with i_links_count and no directory entries at all.  If an inode
+ * was lost but the user chose not to erase the directory entries then
+ * there may be references to inodes that we never saw the i_links_count
+ * for */
+static errcode_t next_inode_any_ref(o2fsck_icount_cursor *refs_cu,
+				    o2fsck_icount_cursor *in_cu,
 				    uint64_t *blkno_ret)
 {
-	errcode_t tmp, ret = OCFS2_ET_BIT_NOT_FOUND;
+	errcode_t ret;
 	uint64_t blkno;
 
-	tmp = o2fsck_icount_next_blkno(ost->ost_icount_refs, start, &blkno);
-	if (tmp == 0) {
-		*blkno_ret = blkno;
-		ret = 0;
-	}
+	ret = o2fsck_icount_cursor_peek(refs_cu, blkno_ret);
 
-	tmp = o2fsck_icount_next_blkno(ost->ost_icount_in_inodes, start,
-				       &blkno);
 	/* use this if we didn't have one yet or this one's lesser */
-	if (tmp == 0 && (ret != 0 || (blkno < *blkno_ret))) {
+	if (o2fsck_icount_cursor_peek(in_cu, &blkno) == 0 &&
+	    (ret != 0 || (blkno < *blkno_ret))) {
 		ret = 0;
 		*blkno_ret = blkno;
 	}
@@ -313,9 +375,14 @@ errcode_t o2fsck_pass4(o2fsck_state *ost)
 	struct ocfs2_dinode *di;
 	char *buf = NULL;
 	errcode_t ret;
-	uint64_t blkno = 0, start;
+	uint64_t blkno = 0;
+	uint16_t refs, in_inode;
 	ocfs2_filesys *fs = ost->ost_fs;
 	struct o2fsck_resource_track rt;
+	struct link_count_batch lb;
+	o2fsck_icount_cursor refs_cu, in_cu;
+
+	memset(&lb, 0, sizeof(lb));
 
 	printf("Pass 4a: Checking for orphaned inodes\n");
 
@@ -337,24 +404,55 @@ errcode_t o2fsck_pass4(o2fsck_state *ost)
 	o2fsck_init_resource_track(&rt, fs->fs_io);
 
 	ret = ocfs2_malloc_block(ost->ost_fs->fs_io, &buf);
+	if (!ret)
+		ret = ocfs2_malloc_blocks(fs->fs_io, NUM_LINK_BATCH,
+					  &lb.lb_buf);
+	if (!ret)
+		ret = ocfs2_malloc0(sizeof(struct io_vec_unit) *
+				    NUM_LINK_BATCH, &lb.lb_ivus);
 	if (ret) {
 		com_err(whoami, ret, "while allocating space to read inodes");
 		goto out;
 	}
 
 	di = (struct ocfs2_dinode *)buf;
-	start = 0;
 
-	while (next_inode_any_ref(ost, start, &blkno) == 0) {
-		check_link_counts(ost, di, blkno);
-		start = blkno + 1;
+	/*
+	 * Both counts are walked side by side in blkno order, so every
+	 * inode costs a step of each cursor instead of a search of both
+	 * icounts.  Only inodes whose counts disagree are read from disk.
+	 */
+	o2fsck_icount_cursor_seek(&refs_cu, ost->ost_icount_refs, 0);
+	o2fsck_icount_cursor_seek(&in_cu, ost->ost_icount_in_inodes, 0);
+
+	while (next_inode_any_ref(&refs_cu, &in_cu, &blkno) == 0) {
+		refs = o2fsck_icount_cursor_take(&refs_cu, blkno);
+		in_inode = o2fsck_icount_cursor_take(&in_cu, blkno);
+
+		/*
+		 * Reconnecting can add references to lost+found, or create
+		 * it, past the cursors.
+		 */
+		if (check_link_counts(ost, di, blkno, refs, in_inode, &lb)) {
+			o2fsck_icount_cursor_seek(&refs_cu,
+						  ost->ost_icount_refs,
+						  blkno + 1);
+			o2fsck_icount_cursor_seek(&in_cu,
+						  ost->ost_icount_in_inodes,
+						  blkno + 1);
+		}
 	}
+	flush_link_count_batch(ost, di, &lb);
 
 	o2fsck_compute_resource_track(&rt, fs->fs_io);
 	o2fsck_print_resource_track("Pass 4b", ost, &rt, fs->fs_io);
 	o2fsck_add_resource_track(&ost->ost_rt, &rt);
 
 out:
+	if (lb.lb_ivus)
+		ocfs2_free(&lb.lb_ivus);
+	if (lb.lb_buf)
+		ocfs2_free(&lb.lb_buf);
 	if (buf)
 		ocfs2_free(&buf);
 
@@ -20,8 +20,14 @@
  * --
  * Pass 5 tries to read as much data as possible from the global quota file.
  * (we are interested mainly in limits for users and groups). After that we
- * scan the filesystem and recompute quota usage for each user / group and
- * finally we dump all the information into freshly created quota files.
+ * take the quota usage for each user / group that pass 1 summed up while it
+ * was scanning the inodes and finally we dump all the information into
+ * freshly created quota files.
+ *
+ * Passes after pass 1 seldom change what an inode is charged.  Pass 4
+ * tells us about the orphans it deletes.  Anything rarer, like cloning
+ * files in pass 1b or creating lost+found, sets ost_qusage_stale and we
+ * fall back to scanning all the inodes again.
  *
  * At this pass, filesystem should be already sound, so we use libocfs2
  * functions for low-level operations.
@@ -38,6 +44,7 @@
 #include "ocfs2/byteorder.h"
 
 #include "fsck.h"
+#include "pass1.h"
 #include "pass5.h"
 #include "problem.h"
 #include "strings.h"
@@ -63,6 +70,186 @@ static errcode_t o2fsck_release_dquot(ocfs2_cached_dquot *dquot, void *p)
 	return 0;
 }
 
+/* Same rules as ocfs2_compute_quota_usage() */
+static int inode_has_quota(ocfs2_filesys *fs, uint64_t blkno,
+			   struct ocfs2_dinode *di)
+{
+	if (di->i_fs_generation != fs->fs_super->i_fs_generation)
+		return 0;
+	if (!(di->i_flags & OCFS2_VALID_FL))
+		return 0;
+	if (di->i_flags & OCFS2_SYSTEM_FL &&
+	    blkno != OCFS2_RAW_SB(fs->fs_super)->s_root_blkno)
+		return 0;
+	return 1;
+}
+
+static errcode_t quota_visit_inode(o2fsck_state *ost, uint64_t blkno,
+				   struct ocfs2_dinode *di, void *priv_data)
+{
+	ocfs2_filesys *fs = ost->ost_fs;
+	ocfs2_cached_dquot *dquot;
+	qid_t ids[MAXQUOTAS] = { [USRQUOTA] = di->i_uid,
+				 [GRPQUOTA] = di->i_gid };
+	errcode_t ret;
+	int type;
+
+	if (!inode_has_quota(fs, blkno, di))
+		return 0;
+
+	for (type = 0; type < MAXQUOTAS; type++) {
+		if (!ost->ost_qusage[type])
+			continue;
+		ret = ocfs2_find_create_quota_hash(ost->ost_qusage[type],
+						   ids[type], &dquot);
+		if (ret) {
+			com_err(whoami, ret, "while summing up %s quota usage",
+				type2name(type));
+			return ret;
+		}
+		dquot->d_ddquot.dqb_curspace +=
+			ocfs2_clusters_to_bytes(fs, di->i_clusters);
+		dquot->d_ddquot.dqb_curinodes++;
+	}
+
+	return 0;
+}
+
+errcode_t o2fsck_init_quota_usage(o2fsck_state *ost)
+{
+	struct ocfs2_super_block *super = OCFS2_RAW_SB(ost->ost_fs->fs_super);
+	errcode_t ret;
+
+	if (OCFS2_HAS_RO_COMPAT_FEATURE(super,
+				OCFS2_FEATURE_RO_COMPAT_USRQUOTA)) {
+		ret = ocfs2_new_quota_hash(ost->ost_qusage + USRQUOTA);
+		if (ret) {
+			com_err(whoami, ret,
+				"while allocating user quota usage hash");
+			return ret;
+		}
+	}
+	if (OCFS2_HAS_RO_COMPAT_FEATURE(super,
+				OCFS2_FEATURE_RO_COMPAT_GRPQUOTA)) {
+		ret = ocfs2_new_quota_hash(ost->ost_qusage + GRPQUOTA);
+		if (ret) {
+			com_err(whoami, ret,
+				"while allocating group quota usage hash");
+			return ret;
+		}
+	}
+
+	if (!ost->ost_qusage[USRQUOTA] && !ost->ost_qusage[GRPQUOTA])
+		return 0;
+
+	return o2fsck_add_inode_visitor(quota_visit_inode, NULL);
+}
+
+/* Take back what pass 1 charged for an inode that is being deleted */
+void o2fsck_quota_drop_inode(o2fsck_state *ost, uint64_t blkno)
+{
+	ocfs2_filesys *fs = ost->ost_fs;
+	ocfs2_cached_dquot *dquot;
+	struct ocfs2_dinode *di;
+	char *buf = NULL;
+	qid_t id;
+	int type;
+	errcode_t ret;
+
+	if (ost->ost_qusage_stale ||
+	    (!ost->ost_qusage[USRQUOTA] && !ost->ost_qusage[GRPQUOTA]))
+		return;
+
+	ret = ocfs2_malloc_block(fs->fs_io, &buf);
+	if (!ret)
+		ret = ocfs2_read_inode(fs, blkno, buf);
+	if (ret)
+		goto out;
+
+	di = (struct ocfs2_dinode *)buf;
+	if (!inode_has_quota(fs, blkno, di))
+		goto out;
+
+	for (type = 0; type < MAXQUOTAS; type++) {
+		if (!ost->ost_qusage[type])
+			continue;
+		id = (type == USRQUOTA) ? di->i_uid : di->i_gid;
+		ret = ocfs2_find_quota_hash(ost->ost_qusage[type], id, &dquot);
+		if (!ret && !dquot)
+			ret = OCFS2_ET_INTERNAL_FAILURE;
+		if (ret)
+			goto out;
+		dquot->d_ddquot.dqb_curspace -=
+			ocfs2_clusters_to_bytes(fs, di->i_clusters);
+		dquot->d_ddquot.dqb_curinodes--;
+	}
+
+out:
+	if (ret) {
+		verbosef("can't uncharge inode %"PRIu64", rescanning "
+			 "in pass 5\n", blkno);
+		ost->ost_qusage_stale = 1;
+	}
+	if (buf)
+		ocfs2_free(&buf);
+}
+
+static errcode_t o2fsck_merge_dquot(ocfs2_cached_dquot *usage, void *p)
+{
+	ocfs2_quota_hash *hash = p;
+	ocfs2_cached_dquot *dquot;
+	errcode_t ret;
+
+	ret = ocfs2_find_create_quota_hash(hash, usage->d_ddquot.dqb_id,
+					   &dquot);
+	if (ret)
+		return ret;
+
+	dquot->d_ddquot.dqb_curspace += usage->d_ddquot.dqb_curspace;
+	dquot->d_ddquot.dqb_curinodes += usage->d_ddquot.dqb_curinodes;
+
+	return 0;
+}
+
+static errcode_t merge_quota_usage(o2fsck_state *ost)
+{
+	errcode_t ret;
+	int type;
+
+	if (ost->ost_qusage_stale) {
+		verbosef("quota usage changed after pass 1, %s\n",
+			 "rescanning inodes");
+		return ocfs2_compute_quota_usage(ost->ost_fs, qhash[USRQUOTA],
+						 qhash[GRPQUOTA]);
+	}
+
+	for (type = 0; type < MAXQUOTAS; type++) {
+		if (!qhash[type] || !ost->ost_qusage[type])
+			continue;
+		ret = ocfs2_iterate_quota_hash(ost->ost_qusage[type],
+					       o2fsck_merge_dquot, qhash[type]);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static void free_quota_usage(o2fsck_state *ost)
+{
+	int type;
+
+	for (type = 0; type < MAXQUOTAS; type++) {
+		if (!ost->ost_qusage[type])
+			continue;
+		ocfs2_iterate_quota_hash(ost->ost_qusage[type],
+					 o2fsck_release_dquot,
+					 ost->ost_qusage[type]);
+		ocfs2_free_quota_hash(ost->ost_qusage[type]);
+		ost->ost_qusage[type] = NULL;
+	}
+}
+
 static int check_blkref(uint32_t block, uint32_t maxblocks)
 {
 	if (block < QT_TREEOFF || block >= maxblocks)
@@ -495,7 +682,8 @@ errcode_t o2fsck_pass5(o2fsck_state *ost)
 		if (ret)
 			goto out;
 	}
-	ret = ocfs2_compute_quota_usage(fs, qhash[USRQUOTA], qhash[GRPQUOTA]);
+	ret = merge_quota_usage(ost);
+	free_quota_usage(ost);
 	if (ret) {
 		com_err(whoami, ret, "while computing quota usage");
 		goto out;
@@ -527,6 +715,7 @@ errcode_t o2fsck_pass5(o2fsck_state *ost)
 
 	return 0;
 out:
+	free_quota_usage(ost);
 	if (qhash[USRQUOTA]) {
 		ocfs2_iterate_quota_hash(qhash[USRQUOTA], o2fsck_release_dquot,
 					 qhash[USRQUOTA]);
@@ -0,0 +1,275 @@
+/* -*- mode: c; c-basic-offset: 8; -*-
+ * vim: noexpandtab sw=8 ts=8 sts=0:
+ *
+ * perf.c
+ *
+ * Copyright (C) 2026 Oracle.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * --
+ *
+ * Collects the resource tracks of each pass, plus finer grained timers
+ * and counters, and writes them out as JSON for --perf-report.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "ocfs2/ocfs2.h"
+
+#include "fsck.h"
+#include "mem.h"
+#include "perf.h"
+
+#define PERF_MAX_PASSES		16
+#define PERF_NAME_LEN		32
+
+struct perf_pass {
+	char				pp_name[PERF_NAME_LEN];
+	struct o2fsck_resource_track	pp_rt;
+	uint64_t			pp_cache_size;	/* at the end */
+	uint64_t			pp_timers[O2FSCK_PERF_NUM_TIMERS];
+	uint64_t			pp_counters[O2FSCK_PERF_NUM_COUNTERS];
+};
+
+static const char *perf_timer_names[O2FSCK_PERF_NUM_TIMERS] = {
+	[O2FSCK_PERF_INODE_SCAN]	= "inode_scan",
+	[O2FSCK_PERF_INODE_VERIFY]	= "inode_verify",
+	[O2FSCK_PERF_EXTENT_WALK]	= "extent_walk",
+	[O2FSCK_PERF_XATTR]		= "xattr",
+	[O2FSCK_PERF_DIR_READAHEAD]	= "dir_readahead",
+	[O2FSCK_PERF_DIR_VERIFY]	= "dir_verify",
+};
+
+static const char *perf_counter_names[O2FSCK_PERF_NUM_COUNTERS] = {
+	[O2FSCK_PERF_INODES]		= "inodes",
+	[O2FSCK_PERF_DIRBLOCKS]		= "dirblocks",
+};
+
+int o2fsck_perf_enabled;
+
+static char *perf_filename;
+static struct perf_pass perf_passes[PERF_MAX_PASSES];
+static int perf_num_passes;
+static struct perf_pass perf_total;
+static int perf_have_total;
+static uint64_t perf_cache_size;
+
+/* What the running pass has used so far, in nanoseconds */
+static uint64_t perf_timers[O2FSCK_PERF_NUM_TIMERS];
+static uint64_t perf_counters[O2FSCK_PERF_NUM_COUNTERS];
+
+errcode_t o2fsck_perf_init(const char *filename)
+{
+	perf_filename = strdup(filename);
+	if (!perf_filename)
+		return OCFS2_ET_NO_MEMORY;
+
+	o2fsck_perf_enabled = 1;
+	return 0;
+}
+
+uint64_t __o2fsck_perf_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void __o2fsck_perf_stop(enum o2fsck_perf_timer timer, uint64_t start)
+{
+	perf_timers[timer] += __o2fsck_perf_now() - start;
+}
+
+void __o2fsck_perf_count(enum o2fsck_perf_counter counter, uint64_t n)
+{
+	perf_counters[counter] += n;
+}
+
+void o2fsck_perf_add_pass(const char *name, struct o2fsck_resource_track *rt,
+			  io_channel *channel)
+{
+	struct perf_pass *pp;
+	int i, j;
+
+	if (!o2fsck_perf_enabled)
+		return;
+
+	perf_cache_size = io_get_cache_size(channel);
+
+	if (!name) {
+		pp = &perf_total;
+		perf_have_total = 1;
+	} else {
+		if (perf_num_passes == PERF_MAX_PASSES)
+			return;
+		pp = &perf_passes[perf_num_passes++];
+		snprintf(pp->pp_name, PERF_NAME_LEN, "%s", name);
+	}
+
+	pp->pp_rt = *rt;
+	pp->pp_cache_size = perf_cache_size;
+
+	if (!name) {
+		/* The total is the sum of what the passes were charged */
+		for (i = 0; i < perf_num_passes; i++) {
+			for (j = 0; j < O2FSCK_PERF_NUM_TIMERS; j++)
+				pp->pp_timers[j] += perf_passes[i].pp_timers[j];
+			for (j = 0; j < O2FSCK_PERF_NUM_COUNTERS; j++)
+				pp->pp_counters[j] +=
+					perf_passes[i].pp_counters[j];
+		}
+		return;
+	}
+
+	memcpy(pp->pp_timers, perf_timers, sizeof(perf_timers));
+	memcpy(pp->pp_counters, perf_counters, sizeof(perf_counters));
+	memset(perf_timers, 0, sizeof(perf_timers));
+	memset(perf_counters, 0, sizeof(perf_counters));
+}
+
+static void print_json_string(FILE *f, const char *str)
+{
+	fputc('"', f);
+	for (; *str; str++) {
+		if ((*str == '"') || (*str == '\\'))
+			fprintf(f, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			fprintf(f, "\\u%04x", *str);
+		else
+			fputc(*str, f);
+	}
+	fputc('"', f);
+}
+
+static inline double tv_secs(struct timeval *tv)
+{
+	return tv->tv_sec + ((double)tv->tv_usec / 1000000);
+}
+
+static void print_pass(FILE *f, struct perf_pass *pp, const char *indent)
+{
+	struct ocfs2_io_stats *io = &pp->pp_rt.rt_io_stats;
+	double real = tv_secs(&pp->pp_rt.rt_real_time);
+	uint64_t lookups = (uint64_t)io->is_cache_hits + io->is_cache_misses;
+	int i, first;
+
+	fprintf(f, "%s\"real_secs\": %.6f,\n", indent, real);
+	fprintf(f, "%s\"user_secs\": %.6f,\n", indent,
+		tv_secs(&pp->pp_rt.rt_user_time));
+	fprintf(f, "%s\"sys_secs\": %.6f,\n", indent,
+		tv_secs(&pp->pp_rt.rt_sys_time));
+	fprintf(f, "%s\"reads\": %"PRIu64",\n", indent, io->is_reads);
+	fprintf(f, "%s\"bytes_read\": %"PRIu64",\n", indent,
+		io->is_bytes_read);
+	fprintf(f, "%s\"writes\": %"PRIu64",\n", indent, io->is_writes);
+	fprintf(f, "%s\"bytes_written\": %"PRIu64",\n", indent,
+		io->is_bytes_written);
+	fprintf(f, "%s\"cache_hits\": %"PRIu32",\n", indent,
+		io->is_cache_hits);
+	fprintf(f, "%s\"cache_misses\": %"PRIu32",\n", indent,
+		io->is_cache_misses);
+	fprintf(f, "%s\"cache_hit_rate\": %.4f,\n", indent,
+		lookups ? (double)io->is_cache_hits / lookups : 0.0);
+	fprintf(f, "%s\"cache_size\": %"PRIu64",\n", indent,
+		pp->pp_cache_size);
+
+	for (i = 0; i < O2FSCK_PERF_NUM_COUNTERS; i++) {
+		if (!pp->pp_counters[i])
+			continue;
+		fprintf(f, "%s\"%s\": %"PRIu64",\n", indent,
+			perf_counter_names[i], pp->pp_counters[i]);
+		fprintf(f, "%s\"%s_per_sec\": %.1f,\n", indent,
+			perf_counter_names[i],
+			real > 0 ? pp->pp_counters[i] / real : 0.0);
+	}
+
+	fprintf(f, "%s\"subphase_secs\": {", indent);
+	for (i = 0, first = 1; i < O2FSCK_PERF_NUM_TIMERS; i++) {
+		if (!pp->pp_timers[i])
+			continue;
+		fprintf(f, "%s\n%s  \"%s\": %.6f", first ? "" : ",", indent,
+			perf_timer_names[i],
+			(double)pp->pp_timers[i] / 1000000000);
+		first = 0;
+	}
+	fprintf(f, "%s}\n", first ? "" : "\n");
+}
+
+void o2fsck_perf_write_report(o2fsck_state *ost, const char *device,
+			      int fsck_mask)
+{
+	ocfs2_filesys *fs = ost->ost_fs;
+	FILE *f;
+	int i;
+
+	if (!o2fsck_perf_enabled)
+		return;
+
+	f = fopen(perf_filename, "w");
+	if (!f) {
+		com_err("perf", errno, "while opening the report file %s",
+			perf_filename);
+		return;
+	}
+
+	fprintf(f, "{\n  \"version\": ");
+	print_json_string(f, VERSION);
+	fprintf(f, ",\n  \"device\": ");
+	print_json_string(f, device);
+	fprintf(f, ",\n  \"exit_status\": %d,\n", fsck_mask);
+	if (fs) {
+		fprintf(f, "  \"block_size\": %u,\n", fs->fs_blocksize);
+		fprintf(f, "  \"blocks\": %"PRIu64",\n", fs->fs_blocks);
+		fprintf(f, "  \"cluster_size\": %u,\n", fs->fs_clustersize);
+		fprintf(f, "  \"clusters\": %"PRIu32",\n", fs->fs_clusters);
+		fprintf(f, "  \"slots\": %u,\n",
+			OCFS2_RAW_SB(fs->fs_super)->s_max_slots);
+	}
+	fprintf(f, "  \"cache_size\": %"PRIu64",\n", perf_cache_size);
+
+	fprintf(f, "  \"passes\": [");
+	for (i = 0; i < perf_num_passes; i++) {
+		fprintf(f, "%s\n    {\n      \"name\": ", i ? "," : "");
+		print_json_string(f, perf_passes[i].pp_name);
+		fprintf(f, ",\n");
+		print_pass(f, &perf_passes[i], "      ");
+		fprintf(f, "    }");
+	}
+	fprintf(f, "%s],\n", perf_num_passes ? "\n  " : "");
+
+	if (perf_have_total) {
+		fprintf(f, "  \"total\": {\n");
+		print_pass(f, &perf_total, "    ");
+		fprintf(f, "  },\n");
+	}
+
+	fprintf(f, "  \"memory\": {\n");
+	fprintf(f, "    \"peak_rss\": %"PRIu64",\n", o2fsck_mem_peak_rss());
+	fprintf(f, "    \"limit\": %"PRIu64",\n", o2fsck_mem_limit());
+	fprintf(f, "    \"spilled\": %"PRIu64",\n", o2fsck_mem_spilled());
+	fprintf(f, "    \"peak_by_structure\": {");
+	for (i = 0; i < O2FSCK_MEM_NUM_TYPES; i++) {
+		fprintf(f, "%s\n      ", i ? "," : "");
+		print_json_string(f, o2fsck_mem_type_name(i));
+		fprintf(f, ": %"PRIu64, o2fsck_mem_peak(i));
+	}
+	fprintf(f, "\n    }\n  }\n}\n");
+
+	if (fclose(f))
+		com_err("perf", errno, "while writing the report file %s",
+			perf_filename);
+}
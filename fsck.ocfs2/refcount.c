@@ -27,6 +27,7 @@
 #include "extent.h"
 #include "util.h"
 #include "refcount.h"
+#include "mem.h"
 
 static const char *whoami = "refcount.c";
 
@@ -386,7 +387,8 @@ errcode_t o2fsck_check_refcount_tree(o2fsck_state *ost,
 	if (tree)
 		goto check_valid;
 
-	ret = ocfs2_malloc0(sizeof(struct refcount_tree), &tree);
+	ret = o2fsck_mem_alloc0(O2FSCK_MEM_REFCOUNT,
+				sizeof(struct refcount_tree), &tree);
 	if (ret)
 		return ret;
 
@@ -415,7 +417,8 @@ check_valid:
 
 		o2fsck_write_inode(ost, di->i_blkno, di);
 	} else {
-		ret = ocfs2_malloc0(sizeof(struct refcount_file), &file);
+		ret = o2fsck_mem_alloc0(O2FSCK_MEM_REFCOUNT,
+					sizeof(struct refcount_file), &file);
 		if (!ret) {
 			file->i_blkno = di->i_blkno;
 			INIT_LIST_HEAD(&file->list);
@@ -480,7 +483,8 @@ errcode_t o2fsck_mark_clusters_refcounted(o2fsck_state *ost,
 
 add_clusters:
 	ost->ost_latest_file = file;
-	ret = ocfs2_malloc0(sizeof(struct refcount_extent), &extent);
+	ret = o2fsck_mem_alloc0(O2FSCK_MEM_REFCOUNT,
+				sizeof(struct refcount_extent), &extent);
 	if (ret)
 		return ret;
 
@@ -583,7 +587,9 @@ static void remove_refcounted_extent(struct refcount_tree *tree,
 
 		if (cpos + clusters == extent->p_cpos + extent->clusters) {
 			rb_erase(&extent->ext_node, &file->ref_extents);
-			ocfs2_free(&extent);
+			o2fsck_mem_free(O2FSCK_MEM_REFCOUNT,
+					sizeof(struct refcount_extent),
+					&extent);
 		} else {
 			extent->clusters =
 				(extent->p_cpos + extent->clusters) -
@@ -1088,10 +1094,12 @@ errcode_t o2fsck_check_mark_refcounted_clusters(o2fsck_state *ost)
 			node = rb_first(&file->ref_extents);
 			assert(!node);
 			list_del(&file->list);
-			ocfs2_free(&file);
+			o2fsck_mem_free(O2FSCK_MEM_REFCOUNT,
+					sizeof(struct refcount_file), &file);
 		}
 		rb_erase(&tree->ref_node, &ost->ost_refcount_trees);
-		ocfs2_free(&tree);
+		o2fsck_mem_free(O2FSCK_MEM_REFCOUNT,
+				sizeof(struct refcount_tree), &tree);
 	}
 out:
 	return ret;
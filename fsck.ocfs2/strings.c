@@ -19,8 +19,12 @@
  *
  * --
  *
- * A light wrapper around rbtree to store strings with the sole purpose of
- * detecting dupliates.
+ * A set of strings with the sole purpose of detecting duplicates.
+ *
+ * The names are copied back to back into one arena and found through an
+ * open addressing table of slots.  Each slot carries the generation it was
+ * filled in, so o2fsck_strings_reset() just bumps the generation and
+ * rewinds the arena instead of visiting every entry.
  *
  */
 #include <unistd.h>
@@ -34,113 +38,196 @@
 #include "strings.h"
 #include "util.h"
 
-struct string_entry {
-	struct rb_node	s_node;
-	size_t		s_strlen;
-	char		s_string[0]; /* null terminated */
+struct string_slot {
+	uint32_t	ss_gen;		/* live if it matches s_gen */
+	uint32_t	ss_hash;
+	uint32_t	ss_off;		/* offset of the name in the arena */
+	uint32_t	ss_len;
 };
 
-/* I'm too lazy to share code with _insert right now */
-int o2fsck_strings_exists(o2fsck_strings *strings, char *string,
-			  size_t strlen)
-{	struct rb_node ** p = &strings->s_root.rb_node;
-	struct rb_node * parent = NULL;
-	struct string_entry *se;
-	int cmp;
-
-	while (*p)
-	{
-		parent = *p;
-		se = rb_entry(parent, struct string_entry, s_node);
-
-		/* we don't actually care about lexographical sorting */
-		cmp = strlen - se->s_strlen;
-		if (cmp == 0)
-			cmp = memcmp(string, se->s_string, strlen);
-
-		if (cmp < 0)
-			p = &(*p)->rb_left;
-		else if (cmp > 0)
-			p = &(*p)->rb_right;
-		else {
-			return 1;
-		}
+#define STRINGS_INITIAL_SLOTS	1024
+#define STRINGS_INITIAL_ARENA	(16 * 1024)
+
+/* FNV-1a; names are short and this only has to spread them */
+static uint32_t strings_hash(const char *string, size_t strlen)
+{
+	uint32_t hash = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < strlen; i++) {
+		hash ^= (unsigned char)string[i];
+		hash *= 16777619;
+	}
+	return hash;
+}
+
+static inline int slot_live(o2fsck_strings *strings, struct string_slot *ss)
+{
+	return ss->ss_gen == strings->s_gen;
+}
+
+/*
+ * Returns the slot holding the string, or the empty slot where it would
+ * go.
+ */
+static struct string_slot *strings_find(o2fsck_strings *strings,
+					const char *string, size_t strlen,
+					uint32_t hash)
+{
+	unsigned int mask = strings->s_nr_slots - 1;
+	unsigned int i = hash & mask;
+	struct string_slot *ss;
+
+	for (;;) {
+		ss = &strings->s_slots[i];
+		if (!slot_live(strings, ss))
+			return ss;
+		if ((ss->ss_hash == hash) && (ss->ss_len == strlen) &&
+		    !memcmp(strings->s_arena + ss->ss_off, string, strlen))
+			return ss;
+		i = (i + 1) & mask;
 	}
+}
+
+static errcode_t strings_grow_slots(o2fsck_strings *strings)
+{
+	struct string_slot *old = strings->s_slots, *ss;
+	unsigned int old_nr = strings->s_nr_slots, i, j, mask;
+	unsigned int nr = old_nr ? old_nr * 2 : STRINGS_INITIAL_SLOTS;
+	errcode_t ret;
+
+	ret = ocfs2_malloc0(sizeof(struct string_slot) * nr,
+			    &strings->s_slots);
+	if (ret) {
+		strings->s_slots = old;
+		return ret;
+	}
+	strings->s_nr_slots = nr;
+	mask = nr - 1;
+
+	/* The new table is all zero, so live slots need a non-zero gen */
+	for (i = 0; i < old_nr; i++) {
+		if (!slot_live(strings, &old[i]))
+			continue;
+		for (j = old[i].ss_hash & mask;
+		     strings->s_slots[j].ss_gen;
+		     j = (j + 1) & mask)
+			;
+		ss = &strings->s_slots[j];
+		*ss = old[i];
+	}
+
+	if (old)
+		ocfs2_free(&old);
+	return 0;
+}
+
+static errcode_t strings_grow_arena(o2fsck_strings *strings, size_t need)
+{
+	size_t size = strings->s_arena_size ? strings->s_arena_size :
+					      STRINGS_INITIAL_ARENA;
+	errcode_t ret;
+
+	while (size < strings->s_arena_used + need)
+		size *= 2;
+	if (size > UINT32_MAX)
+		return OCFS2_ET_NO_MEMORY;
+
+	ret = ocfs2_realloc(size, &strings->s_arena);
+	if (ret)
+		return ret;
+	strings->s_arena_size = size;
 	return 0;
 }
 
+int o2fsck_strings_exists(o2fsck_strings *strings, char *string,
+			  size_t strlen)
+{
+	struct string_slot *ss;
+
+	if (!strings->s_nr_slots)
+		return 0;
+
+	ss = strings_find(strings, string, strlen,
+			  strings_hash(string, strlen));
+	return slot_live(strings, ss);
+}
+
 errcode_t o2fsck_strings_insert(o2fsck_strings *strings, char *string,
 			   size_t strlen, int *is_dup)
 {
-	struct rb_node ** p = &strings->s_root.rb_node;
-	struct rb_node * parent = NULL;
-	struct string_entry *se;
-	size_t bytes;
-	int cmp;
+	struct string_slot *ss;
+	uint32_t hash = strings_hash(string, strlen);
+	errcode_t ret;
 
 	if (is_dup)
 		*is_dup = 0;
 
-	while (*p)
-	{
-		parent = *p;
-		se = rb_entry(parent, struct string_entry, s_node);
-
-		/* we don't actually care about lexographical sorting */
-		cmp = strlen - se->s_strlen;
-		if (cmp == 0)
-			cmp = memcmp(string, se->s_string, strlen);
-
-#if 0
-		printf("%.*s %s %.*s\n", (int)strlen, string, 
-			cmp < 0 ? "<" : (cmp > 0 ? ">" : "==" ),
-			(int)se->s_strlen, se->s_string);
-#endif
-
-		if (cmp < 0)
-			p = &(*p)->rb_left;
-		else if (cmp > 0)
-			p = &(*p)->rb_right;
-		else {
+	if (strings->s_nr_slots) {
+		ss = strings_find(strings, string, strlen, hash);
+		if (slot_live(strings, ss)) {
 			if (is_dup)
 				*is_dup = 1;
 			return 0;
 		}
 	}
 
-	bytes = offsetof(struct string_entry, s_string[strlen]);
-	se = malloc(bytes);
-	if (se == NULL)
-		return OCFS2_ET_NO_MEMORY;
+	/* Keep the table at most half full */
+	if ((strings->s_used + 1) * 2 > strings->s_nr_slots) {
+		ret = strings_grow_slots(strings);
+		if (ret)
+			return ret;
+	}
 
-	strings->s_allocated += bytes;
+	if (strings->s_arena_used + strlen > strings->s_arena_size) {
+		ret = strings_grow_arena(strings, strlen);
+		if (ret)
+			return ret;
+	}
 
-	se->s_strlen = strlen;
-	memcpy(se->s_string, string, strlen);
+	ss = strings_find(strings, string, strlen, hash);
+	ss->ss_gen = strings->s_gen;
+	ss->ss_hash = hash;
+	ss->ss_off = strings->s_arena_used;
+	ss->ss_len = strlen;
+	memcpy(strings->s_arena + ss->ss_off, string, strlen);
 
-	rb_link_node(&se->s_node, parent, p);
-	rb_insert_color(&se->s_node, &strings->s_root);
+	strings->s_arena_used += strlen;
+	strings->s_used++;
+	strings->s_allocated += sizeof(struct string_slot) + strlen;
 
 	return 0;
 }
 
 void o2fsck_strings_init(o2fsck_strings *strings)
 {
-	strings->s_root = RB_ROOT;
+	memset(strings, 0, sizeof(o2fsck_strings));
+	strings->s_gen = 1;
 }
 
-void o2fsck_strings_free(o2fsck_strings *strings)
+/* Forget every string but keep the memory for the next set */
+void o2fsck_strings_reset(o2fsck_strings *strings)
 {
-	struct string_entry *se;
-	struct rb_node *node;
+	strings->s_used = 0;
+	strings->s_arena_used = 0;
+	strings->s_allocated = 0;
 
-	while((node = rb_first(&strings->s_root)) != NULL) {
-		se = rb_entry(node, struct string_entry, s_node);
-		rb_erase(node, &strings->s_root);
-		free(se);
+	/* Slots from 2^32 resets ago would look live again */
+	if (++strings->s_gen == 0) {
+		if (strings->s_slots)
+			memset(strings->s_slots, 0, sizeof(struct string_slot) *
+			       strings->s_nr_slots);
+		strings->s_gen = 1;
 	}
+}
 
-	strings->s_allocated = 0;
+void o2fsck_strings_free(o2fsck_strings *strings)
+{
+	if (strings->s_slots)
+		ocfs2_free(&strings->s_slots);
+	if (strings->s_arena)
+		ocfs2_free(&strings->s_arena);
+	o2fsck_strings_init(strings);
 }
 
 size_t o2fsck_strings_bytes_allocated(o2fsck_strings *strings)
@@ -0,0 +1,524 @@
+/* -*- mode: c; c-basic-offset: 8; -*-
+ * vim: noexpandtab sw=8 ts=8 sts=0:
+ *
+ * subtree.c
+ *
+ * Copyright (C) 2026 Oracle.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * --
+ *
+ * --subtree and --inodes check part of a volume instead of all of it.
+ *
+ * The named inodes are checked the way pass 1 checks every inode: their
+ * fields, extent trees, extended attributes and refcount trees.  When one
+ * of them is a directory, its entries are walked and everything below it
+ * is checked too.  Along the way we make sure that each entry points at
+ * an allocated, valid inode of the type the entry claims, that '.' and
+ * '..' are right, that only one entry points at each directory, and that
+ * a directory's link count matches its subdirectories.
+ *
+ * We never see the whole volume, so nothing is rebuilt.  The clusters the
+ * subtree uses are checked against the on-disk global bitmap, and its
+ * inodes against the on-disk inode allocators.  A file with more links
+ * from inside the subtree than its link count is caught; one with fewer
+ * can't be, as the other links may be anywhere.  Refcounted extents are
+ * checked against their refcount tree's structure but not counted, for
+ * the same reason.  The check is always read-only.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include "ocfs2/ocfs2.h"
+
+#include "fsck.h"
+#include "icount.h"
+#include "pass1.h"
+#include "subtree.h"
+#include "util.h"
+
+static const char *whoami = "subtree";
+
+struct subtree_item {
+	uint64_t	si_blkno;
+	uint64_t	si_parent;	/* 0 if we don't know it */
+	uint8_t		si_file_type;	/* What its entry says it is */
+	int		si_walked;	/* A directory whose entries we read */
+	uint16_t	si_links;	/* Its link count, if walked */
+};
+
+struct subtree_state {
+	o2fsck_state		*ss_ost;
+	ocfs2_bitmap		*ss_seen;	/* Inodes already queued */
+	struct subtree_item	*ss_items;
+	uint64_t		ss_nr_items;
+	uint64_t		ss_max_items;
+	uint64_t		ss_problems;
+
+	/* Verified directories found under each directory */
+	o2fsck_icount		*ss_subdirs;
+
+	/* Filled in by the dirent walk of one directory */
+	uint64_t		ss_dir;
+	uint64_t		ss_parent;
+	errcode_t		ss_err;
+
+	uint64_t		ss_inodes;
+	uint64_t		ss_dirs;
+	uint64_t		ss_clusters;
+};
+
+/* What was asked for on the command line */
+static char **subtree_paths;
+static int subtree_nr_paths;
+static uint64_t *subtree_inodes;
+static int subtree_nr_inodes;
+
+errcode_t o2fsck_subtree_add_path(const char *path)
+{
+	errcode_t ret;
+
+	ret = ocfs2_realloc((subtree_nr_paths + 1) * sizeof(char *),
+			    &subtree_paths);
+	if (ret)
+		return ret;
+
+	subtree_paths[subtree_nr_paths++] = (char *)path;
+	return 0;
+}
+
+/* A list of inode numbers separated by commas */
+errcode_t o2fsck_subtree_add_inodes(const char *list)
+{
+	const char *p = list;
+	char *end;
+	uint64_t blkno;
+	errcode_t ret;
+
+	while (*p) {
+		blkno = strtoull(p, &end, 0);
+		if (end == p || !blkno || (*end && *end != ','))
+			return OCFS2_ET_INVALID_ARGUMENT;
+
+		ret = ocfs2_realloc((subtree_nr_inodes + 1) * sizeof(uint64_t),
+				    &subtree_inodes);
+		if (ret)
+			return ret;
+		subtree_inodes[subtree_nr_inodes++] = blkno;
+
+		p = *end ? end + 1 : end;
+	}
+
+	return 0;
+}
+
+int o2fsck_subtree_wanted(void)
+{
+	return subtree_nr_paths || subtree_nr_inodes;
+}
+
+static void subtree_problem(struct subtree_state *ss, const char *fmt, ...)
+	__attribute__ ((format (printf, 2, 3)));
+static void subtree_problem(struct subtree_state *ss, const char *fmt, ...)
+{
+	va_list ap;
+
+	printf("[SUBTREE] ");
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+
+	ss->ss_problems++;
+}
+
+static errcode_t queue_inode(struct subtree_state *ss, uint64_t blkno,
+			     uint64_t parent, uint8_t file_type)
+{
+	errcode_t ret;
+	int was_set;
+
+	ret = ocfs2_bitmap_set(ss->ss_seen, blkno, &was_set);
+	if (ret || was_set)
+		return ret;
+
+	if (ss->ss_nr_items == ss->ss_max_items) {
+		ss->ss_max_items = ss->ss_max_items ?
+			ss->ss_max_items * 2 : 1024;
+		ret = ocfs2_realloc(ss->ss_max_items *
+				    sizeof(struct subtree_item),
+				    &ss->ss_items);
+		if (ret)
+			return ret;
+	}
+
+	ss->ss_items[ss->ss_nr_items].si_blkno = blkno;
+	ss->ss_items[ss->ss_nr_items].si_parent = parent;
+	ss->ss_items[ss->ss_nr_items].si_file_type = file_type;
+	ss->ss_items[ss->ss_nr_items].si_walked = 0;
+	ss->ss_items[ss->ss_nr_items].si_links = 0;
+	ss->ss_nr_items++;
+
+	return 0;
+}
+
+static errcode_t queue_path(struct subtree_state *ss, const char *path)
+{
+	ocfs2_filesys *fs = ss->ss_ost->ost_fs;
+	uint64_t blkno, parent = 0;
+	char *dir, *slash;
+	errcode_t ret;
+
+	ret = ocfs2_namei(fs, fs->fs_root_blkno, fs->fs_root_blkno, path,
+			  &blkno);
+	if (ret) {
+		com_err(whoami, ret, "while looking up \"%s\"", path);
+		return ret;
+	}
+
+	/* The parent is whatever the path minus its last name is */
+	ret = ocfs2_malloc(strlen(path) + 2, &dir);
+	if (ret)
+		return ret;
+	strcpy(dir, path);
+	while ((slash = strrchr(dir, '/')) && !slash[1] && slash != dir)
+		*slash = '\0';
+	slash = strrchr(dir, '/');
+	if (blkno == fs->fs_root_blkno)
+		parent = blkno;
+	else if (slash) {
+		slash[1] = '\0';
+		if (ocfs2_namei(fs, fs->fs_root_blkno, fs->fs_root_blkno,
+				dir, &parent))
+			parent = 0;
+	} else
+		parent = fs->fs_root_blkno;
+	ocfs2_free(&dir);
+
+	verbosef("Checking \"%s\", inode %"PRIu64" in directory %"PRIu64"\n",
+		 path, blkno, parent);
+
+	return queue_inode(ss, blkno, parent, OCFS2_FT_UNKNOWN);
+}
+
+static int check_dirent(struct ocfs2_dir_entry *dirent, uint64_t blocknr,
+			int offset, int blocksize, char *buf, void *priv_data)
+{
+	struct subtree_state *ss = priv_data;
+	o2fsck_state *ost = ss->ss_ost;
+	ocfs2_filesys *fs = ost->ost_fs;
+	uint64_t ino = dirent->inode;
+
+	if (!ino)
+		return 0;
+
+	if (dirent->name_len == 1 && dirent->name[0] == '.') {
+		if (ino != ss->ss_dir)
+			subtree_problem(ss, "Directory %"PRIu64" has a '.' "
+					"entry pointing to %"PRIu64,
+					ss->ss_dir, ino);
+		return 0;
+	}
+
+	if (dirent->name_len == 2 && !strncmp(dirent->name, "..", 2)) {
+		if (ss->ss_parent && ino != ss->ss_parent)
+			subtree_problem(ss, "Directory %"PRIu64" has a '..' "
+					"entry pointing to %"PRIu64" but its "
+					"parent is %"PRIu64, ss->ss_dir, ino,
+					ss->ss_parent);
+		return 0;
+	}
+
+	if (ocfs2_block_out_of_range(fs, ino)) {
+		subtree_problem(ss, "Entry '%.*s' in directory %"PRIu64" "
+				"points to block %"PRIu64" which is out of "
+				"range", dirent->name_len, dirent->name,
+				ss->ss_dir, ino);
+		return 0;
+	}
+
+	o2fsck_icount_delta(ost->ost_icount_refs, ino, 1);
+
+	ss->ss_err = queue_inode(ss, ino, ss->ss_dir, dirent->file_type);
+	if (ss->ss_err)
+		return OCFS2_DIRENT_ABORT;
+
+	return 0;
+}
+
+/*
+ * Walk a directory's entries, queueing everything it points at.  Its
+ * link count is checked once its subdirectories have been read.
+ */
+static errcode_t check_dir(struct subtree_state *ss,
+			   struct subtree_item *si, struct ocfs2_dinode *di)
+{
+	errcode_t ret;
+
+	ss->ss_dir = si->si_blkno;
+	ss->ss_parent = si->si_parent;
+	ss->ss_err = 0;
+
+	ret = ocfs2_dir_iterate(ss->ss_ost->ost_fs, si->si_blkno, 0, NULL,
+				check_dirent, ss);
+	if (ss->ss_err)
+		return ss->ss_err;
+	if (ret) {
+		subtree_problem(ss, "Reading the entries of directory "
+				"%"PRIu64" failed: %s", si->si_blkno,
+				error_message(ret));
+		return 0;
+	}
+
+	si->si_walked = 1;
+	si->si_links = di->i_links_count;
+	return 0;
+}
+
+static errcode_t check_one(struct subtree_state *ss,
+			   struct subtree_item *si, char *buf)
+{
+	o2fsck_state *ost = ss->ss_ost;
+	ocfs2_filesys *fs = ost->ost_fs;
+	struct ocfs2_dinode *di = (struct ocfs2_dinode *)buf;
+	uint64_t blkno = si->si_blkno;
+	uint8_t file_type;
+	int allocated;
+	errcode_t ret;
+
+	ss->ss_inodes++;
+
+	if (ocfs2_block_out_of_range(fs, blkno)) {
+		subtree_problem(ss, "Inode %"PRIu64" is out of range", blkno);
+		return 0;
+	}
+
+	ret = ocfs2_read_inode(fs, blkno, buf);
+	if (ret) {
+		subtree_problem(ss, "Inode %"PRIu64" can't be read: %s",
+				blkno, error_message(ret));
+		return 0;
+	}
+
+	if (!(di->i_flags & OCFS2_VALID_FL)) {
+		subtree_problem(ss, "Inode %"PRIu64" is referenced but is "
+				"not in use", blkno);
+		return 0;
+	}
+
+	if (di->i_flags & OCFS2_SYSTEM_FL)
+		verbosef("Inode %"PRIu64" is a system file\n", blkno);
+
+	ret = ocfs2_test_inode_allocated(fs, blkno, &allocated);
+	if (ret)
+		subtree_problem(ss, "Can't find inode %"PRIu64" in the inode "
+				"allocators: %s", blkno, error_message(ret));
+	else if (!allocated)
+		subtree_problem(ss, "Inode %"PRIu64" is in use but is free in "
+				"its inode allocator", blkno);
+
+	ret = o2fsck_check_inode(ost, blkno, di);
+	if (ret)
+		return ret;
+
+	/* o2fsck_check_inode() said to clear it; we just say so */
+	if (!(di->i_flags & OCFS2_VALID_FL))
+		return 0;
+
+	file_type = ocfs2_type_by_mode[(di->i_mode & S_IFMT) >> S_SHIFT];
+	if (si->si_file_type != OCFS2_FT_UNKNOWN &&
+	    si->si_file_type != file_type)
+		subtree_problem(ss, "Entry for inode %"PRIu64" in directory "
+				"%"PRIu64" says it is of type %u but its mode "
+				"makes it type %u", blkno, si->si_parent,
+				si->si_file_type, file_type);
+
+	if (!S_ISDIR(di->i_mode))
+		return 0;
+
+	/* The root is queued as its own parent, not its own subdir */
+	if (si->si_parent && si->si_parent != si->si_blkno)
+		o2fsck_icount_delta(ss->ss_subdirs, si->si_parent, 1);
+
+	ss->ss_dirs++;
+	return check_dir(ss, si, di);
+}
+
+/*
+ * No more links inside the subtree than the inode's link count, and
+ * only one entry for a directory.  A directory we walked must have a
+ * link for each of its subdirectories, plus '.' and its own entry.
+ */
+static void check_link_counts(struct subtree_state *ss)
+{
+	o2fsck_state *ost = ss->ss_ost;
+	struct subtree_item *si;
+	uint64_t blkno = 0;
+	uint16_t refs, links, subdirs;
+	uint64_t i;
+	int is_dir;
+
+	while (!ocfs2_bitmap_find_next_set(ss->ss_seen, blkno, &blkno)) {
+		ocfs2_bitmap_test(ost->ost_dir_inodes, blkno, &is_dir);
+		refs = o2fsck_icount_get(ost->ost_icount_refs, blkno);
+		links = o2fsck_icount_get(ost->ost_icount_in_inodes, blkno);
+		if (is_dir && refs > 1)
+			subtree_problem(ss, "Directory %"PRIu64" has %u "
+					"entries in the subtree pointing to "
+					"it", blkno, refs);
+		else if (!is_dir && links && refs > links)
+			subtree_problem(ss, "Inode %"PRIu64" has a link count "
+					"of %u but %u entries in the subtree "
+					"point to it", blkno, links, refs);
+		blkno++;
+	}
+
+	for (i = 0; i < ss->ss_nr_items; i++) {
+		si = &ss->ss_items[i];
+		if (!si->si_walked)
+			continue;
+
+		subdirs = o2fsck_icount_get(ss->ss_subdirs, si->si_blkno);
+		if (si->si_links != subdirs + 2)
+			subtree_problem(ss, "Directory %"PRIu64" has a link "
+					"count of %u but %u subdirectories, "
+					"so it should be %u", si->si_blkno,
+					si->si_links, subdirs, subdirs + 2);
+	}
+}
+
+/*
+ * Every cluster the subtree uses must be allocated in the global
+ * bitmap on disk, and no two objects in the subtree may share one.
+ */
+static errcode_t check_clusters(struct subtree_state *ss)
+{
+	o2fsck_state *ost = ss->ss_ost;
+	uint64_t cpos = 0;
+	int allocated;
+	errcode_t ret;
+
+	while (!ocfs2_bitmap_find_next_set(ost->ost_allocated_clusters,
+					   cpos, &cpos)) {
+		ss->ss_clusters++;
+		ret = ocfs2_test_cluster_allocated(ost->ost_fs, cpos,
+						   &allocated);
+		if (ret) {
+			com_err(whoami, ret, "while reading the global "
+				"bitmap");
+			return ret;
+		}
+		if (!allocated)
+			subtree_problem(ss, "Cluster %"PRIu64" is in use but "
+					"is free in the global bitmap", cpos);
+		cpos++;
+	}
+
+	cpos = 0;
+	while (ost->ost_duplicate_clusters &&
+	       !ocfs2_bitmap_find_next_set(ost->ost_duplicate_clusters,
+					   cpos, &cpos)) {
+		subtree_problem(ss, "Cluster %"PRIu64" is used by more than "
+				"one object", cpos);
+		cpos++;
+	}
+
+	return 0;
+}
+
+errcode_t o2fsck_check_subtree(o2fsck_state *ost, uint64_t *problems)
+{
+	ocfs2_filesys *fs = ost->ost_fs;
+	struct subtree_state ss = { .ss_ost = ost, };
+	struct o2fsck_resource_track rt;
+	uint64_t i;
+	char *buf = NULL;
+	errcode_t ret;
+
+	printf("Checking the subtree\n");
+
+	o2fsck_init_resource_track(&rt, fs->fs_io);
+
+	ret = ocfs2_malloc_block(fs->fs_io, &buf);
+	if (ret) {
+		com_err(whoami, ret, "while allocating an inode buffer");
+		goto out;
+	}
+
+	ret = ocfs2_block_bitmap_new(fs, "subtree inodes", &ss.ss_seen);
+	if (ret) {
+		com_err(whoami, ret, "while allocating the subtree bitmap");
+		goto out;
+	}
+
+	ret = o2fsck_icount_new(fs, &ss.ss_subdirs);
+	if (ret) {
+		com_err(whoami, ret, "while allocating subdirectory counts");
+		goto out;
+	}
+
+	for (i = 0; i < subtree_nr_paths; i++) {
+		ret = queue_path(&ss, subtree_paths[i]);
+		if (ret)
+			goto out;
+	}
+
+	for (i = 0; i < subtree_nr_inodes; i++) {
+		ret = queue_inode(&ss, subtree_inodes[i], 0,
+				  OCFS2_FT_UNKNOWN);
+		if (ret)
+			goto out;
+	}
+
+	/*
+	 * Breadth first: ss_items grows as directories are checked, so a
+	 * whole level is queued before any of the next one is read.
+	 */
+	for (i = 0; i < ss.ss_nr_items; i++) {
+		ret = check_one(&ss, &ss.ss_items[i], buf);
+		if (ret) {
+			com_err(whoami, ret, "while checking inode %"PRIu64,
+				ss.ss_items[i].si_blkno);
+			goto out;
+		}
+	}
+
+	check_link_counts(&ss);
+
+	ret = check_clusters(&ss);
+	if (ret)
+		goto out;
+
+	printf("Checked %"PRIu64" inodes, %"PRIu64" directories and "
+	       "%"PRIu64" clusters, %"PRIu64" problems found.\n\n",
+	       ss.ss_inodes, ss.ss_dirs, ss.ss_clusters,
+	       ss.ss_problems + ost->ost_prompts);
+	*problems = ss.ss_problems + ost->ost_prompts;
+
+	o2fsck_compute_resource_track(&rt, fs->fs_io);
+	o2fsck_print_resource_track("Subtree", ost, &rt, fs->fs_io);
+	o2fsck_add_resource_track(&ost->ost_rt, &rt);
+
+out:
+	if (ss.ss_items)
+		ocfs2_free(&ss.ss_items);
+	if (ss.ss_subdirs)
+		o2fsck_icount_free(ss.ss_subdirs);
+	if (ss.ss_seen)
+		ocfs2_bitmap_free(ss.ss_seen);
+	if (buf)
+		ocfs2_free(&buf);
+	return ret;
+}
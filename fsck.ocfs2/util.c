@@ -34,9 +34,13 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include "ocfs2/ocfs2.h"
+#include "ocfs2/bitops.h"
 
 
 #include "util.h"
+#include "mem.h"
+#include "perf.h"
+#include "subtree.h"
 
 void o2fsck_write_inode(o2fsck_state *ost, uint64_t blkno,
 			struct ocfs2_dinode *di)
@@ -71,8 +75,10 @@ void o2fsck_mark_cluster_allocated(o2fsck_state *ost, uint32_t cluster)
 		return;
 
 	if (!ost->ost_duplicate_clusters) {
-		fprintf(stderr,
-			"Duplicate clusters detected.  Pass 1b will be run\n");
+		/* A subtree check reports them itself and has no pass 1b */
+		if (!o2fsck_subtree_wanted())
+			fprintf(stderr, "Duplicate clusters detected.  "
+				"Pass 1b will be run\n");
 
 		ret = ocfs2_cluster_bitmap_new(ost->ost_fs,
 					       "duplicate clusters",
@@ -138,17 +144,7 @@ out:
 
 size_t o2fsck_bitcount(unsigned char *bytes, size_t len)
 {
-	static unsigned char nibble_count[16] = {
-		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
-	};
-	size_t count = 0;
-
-	for (; len--; bytes++) {
-		count += nibble_count[*bytes >> 4];
-		count += nibble_count[*bytes & 0xf];
-	}
-
-	return count;
+	return ocfs2_get_bits_set(bytes, len * 8, 0);
 }
 
 errcode_t handle_slots_system_file(ocfs2_filesys *fs,
@@ -252,6 +248,8 @@ void o2fsck_add_resource_track(struct o2fsck_resource_track *rt1,
 	io1->is_cache_misses += io2->is_cache_misses;
 	io1->is_cache_inserts += io2->is_cache_inserts;
 	io1->is_cache_removes += io2->is_cache_removes;
+	io1->is_reads += io2->is_reads;
+	io1->is_writes += io2->is_writes;
 
 }
 
@@ -282,6 +280,8 @@ void o2fsck_compute_resource_track(struct o2fsck_resource_track *rt,
 	rtio->is_cache_misses = ios->is_cache_misses - rtio->is_cache_misses;
 	rtio->is_cache_inserts = ios->is_cache_inserts - rtio->is_cache_inserts;
 	rtio->is_cache_removes = ios->is_cache_removes - rtio->is_cache_removes;
+	rtio->is_reads = ios->is_reads - rtio->is_reads;
+	rtio->is_writes = ios->is_writes - rtio->is_writes;
 }
 
 void o2fsck_print_resource_track(char *pass, o2fsck_state *ost,
@@ -289,10 +289,12 @@ void o2fsck_print_resource_track(char *pass, o2fsck_state *ost,
 				 io_channel *channel)
 {
 	struct ocfs2_io_stats *rtio = &rt->rt_io_stats;
-	uint64_t total_io, cache_read;
+	uint64_t total_io, cache_read, lookups;
 	float rtime_s, utime_s, stime_s, walltime;
 	uint32_t rtime_m, utime_m, stime_m;
 
+	o2fsck_perf_add_pass(pass, rt, channel);
+
 	if (!ost->ost_show_stats)
 		return ;
 
@@ -330,6 +332,13 @@ void o2fsck_print_resource_track(char *pass, o2fsck_state *ost,
 	       mbytes(cache_read), mbytes(rtio->is_bytes_written),
 	       (double)(mbytes(total_io) / walltime));
 
+	lookups = (uint64_t)rtio->is_cache_hits + rtio->is_cache_misses;
+	if (pass && lookups)
+		printf("  Cache hit rate: %.1f%% of %"PRIu64" lookups, "
+		       "cache size: %luMB\n",
+		       100.0 * rtio->is_cache_hits / lookups, lookups,
+		       mbytes(io_get_cache_size(channel)));
+
 	printf("  Times real: %dm%.3fs, user: %dm%.3fs, sys: %dm%.3fs\n",
 	       rtime_m, rtime_s, utime_m, utime_s, stime_m, stime_s);
 }
@@ -343,18 +352,21 @@ static int cache_blocks;
  */
 static int blocks_cached;
 
-void o2fsck_init_cache(o2fsck_state *ost, enum o2fsck_cache_hint hint)
+/*
+ * How many blocks of cache o2fsck_init_cache() asks for first.
+ * leave_room is set if that is twice what it means to keep.
+ */
+static uint64_t cache_blocks_wanted(o2fsck_state *ost,
+				    enum o2fsck_cache_hint hint,
+				    int *leave_room)
 {
-	errcode_t ret;
-	uint64_t blocks_wanted, av_blocks;
-	int leave_room;
+	uint64_t blocks_wanted, budget;
 	ocfs2_filesys *fs = ost->ost_fs;
 	int max_slots = OCFS2_RAW_SB(fs->fs_super)->s_max_slots;
-	uint64_t pages_wanted, avpages;
 
 	switch (hint) {
 		case O2FSCK_CACHE_MODE_FULL:
-			leave_room = 1;
+			*leave_room = 1;
 			blocks_wanted = fs->fs_blocks;
 			break;
 		case O2FSCK_CACHE_MODE_JOURNAL:
@@ -362,14 +374,15 @@ void o2fsck_init_cache(o2fsck_state *ost, enum o2fsck_cache_hint hint)
 			 * We need enough blocks for all the journal
 			 * data.  Let's guess at 256M journals.
 			 */
-			leave_room = 0;
+			*leave_room = 0;
 
 			blocks_wanted = (uint64_t)max_slots * 1024 * 1024 * 256;
 			blocks_wanted = ocfs2_bytes_to_blocks(fs,
 							      blocks_wanted);
 			break;
 		case O2FSCK_CACHE_MODE_NONE:
-			return;
+			*leave_room = 0;
+			return 0;
 		default:
 			assert(0);
 	}
@@ -383,17 +396,62 @@ void o2fsck_init_cache(o2fsck_state *ost, enum o2fsck_cache_hint hint)
 	 * want; if that works, we know that getting exactly as much as
 	 * we want is going to be safe.
 	 */
-	if (leave_room)
+	if (*leave_room)
 		blocks_wanted <<= 1;
 
+	/*
+	 * With a memory limit, the cache gets a fixed share of it.  That
+	 * share already leaves room for everything else.
+	 */
+	budget = o2fsck_mem_cache_budget(fs);
+	if (budget != UINT64_MAX) {
+		*leave_room = 0;
+		if (blocks_wanted > budget / fs->fs_blocksize)
+			blocks_wanted = budget / fs->fs_blocksize;
+	}
+
 	if (blocks_wanted > INT_MAX)
 		blocks_wanted = INT_MAX;
 
-	av_blocks = blocks_wanted;
-	avpages = sysconf(_SC_AVPHYS_PAGES);
-	pages_wanted = blocks_wanted * fs->fs_blocksize / getpagesize();
-	if (pages_wanted > avpages)
-		av_blocks = avpages * getpagesize() / fs->fs_blocksize;
+	return blocks_wanted;
+}
+
+/*
+ * The size in bytes of the cache o2fsck_init_cache() would set up for
+ * this hint, if its first try succeeds.  Nothing is allocated.
+ */
+uint64_t o2fsck_cache_size(o2fsck_state *ost, enum o2fsck_cache_hint hint)
+{
+	ocfs2_filesys *fs = ost->ost_fs;
+	uint64_t blocks, av_blocks;
+	int leave_room;
+
+	blocks = cache_blocks_wanted(ost, hint, &leave_room);
+
+	av_blocks = (o2fsck_mem_available() + io_get_cache_size(fs->fs_io)) /
+		fs->fs_blocksize;
+	if (blocks > av_blocks)
+		blocks = av_blocks;
+	if (leave_room)
+		blocks >>= 1;
+
+	return blocks * fs->fs_blocksize;
+}
+
+void o2fsck_init_cache(o2fsck_state *ost, enum o2fsck_cache_hint hint)
+{
+	errcode_t ret;
+	uint64_t blocks_wanted, av_blocks;
+	int leave_room;
+	ocfs2_filesys *fs = ost->ost_fs;
+
+	blocks_wanted = cache_blocks_wanted(ost, hint, &leave_room);
+	if (!blocks_wanted)
+		return;
+
+	/* The cache we already have is about to be given back */
+	av_blocks = (o2fsck_mem_available() + io_get_cache_size(fs->fs_io)) /
+		fs->fs_blocksize;
 
 	while (blocks_wanted > 0) {
 		io_destroy_cache(fs->fs_io);
@@ -425,6 +483,8 @@ void o2fsck_init_cache(o2fsck_state *ost, enum o2fsck_cache_hint hint)
 			 */
 			if (!leave_room) {
 				cache_blocks = blocks_wanted;
+				o2fsck_mem_set_cache(blocks_wanted *
+						     fs->fs_blocksize);
 				break;
 			}
 
@@ -436,6 +496,169 @@ void o2fsck_init_cache(o2fsck_state *ost, enum o2fsck_cache_hint hint)
 	}
 }
 
+/*
+ * What the allocators say is in the filesystem, in blocks.  Taken once,
+ * before pass 0, so it is only as good as the allocators are; it is only
+ * used to size the cache.
+ */
+struct cache_census {
+	int		cc_taken;
+	uint64_t	cc_groups;		/* group descriptors */
+	uint64_t	cc_inodes;		/* inodes in use */
+	uint64_t	cc_extent_blocks;	/* extent blocks in use */
+	uint64_t	cc_quota_blocks;	/* global quota files */
+};
+
+static struct cache_census census;
+
+static void census_system_inode(ocfs2_filesys *fs, char *buf, int type,
+				int slot, uint64_t *used)
+{
+	struct ocfs2_dinode *di = (struct ocfs2_dinode *)buf;
+	struct ocfs2_chain_list *cl;
+	uint64_t blkno, blocks;
+
+	if (ocfs2_lookup_system_inode(fs, type, slot, &blkno) ||
+	    ocfs2_read_inode(fs, blkno, buf))
+		return;
+
+	if (!(di->i_flags & OCFS2_CHAIN_FL)) {
+		/* A quota file */
+		blocks = ocfs2_blocks_in_bytes(fs, di->i_size);
+		if (blocks < fs->fs_blocks)
+			census.cc_quota_blocks += blocks;
+		return;
+	}
+
+	cl = &di->id2.i_chain;
+	if (cl->cl_cpg)
+		census.cc_groups += di->i_clusters / cl->cl_cpg;
+	if (used)
+		*used += di->id1.bitmap1.i_used;
+}
+
+static void take_cache_census(o2fsck_state *ost)
+{
+	ocfs2_filesys *fs = ost->ost_fs;
+	struct ocfs2_super_block *sb = OCFS2_RAW_SB(fs->fs_super);
+	char *buf;
+	int slot;
+
+	census.cc_taken = 1;
+	if (ocfs2_malloc_block(fs->fs_io, &buf))
+		return;
+
+	census_system_inode(fs, buf, GLOBAL_BITMAP_SYSTEM_INODE, 0, NULL);
+	census_system_inode(fs, buf, GLOBAL_INODE_ALLOC_SYSTEM_INODE, 0,
+			    &census.cc_inodes);
+	for (slot = 0; slot < sb->s_max_slots; slot++) {
+		census_system_inode(fs, buf, INODE_ALLOC_SYSTEM_INODE, slot,
+				    &census.cc_inodes);
+		census_system_inode(fs, buf, EXTENT_ALLOC_SYSTEM_INODE, slot,
+				    &census.cc_extent_blocks);
+	}
+	if (OCFS2_HAS_RO_COMPAT_FEATURE(sb, OCFS2_FEATURE_RO_COMPAT_USRQUOTA))
+		census_system_inode(fs, buf, USER_QUOTA_SYSTEM_INODE, 0, NULL);
+	if (OCFS2_HAS_RO_COMPAT_FEATURE(sb, OCFS2_FEATURE_RO_COMPAT_GRPQUOTA))
+		census_system_inode(fs, buf, GROUP_QUOTA_SYSTEM_INODE, 0, NULL);
+
+	verbosef("Census: %"PRIu64" groups, %"PRIu64" inodes, %"PRIu64" "
+		 "extent blocks, %"PRIu64" quota blocks\n", census.cc_groups,
+		 census.cc_inodes, census.cc_extent_blocks,
+		 census.cc_quota_blocks);
+
+	ocfs2_free(&buf);
+}
+
+/* The blocks a pass is expected to touch */
+static uint64_t pass_working_set(o2fsck_state *ost, int pass)
+{
+	switch (pass) {
+		case 0:
+			/* The chains and their group descriptors */
+			return census.cc_groups;
+		case 1:
+			/* Every inode and extent block, and the bitmaps */
+			return census.cc_groups + census.cc_inodes +
+				census.cc_extent_blocks;
+		case 2:
+			/* Pass 1 has counted the directory blocks for us */
+			return ost->ost_dirblocks.db_numblocks +
+				ost->ost_dir_count;
+		case 3:
+		case 4:
+			return ost->ost_dir_count;
+		case 5:
+			return census.cc_quota_blocks;
+		default:
+			return 0;
+	}
+}
+
+/*
+ * Resize the I/O cache for the pass about to start.  The cache is sized
+ * for the biggest working set of this and the passes after it, so blocks
+ * a later pass will want again aren't dropped just because this pass is
+ * light.  It grows whenever it is short and shrinks only when it is more
+ * than twice the size wanted, and the blocks most recently used survive
+ * either way.  Half of the free memory, as the cgroup sees it, is left
+ * for everything else, and --memory-limit still has the last word.
+ */
+void o2fsck_size_cache_for_pass(o2fsck_state *ost, int pass)
+{
+	ocfs2_filesys *fs = ost->ost_fs;
+	uint64_t wanted = 0, ws, cap, budget;
+	errcode_t ret;
+	int i;
+
+	if (!census.cc_taken)
+		take_cache_census(ost);
+
+	for (i = pass; i <= 5; i++) {
+		ws = pass_working_set(ost, i);
+		if (ws > wanted)
+			wanted = ws;
+	}
+	wanted += wanted / 4;
+	if (wanted < 1024)
+		wanted = 1024;
+
+	cap = (o2fsck_mem_available() + io_get_cache_size(fs->fs_io)) /
+		fs->fs_blocksize / 2;
+	budget = o2fsck_mem_cache_budget(fs);
+	if (budget != UINT64_MAX && (budget / fs->fs_blocksize) < cap)
+		cap = budget / fs->fs_blocksize;
+	if (cap > fs->fs_blocks)
+		cap = fs->fs_blocks;
+	if (cap > INT_MAX)
+		cap = INT_MAX;
+	if (cap < 512)
+		cap = 512;
+	if (wanted > cap)
+		wanted = cap;
+
+	verbosef("Pass %d wants %"PRIu64" blocks of I/O cache, have %d\n",
+		 pass, wanted, cache_blocks);
+
+	if ((wanted <= cache_blocks) && (wanted >= (cache_blocks / 2)))
+		return;
+
+	ret = io_resize_cache(fs->fs_io, wanted);
+	if (ret) {
+		verbosef("Keeping %d blocks of I/O cache: %s\n", cache_blocks,
+			 error_message(ret));
+		return;
+	}
+
+	/* Same as o2fsck_init_cache(), but an unpinned cache beats none */
+	if (io_mlock_cache(fs->fs_io))
+		verbosef("Couldn't pin %"PRIu64" blocks of I/O cache\n",
+			 wanted);
+
+	cache_blocks = wanted;
+	o2fsck_mem_set_cache(wanted * fs->fs_blocksize);
+}
+
 int o2fsck_worth_caching(int blocks_to_read)
 {
 	if ((blocks_to_read + blocks_cached) > cache_blocks)
@@ -19,6 +19,7 @@
 
 #include "ocfs2/byteorder.h"
 #include "ocfs2/ocfs2.h"
+#include "ocfs2/bitops.h"
 
 #include "xattr.h"
 #include "extent.h"
@@ -56,18 +57,32 @@ struct xattr_info {
 /*
  * This use to describe the used area of xattr in inode, block and bucket.
  * The used area include all xattr structs, such as header, entry, name+value.
+ * Each byte of the object is one bit in um_used; um_starts marks where
+ * every area begins, which is only needed to judge empty areas the way
+ * the range checks always have.  The valid entries are kept in the order
+ * they were marked so that bad entries can be dropped afterwards.  An
+ * entry is only kept once its own area is marked, and marked areas never
+ * overlap, so no more entries than fit after the header can be kept.
+ * Their values may be empty, so that is the bound.
  */
-struct used_area {
-	struct list_head ua_list;	/* list of used area */
-	uint16_t ua_offset;		/* the offset of the area */
-	uint16_t ua_length;		/* the length of the area */
-	struct ocfs2_xattr_entry ua_xe;	/* store the valid xattr entry */
-	uint16_t ua_xe_valid;		/* whether it is a valid xattr entry */
+#define USED_MAP_BYTES		(OCFS2_XATTR_BUCKET_SIZE / 8)
+#define USED_MAP_MAX_ENTRIES	((OCFS2_XATTR_BUCKET_SIZE - HEADER_SIZE) / \
+				 ENTRY_SIZE)
+
+/* Blocks of xattr buckets to read ahead in one go */
+#define NUM_XATTR_RA_BLOCKS	1024
+
+struct xattr_bucket_run {
+	uint64_t br_blkno;		/* the first block of the run */
+	uint32_t br_clusters;		/* the length of the run */
 };
 
 struct used_map {
 	uint16_t um_size;		/* the size of the map */
-	struct list_head um_areas;	/* list of used area */
+	uint16_t um_nr_xe;		/* the number of valid entries */
+	unsigned char um_used[USED_MAP_BYTES];
+	unsigned char um_starts[USED_MAP_BYTES];
+	struct ocfs2_xattr_entry um_xe[USED_MAP_MAX_ENTRIES];
 };
 
 static int check_xattr_count(o2fsck_state *ost,
@@ -117,107 +132,81 @@ static int check_xattr_count(o2fsck_state *ost,
 	return 0;
 }
 
-static struct used_area *new_used_area(uint16_t off, uint16_t len,
-				       struct ocfs2_xattr_entry *xe)
+static void used_map_fill(unsigned char *map, uint16_t off, uint16_t len,
+			  int set)
 {
-	struct used_area *ua = NULL;
-
-	ua = malloc(sizeof(struct used_area));
-	if (!ua)
-		return NULL;
+	uint32_t end = off + len;
 
-	memset(ua, 0 , sizeof(struct used_area));
-	ua->ua_offset = off;
-	ua->ua_length = len;
-
-	if (xe) {
-		memcpy(&ua->ua_xe, xe, ENTRY_SIZE);
-		ua->ua_xe_valid = 1;
+	for (; off < end && (off & 7); off++, len--) {
+		if (set)
+			ocfs2_set_bit(off, map);
+		else
+			ocfs2_clear_bit(off, map);
+	}
+	if (len >= 8) {
+		memset(map + (off >> 3), set ? 0xff : 0, len >> 3);
+		off += len & ~7;
+	}
+	for (; off < end; off++) {
+		if (set)
+			ocfs2_set_bit(off, map);
+		else
+			ocfs2_clear_bit(off, map);
 	}
-
-	return ua;
 }
 
 static errcode_t set_used_area(struct used_map *um,
 			       uint16_t off, uint16_t len,
 			       struct ocfs2_xattr_entry *xe)
 {
-	struct used_area *new_area = NULL;
-
-	if (!um)
+	if (!um || (off + len) > um->um_size)
 		return OCFS2_ET_INVALID_ARGUMENT;
 
-	new_area = new_used_area(off, len, xe);
-	if (!new_area) {
-		com_err(whoami, OCFS2_ET_NO_MEMORY, "Unable to allocate"
-			" buffer for extended attribute ");
-		return OCFS2_ET_NO_MEMORY;
+	if (xe) {
+		if (um->um_nr_xe >= USED_MAP_MAX_ENTRIES)
+			return OCFS2_ET_INVALID_ARGUMENT;
+		memcpy(&um->um_xe[um->um_nr_xe++], xe, ENTRY_SIZE);
 	}
 
-	INIT_LIST_HEAD(&new_area->ua_list);
-	list_add_tail(&new_area->ua_list, &um->um_areas);
+	used_map_fill(um->um_used, off, len, 1);
+	if (off < um->um_size)
+		ocfs2_set_bit(off, um->um_starts);
 
 	return 0;
 }
 
-static void clear_used_area(struct used_map *um, uint16_t off, uint16_t len)
+/* Only ever undoes the entry area that was marked last */
+static void clear_used_area(struct used_map *um, uint16_t off, uint16_t len,
+			    struct ocfs2_xattr_entry *xe)
 {
-	struct used_area *area = NULL;
-	struct list_head *ua, *ua2;
-
-	if (list_empty(&um->um_areas))
-		return;
-
-	list_for_each_safe(ua, ua2, &um->um_areas) {
-		area = list_entry(ua, struct used_area, ua_list);
-		if (off == area->ua_offset && len == area->ua_length) {
-			list_del(ua);
-			free(area);
-			return;
-		}
-	}
-	return;
+	if (xe && um->um_nr_xe &&
+	    !memcmp(&um->um_xe[um->um_nr_xe - 1], xe, ENTRY_SIZE))
+		um->um_nr_xe--;
+
+	used_map_fill(um->um_used, off, len, 0);
+	ocfs2_clear_bit(off, um->um_starts);
 }
 
 static int check_area_fits(struct used_map *um, uint16_t off, uint16_t len)
 {
-	struct used_area *area = NULL;
-	struct list_head *ua, *ua2;
-
 	if (!um || (off + len) > um->um_size)
 		return -1;
 
-	if (list_empty(&um->um_areas))
-		return 0;
+	/*
+	 * An empty area only collides when it lands strictly inside
+	 * another one.
+	 */
+	if (!len)
+		return (off < um->um_size &&
+			ocfs2_test_bit(off, um->um_used) &&
+			!ocfs2_test_bit(off, um->um_starts)) ? -1 : 0;
 
-	list_for_each_safe(ua, ua2, &um->um_areas) {
-		area = list_entry(ua, struct used_area, ua_list);
-		if ((off + len) <= area->ua_offset)
-			continue;
-		if ((area->ua_offset + area->ua_length) <= off)
-			continue;
+	if (ocfs2_find_next_bit_set(um->um_used, off + len, off) < off + len)
 		return -1;
-	}
 
 	return 0;
 }
 
-static void free_used_map(struct used_map *um)
-{
-	struct used_area *area = NULL;
-	struct list_head *ua, *ua2;
-
-	if (list_empty(&um->um_areas))
-		return;
-
-	list_for_each_safe(ua, ua2, &um->um_areas) {
-		area = list_entry(ua, struct used_area, ua_list);
-		list_del(ua);
-		free(area);
-	}
-	return;
-}
-
 static errcode_t check_xattr_entry(o2fsck_state *ost,
 				   struct ocfs2_dinode *di,
 				   struct ocfs2_xattr_header *xh,
@@ -229,14 +218,12 @@ static errcode_t check_xattr_entry(o2fsck_state *ost,
 	struct used_map *umap;
 
 	count = xh->xh_count;
-	umap = malloc(sizeof(struct used_map));
-	if (!umap) {
+	if (ocfs2_malloc0(sizeof(struct used_map), &umap)) {
 		com_err(whoami, OCFS2_ET_NO_MEMORY, "Unable to allocate"
 			" buffer for extended attribute ");
 		return OCFS2_ET_NO_MEMORY;
 	}
 	umap->um_size = xi->max_offset;
-	INIT_LIST_HEAD(&umap->um_areas);
 
 	/* set xattr header as used area */
 	set_used_area(umap, 0, sizeof(struct ocfs2_xattr_header), NULL);
@@ -313,7 +300,7 @@ static errcode_t check_xattr_entry(o2fsck_state *ost,
 				break;
 			} else {
 				clear_used_area(umap, XE_OFFSET(xh, xe),
-						ENTRY_SIZE);
+						ENTRY_SIZE, xe);
 				goto wipe_entry;
 			}
 		}
@@ -347,25 +334,16 @@ wipe_entry:
 	}
 
 	if (*changed && xh->xh_count != count) {
-		struct used_area *area = NULL;
-		struct list_head *ua, *ua2;
 		/*
 		 * according to used map, remove bad entries from entry area,
 		 * and left the name+value in the object.
 		 */
-		i = 0;
-		list_for_each_safe(ua, ua2, &umap->um_areas) {
-			area = list_entry(ua, struct used_area, ua_list);
-			if (!area->ua_xe_valid)
-				continue;
-			memcpy(&xh->xh_entries[i], &area->ua_xe, ENTRY_SIZE);
-			i++;
-		}
-		xh->xh_count = i;
+		for (i = 0; i < umap->um_nr_xe; i++)
+			memcpy(&xh->xh_entries[i], &umap->um_xe[i], ENTRY_SIZE);
+		xh->xh_count = umap->um_nr_xe;
 	}
 
-	free_used_map(umap);
-	free(umap);
+	ocfs2_free(&umap);
 	return ret;
 }
 
@@ -502,7 +480,6 @@ static errcode_t ocfs2_check_xattr_buckets(o2fsck_state *ost,
 	uint32_t max_buckets = clusters * bpc;
 	uint32_t max_blocks = max_buckets * blk_per_bucket;
 	uint32_t num_buckets = 0;
-	uint64_t blk = 0;
 
 	/* malloc space for all buckets */
 	ret = ocfs2_malloc_blocks(ost->ost_fs->fs_io, max_blocks, &bucket);
@@ -512,18 +489,12 @@ static errcode_t ocfs2_check_xattr_buckets(o2fsck_state *ost,
 		goto out;
 	}
 
-	/* read all buckets for detect (some of them may not be used) */
-	bucket_buf = bucket;
-	blk = blkno;
-	for (i = 0; i < max_buckets; i++) {
-		ret = ocfs2_read_xattr_bucket(ost->ost_fs, blk, bucket_buf);
-		if (ret) {
-			max_buckets = i;
-			break;
-		}
-		blk += blk_per_bucket;
-		bucket_buf += OCFS2_XATTR_BUCKET_SIZE;
-	}
+	/*
+	 * read all buckets for detect (some of them may not be used) in
+	 * one go; max_buckets is cut back to the ones that read cleanly.
+	 */
+	ocfs2_read_xattr_buckets(ost->ost_fs, blkno, &max_buckets, bucket);
+	ret = 0;
 
 	/*
 	 * The real bucket num in this series of blocks is stored
@@ -595,16 +566,58 @@ out:
 	return ret;
 }
 
+/*
+ * Read the bucket runs from 'start' on into the I/O cache, merging runs
+ * that sit next to each other on disk, until NUM_XATTR_RA_BLOCKS blocks
+ * are queued.  Returns the index of the first run not read ahead.
+ */
+static int o2fsck_readahead_xattr_runs(o2fsck_state *ost,
+				       struct xattr_bucket_run *runs,
+				       int start, int nr_runs,
+				       char *buf, struct io_vec_unit *ivus)
+{
+	ocfs2_filesys *fs = ost->ost_fs;
+	uint64_t blocks = 0, len;
+	int i, count = 0;
+
+	for (i = start; i < nr_runs && blocks < NUM_XATTR_RA_BLOCKS; i++) {
+		len = ocfs2_clusters_to_blocks(fs, runs[i].br_clusters);
+		if (len > NUM_XATTR_RA_BLOCKS - blocks)
+			len = NUM_XATTR_RA_BLOCKS - blocks;
+
+		if (count && (ivus[count - 1].ivu_blkno +
+			      ivus[count - 1].ivu_buflen / fs->fs_blocksize ==
+			      runs[i].br_blkno))
+			ivus[count - 1].ivu_buflen += len * fs->fs_blocksize;
+		else {
+			ivus[count].ivu_blkno = runs[i].br_blkno;
+			ivus[count].ivu_buf = buf + blocks * fs->fs_blocksize;
+			ivus[count].ivu_buflen = len * fs->fs_blocksize;
+			count++;
+		}
+		blocks += len;
+	}
+
+	io_vec_read_blocks(fs->fs_io, ivus, count);
+
+	return i;
+}
+
 static errcode_t o2fsck_check_xattr_index_block(o2fsck_state *ost,
 						struct ocfs2_dinode *di,
 						struct ocfs2_xattr_block *xb,
 						int *changed)
 {
+	ocfs2_filesys *fs = ost->ost_fs;
 	struct ocfs2_extent_list *el = &xb->xb_attrs.xb_root.xt_list;
-	errcode_t ret = 0;
+	errcode_t ret = 0, rec_ret = 0;
 	uint32_t name_hash = UINT_MAX, e_cpos = 0, num_clusters = 0;
-	uint64_t p_blkno = 0;
+	uint64_t p_blkno = 0, ra_blocks = 0;
 	struct extent_info ei = {0, };
+	struct xattr_bucket_run *runs = NULL;
+	struct io_vec_unit *ivus = NULL;
+	char *ra_buf = NULL;
+	int i, nr_runs = 0, max_runs = 0, ra_next = 0;
 
 	if (!el->l_next_free_rec)
 		return 0;
@@ -613,7 +626,7 @@ static errcode_t o2fsck_check_xattr_index_block(o2fsck_state *ost,
 	ei.mark_rec_alloc_func = o2fsck_mark_tree_clusters_allocated;
 	ei.para = di;
 	ret = check_el(ost, &ei, xb->xb_blkno, el,
-		ocfs2_xattr_recs_per_xb(ost->ost_fs->fs_blocksize), 0, 0,
+		ocfs2_xattr_recs_per_xb(fs->fs_blocksize), 0, 0,
 		changed);
 	if (ret)
 		return ret;
@@ -623,7 +636,7 @@ static errcode_t o2fsck_check_xattr_index_block(o2fsck_state *ost,
 	 * ocfs2_xattr_get_rec can get the updated information.
 	 */
 	if (*changed) {
-		ret = ocfs2_write_xattr_block(ost->ost_fs,
+		ret = ocfs2_write_xattr_block(fs,
 					      di->i_xattr_loc, (char *)xb);
 		if (ret) {
 			com_err(whoami, ret, "while writing root block of"
@@ -632,31 +645,77 @@ static errcode_t o2fsck_check_xattr_index_block(o2fsck_state *ost,
 		}
 	}
 
-
+	/*
+	 * Collect every bucket run up front so that the buckets can be
+	 * read ahead of the checks instead of one bucket at a time.
+	 */
 	while (name_hash > 0) {
-		ret = ocfs2_xattr_get_rec(ost->ost_fs, xb, name_hash, &p_blkno,
-					  &e_cpos, &num_clusters);
-		if (ret) {
-			com_err(whoami, ret, "while getting bucket record"
-				" of extended attributes ");
-			goto out;
+		rec_ret = ocfs2_xattr_get_rec(fs, xb, name_hash, &p_blkno,
+					      &e_cpos, &num_clusters);
+		if (rec_ret)
+			break;
+
+		if (nr_runs == max_runs) {
+			max_runs = max_runs ? max_runs * 2 : 16;
+			ret = ocfs2_realloc(max_runs * sizeof(*runs), &runs);
+			if (ret) {
+				com_err(whoami, ret, "while allocating bucket"
+					" runs of extended attributes ");
+				goto out;
+			}
 		}
+		runs[nr_runs].br_blkno = p_blkno;
+		runs[nr_runs].br_clusters = num_clusters;
+		nr_runs++;
+		ra_blocks += ocfs2_clusters_to_blocks(fs, num_clusters);
+
+		if (e_cpos == 0)
+			break;
+
+		name_hash = e_cpos - 1;
+	}
 
-		ret = ocfs2_check_xattr_buckets(ost, di, p_blkno,
-						num_clusters);
+	if (ra_blocks > NUM_XATTR_RA_BLOCKS)
+		ra_blocks = NUM_XATTR_RA_BLOCKS;
+	if (fs->fs_io && nr_runs > 1 &&
+	    (NUM_XATTR_RA_BLOCKS * fs->fs_blocksize <=
+	     io_get_cache_size(fs->fs_io))) {
+		if (ocfs2_malloc_blocks(fs->fs_io, ra_blocks, &ra_buf) ||
+		    ocfs2_malloc(sizeof(struct io_vec_unit) * nr_runs,
+				 &ivus)) {
+			if (ra_buf)
+				ocfs2_free(&ra_buf);
+		}
+	}
+
+	for (i = 0; i < nr_runs; i++) {
+		if (ivus && i == ra_next)
+			ra_next = o2fsck_readahead_xattr_runs(ost, runs, i,
+							      nr_runs, ra_buf,
+							      ivus);
+
+		ret = ocfs2_check_xattr_buckets(ost, di, runs[i].br_blkno,
+						runs[i].br_clusters);
 		if (ret) {
 			com_err(whoami, ret, "while iterating bucket"
 				" of extended attributes ");
 			goto out;
 		}
+	}
 
-		if (e_cpos == 0)
-			break;
-
-		name_hash = e_cpos - 1;
+	if (rec_ret) {
+		ret = rec_ret;
+		com_err(whoami, ret, "while getting bucket record"
+			" of extended attributes ");
 	}
 
 out:
+	if (ivus)
+		ocfs2_free(&ivus);
+	if (ra_buf)
+		ocfs2_free(&ra_buf);
+	if (runs)
+		ocfs2_free(&runs);
 	return ret;
 }
 
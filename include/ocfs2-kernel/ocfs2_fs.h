@@ -285,6 +285,9 @@
  * Journal Flags (ocfs2_dinode.id1.journal1.i_flags)
  */
 #define OCFS2_JOURNAL_DIRTY_FL	(0x00000001)	/* Journal needs recovery */
+#define OCFS2_JOURNAL_UNZEROED_FL (0x00000002)	/* Log area not yet zeroed,
+						   see tunefs.ocfs2
+						   --zero-journals */
 
 /*
  * superblock s_state flags
@@ -655,7 +658,11 @@ struct ocfs2_super_block {
 	__le16 s_reserved0;
 	__le32 s_dx_seed[3];		/* seed[0-2] for dx dir hash.
 					 * s_uuid_hash serves as seed[3]. */
-/*C0*/  __le64 s_reserved2[15];		/* Fill out superblock */
+/*C8*/	__le32 s_raid_stride;		/* RAID stride (chunk size), in
+					   blocks.  0 if not known */
+	__le32 s_raid_stripe_width;	/* RAID full stripe width, in
+					   blocks.  0 if not known */
+/*D0*/  __le64 s_reserved2[14];		/* Fill out superblock */
 /*140*/
 
 	/*
@@ -144,8 +144,10 @@ typedef struct _ocfs2_cached_inode ocfs2_cached_inode;
 typedef struct _ocfs2_cached_dquot ocfs2_cached_dquot;
 typedef struct _io_channel io_channel;
 typedef struct _ocfs2_inode_scan ocfs2_inode_scan;
+typedef struct _ocfs2_scan_bus ocfs2_scan_bus;
 typedef struct _ocfs2_dir_scan ocfs2_dir_scan;
 typedef struct _ocfs2_bitmap ocfs2_bitmap;
+typedef struct _ocfs2_extent_map ocfs2_extent_map;
 typedef struct _ocfs2_devices ocfs2_devices;
 
 enum ocfs2_block_type {
@@ -177,6 +179,19 @@ struct _ocfs2_quota_info {
 
 typedef struct _ocfs2_quota_info ocfs2_quota_info;
 
+/*
+ * Running totals for the cluster and extent block allocators.  Zero
+ * fs_alloc_stats before a call to see what that call allocated.
+ */
+struct ocfs2_alloc_stats {
+	uint64_t as_cluster_calls;	/* successful cluster allocations */
+	uint64_t as_clusters;		/* clusters they returned */
+	uint64_t as_eb_calls;		/* extent blocks allocated */
+	uint64_t as_hinted;		/* allocations that had a goal */
+	uint64_t as_goal_hits;		/* ...and started right at it */
+	uint64_t as_goal_distance;	/* sum of blocks from goal to result */
+};
+
 struct _ocfs2_filesys {
 	char *fs_devname;
 	uint32_t fs_flags;
@@ -205,6 +220,8 @@ struct _ocfs2_filesys {
 
 	ocfs2_quota_info qinfo[MAXQUOTAS];
 
+	struct ocfs2_alloc_stats fs_alloc_stats;
+
 	/* Reserved for the use of the calling application. */
 	void *fs_private;
 };
@@ -214,14 +231,13 @@ struct _ocfs2_cached_inode {
 	uint64_t ci_blkno;
 	struct ocfs2_dinode *ci_inode;
 	ocfs2_bitmap *ci_chains;
+	ocfs2_extent_map *ci_map;
 };
 
 typedef unsigned int qid_t;
 
 struct _ocfs2_cached_dquot {
 	loff_t d_off;	/* Offset of structure in the file */
-	struct _ocfs2_cached_dquot *d_next;	/* Next entry in hashchain */
-	struct _ocfs2_cached_dquot **d_pprev;	/* Previous pointer in hashchain */
 	struct ocfs2_global_disk_dqblk d_ddquot;	/* Quota entry */
 };
 
@@ -271,7 +287,8 @@ enum ocfs2_mkfs_types {
 struct _ocfs2_quota_hash {
 	int alloc_entries;
 	int used_entries;
-	ocfs2_cached_dquot **hash;
+	int deleted_entries;		/* Tombstones left by removal */
+	ocfs2_cached_dquot **hash;	/* Open addressing, linear probing */
 };
 
 struct ocfs2_dx_hinfo {
@@ -317,6 +334,8 @@ struct ocfs2_io_stats {
 	uint32_t is_cache_misses;
 	uint32_t is_cache_inserts;
 	uint32_t is_cache_removes;
+	uint64_t is_reads;		/* Requests sent to the device */
+	uint64_t is_writes;
 };
 
 void io_get_stats(io_channel *channel, struct ocfs2_io_stats *stats);
@@ -343,10 +362,25 @@ errcode_t io_write_block(io_channel *channel, int64_t blkno, int count,
 			 const char *data);
 errcode_t io_write_block_nocache(io_channel *channel, int64_t blkno, int count,
 			 const char *data);
+
+/*
+ * Zero a range of blocks.  io_zero_blocks() lets the device or file do
+ * the zeroing when it can (BLKZEROOUT, a discard that is known to zero,
+ * or a punched hole) and writes zeroes when it can't.  Once it
+ * succeeds, cached blocks in the range are zeroed as well.
+ *
+ * io_zero_range() and io_discard_range() work on a file descriptor,
+ * for tools that don't have a channel.  Offsets and lengths are bytes.
+ */
+#define IO_ZERO_NOFALLBACK	0x01	/* Don't write the zeroes ourselves */
+errcode_t io_zero_blocks(io_channel *channel, int64_t blkno, int64_t count);
+errcode_t io_zero_range(int fd, uint64_t offset, uint64_t len, int flags);
+errcode_t io_discard_range(int fd, uint64_t offset, uint64_t len);
 errcode_t io_init_cache(io_channel *channel, size_t nr_blocks);
 void io_set_nocache(io_channel *channel, bool nocache);
 errcode_t io_init_cache_size(io_channel *channel, size_t bytes);
 size_t io_get_cache_size(io_channel *channel);
+errcode_t io_resize_cache(io_channel *channel, size_t nr_blocks);
 errcode_t io_share_cache(io_channel *from, io_channel *to);
 errcode_t io_mlock_cache(io_channel *channel);
 void io_destroy_cache(io_channel *channel);
@@ -360,6 +394,13 @@ struct io_vec_unit {
 
 errcode_t io_vec_read_blocks(io_channel *channel, struct io_vec_unit *ivus,
 			     int count);
+struct io_vec_read;
+errcode_t io_vec_read_init(io_channel *channel, int max_count,
+			   struct io_vec_read **ret_ivr);
+void io_vec_read_free(struct io_vec_read *ivr);
+errcode_t io_vec_read_start(struct io_vec_read *ivr,
+			    struct io_vec_unit *ivus, int count);
+errcode_t io_vec_read_finish(struct io_vec_read *ivr);
 
 errcode_t ocfs2_read_super(ocfs2_filesys *fs, uint64_t superblock, char *sb);
 /* Writes the main superblock at OCFS2_SUPER_BLOCK_BLKNO */
@@ -424,6 +465,9 @@ errcode_t ocfs2_get_clusters(ocfs2_cached_inode *cinode,
 			     uint32_t *p_cluster,
 			     uint32_t *num_clusters,
 			     uint16_t *extent_flags);
+errcode_t ocfs2_load_extent_map(ocfs2_filesys *fs,
+				ocfs2_cached_inode *cinode);
+void ocfs2_drop_extent_map(ocfs2_filesys *fs, ocfs2_cached_inode *cinode);
 errcode_t ocfs2_xattr_get_clusters(ocfs2_filesys *fs,
 				   struct ocfs2_extent_list *el,
 				   uint64_t el_blkno,
@@ -444,6 +488,15 @@ errcode_t ocfs2_write_journal_superblock(ocfs2_filesys *fs, uint64_t blkno,
 					 char *jsb_buf);
 errcode_t ocfs2_make_journal(ocfs2_filesys *fs, uint64_t blkno,
 			     uint32_t clusters, ocfs2_fs_options *features);
+errcode_t ocfs2_make_lazy_journal(ocfs2_filesys *fs, uint64_t blkno,
+				  uint32_t clusters,
+				  ocfs2_fs_options *features);
+errcode_t ocfs2_zero_journal(ocfs2_filesys *fs, uint64_t blkno,
+			     uint64_t chunk_blocks,
+			     errcode_t (*func)(ocfs2_filesys *fs,
+					       uint64_t done, uint64_t total,
+					       void *priv_data),
+			     void *priv_data);
 errcode_t ocfs2_journal_clear_features(journal_superblock_t *jsb,
 				       ocfs2_fs_options *features);
 errcode_t ocfs2_journal_set_features(journal_superblock_t *jsb,
@@ -612,6 +665,18 @@ errcode_t ocfs2_get_next_inode(ocfs2_inode_scan *scan,
 			       uint64_t *blkno, char *inode);
 uint64_t ocfs2_get_max_inode_count(ocfs2_inode_scan *scan);
 
+/* Hand inodes from other generations to this consumer too */
+#define OCFS2_SCAN_BUS_ANY_GENERATION	0x0001
+
+typedef errcode_t (*ocfs2_scan_bus_func)(ocfs2_filesys *fs, uint64_t blkno,
+					 struct ocfs2_dinode *di,
+					 void *priv_data);
+errcode_t ocfs2_open_scan_bus(ocfs2_filesys *fs, ocfs2_scan_bus **ret_bus);
+errcode_t ocfs2_scan_bus_add(ocfs2_scan_bus *bus, int flags,
+			     ocfs2_scan_bus_func func, void *priv_data);
+errcode_t ocfs2_scan_bus_run(ocfs2_scan_bus *bus);
+void ocfs2_close_scan_bus(ocfs2_scan_bus *bus);
+
 errcode_t ocfs2_open_dir_scan(ocfs2_filesys *fs, uint64_t dir, int flags,
 			      ocfs2_dir_scan **ret_scan);
 void ocfs2_close_dir_scan(ocfs2_dir_scan *scan);
@@ -638,9 +703,9 @@ errcode_t ocfs2_bitmap_find_next_clear(ocfs2_bitmap *bitmap,
 errcode_t ocfs2_bitmap_read(ocfs2_bitmap *bitmap);
 errcode_t ocfs2_bitmap_write(ocfs2_bitmap *bitmap);
 uint64_t ocfs2_bitmap_get_set_bits(ocfs2_bitmap *bitmap);
-errcode_t ocfs2_bitmap_alloc_range(ocfs2_bitmap *bitmap, uint64_t min,
-				   uint64_t len, uint64_t *first_bit,
-				   uint64_t *bits_found);
+errcode_t ocfs2_bitmap_alloc_range(ocfs2_bitmap *bitmap, uint64_t goal,
+				   uint64_t min, uint64_t len,
+				   uint64_t *first_bit, uint64_t *bits_found);
 errcode_t ocfs2_bitmap_clear_range(ocfs2_bitmap *bitmap, uint64_t len, 
 				   uint64_t first_bit);
 
@@ -680,6 +745,9 @@ uint64_t ocfs2_get_block_from_group(ocfs2_filesys *fs,
 
 errcode_t ocfs2_cache_chain_allocator_blocks(ocfs2_filesys *fs,
 					     struct ocfs2_dinode *di);
+errcode_t ocfs2_cache_chain_allocators_blocks(ocfs2_filesys *fs,
+					      struct ocfs2_dinode **dis,
+					      int nr_dis);
 errcode_t ocfs2_chain_iterate(ocfs2_filesys *fs,
 			      uint64_t blkno,
 			      int (*func)(ocfs2_filesys *fs,
@@ -694,6 +762,7 @@ errcode_t ocfs2_write_chain_allocator(ocfs2_filesys *fs,
 				      ocfs2_cached_inode *cinode);
 errcode_t ocfs2_chain_alloc(ocfs2_filesys *fs,
 			    ocfs2_cached_inode *cinode,
+			    uint64_t goal,
 			    uint64_t *gd_blkno,
 			    uint16_t *suballoc_bit,
 			    uint64_t *bitno);
@@ -702,6 +771,7 @@ errcode_t ocfs2_chain_free(ocfs2_filesys *fs,
 			   uint64_t bitno);
 errcode_t ocfs2_chain_alloc_range(ocfs2_filesys *fs,
 				  ocfs2_cached_inode *cinode,
+				  uint64_t goal,
 				  uint64_t min,
 				  uint64_t requested,
 				  uint64_t *start_bit,
@@ -754,6 +824,8 @@ errcode_t ocfs2_new_inode(ocfs2_filesys *fs, uint64_t *ino, int mode);
 errcode_t ocfs2_new_system_inode(ocfs2_filesys *fs, uint64_t *ino, int mode, int flags);
 errcode_t ocfs2_delete_inode(ocfs2_filesys *fs, uint64_t ino);
 errcode_t ocfs2_new_extent_block(ocfs2_filesys *fs, uint64_t *blkno);
+errcode_t ocfs2_new_extent_block_goal(ocfs2_filesys *fs, uint64_t goal,
+				      uint64_t *blkno);
 errcode_t ocfs2_new_dx_root(ocfs2_filesys *fs, struct ocfs2_dinode *di, uint64_t *dr_blkno);
 errcode_t ocfs2_delete_extent_block(ocfs2_filesys *fs, uint64_t blkno);
 errcode_t ocfs2_delete_dx_root(ocfs2_filesys *fs, uint64_t dr_blkno);
@@ -767,6 +839,8 @@ errcode_t ocfs2_extend_allocation(ocfs2_filesys *fs, uint64_t ino,
 /* Ditto for cached inode */
 errcode_t ocfs2_cached_inode_extend_allocation(ocfs2_cached_inode *ci,
 					       uint32_t new_clusters);
+/* The block new clusters for cpos should be allocated near */
+uint64_t ocfs2_file_alloc_goal(ocfs2_cached_inode *ci, uint32_t cpos);
 /* Extend the file to the new size. No clusters will be allocated. */
 errcode_t ocfs2_extend_file(ocfs2_filesys *fs, uint64_t ino, uint64_t new_size);
 
@@ -799,6 +873,12 @@ errcode_t ocfs2_new_clusters(ocfs2_filesys *fs,
 			     uint32_t requested,
 			     uint64_t *start_blkno,
 			     uint32_t *clusters_found);
+errcode_t ocfs2_new_clusters_goal(ocfs2_filesys *fs,
+				  uint64_t goal,
+				  uint32_t min,
+				  uint32_t requested,
+				  uint64_t *start_blkno,
+				  uint32_t *clusters_found);
 errcode_t ocfs2_test_cluster_allocated(ocfs2_filesys *fs, uint32_t cpos,
 				       int *is_allocated);
 errcode_t ocfs2_new_specific_cluster(ocfs2_filesys *fs, uint32_t cpos);
@@ -825,6 +905,11 @@ errcode_t ocfs2_follow_link(ocfs2_filesys *fs, uint64_t root, uint64_t cwd,
 
 errcode_t ocfs2_file_read(ocfs2_cached_inode *ci, void *buf, uint32_t count,
 			  uint64_t offset, uint32_t *got);
+errcode_t ocfs2_file_stream(ocfs2_cached_inode *ci, uint64_t offset,
+			    errcode_t (*func)(ocfs2_filesys *fs,
+					      uint64_t offset, char *buf,
+					      uint64_t len, void *priv_data),
+			    void *priv_data);
 
 errcode_t ocfs2_file_write(ocfs2_cached_inode *ci, void *buf, uint32_t count,
 			   uint64_t offset, uint32_t *wrote);
@@ -1224,6 +1309,24 @@ static inline uint64_t ocfs2_which_cluster_group(ocfs2_filesys *fs,
 	return ocfs2_clusters_to_blocks(fs, group_no * cpg);
 }
 
+/*
+ * The RAID full stripe width recorded by mkfs, in clusters.  Returns 0
+ * when none was recorded or when the stripe is not a whole number of
+ * clusters larger than one; cluster boundaries are then as good as it
+ * gets.
+ */
+static inline uint32_t ocfs2_stripe_clusters(ocfs2_filesys *fs)
+{
+	struct ocfs2_super_block *sb = OCFS2_RAW_SB(fs->fs_super);
+	uint32_t bpc = ocfs2_clusters_to_blocks(fs, 1);
+
+	if (!sb->s_raid_stripe_width || (sb->s_raid_stripe_width % bpc))
+		return 0;
+	if (sb->s_raid_stripe_width / bpc < 2)
+		return 0;
+	return sb->s_raid_stripe_width / bpc;
+}
+
 static inline int ocfs2_block_out_of_range(ocfs2_filesys *fs, uint64_t block)
 {
 	return (block < OCFS2_SUPER_BLOCK_BLKNO) || (block > fs->fs_blocks);
@@ -1603,6 +1706,10 @@ uint16_t ocfs2_xattr_name_value_len(struct ocfs2_xattr_header *xh);
 errcode_t ocfs2_read_xattr_bucket(ocfs2_filesys *fs,
 				  uint64_t blkno,
 				  char *bucket_buf);
+errcode_t ocfs2_read_xattr_buckets(ocfs2_filesys *fs,
+				   uint64_t blkno,
+				   uint32_t *nr_buckets,
+				   char *buckets_buf);
 errcode_t ocfs2_write_xattr_bucket(ocfs2_filesys *fs,
 				   uint64_t blkno,
 				   char *bucket_buf);
@@ -33,6 +33,7 @@
 
 static errcode_t ocfs2_chain_alloc_with_io(ocfs2_filesys *fs,
 					   ocfs2_cached_inode *cinode,
+					   uint64_t goal,
 					   uint64_t *gd_blkno,
 					   uint16_t *suballoc_bit,
 					   uint64_t *bitno)
@@ -45,7 +46,8 @@ static errcode_t ocfs2_chain_alloc_with_io(ocfs2_filesys *fs,
 			return ret;
 	}
 
-	ret = ocfs2_chain_alloc(fs, cinode, gd_blkno, suballoc_bit, bitno);
+	ret = ocfs2_chain_alloc(fs, cinode, goal, gd_blkno, suballoc_bit,
+				bitno);
 	if (ret)
 		return ret;
 
@@ -71,6 +73,21 @@ static errcode_t ocfs2_chain_free_with_io(ocfs2_filesys *fs,
 	return ocfs2_write_chain_allocator(fs, cinode);
 }
 
+/* Every allocation with a goal says how close it came */
+static void ocfs2_account_goal(ocfs2_filesys *fs, uint64_t goal,
+			       uint64_t blkno)
+{
+	struct ocfs2_alloc_stats *as = &fs->fs_alloc_stats;
+
+	if (!goal)
+		return;
+
+	as->as_hinted++;
+	if (blkno == goal)
+		as->as_goal_hits++;
+	as->as_goal_distance += (blkno > goal) ? blkno - goal : goal - blkno;
+}
+
 static errcode_t ocfs2_load_allocator(ocfs2_filesys *fs,
 				      int type, int slot_num,
 				      ocfs2_cached_inode **alloc_cinode)
@@ -251,13 +268,14 @@ errcode_t ocfs2_new_inode(ocfs2_filesys *fs, uint64_t *ino, int mode)
 		goto out;
 
 	ret = ocfs2_chain_alloc_with_io(fs, fs->fs_inode_allocs[0],
-					&gd_blkno, &suballoc_bit, ino);
+					0, &gd_blkno, &suballoc_bit, ino);
 	if (ret == OCFS2_ET_BIT_NOT_FOUND) {
 		ret = ocfs2_chain_add_group(fs, fs->fs_inode_allocs[0]);
 		if (ret)
 			goto out;
 		ret = ocfs2_chain_alloc_with_io(fs, fs->fs_inode_allocs[0],
-						&gd_blkno, &suballoc_bit, ino);
+						0, &gd_blkno, &suballoc_bit,
+						ino);
 		if (ret)
 			goto out;
 	} else if (ret)
@@ -297,13 +315,14 @@ errcode_t ocfs2_new_system_inode(ocfs2_filesys *fs, uint64_t *ino,
 		goto out;
 
 	ret = ocfs2_chain_alloc_with_io(fs, fs->fs_system_inode_alloc,
-					&gd_blkno, &suballoc_bit, ino);
+					0, &gd_blkno, &suballoc_bit, ino);
 	if (ret == OCFS2_ET_BIT_NOT_FOUND) {
 		ret = ocfs2_chain_add_group(fs, fs->fs_system_inode_alloc);
 		if (ret)
 			goto out;
 		ret = ocfs2_chain_alloc_with_io(fs, fs->fs_system_inode_alloc,
-						&gd_blkno, &suballoc_bit, ino);
+						0, &gd_blkno, &suballoc_bit,
+						ino);
 		if (ret)
 			goto out;
 	}
@@ -396,7 +415,9 @@ errcode_t ocfs2_test_inode_allocated(ocfs2_filesys *fs, uint64_t blkno,
 	return ret;
 }
 
-errcode_t ocfs2_new_extent_block(ocfs2_filesys *fs, uint64_t *blkno)
+/* Extent allocator bits are blocks, so goal is used as a bit as-is */
+errcode_t ocfs2_new_extent_block_goal(ocfs2_filesys *fs, uint64_t goal,
+				      uint64_t *blkno)
 {
 	errcode_t ret;
 	char *buf;
@@ -414,13 +435,13 @@ errcode_t ocfs2_new_extent_block(ocfs2_filesys *fs, uint64_t *blkno)
 		goto out;
 
 	ret = ocfs2_chain_alloc_with_io(fs, fs->fs_eb_allocs[0],
-					&gd_blkno, &suballoc_bit, blkno);
+					goal, &gd_blkno, &suballoc_bit, blkno);
 	if (ret == OCFS2_ET_BIT_NOT_FOUND) {
 		ret = ocfs2_chain_add_group(fs, fs->fs_eb_allocs[0]);
 		if (ret)
 			goto out;
 		ret = ocfs2_chain_alloc_with_io(fs, fs->fs_eb_allocs[0],
-						&gd_blkno, &suballoc_bit,
+						goal, &gd_blkno, &suballoc_bit,
 						blkno);
 		if (ret)
 			goto out;
@@ -432,6 +453,10 @@ errcode_t ocfs2_new_extent_block(ocfs2_filesys *fs, uint64_t *blkno)
 	ocfs2_init_eb(fs, eb, gd_blkno, suballoc_bit, *blkno);
 
 	ret = ocfs2_write_extent_block(fs, *blkno, buf);
+	if (!ret) {
+		fs->fs_alloc_stats.as_eb_calls++;
+		ocfs2_account_goal(fs, goal, *blkno);
+	}
 
 out:
 	ocfs2_free(&buf);
@@ -439,6 +464,11 @@ out:
 	return ret;
 }
 
+errcode_t ocfs2_new_extent_block(ocfs2_filesys *fs, uint64_t *blkno)
+{
+	return ocfs2_new_extent_block_goal(fs, 0, blkno);
+}
+
 errcode_t ocfs2_delete_xattr_block(ocfs2_filesys *fs, uint64_t blkno)
 {
 	errcode_t ret;
@@ -574,14 +604,15 @@ errcode_t ocfs2_new_refcount_block(ocfs2_filesys *fs, uint64_t *blkno,
 		goto out;
 
 	ret = ocfs2_chain_alloc_with_io(fs, fs->fs_eb_allocs[0],
-					&gd_blkno, &suballoc_bit, blkno);
+					root_blkno, &gd_blkno, &suballoc_bit,
+					blkno);
 	if (ret == OCFS2_ET_BIT_NOT_FOUND) {
 		ret = ocfs2_chain_add_group(fs, fs->fs_eb_allocs[0]);
 		if (ret)
 			goto out;
 		ret = ocfs2_chain_alloc_with_io(fs, fs->fs_eb_allocs[0],
-						&gd_blkno, &suballoc_bit,
-						blkno);
+						root_blkno, &gd_blkno,
+						&suballoc_bit, blkno);
 		if (ret)
 			goto out;
 	} else if (ret)
@@ -688,14 +719,15 @@ errcode_t ocfs2_new_dx_root(ocfs2_filesys *fs,
 		goto out;
 
 	ret = ocfs2_chain_alloc_with_io(fs, fs->fs_eb_allocs[slot],
-					&gd_blkno, &suballoc_bit, dr_blkno);
+					di->i_blkno, &gd_blkno, &suballoc_bit,
+					dr_blkno);
 	if (ret == OCFS2_ET_BIT_NOT_FOUND) {
 		ret = ocfs2_chain_add_group(fs, fs->fs_eb_allocs[slot]);
 		if (ret)
 			goto out;
 		ret = ocfs2_chain_alloc_with_io(fs, fs->fs_eb_allocs[slot],
-						&gd_blkno, &suballoc_bit,
-						dr_blkno);
+						di->i_blkno, &gd_blkno,
+						&suballoc_bit, dr_blkno);
 		if (ret)
 			goto out;
 	} else if (ret)
@@ -749,24 +781,116 @@ out:
  *     doesn't solve the issue of "is space still in dirty local
  *     allocs?"
  */
-errcode_t ocfs2_new_clusters(ocfs2_filesys *fs,
-			     uint32_t min,
-			     uint32_t requested,
-			     uint64_t *start_blkno,
-			     uint32_t *clusters_found)
+/*
+ * Look for a free run of at least min clusters that starts on a RAID
+ * stripe boundary and claim up to requested clusters of it.  The search
+ * starts at the goal bit and wraps around.  Returns
+ * OCFS2_ET_BIT_NOT_FOUND if there is no such run; the caller falls
+ * back to an unaligned allocation.
+ */
+static errcode_t ocfs2_new_clusters_aligned(ocfs2_filesys *fs,
+					    uint32_t stripe,
+					    uint64_t goal,
+					    uint64_t min,
+					    uint64_t requested,
+					    uint64_t *start_bit,
+					    uint64_t *found)
+{
+	errcode_t ret;
+	ocfs2_bitmap *bitmap = fs->fs_cluster_alloc->ci_chains;
+	uint64_t total = fs->fs_clusters;
+	uint64_t bit, limit, start, end, len, i;
+	int pass;
+
+	for (pass = 0; pass < 2; pass++) {
+		bit = pass ? 0 : goal;
+		limit = pass ? goal : total;
+
+		while (bit < limit) {
+			ret = ocfs2_bitmap_find_next_clear(bitmap, bit, &start);
+			if (ret == OCFS2_ET_BIT_NOT_FOUND)
+				break;
+			if (ret)
+				return ret;
+
+			start = (start + stripe - 1) / stripe * stripe;
+			if ((start >= limit) || (start + min > total))
+				break;
+
+			ret = ocfs2_bitmap_find_next_set(bitmap, start, &end);
+			if (ret == OCFS2_ET_BIT_NOT_FOUND)
+				end = total;
+			else if (ret)
+				return ret;
+
+			if (end - start >= min)
+				goto found;
+
+			bit = end > start ? end : start + 1;
+		}
+
+		if (!goal)
+			break;
+	}
+
+	return OCFS2_ET_BIT_NOT_FOUND;
+
+found:
+	len = ocfs2_min(end - start, requested);
+	for (i = start; i < start + len; i++) {
+		ret = ocfs2_bitmap_set(bitmap, i, NULL);
+		if (ret) {
+			if (i > start)
+				ocfs2_bitmap_clear_range(bitmap, i - start,
+							 start);
+			return ret;
+		}
+	}
+	*start_bit = start;
+	*found = len;
+	return 0;
+}
 
+/*
+ * goal is a block to allocate near, usually the block after a file's
+ * last extent or the inode itself.  Zero means no preference.
+ */
+errcode_t ocfs2_new_clusters_goal(ocfs2_filesys *fs,
+				  uint64_t goal,
+				  uint32_t min,
+				  uint32_t requested,
+				  uint64_t *start_blkno,
+				  uint32_t *clusters_found)
 {
 	errcode_t ret;
-	uint64_t start_bit;
+	uint64_t start_bit, goal_bit = 0;
 	uint64_t found;
+	uint32_t stripe = ocfs2_stripe_clusters(fs);
 
 	ret = ocfs2_load_allocator(fs, GLOBAL_BITMAP_SYSTEM_INODE,
 				   0, &fs->fs_cluster_alloc);
 	if (ret)
 		goto out;
 
-	ret = ocfs2_chain_alloc_range(fs, fs->fs_cluster_alloc, min, requested,
-				      &start_bit, &found);
+	if (goal >= fs->fs_blocks)
+		goal = 0;
+	goal_bit = ocfs2_blocks_to_clusters(fs, goal);
+
+	/*
+	 * Requests of at least a full stripe start on a stripe boundary
+	 * when the volume has one, so that large extents (journals,
+	 * allocator groups) don't straddle stripes.
+	 */
+	ret = OCFS2_ET_BIT_NOT_FOUND;
+	if (stripe && requested >= stripe)
+		ret = ocfs2_new_clusters_aligned(fs, stripe, goal_bit,
+						 ocfs2_max(min, stripe),
+						 requested, &start_bit,
+						 &found);
+	if (ret == OCFS2_ET_BIT_NOT_FOUND)
+		ret = ocfs2_chain_alloc_range(fs, fs->fs_cluster_alloc,
+					      goal_bit, min, requested,
+					      &start_bit, &found);
 	if (ret)
 		goto out;
 
@@ -777,13 +901,30 @@ errcode_t ocfs2_new_clusters(ocfs2_filesys *fs,
 	*clusters_found = (uint32_t) found;
 
 	ret = ocfs2_write_chain_allocator(fs, fs->fs_cluster_alloc);
-	if (ret)
+	if (ret) {
 		ocfs2_free_clusters(fs, requested, *start_blkno);
+		goto out;
+	}
+
+	fs->fs_alloc_stats.as_cluster_calls++;
+	fs->fs_alloc_stats.as_clusters += found;
+	ocfs2_account_goal(fs, ocfs2_clusters_to_blocks(fs, goal_bit),
+			   *start_blkno);
 
 out:
 	return ret;
 }
 
+errcode_t ocfs2_new_clusters(ocfs2_filesys *fs,
+			     uint32_t min,
+			     uint32_t requested,
+			     uint64_t *start_blkno,
+			     uint32_t *clusters_found)
+{
+	return ocfs2_new_clusters_goal(fs, 0, min, requested, start_blkno,
+				       clusters_found);
+}
+
 errcode_t ocfs2_test_cluster_allocated(ocfs2_filesys *fs, uint32_t cpos,
 				       int *is_allocated)
 {
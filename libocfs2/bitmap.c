@@ -136,17 +136,23 @@ errcode_t ocfs2_bitmap_find_next_clear(ocfs2_bitmap *bitmap,
 	return (*bitmap->b_ops->find_next_clear)(bitmap, start, found);
 }
 
-/* kind of poorly named, but I couldn't come up with something nicer */
-errcode_t ocfs2_bitmap_alloc_range(ocfs2_bitmap *bitmap, uint64_t min,
-				   uint64_t len, uint64_t *first_bit,
-				   uint64_t *bits_found)
+/*
+ * kind of poorly named, but I couldn't come up with something nicer.
+ * goal is only a hint; the search starts there and wraps around.
+ */
+errcode_t ocfs2_bitmap_alloc_range(ocfs2_bitmap *bitmap, uint64_t goal,
+				   uint64_t min, uint64_t len,
+				   uint64_t *first_bit, uint64_t *bits_found)
 {
 	errcode_t ret;
 
 	if (min == 0 || len == 0 || len >= bitmap->b_total_bits || min > len)
 		return OCFS2_ET_INVALID_ARGUMENT;
 
-	ret = (*bitmap->b_ops->alloc_range)(bitmap, min, len, first_bit,
+	if (goal >= bitmap->b_total_bits)
+		goal = 0;
+
+	ret = (*bitmap->b_ops->alloc_range)(bitmap, goal, min, len, first_bit,
 					    bits_found);
 	if (ret == 0 && *bits_found < min)
 		abort();
@@ -718,13 +724,21 @@ out:
 	return ret;
 }
 
+/*
+ * Regions are tried starting with the one holding goal, wrapping
+ * around to the first.  Within a region the search still starts at
+ * its first bit.
+ */
 errcode_t ocfs2_bitmap_alloc_range_generic(ocfs2_bitmap *bitmap,
+					   uint64_t goal,
 					   uint64_t min_len,
 					   uint64_t len,
 					   uint64_t *first_bit,
 					   uint64_t *bits_found)
 {
-	errcode_t ret;
+	errcode_t ret = 0;
+	struct ocfs2_bitmap_region *br;
+	struct rb_node *start = NULL, *node;
 	struct alloc_range_args ar = { 
 		.ar_bitmap = bitmap,
 		.ar_min_len = min_len,
@@ -732,8 +746,27 @@ errcode_t ocfs2_bitmap_alloc_range_generic(ocfs2_bitmap *bitmap,
 		.ar_ret = OCFS2_ET_BIT_NOT_FOUND,
 	};
 
-	ret = ocfs2_bitmap_foreach_region(bitmap, alloc_range_func,
-					  &ar);
+	br = ocfs2_bitmap_lookup(bitmap, goal, 1, NULL, NULL, &start);
+	if (br)
+		start = &br->br_node;
+	if (!start)
+		start = rb_first(&bitmap->b_regions);
+
+	node = start;
+	while (node) {
+		br = rb_entry(node, struct ocfs2_bitmap_region, br_node);
+		ret = alloc_range_func(br, &ar);
+		if (ret == OCFS2_ET_ITERATION_COMPLETE) {
+			ret = 0;
+			break;
+		}
+
+		node = rb_next(node);
+		if (!node)
+			node = rb_first(&bitmap->b_regions);
+		if (node == start)
+			break;
+	}
 	if (ret == 0)
 		ret = ar.ar_ret;
 
@@ -762,6 +795,27 @@ errcode_t ocfs2_bitmap_clear_range_generic(ocfs2_bitmap *bitmap,
 	return 0;
 }
 
+/* For alloc_range methods that pick their own bits */
+errcode_t ocfs2_bitmap_set_range_generic(ocfs2_bitmap *bitmap,
+					 uint64_t len,
+					 uint64_t first_bit)
+{
+	struct ocfs2_bitmap_region *br;
+	uint64_t end;
+
+	br = ocfs2_bitmap_lookup(bitmap, first_bit, len, NULL, NULL, NULL);
+	if (!br)
+		return OCFS2_ET_INVALID_BIT;
+	if ((first_bit < br->br_start_bit) ||
+	    ((first_bit + len) > (br->br_start_bit + br->br_valid_bits)))
+		return OCFS2_ET_INVALID_BIT;
+
+	for (end = first_bit + len; first_bit < end; first_bit++)
+		set_generic_shared(bitmap, br, first_bit);
+
+	return 0;
+}
+
 /*
  * Helper functions for a bitmap with holes in it.
  * If a bit doesn't have memory allocated for it, we allocate.
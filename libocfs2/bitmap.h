@@ -67,9 +67,9 @@ struct ocfs2_bitmap_operations {
 				  struct ocfs2_bitmap_region *br,
 				  uint64_t bitno,
 				  int new_val);
-	errcode_t (*alloc_range)(ocfs2_bitmap *bitmap, uint64_t min_len,
-				 uint64_t len, uint64_t *first_bit,
-				 uint64_t *bits_found);
+	errcode_t (*alloc_range)(ocfs2_bitmap *bitmap, uint64_t goal,
+				 uint64_t min_len, uint64_t len,
+				 uint64_t *first_bit, uint64_t *bits_found);
 	errcode_t (*clear_range)(ocfs2_bitmap *bitmap, uint64_t len, 
 				 uint64_t first_bit);
 };
@@ -120,6 +120,7 @@ errcode_t ocfs2_bitmap_find_next_clear_generic(ocfs2_bitmap *bitmap,
 					       uint64_t start,
 					       uint64_t *found);
 errcode_t ocfs2_bitmap_alloc_range_generic(ocfs2_bitmap *bitmap,
+					   uint64_t goal,
 					   uint64_t min_len,
 					   uint64_t len,
 					   uint64_t *first_bit,
@@ -127,6 +128,9 @@ errcode_t ocfs2_bitmap_alloc_range_generic(ocfs2_bitmap *bitmap,
 errcode_t ocfs2_bitmap_clear_range_generic(ocfs2_bitmap *bitmap,
 					   uint64_t len,
 					   uint64_t first_bit);
+errcode_t ocfs2_bitmap_set_range_generic(ocfs2_bitmap *bitmap,
+					 uint64_t len,
+					 uint64_t first_bit);
 errcode_t ocfs2_bitmap_set_holes(ocfs2_bitmap *bitmap,
 				 uint64_t bitno, int *oldval);
 errcode_t ocfs2_bitmap_clear_holes(ocfs2_bitmap *bitmap,
@@ -139,4 +143,16 @@ errcode_t ocfs2_bitmap_find_next_set_holes(ocfs2_bitmap *bitmap,
 errcode_t ocfs2_bitmap_find_next_clear_holes(ocfs2_bitmap *bitmap,
 					     uint64_t start,
 					     uint64_t *found);
+
+/* free_index.c */
+struct ocfs2_free_index;
+errcode_t ocfs2_free_index_build(ocfs2_bitmap *bitmap,
+				 struct ocfs2_free_index **ret_fi);
+void ocfs2_free_index_free(struct ocfs2_free_index **fi);
+errcode_t ocfs2_free_index_update(struct ocfs2_free_index *fi,
+				  struct ocfs2_bitmap_region *br,
+				  uint64_t bitno, int new_val);
+errcode_t ocfs2_free_index_find(struct ocfs2_free_index *fi, uint64_t goal,
+				uint64_t min_len, uint64_t len,
+				uint64_t *first_bit, uint64_t *bits_found);
 #endif  /* _BITMAP_H */
@@ -27,7 +27,9 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include <strings.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 #include "ocfs2/bitops.h"
@@ -161,19 +163,44 @@ int ocfs2_find_next_bit_clear(void *addr, int size, int offset)
 	return (res + d0 - 1);
 }
 
+/*
+ * Count the bits set in [offset, size).  Whole words go through the
+ * population count; only the ragged bytes at either end are masked.
+ */
 int ocfs2_get_bits_set(void *addr, int size, int offset)
 {
-	int set_bits = 0, found = 0;
-
-	while (1) {
-		found = ocfs2_find_next_bit_set(addr, size, offset);
-		if (found < size) {
-			set_bits++;
-			offset = found + 1;
-		} else
-			break;
+	const unsigned char *p = addr;
+	int set_bits = 0, start, end;
+	uint64_t word;
+
+	if (offset >= size)
+		return 0;
+
+	start = offset >> 3;
+	end = size >> 3;
+
+	if (start == end)
+		return __builtin_popcount(p[start] &
+					  ((1U << (size & 7)) - 1) &
+					  (0xffU << (offset & 7)));
+
+	if (offset & 7) {
+		set_bits += __builtin_popcount(p[start] &
+					       (0xffU << (offset & 7)));
+		start++;
 	}
 
+	for (; start + 8 <= end; start += 8) {
+		memcpy(&word, p + start, sizeof(word));
+		set_bits += __builtin_popcountll(word);
+	}
+	for (; start < end; start++)
+		set_bits += __builtin_popcount(p[start]);
+
+	if (size & 7)
+		set_bits += __builtin_popcount(p[end] &
+					       ((1U << (size & 7)) - 1));
+
 	return set_bits;
 }
 
@@ -76,6 +76,8 @@ errcode_t ocfs2_free_cached_inode(ocfs2_filesys *fs,
 	if (cinode->ci_chains)
 		ocfs2_bitmap_free(cinode->ci_chains);
 
+	ocfs2_drop_extent_map(fs, cinode);
+
 	if (cinode->ci_inode)
 		ocfs2_free(&cinode->ci_inode);
 
@@ -110,6 +112,8 @@ errcode_t ocfs2_refresh_cached_inode(ocfs2_filesys *fs,
 		cinode->ci_chains = NULL;
 	}
 
+	ocfs2_drop_extent_map(fs, cinode);
+
 	return ocfs2_read_inode(fs, cinode->ci_blkno,
 				(char *)cinode->ci_inode);
 }
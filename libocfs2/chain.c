@@ -303,39 +303,59 @@ uint64_t ocfs2_get_block_from_group(ocfs2_filesys *fs,
 		ocfs2_clusters_to_blocks(fs, rec->e_cpos));
 }
 
-errcode_t ocfs2_cache_chain_allocator_blocks(ocfs2_filesys *fs,
-					     struct ocfs2_dinode *di)
+/*
+ * Read the group descriptors of every chain of every allocator in
+ * 'dis' into the I/O cache.  The chains are walked in lockstep: each
+ * round reads the next descriptor of all the live chains with one
+ * vectored read, so the number of round trips is the length of the
+ * longest chain rather than the number of groups.  Allocators are
+ * taken in order for as long as their groups fit in the cache.
+ *
+ * A chain that runs into a bad descriptor is dropped and the others
+ * carry on; the first such error is returned.  Callers treat this as
+ * a hint and verify the chains themselves.
+ */
+errcode_t ocfs2_cache_chain_allocators_blocks(ocfs2_filesys *fs,
+					      struct ocfs2_dinode **dis,
+					      int nr_dis)
 {
 	struct io_vec_unit *ivus = NULL;
 	char *buf = NULL;
-	errcode_t ret = 0;
-	int i, j, count;
+	errcode_t ret = 0, err = 0;
+	int i, j, count = 0, nr = 0;
+	uint32_t groups, max_groups = 0, rounds = 0;
 	struct ocfs2_chain_list *cl;
 	struct ocfs2_chain_rec *cr;
 	struct ocfs2_group_desc *gd;
 	io_channel *channel = fs->fs_io;
 	int blocksize = fs->fs_blocksize;
-	int64_t group_size;
-
-	if (!(di->i_flags & OCFS2_CHAIN_FL)) {
-		ret = OCFS2_ET_INODE_NOT_VALID;
-		goto out;
-	}
+	uint64_t group_bytes = 0;
 
 	if (!channel)
 		goto out;
 
-	if (!di->i_clusters)
-		goto out;
+	for (nr = 0; nr < nr_dis; nr++) {
+		if (!(dis[nr]->i_flags & OCFS2_CHAIN_FL)) {
+			if (!err)
+				err = OCFS2_ET_INODE_NOT_VALID;
+			break;
+		}
 
-	group_size = (int64_t)di->i_clusters / di->id2.i_chain.cl_cpg;
-	group_size *= blocksize;
+		cl = &dis[nr]->id2.i_chain;
+		if (!cl->cl_cpg)
+			break;
+		groups = dis[nr]->i_clusters / cl->cl_cpg;
+		group_bytes += (uint64_t)groups * blocksize;
+		if (group_bytes > io_get_cache_size(channel))
+			break;
 
-	if (group_size > io_get_cache_size(channel))
-		goto out;
+		if (groups > max_groups)
+			max_groups = groups;
+		count += ocfs2_min(cl->cl_next_free_rec, cl->cl_count);
+	}
 
-	cl = &(di->id2.i_chain);
-	count = cl->cl_next_free_rec;
+	if (!count)
+		goto out;
 
 	ret = ocfs2_malloc_blocks(channel, count, &buf);
 	if (ret)
@@ -346,14 +366,24 @@ errcode_t ocfs2_cache_chain_allocator_blocks(ocfs2_filesys *fs,
 	if (ret)
 		goto out;
 
-	for (i = 0; i < count; ++i) {
-		cr = &(cl->cl_recs[i]);
-		ivus[i].ivu_blkno = cr->c_blkno;
-		ivus[i].ivu_buf = buf + (i * blocksize);
-		ivus[i].ivu_buflen = blocksize;
+	count = 0;
+	for (i = 0; i < nr; i++) {
+		cl = &dis[i]->id2.i_chain;
+		for (j = 0; j < ocfs2_min(cl->cl_next_free_rec, cl->cl_count);
+		     j++) {
+			cr = &cl->cl_recs[j];
+			if ((cr->c_blkno <= OCFS2_SUPER_BLOCK_BLKNO) ||
+			    (cr->c_blkno >= fs->fs_blocks))
+				continue;
+			ivus[count].ivu_blkno = cr->c_blkno;
+			ivus[count].ivu_buf = buf + (count * blocksize);
+			ivus[count].ivu_buflen = blocksize;
+			count++;
+		}
 	}
 
-	while (count) {
+	/* A looping chain must not keep us here forever */
+	while (count && rounds++ <= max_groups) {
 		ret = io_vec_read_blocks(channel, ivus, count);
 		if (ret)
 			goto out;
@@ -363,19 +393,22 @@ errcode_t ocfs2_cache_chain_allocator_blocks(ocfs2_filesys *fs,
 
 			ret = ocfs2_validate_meta_ecc(fs, ivus[i].ivu_buf,
 						      &gd->bg_check);
-			if (ret)
-				goto out;
-
-			if (memcmp(gd->bg_signature, OCFS2_GROUP_DESC_SIGNATURE,
-				   strlen(OCFS2_GROUP_DESC_SIGNATURE))) {
+			if (!ret &&
+			    memcmp(gd->bg_signature, OCFS2_GROUP_DESC_SIGNATURE,
+				   strlen(OCFS2_GROUP_DESC_SIGNATURE)))
 				ret = OCFS2_ET_BAD_GROUP_DESC_MAGIC;
-				goto out;
+			if (ret) {
+				if (!err)
+					err = ret;
+				ret = 0;
+				continue;
 			}
 			ocfs2_swap_group_desc_to_cpu(fs, gd);
 
 			if ((gd->bg_next_group > OCFS2_SUPER_BLOCK_BLKNO) &&
 			    (gd->bg_next_group < fs->fs_blocks)) {
 				ivus[j].ivu_blkno = gd->bg_next_group;
+				ivus[j].ivu_buf = buf + (j * blocksize);
 				memset(ivus[j].ivu_buf, 0, blocksize);
 				ivus[j].ivu_buflen = blocksize;
 				j++;
@@ -386,9 +419,20 @@ errcode_t ocfs2_cache_chain_allocator_blocks(ocfs2_filesys *fs,
 	}
 
 out:
-	ocfs2_free(&ivus);
-	ocfs2_free(&buf);
-	return ret;
+	if (ivus)
+		ocfs2_free(&ivus);
+	if (buf)
+		ocfs2_free(&buf);
+	return ret ? ret : err;
+}
+
+errcode_t ocfs2_cache_chain_allocator_blocks(ocfs2_filesys *fs,
+					     struct ocfs2_dinode *di)
+{
+	if (!(di->i_flags & OCFS2_CHAIN_FL))
+		return OCFS2_ET_INODE_NOT_VALID;
+
+	return ocfs2_cache_chain_allocators_blocks(fs, &di, 1);
 }
 
 #ifdef DEBUG_EXE
@@ -40,6 +40,10 @@ struct chainalloc_bitmap_private {
 	errcode_t		cb_errcode;
 	int			cb_dirty;
 	int			cb_suballoc;
+
+	/* Built on the first alloc_range(), kept current by
+	 * chainalloc_bit_change_notify() */
+	struct ocfs2_free_index	*cb_free_index;
 };
 
 struct chainalloc_region_private {
@@ -60,6 +64,7 @@ static void chainalloc_destroy_notify(ocfs2_bitmap *bitmap)
 	struct rb_node *node = NULL;
 	struct ocfs2_bitmap_region *br;
 	struct chainalloc_region_private *cr;
+	struct chainalloc_bitmap_private *cb;
 
 	for (node = rb_first(&bitmap->b_regions); node; node = rb_next(node)) {
 		br = rb_entry(node, struct ocfs2_bitmap_region, br_node);
@@ -74,6 +79,8 @@ static void chainalloc_destroy_notify(ocfs2_bitmap *bitmap)
 		ocfs2_free(&br->br_private);
 	}
 
+	cb = bitmap->b_private;
+	ocfs2_free_index_free(&cb->cb_free_index);
 	ocfs2_free(&bitmap->b_private);
 }
 
@@ -163,6 +170,9 @@ static errcode_t create_chainalloc_region(ocfs2_filesys *fs,
 	struct chainalloc_region_private *cr = NULL;
 	struct ocfs2_bitmap_region *br = NULL;
 
+	/* The index doesn't know about the new free bits */
+	ocfs2_free_index_free(&cb->cb_free_index);
+
 	while (total_bits) {
 		chainalloc_get_next_region(fs, gd, cb, &start_bit,
 					   bit_offset, &region_bits,
@@ -369,6 +379,48 @@ static void chainalloc_bit_change_notify(ocfs2_bitmap *bitmap,
 
 	cr->cr_dirty = 1;
 	cb->cb_dirty = 1;
+
+	/* If we can't keep the index right, drop it and rebuild later */
+	if (cb->cb_free_index &&
+	    ocfs2_free_index_update(cb->cb_free_index, br, bitno, new_val))
+		ocfs2_free_index_free(&cb->cb_free_index);
+}
+
+/*
+ * The global bitmap is asked for clusters over and over, and walking
+ * every group for each request adds up on a large volume.  Answer
+ * from the free run index instead, falling back to the walk only if
+ * the index can't be built.
+ */
+static errcode_t chainalloc_alloc_range(ocfs2_bitmap *bitmap,
+					uint64_t goal,
+					uint64_t min_len,
+					uint64_t len,
+					uint64_t *first_bit,
+					uint64_t *bits_found)
+{
+	errcode_t ret;
+	struct chainalloc_bitmap_private *cb = bitmap->b_private;
+	uint64_t start, found;
+
+	if (!cb->cb_free_index &&
+	    ocfs2_free_index_build(bitmap, &cb->cb_free_index))
+		return ocfs2_bitmap_alloc_range_generic(bitmap, goal, min_len,
+							len, first_bit,
+							bits_found);
+
+	ret = ocfs2_free_index_find(cb->cb_free_index, goal, min_len, len,
+				    &start, &found);
+	if (ret)
+		return ret;
+
+	ret = ocfs2_bitmap_set_range_generic(bitmap, found, start);
+	if (ret)
+		return ret;
+
+	*first_bit = start;
+	*bits_found = found;
+	return 0;
 }
 
 static struct ocfs2_bitmap_operations chainalloc_bitmap_ops = {
@@ -382,7 +434,7 @@ static struct ocfs2_bitmap_operations chainalloc_bitmap_ops = {
 	.write_bitmap		= chainalloc_write_bitmap,
 	.destroy_notify		= chainalloc_destroy_notify,
 	.bit_change_notify	= chainalloc_bit_change_notify,
-	.alloc_range		= ocfs2_bitmap_alloc_range_generic,
+	.alloc_range		= chainalloc_alloc_range,
 	.clear_range		= ocfs2_bitmap_clear_range_generic,
 };
 
@@ -470,10 +522,10 @@ errcode_t ocfs2_write_chain_allocator(ocfs2_filesys *fs,
 	return ocfs2_bitmap_write(cinode->ci_chains);
 }
 
-/* FIXME: should take a hint, no? */
 /* FIXME: Better name, too */
 errcode_t ocfs2_chain_alloc_range(ocfs2_filesys *fs,
 				  ocfs2_cached_inode *cinode,
+				  uint64_t goal,
 				  uint64_t min,
 				  uint64_t requested,
 				  uint64_t *start_bit,
@@ -482,8 +534,8 @@ errcode_t ocfs2_chain_alloc_range(ocfs2_filesys *fs,
 	if (!cinode->ci_chains)
 		return OCFS2_ET_INVALID_ARGUMENT;
 
-	return ocfs2_bitmap_alloc_range(cinode->ci_chains, min, requested,
-				        start_bit, bits_found);
+	return ocfs2_bitmap_alloc_range(cinode->ci_chains, goal, min,
+					requested, start_bit, bits_found);
 }
 
 errcode_t ocfs2_chain_free_range(ocfs2_filesys *fs,
@@ -525,20 +577,27 @@ static errcode_t chainalloc_find_gd(struct ocfs2_bitmap_region *br,
 	return 0;
 }
 
+/* The first clear bit at or after goal is taken, wrapping to zero */
 errcode_t ocfs2_chain_alloc(ocfs2_filesys *fs,
 			    ocfs2_cached_inode *cinode,
+			    uint64_t goal,
 			    uint64_t *gd_blkno,
 			    uint16_t *suballoc_bit,
 			    uint64_t *bitno)
 {
-	errcode_t ret;
+	errcode_t ret = OCFS2_ET_BIT_NOT_FOUND;
 	int oldval;
 	struct find_gd_state state;
 
 	if (!cinode->ci_chains)
 		return OCFS2_ET_INVALID_ARGUMENT;
 
-	ret = ocfs2_bitmap_find_next_clear(cinode->ci_chains, 0, bitno);
+	if (goal && (goal < cinode->ci_chains->b_total_bits))
+		ret = ocfs2_bitmap_find_next_clear(cinode->ci_chains, goal,
+						   bitno);
+	if (ret == OCFS2_ET_BIT_NOT_FOUND)
+		ret = ocfs2_bitmap_find_next_clear(cinode->ci_chains, 0,
+						   bitno);
 	if (ret)
 		return ret;
 
@@ -379,7 +379,8 @@ static errcode_t ocfs2_expand_inline_dx_root(ocfs2_filesys *fs,
 		goto out;
 	}
 
-	ret = ocfs2_new_clusters(fs, 1, 1, &start_blkno, &clusters_found);
+	ret = ocfs2_new_clusters_goal(fs, dx_root->dr_blkno, 1, 1,
+				      &start_blkno, &clusters_found);
 	if (ret)
 		goto out;
 	assert(clusters_found == 1);
@@ -697,6 +698,7 @@ out:
 }
 
 static errcode_t __ocfs2_dx_dir_new_cluster(ocfs2_filesys *fs,
+					uint64_t goal,
 					uint32_t cpos,
 					struct ocfs2_dx_leaf **dx_leaves,
 					int num_dx_leaves,
@@ -706,7 +708,7 @@ static errcode_t __ocfs2_dx_dir_new_cluster(ocfs2_filesys *fs,
 	uint32_t num;
 	uint64_t phys;
 
-	ret = ocfs2_new_clusters(fs, 1, 1, &phys, &num);
+	ret = ocfs2_new_clusters_goal(fs, goal, 1, 1, &phys, &num);
 	if (ret)
 		goto out;
 	assert(num == 1);
@@ -730,8 +732,8 @@ static errcode_t ocfs2_dx_dir_new_cluster(ocfs2_filesys *fs,
 {
 	errcode_t ret;
 	uint64_t blkno;
-	ret = __ocfs2_dx_dir_new_cluster(fs, cpos, dx_leaves,
-					num_dx_leaves, &blkno);
+	ret = __ocfs2_dx_dir_new_cluster(fs, et->et_root_blkno, cpos,
+					dx_leaves, num_dx_leaves, &blkno);
 	 if (ret)
 		 goto out;
 
@@ -35,6 +35,7 @@
 #include <assert.h>
 #include "ocfs2/ocfs2.h"
 #include "extent_tree.h"
+#include "extent_map.h"
 
 /*
  * Insert an extent into an inode btree.
@@ -68,13 +69,41 @@ errcode_t ocfs2_cached_inode_insert_extent(ocfs2_cached_inode *ci,
 					   uint32_t cpos, uint64_t c_blkno,
 					   uint32_t clusters, uint16_t flag)
 {
+	errcode_t ret;
 	struct ocfs2_extent_tree et;
 
 	ocfs2_init_dinode_extent_tree(&et, ci->ci_fs, (char *)ci->ci_inode,
 				      ci->ci_inode->i_blkno);
 
-	return ocfs2_tree_insert_extent(ci->ci_fs, &et, cpos, c_blkno,
-					clusters, flag);
+	ret = ocfs2_tree_insert_extent(ci->ci_fs, &et, cpos, c_blkno,
+				       clusters, flag);
+	if (ret)
+		ocfs2_drop_extent_map(ci->ci_fs, ci);
+	else
+		ocfs2_extent_map_insert(ci, cpos, c_blkno, clusters, flag);
+
+	return ret;
+}
+
+/*
+ * Where new clusters at cpos would best go: right after the ones
+ * holding cpos - 1, so the file stays contiguous, or else near the
+ * inode itself.
+ */
+uint64_t ocfs2_file_alloc_goal(ocfs2_cached_inode *ci, uint32_t cpos)
+{
+	errcode_t ret;
+	uint32_t p_cluster = 0, num_clusters;
+
+	if (cpos && !(ci->ci_inode->i_dyn_features & OCFS2_INLINE_DATA_FL)) {
+		ret = ocfs2_get_clusters(ci, cpos - 1, &p_cluster,
+					 &num_clusters, NULL);
+		if (!ret && p_cluster)
+			return ocfs2_clusters_to_blocks(ci->ci_fs,
+							p_cluster + 1);
+	}
+
+	return ci->ci_blkno;
 }
 
 errcode_t ocfs2_cached_inode_extend_allocation(ocfs2_cached_inode *ci,
@@ -82,15 +111,16 @@ errcode_t ocfs2_cached_inode_extend_allocation(ocfs2_cached_inode *ci,
 {
 	errcode_t ret = 0;
 	uint32_t n_clusters = 0, cpos;
-	uint64_t blkno, file_size;
+	uint64_t blkno, file_size, goal;
 	ocfs2_filesys *fs = ci->ci_fs;
 
 	file_size = ci->ci_inode->i_size;
 	cpos = (file_size + fs->fs_clustersize - 1) / fs->fs_clustersize;
+	goal = ocfs2_file_alloc_goal(ci, cpos);
 	while (new_clusters) {
 		n_clusters = 1;
-		ret = ocfs2_new_clusters(fs, 1, new_clusters, &blkno,
-					 &n_clusters);
+		ret = ocfs2_new_clusters_goal(fs, goal, 1, new_clusters,
+					      &blkno, &n_clusters);
 		if (ret)
 			break;
 
@@ -106,6 +136,7 @@ errcode_t ocfs2_cached_inode_extend_allocation(ocfs2_cached_inode *ci,
 
 	 	new_clusters -= n_clusters;
 		cpos += n_clusters;
+		goal = blkno + ocfs2_clusters_to_blocks(fs, n_clusters);
 	}
 	return ret;
 }
@@ -209,12 +240,14 @@ errcode_t ocfs2_allocate_unwritten_extents(ocfs2_filesys *fs, uint64_t ino,
 		 */
 		wanted_blocks = ocfs2_min(contig_blocks, v_end - v_blkno + 1);
 		n_clusters = ocfs2_clusters_in_blocks(fs, wanted_blocks);
-		ret = ocfs2_new_clusters(fs, 1, n_clusters, &p_blkno,
-					 &n_clusters);
+		cpos = ocfs2_blocks_to_clusters(fs, v_blkno);
+		ret = ocfs2_new_clusters_goal(fs,
+					      ocfs2_file_alloc_goal(ci, cpos),
+					      1, n_clusters, &p_blkno,
+					      &n_clusters);
 		if (ret || n_clusters == 0)
 			break;
 
-		cpos = ocfs2_blocks_to_clusters(fs, v_blkno);
 		ret = ocfs2_cached_inode_insert_extent(ci, cpos,
 						       p_blkno, n_clusters,
 						       OCFS2_EXT_UNWRITTEN);
@@ -126,6 +126,296 @@ out:
 	return ret;
 }
 
+/*
+ * The extent map of a cached inode holds the leaf records of its
+ * extent tree.  It is loaded with one walk of the tree the first time
+ * a lookup would otherwise read extent blocks, so walking a fragmented
+ * file front to back doesn't re-read the tree for every extent.
+ *
+ * Inline extent lists are looked up directly and never mapped.  The
+ * library paths that change the tree of a cached inode keep the map in
+ * step or drop it.  Anything else that changes ci_inode's i_clusters or
+ * i_last_eb_blk behind our back makes the map stale, and it is dropped
+ * on the next lookup.
+ */
+static inline ocfs2_extent_map_entry *extent_map_entry(struct rb_node *node)
+{
+	return node ? rb_entry(node, ocfs2_extent_map_entry, e_node) : NULL;
+}
+
+static inline uint32_t extent_map_entry_end(ocfs2_extent_map_entry *ent)
+{
+	return ent->e_rec.e_cpos + ent->e_rec.e_leaf_clusters;
+}
+
+/*
+ * Find the last entry starting at or before cpos and the first one
+ * starting after it.  Either may be NULL.
+ */
+static void ocfs2_extent_map_find(ocfs2_extent_map *em, uint32_t cpos,
+				  ocfs2_extent_map_entry **ret_prev,
+				  ocfs2_extent_map_entry **ret_next)
+{
+	struct rb_node *n = em->em_extents.rb_node;
+	ocfs2_extent_map_entry *ent, *prev = NULL, *next = NULL;
+
+	while (n) {
+		ent = extent_map_entry(n);
+		if (cpos < ent->e_rec.e_cpos) {
+			next = ent;
+			n = n->rb_left;
+		} else {
+			prev = ent;
+			n = n->rb_right;
+		}
+	}
+
+	*ret_prev = prev;
+	*ret_next = next;
+}
+
+static errcode_t ocfs2_extent_map_link(ocfs2_extent_map *em,
+				       ocfs2_extent_map_entry *new)
+{
+	struct rb_node **p = &em->em_extents.rb_node;
+	struct rb_node *parent = NULL;
+	ocfs2_extent_map_entry *ent;
+
+	while (*p) {
+		parent = *p;
+		ent = extent_map_entry(parent);
+		if (extent_map_entry_end(new) <= ent->e_rec.e_cpos)
+			p = &(*p)->rb_left;
+		else if (new->e_rec.e_cpos >= extent_map_entry_end(ent))
+			p = &(*p)->rb_right;
+		else
+			return OCFS2_ET_CORRUPT_EXTENT_BLOCK;
+	}
+
+	rb_link_node(&new->e_node, parent, p);
+	rb_insert_color(&new->e_node, &em->em_extents);
+
+	return 0;
+}
+
+static void ocfs2_extent_map_unlink(ocfs2_extent_map *em,
+				    ocfs2_extent_map_entry *ent)
+{
+	rb_erase(&ent->e_node, &em->em_extents);
+	ocfs2_free(&ent);
+}
+
+void ocfs2_drop_extent_map(ocfs2_filesys *fs, ocfs2_cached_inode *cinode)
+{
+	ocfs2_extent_map *em = cinode->ci_map;
+	struct rb_node *node;
+
+	if (!em)
+		return;
+
+	while ((node = rb_first(&em->em_extents)) != NULL)
+		ocfs2_extent_map_unlink(em, extent_map_entry(node));
+
+	ocfs2_free(&cinode->ci_map);
+}
+
+struct load_extent_map_context {
+	ocfs2_extent_map *em;
+	errcode_t errcode;
+};
+
+static int load_extent_map_func(ocfs2_filesys *fs,
+				struct ocfs2_extent_rec *rec,
+				int tree_depth, uint32_t ccount,
+				uint64_t ref_blkno, int ref_recno,
+				void *priv_data)
+{
+	struct load_extent_map_context *ctxt = priv_data;
+	ocfs2_extent_map_entry *ent;
+
+	if (!rec->e_leaf_clusters)
+		return 0;
+
+	ctxt->errcode = ocfs2_malloc0(sizeof(ocfs2_extent_map_entry), &ent);
+	if (ctxt->errcode)
+		return OCFS2_EXTENT_ABORT;
+
+	ent->e_rec = *rec;
+	ctxt->errcode = ocfs2_extent_map_link(ctxt->em, ent);
+	if (ctxt->errcode) {
+		ocfs2_free(&ent);
+		return OCFS2_EXTENT_ABORT;
+	}
+
+	return 0;
+}
+
+errcode_t ocfs2_load_extent_map(ocfs2_filesys *fs,
+				ocfs2_cached_inode *cinode)
+{
+	errcode_t ret;
+	struct ocfs2_dinode *di = cinode->ci_inode;
+	struct load_extent_map_context ctxt;
+
+	if (di->i_dyn_features & OCFS2_INLINE_DATA_FL)
+		return OCFS2_ET_INVALID_ARGUMENT;
+
+	ocfs2_drop_extent_map(fs, cinode);
+
+	ret = ocfs2_malloc0(sizeof(ocfs2_extent_map), &cinode->ci_map);
+	if (ret)
+		return ret;
+
+	ctxt.em = cinode->ci_map;
+	ctxt.errcode = 0;
+	ret = ocfs2_extent_iterate_inode(fs, di, OCFS2_EXTENT_FLAG_DATA_ONLY,
+					 NULL, load_extent_map_func, &ctxt);
+	if (!ret)
+		ret = ctxt.errcode;
+	if (ret) {
+		ocfs2_drop_extent_map(fs, cinode);
+		return ret;
+	}
+
+	cinode->ci_map->em_clusters = di->i_clusters;
+	cinode->ci_map->em_last_eb_blk = di->i_last_eb_blk;
+
+	return 0;
+}
+
+/*
+ * Record that [cpos, cpos + clusters) now maps to blkno with the given
+ * flags, after the same change has been made to the tree.  Whatever
+ * the map held for that range is replaced.  If we can't keep up, the
+ * map is dropped and the next lookup reloads it.
+ */
+void ocfs2_extent_map_insert(ocfs2_cached_inode *cinode, uint32_t cpos,
+			     uint64_t blkno, uint32_t clusters,
+			     uint16_t flags)
+{
+	ocfs2_filesys *fs = cinode->ci_fs;
+	ocfs2_extent_map *em = cinode->ci_map;
+	ocfs2_extent_map_entry *new = NULL, *tail = NULL;
+	ocfs2_extent_map_entry *prev, *next, *ent;
+	uint32_t end = cpos + clusters, skip;
+
+	if (!em)
+		return;
+
+	if (!clusters || (clusters > UINT16_MAX) ||
+	    ocfs2_malloc0(sizeof(ocfs2_extent_map_entry), &new) ||
+	    ocfs2_malloc0(sizeof(ocfs2_extent_map_entry), &tail))
+		goto drop;
+
+	ocfs2_extent_map_find(em, cpos, &prev, &next);
+
+	/* Cut the front off whatever overlaps us from the left */
+	if (prev && (extent_map_entry_end(prev) > cpos)) {
+		if (extent_map_entry_end(prev) > end) {
+			skip = end - prev->e_rec.e_cpos;
+			tail->e_rec = prev->e_rec;
+			tail->e_rec.e_cpos = end;
+			tail->e_rec.e_blkno +=
+				ocfs2_clusters_to_blocks(fs, skip);
+			tail->e_rec.e_leaf_clusters -= skip;
+		}
+
+		prev->e_rec.e_leaf_clusters = cpos - prev->e_rec.e_cpos;
+		if (!prev->e_rec.e_leaf_clusters)
+			ocfs2_extent_map_unlink(em, prev);
+
+		if (tail->e_rec.e_leaf_clusters) {
+			if (ocfs2_extent_map_link(em, tail))
+				goto drop;
+			tail = NULL;
+		}
+	}
+
+	/* And everything starting inside us */
+	while (next && (next->e_rec.e_cpos < end)) {
+		ent = next;
+		next = extent_map_entry(rb_next(&ent->e_node));
+
+		if (extent_map_entry_end(ent) <= end) {
+			ocfs2_extent_map_unlink(em, ent);
+			continue;
+		}
+
+		skip = end - ent->e_rec.e_cpos;
+		ent->e_rec.e_cpos = end;
+		ent->e_rec.e_blkno += ocfs2_clusters_to_blocks(fs, skip);
+		ent->e_rec.e_leaf_clusters -= skip;
+	}
+
+	new->e_rec.e_cpos = cpos;
+	new->e_rec.e_blkno = blkno;
+	new->e_rec.e_leaf_clusters = clusters;
+	new->e_rec.e_flags = flags;
+	if (ocfs2_extent_map_link(em, new))
+		goto drop;
+
+	em->em_clusters = cinode->ci_inode->i_clusters;
+	em->em_last_eb_blk = cinode->ci_inode->i_last_eb_blk;
+
+	if (tail)
+		ocfs2_free(&tail);
+	return;
+
+drop:
+	if (new)
+		ocfs2_free(&new);
+	if (tail)
+		ocfs2_free(&tail);
+	ocfs2_drop_extent_map(fs, cinode);
+}
+
+static int ocfs2_extent_map_valid(ocfs2_cached_inode *cinode)
+{
+	ocfs2_extent_map *em = cinode->ci_map;
+	struct ocfs2_dinode *di = cinode->ci_inode;
+
+	return (em->em_clusters == di->i_clusters) &&
+		(em->em_last_eb_blk == di->i_last_eb_blk);
+}
+
+static errcode_t ocfs2_extent_map_get_clusters(ocfs2_cached_inode *cinode,
+					       uint32_t v_cluster,
+					       uint32_t *p_cluster,
+					       uint32_t *num_clusters,
+					       uint16_t *extent_flags)
+{
+	ocfs2_extent_map_entry *prev, *next;
+	struct ocfs2_extent_rec *rec;
+	uint32_t coff;
+
+	ocfs2_extent_map_find(cinode->ci_map, v_cluster, &prev, &next);
+
+	if (!prev || (extent_map_entry_end(prev) <= v_cluster)) {
+		*p_cluster = 0;
+		if (num_clusters)
+			*num_clusters = next ?
+				next->e_rec.e_cpos - v_cluster :
+				UINT32_MAX - v_cluster;
+		if (extent_flags)
+			*extent_flags = 0;
+		return 0;
+	}
+
+	rec = &prev->e_rec;
+	if (!rec->e_blkno)
+		return OCFS2_ET_BAD_BLKNO;
+
+	coff = v_cluster - rec->e_cpos;
+	*p_cluster = ocfs2_blocks_to_clusters(cinode->ci_fs, rec->e_blkno) +
+		coff;
+	if (num_clusters)
+		*num_clusters = rec->e_leaf_clusters - coff;
+	if (extent_flags)
+		*extent_flags = rec->e_flags;
+
+	return 0;
+}
+
 errcode_t ocfs2_get_clusters(ocfs2_cached_inode *cinode,
 			     uint32_t v_cluster,
 			     uint32_t *p_cluster,
@@ -147,6 +437,16 @@ errcode_t ocfs2_get_clusters(ocfs2_cached_inode *cinode,
 	el = &di->id2.i_list;
 
 	if (el->l_tree_depth) {
+		if (cinode->ci_map && !ocfs2_extent_map_valid(cinode))
+			ocfs2_drop_extent_map(fs, cinode);
+
+		/* If the map can't be loaded, walk the tree as before */
+		if (cinode->ci_map || !ocfs2_load_extent_map(fs, cinode))
+			return ocfs2_extent_map_get_clusters(cinode, v_cluster,
+							     p_cluster,
+							     num_clusters,
+							     extent_flags);
+
 		ret = ocfs2_find_leaf(fs, di, v_cluster, &eb_buf);
 		if (ret)
 			goto out;
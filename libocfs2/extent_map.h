@@ -31,9 +31,15 @@
 
 typedef struct _ocfs2_extent_map_entry ocfs2_extent_map_entry;
 
+/*
+ * The leaf records of a cached inode's extent tree, keyed by e_cpos.
+ * em_clusters and em_last_eb_blk are the inode's values when the map
+ * was last in sync with the tree.
+ */
 struct _ocfs2_extent_map {
 	struct rb_root em_extents;
 	uint32_t em_clusters;
+	uint64_t em_last_eb_blk;
 };
 
 struct _ocfs2_extent_map_entry {
@@ -42,4 +48,8 @@ struct _ocfs2_extent_map_entry {
 	struct ocfs2_extent_rec e_rec;
 };
 
+void ocfs2_extent_map_insert(ocfs2_cached_inode *cinode, uint32_t cpos,
+			     uint64_t blkno, uint32_t clusters,
+			     uint16_t flags);
+
 #endif  /* _EXTENT_MAP_H */
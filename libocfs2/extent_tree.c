@@ -674,7 +674,7 @@ static int ocfs2_add_branch(ocfs2_filesys *fs,
 {
 	errcode_t ret;
 	int new_blocks, i;
-	uint64_t next_blkno, new_last_eb_blk;
+	uint64_t next_blkno, new_last_eb_blk, goal;
 	struct ocfs2_extent_block *eb;
 	struct ocfs2_extent_list  *eb_el;
 	struct ocfs2_extent_list  *el;
@@ -708,13 +708,16 @@ static int ocfs2_add_branch(ocfs2_filesys *fs,
 		goto bail;
 	memset(new_eb_bufs, 0, sizeof(char *) * new_blocks);
 
+	/* Keep the new branch near the current last leaf */
+	eb = (struct ocfs2_extent_block *)(*last_eb_buf);
+	goal = eb->h_blkno;
 	for (i = 0; i < new_blocks; i++) {
 		ret = ocfs2_malloc_block(fs->fs_io, &buf);
 		if (ret)
 			return ret;
 		new_eb_bufs[i] = buf;
 
-		ret = ocfs2_new_extent_block(fs, &new_blknos[i]);
+		ret = ocfs2_new_extent_block_goal(fs, goal, &new_blknos[i]);
 		if (ret)
 			goto bail;
 
@@ -2594,7 +2597,8 @@ static errcode_t shift_tree_depth(ocfs2_filesys *fs,
 	if (ret)
 		return ret;
 
-	ret = ocfs2_new_extent_block(fs, &blkno);
+	/* The first extent block goes near the tree's owner */
+	ret = ocfs2_new_extent_block_goal(fs, et->et_root_blkno, &blkno);
 	if (ret)
 		goto out;
 
@@ -2969,6 +2973,88 @@ static int ocfs2_adjust_rightmost_records(ocfs2_filesys *fs,
 	return 0;
 }
 
+/*
+ * Files written front to back always insert past the end of the
+ * rightmost leaf, and with goal allocation the new clusters usually
+ * follow the last record on disk too.  Handle that case here: grow the
+ * last record, or add one when the leaf has room, then fix up the
+ * rightmost path.  Only the blocks on that path are read and written,
+ * deepest first, so we skip both the copy-on-write of the whole tree
+ * and the generic insert.  *appended is 0 if the caller has to do a
+ * full insert instead.
+ */
+static errcode_t ocfs2_append_extent_fast(ocfs2_filesys *fs,
+					  struct ocfs2_extent_tree *et,
+					  struct ocfs2_extent_rec *insert_rec,
+					  int *appended)
+{
+	errcode_t ret;
+	int i;
+	uint32_t len;
+	struct ocfs2_path *path;
+	struct ocfs2_extent_list *el;
+	struct ocfs2_extent_rec *rec;
+
+	*appended = 0;
+
+	/* Refcount trees have their own idea of contiguous */
+	if (et->et_ops->eo_extent_contig)
+		return 0;
+
+	if (!et->et_root_el->l_next_free_rec)
+		return 0;
+
+	path = ocfs2_new_path_from_et(et);
+	if (!path)
+		return OCFS2_ET_NO_MEMORY;
+
+	ret = ocfs2_find_path(fs, path, UINT_MAX);
+	if (ret)
+		goto out;
+
+	el = path_leaf_el(path);
+	if (path->p_tree_depth &&
+	    (path_leaf_blkno(path) != ocfs2_et_get_last_eb_blk(et)))
+		goto out;
+	if (!el->l_next_free_rec)
+		goto out;
+
+	rec = &el->l_recs[el->l_next_free_rec - 1];
+	if (ocfs2_is_empty_extent(rec) ||
+	    (insert_rec->e_cpos < (rec->e_cpos + rec->e_leaf_clusters)))
+		goto out;
+
+	len = rec->e_leaf_clusters + insert_rec->e_leaf_clusters;
+	if ((ocfs2_extent_rec_contig(fs, rec, insert_rec) == CONTIG_RIGHT) &&
+	    (len <= UINT16_MAX) &&
+	    (!et->et_max_leaf_clusters || (len <= et->et_max_leaf_clusters)))
+		rec->e_leaf_clusters = len;
+	else if (el->l_next_free_rec < el->l_count) {
+		rec = &el->l_recs[el->l_next_free_rec];
+		*rec = *insert_rec;
+		el->l_next_free_rec++;
+	} else
+		goto out;
+
+	ret = ocfs2_adjust_rightmost_records(fs, path, rec);
+	if (ret)
+		goto out;
+
+	for (i = path->p_tree_depth; i > 0; i--) {
+		ret = ocfs2_write_extent_block(fs, path->p_node[i].blkno,
+					       path->p_node[i].buf);
+		if (ret)
+			goto out;
+	}
+
+	ocfs2_et_update_clusters(et, insert_rec->e_leaf_clusters);
+	*appended = 1;
+
+out:
+	ocfs2_free_path(path);
+	return ret;
+}
+
 static int ocfs2_append_rec_to_path(ocfs2_filesys *fs,
 				    struct ocfs2_extent_rec *insert_rec,
 				    struct ocfs2_path *right_path,
@@ -3329,7 +3415,8 @@ static errcode_t duplicate_extent_block(ocfs2_filesys *fs,
 		}
 
 		/* now we allocate a new extent block and save it. */
-		ret = ocfs2_new_extent_block(fs, &new_blkno);
+		ret = ocfs2_new_extent_block_goal(fs, ctxt->et->et_root_blkno,
+						  &new_blkno);
 		if (ret)
 			goto bail;
 
@@ -3525,11 +3612,23 @@ errcode_t ocfs2_tree_insert_extent(ocfs2_filesys *fs,
 	char *last_eb = NULL;
 	char *backup_buf = NULL;
 	char *root_buf = et->et_root_buf;
-	int free_records = 0;
+	int free_records = 0, appended = 0;
 
 	ctxt.fs = fs;
 	ctxt.et = et;
 
+	memset(&ctxt.rec, 0, sizeof(struct ocfs2_extent_rec));
+	ctxt.rec.e_cpos = cpos;
+	ctxt.rec.e_blkno = c_blkno;
+	ctxt.rec.e_leaf_clusters = clusters;
+	ctxt.rec.e_flags = flag;
+
+	ret = ocfs2_append_extent_fast(fs, et, &ctxt.rec, &appended);
+	if (ret)
+		return ret;
+	if (appended)
+		goto write_root;
+
 	/* In order to orderize the written block sequence and avoid
 	 * the corruption for the b-tree, we duplicate the extent block
 	 * here and do the insertion in the duplicated ones.
@@ -3557,12 +3656,6 @@ errcode_t ocfs2_tree_insert_extent(ocfs2_filesys *fs,
 		}
 	}
 
-	memset(&ctxt.rec, 0, sizeof(struct ocfs2_extent_rec));
-	ctxt.rec.e_cpos = cpos;
-	ctxt.rec.e_blkno = c_blkno;
-	ctxt.rec.e_leaf_clusters = clusters;
-	ctxt.rec.e_flags = flag;
-
 	ret = ocfs2_malloc_block(fs->fs_io, &last_eb);
 	if (ret)
 		return ret;
@@ -3606,6 +3699,7 @@ bail:
 	if (last_eb)
 		ocfs2_free(&last_eb);
 
+write_root:
 	/*
 	 * Write the root buffer here.
 	 * If the caller don't initialize the write function, it should
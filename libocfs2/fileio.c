@@ -34,6 +34,7 @@
 
 #include "ocfs2/ocfs2.h"
 #include "refcount.h"
+#include "extent_map.h"
 
 struct read_whole_context {
 	char		*buf;
@@ -234,6 +235,264 @@ errcode_t ocfs2_file_read(ocfs2_cached_inode *ci, void *buf, uint32_t count,
 	return ret;
 }
 
+/*
+ * ocfs2_file_stream() maps and reads a file a batch at a time.  A batch
+ * is up to OCFS2_STREAM_BATCH_BYTES of data in up to OCFS2_STREAM_RUNS
+ * reads, all in flight at once.  While func works through one batch,
+ * the next one is being read.
+ */
+#define OCFS2_STREAM_BATCH_BYTES	(4 * 1024 * 1024)
+#define OCFS2_STREAM_RUNS		64
+/* Holes are merged, so at most one sits between two data runs */
+#define OCFS2_STREAM_ENTRIES		(OCFS2_STREAM_RUNS * 2 + 1)
+
+struct stream_run {
+	uint64_t	sr_offset;
+	uint64_t	sr_len;
+	char		*sr_buf;	/* NULL for holes */
+};
+
+struct stream_batch {
+	struct stream_run	sb_runs[OCFS2_STREAM_ENTRIES];
+	int			sb_nr_runs;
+	struct io_vec_unit	sb_ivus[OCFS2_STREAM_RUNS];
+	int			sb_nr_ivus;
+	char			*sb_buf;
+	uint64_t		sb_buflen;
+	struct io_vec_read	*sb_read;
+	int			sb_reading;
+};
+
+/*
+ * Map the file from *pos onwards into sb until it is full, and leave
+ * *pos where the batch ends.
+ */
+static errcode_t stream_batch_fill(ocfs2_cached_inode *ci,
+				   struct stream_batch *sb, uint64_t *pos)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ci->ci_fs;
+	int bs_bits = OCFS2_RAW_SB(fs->fs_super)->s_blocksize_bits;
+	uint64_t size = ci->ci_inode->i_size;
+	uint64_t p_blkno, contig_blocks, len, used = 0;
+	uint16_t extent_flags;
+	struct stream_run *sr;
+	struct io_vec_unit *ivu;
+
+	sb->sb_nr_runs = 0;
+	sb->sb_nr_ivus = 0;
+
+	while ((*pos < size) && (sb->sb_nr_runs < OCFS2_STREAM_ENTRIES) &&
+	       (used < sb->sb_buflen)) {
+		ret = ocfs2_extent_map_get_blocks(ci, *pos >> bs_bits, 1,
+						  &p_blkno, &contig_blocks,
+						  &extent_flags);
+		if (ret)
+			return ret;
+
+		len = ocfs2_min(contig_blocks << bs_bits, size - *pos);
+		sr = &sb->sb_runs[sb->sb_nr_runs];
+
+		if (!p_blkno || (extent_flags & OCFS2_EXT_UNWRITTEN)) {
+			if (sb->sb_nr_runs && !sr[-1].sr_buf) {
+				sr[-1].sr_len += len;
+			} else {
+				sr->sr_offset = *pos;
+				sr->sr_len = len;
+				sr->sr_buf = NULL;
+				sb->sb_nr_runs++;
+			}
+			*pos += len;
+			continue;
+		}
+
+		len = ocfs2_min(len, sb->sb_buflen - used);
+		ivu = &sb->sb_ivus[sb->sb_nr_ivus];
+
+		/* Extents that are adjacent on disk are read together */
+		if (sb->sb_nr_runs && sr[-1].sr_buf &&
+		    (ivu[-1].ivu_blkno + (ivu[-1].ivu_buflen >> bs_bits) ==
+		     p_blkno)) {
+			sr[-1].sr_len += len;
+			ivu[-1].ivu_buflen +=
+				ocfs2_align_bytes_to_blocks(fs, len);
+		} else {
+			if (sb->sb_nr_ivus == OCFS2_STREAM_RUNS)
+				break;
+			ivu->ivu_blkno = p_blkno;
+			ivu->ivu_buf = sb->sb_buf + used;
+			ivu->ivu_buflen = ocfs2_align_bytes_to_blocks(fs, len);
+			sb->sb_nr_ivus++;
+
+			sr->sr_offset = *pos;
+			sr->sr_len = len;
+			sr->sr_buf = ivu->ivu_buf;
+			sb->sb_nr_runs++;
+		}
+
+		used += ocfs2_align_bytes_to_blocks(fs, len);
+		*pos += len;
+	}
+
+	return 0;
+}
+
+/*
+ * Without a handle, the batch is read right away.  An o2image file has
+ * no handle, and its blocks must be remapped by ocfs2_read_blocks().
+ */
+static errcode_t stream_batch_start(ocfs2_filesys *fs,
+				    struct stream_batch *sb)
+{
+	errcode_t ret = 0;
+	struct io_vec_unit *ivu;
+	int i;
+
+	if (!sb->sb_nr_ivus)
+		return 0;
+
+	if (sb->sb_read) {
+		ret = io_vec_read_start(sb->sb_read, sb->sb_ivus,
+					sb->sb_nr_ivus);
+		if (!ret)
+			sb->sb_reading = 1;
+		return ret;
+	}
+
+	for (i = 0; !ret && (i < sb->sb_nr_ivus); i++) {
+		ivu = &sb->sb_ivus[i];
+		if (fs->fs_flags & OCFS2_FLAG_IMAGE_FILE)
+			ret = ocfs2_read_blocks(fs, ivu->ivu_blkno,
+						ivu->ivu_buflen /
+						fs->fs_blocksize,
+						ivu->ivu_buf);
+		else
+			ret = io_read_block_nocache(fs->fs_io, ivu->ivu_blkno,
+						    ivu->ivu_buflen /
+						    fs->fs_blocksize,
+						    ivu->ivu_buf);
+	}
+
+	return ret;
+}
+
+static errcode_t stream_batch_finish(struct stream_batch *sb)
+{
+	if (!sb->sb_reading)
+		return 0;
+
+	sb->sb_reading = 0;
+	return io_vec_read_finish(sb->sb_read);
+}
+
+/*
+ * Hand the contents of the file from offset to i_size to func, in
+ * order.  Each call covers a run of data that was read together, or a
+ * stretch of holes and unwritten extents.  The latter are passed with
+ * a NULL buf and are never read.  buf is only valid until func
+ * returns.  If func returns an error, streaming stops and that error
+ * is returned.
+ *
+ * offset must be block aligned.  Reads are large and are kept in
+ * flight while func runs, so callers copying a big file off the
+ * device should prefer this to looping over ocfs2_file_read().
+ */
+errcode_t ocfs2_file_stream(ocfs2_cached_inode *ci, uint64_t offset,
+			    errcode_t (*func)(ocfs2_filesys *fs,
+					      uint64_t offset, char *buf,
+					      uint64_t len, void *priv_data),
+			    void *priv_data)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ci->ci_fs;
+	struct ocfs2_dinode *di = ci->ci_inode;
+	struct stream_batch *batches = NULL, *sb;
+	struct io_vec_read *ivr = NULL;
+	char *buf = NULL;
+	uint64_t pos = offset, buflen;
+	int i, cur = 0;
+
+	if (di->i_dyn_features & OCFS2_INLINE_DATA_FL) {
+		if (offset >= di->i_size)
+			return 0;
+		if (di->i_size > di->id2.i_data.id_count)
+			return OCFS2_ET_CORRUPT_EXTENT_BLOCK;
+		return func(fs, offset, (char *)di->id2.i_data.id_data + offset,
+			    di->i_size - offset, priv_data);
+	}
+
+	if (offset & (fs->fs_blocksize - 1))
+		return OCFS2_ET_INVALID_ARGUMENT;
+
+	if (offset >= di->i_size)
+		return 0;
+
+	ret = ocfs2_malloc0(sizeof(struct stream_batch) * 2, &batches);
+	if (ret)
+		goto out;
+
+	/* Small files get a small buffer, and only one batch */
+	buflen = ocfs2_min(ocfs2_align_bytes_to_blocks(fs, di->i_size - offset),
+			   (uint64_t)OCFS2_STREAM_BATCH_BYTES);
+	ret = ocfs2_malloc_blocks(fs->fs_io,
+				  ocfs2_blocks_in_bytes(fs, buflen * 2), &buf);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < 2; i++) {
+		batches[i].sb_buf = buf + i * buflen;
+		batches[i].sb_buflen = buflen;
+	}
+
+	ret = stream_batch_fill(ci, &batches[0], &pos);
+	if (ret)
+		goto out;
+
+	/*
+	 * Only files that take more than one batch have anything to
+	 * overlap.  Setting up the aio context isn't free, so the rest
+	 * are read directly.  So are o2image files, whose blocks the
+	 * aio reads wouldn't remap.
+	 */
+	if ((pos < di->i_size) && !(fs->fs_flags & OCFS2_FLAG_IMAGE_FILE)) {
+		ret = io_vec_read_init(fs->fs_io, OCFS2_STREAM_RUNS, &ivr);
+		if (ret)
+			goto out;
+		batches[0].sb_read = batches[1].sb_read = ivr;
+	}
+
+	ret = stream_batch_start(fs, &batches[0]);
+	while (!ret && batches[cur].sb_nr_runs) {
+		sb = &batches[cur];
+		cur = !cur;
+
+		ret = stream_batch_finish(sb);
+
+		/* Get the next batch going while func works on this one */
+		if (!ret)
+			ret = stream_batch_fill(ci, &batches[cur], &pos);
+		if (!ret)
+			ret = stream_batch_start(fs, &batches[cur]);
+
+		for (i = 0; !ret && (i < sb->sb_nr_runs); i++)
+			ret = func(fs, sb->sb_runs[i].sr_offset,
+				   sb->sb_runs[i].sr_buf,
+				   sb->sb_runs[i].sr_len, priv_data);
+	}
+
+out:
+	if (batches) {
+		/* Nothing may still be reading into buf when it is freed */
+		for (i = 0; i < 2; i++)
+			stream_batch_finish(&batches[i]);
+		ocfs2_free(&batches);
+	}
+	io_vec_read_free(ivr);
+	if (buf)
+		ocfs2_free(&buf);
+	return ret;
+}
+
 /*
  * Emtpy the blocks on the disk.
  */
@@ -364,8 +623,9 @@ static errcode_t ocfs2_file_block_write(ocfs2_cached_inode *ci,
 			cluster_end = ocfs2_blocks_to_clusters(fs,
 						v_blkno + contig_blocks -1);
 			n_clusters = cluster_end - cluster_begin + 1;
-			ret = ocfs2_new_clusters(fs, 1, n_clusters, &p_start,
-						 &n_clusters);
+			ret = ocfs2_new_clusters_goal(fs,
+					ocfs2_file_alloc_goal(ci, cluster_begin),
+					1, n_clusters, &p_start, &n_clusters);
 			if (ret || n_clusters == 0)
 				return ret;
 
@@ -447,16 +707,17 @@ static errcode_t ocfs2_file_block_write(ocfs2_cached_inode *ci,
 			ret = ocfs2_mark_extent_written(fs, ci->ci_inode,
 					cluster_begin, n_clusters,
 					p_blkno & ~(bpc - 1));
-			if (ret)
+			if (ret) {
+				ocfs2_drop_extent_map(fs, ci);
 				return ret;
+			}
 			/*
-			 * We don't cache in the library right now, so any
-			 * work done in mark_extent_written won't be reflected
-			 * in our now stale copy. So refresh it.
+			 * mark_extent_written worked on ci_inode itself,
+			 * so only the extent map needs to catch up.
 			 */
-			ret = ocfs2_refresh_cached_inode(fs, ci);
-			if (ret)
-				return ret;
+			ocfs2_extent_map_insert(ci, cluster_begin,
+					p_blkno & ~(bpc - 1), n_clusters,
+					extent_flags & ~OCFS2_EXT_UNWRITTEN);
 		}
 
 		*wrote += (contig_blocks << bs_bits);
@@ -530,7 +791,8 @@ errcode_t ocfs2_convert_inline_data_to_extents(ocfs2_cached_inode *ci)
 	ocfs2_dinode_new_extent_list(fs, di);
 	di->i_dyn_features &= ~OCFS2_INLINE_DATA_FL;
 
-	ret = ocfs2_new_clusters(fs, 1, 1, &p_start, &n_clusters);
+	ret = ocfs2_new_clusters_goal(fs, ci->ci_blkno, 1, 1, &p_start,
+				      &n_clusters);
 	if (ret || n_clusters == 0)
 		goto out;
 
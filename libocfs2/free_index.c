@@ -0,0 +1,412 @@
+/* -*- mode: c; c-basic-offset: 8; -*-
+ * vim: noexpandtab sw=8 ts=8 sts=0:
+ *
+ * free_index.c
+ *
+ * An in-memory index of the free runs in a bitmap, so that the
+ * allocators don't have to walk every region for each request.
+ *
+ * Copyright (C) 2026 Oracle.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+/*
+ * Every maximal run of clear bits inside a bitmap region is one
+ * ocfs2_free_run.  Runs never span regions, just like the bits they
+ * describe.  Each run lives in two trees, both ordered by start bit:
+ *
+ *   fi_runs	   - every run.  Used to find the run holding a bit, and
+ *		     its neighbours, when a single bit changes.
+ *   fi_buckets[b] - the runs whose length is in [2^b, 2^(b+1)).  A
+ *		     request for len bits can be satisfied by the first
+ *		     run of any bucket above len's, so a query only
+ *		     ever walks one bucket.
+ *
+ * The owning bitmap keeps the index current from its
+ * bit_change_notify() hook.  Changing a run's start or length never
+ * changes its order in either tree, so most updates are done in place.
+ */
+
+#define _XOPEN_SOURCE 600 /* Triggers magic in features.h */
+#define _LARGEFILE64_SOURCE
+
+#include <string.h>
+#include <inttypes.h>
+
+#include "ocfs2/ocfs2.h"
+#include "ocfs2/bitops.h"
+
+#include "bitmap.h"
+
+
+#define OCFS2_FREE_INDEX_BUCKETS	64
+
+struct ocfs2_free_run {
+	struct rb_node	fr_node;	/* In fi_runs */
+	struct rb_node	fr_bucket_node;	/* In fi_buckets[fr_bucket] */
+	uint64_t	fr_start;
+	uint64_t	fr_len;
+	int		fr_bucket;
+};
+
+struct ocfs2_free_index {
+	struct rb_root	fi_runs;
+	struct rb_root	fi_buckets[OCFS2_FREE_INDEX_BUCKETS];
+	uint64_t	fi_nr_runs;
+};
+
+static int free_run_bucket(uint64_t len)
+{
+	int b = 0;
+
+	while (len >>= 1)
+		b++;
+	return b;
+}
+
+static struct ocfs2_free_run *free_run_entry(struct rb_node *node,
+					     int bucket_tree)
+{
+	if (!node)
+		return NULL;
+	if (bucket_tree)
+		return rb_entry(node, struct ocfs2_free_run, fr_bucket_node);
+	return rb_entry(node, struct ocfs2_free_run, fr_node);
+}
+
+static void free_run_link(struct rb_root *root, struct ocfs2_free_run *fr,
+			  int bucket_tree)
+{
+	struct rb_node **p = &root->rb_node;
+	struct rb_node *parent = NULL;
+	struct rb_node *node = bucket_tree ? &fr->fr_bucket_node : &fr->fr_node;
+	struct ocfs2_free_run *tmp;
+
+	while (*p) {
+		parent = *p;
+		tmp = free_run_entry(parent, bucket_tree);
+		if (fr->fr_start < tmp->fr_start)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+
+	rb_link_node(node, parent, p);
+	rb_insert_color(node, root);
+}
+
+/* The first run in the tree starting at or after bit */
+static struct ocfs2_free_run *free_run_ceil(struct rb_root *root,
+					    uint64_t bit, int bucket_tree)
+{
+	struct rb_node *node = root->rb_node;
+	struct ocfs2_free_run *fr, *ret = NULL;
+
+	while (node) {
+		fr = free_run_entry(node, bucket_tree);
+		if (bit <= fr->fr_start) {
+			ret = fr;
+			node = node->rb_left;
+		} else
+			node = node->rb_right;
+	}
+
+	return ret;
+}
+
+/* The last run in fi_runs starting at or before bit */
+static struct ocfs2_free_run *free_run_floor(struct ocfs2_free_index *fi,
+					     uint64_t bit)
+{
+	struct rb_node *node = fi->fi_runs.rb_node;
+	struct ocfs2_free_run *fr, *ret = NULL;
+
+	while (node) {
+		fr = free_run_entry(node, 0);
+		if (fr->fr_start <= bit) {
+			ret = fr;
+			node = node->rb_right;
+		} else
+			node = node->rb_left;
+	}
+
+	return ret;
+}
+
+static errcode_t free_run_add(struct ocfs2_free_index *fi, uint64_t start,
+			      uint64_t len)
+{
+	errcode_t ret;
+	struct ocfs2_free_run *fr;
+
+	ret = ocfs2_malloc0(sizeof(struct ocfs2_free_run), &fr);
+	if (ret)
+		return ret;
+
+	fr->fr_start = start;
+	fr->fr_len = len;
+	fr->fr_bucket = free_run_bucket(len);
+	free_run_link(&fi->fi_runs, fr, 0);
+	free_run_link(&fi->fi_buckets[fr->fr_bucket], fr, 1);
+	fi->fi_nr_runs++;
+
+	return 0;
+}
+
+static void free_run_del(struct ocfs2_free_index *fi,
+			 struct ocfs2_free_run *fr)
+{
+	rb_erase(&fr->fr_node, &fi->fi_runs);
+	rb_erase(&fr->fr_bucket_node, &fi->fi_buckets[fr->fr_bucket]);
+	fi->fi_nr_runs--;
+	ocfs2_free(&fr);
+}
+
+static void free_run_resize(struct ocfs2_free_index *fi,
+			    struct ocfs2_free_run *fr, uint64_t len)
+{
+	int bucket = free_run_bucket(len);
+
+	fr->fr_len = len;
+	if (bucket == fr->fr_bucket)
+		return;
+
+	rb_erase(&fr->fr_bucket_node, &fi->fi_buckets[fr->fr_bucket]);
+	fr->fr_bucket = bucket;
+	free_run_link(&fi->fi_buckets[bucket], fr, 1);
+}
+
+void ocfs2_free_index_free(struct ocfs2_free_index **fi)
+{
+	struct rb_node *node;
+	struct ocfs2_free_run *fr;
+
+	if (!*fi)
+		return;
+
+	while ((node = rb_first(&(*fi)->fi_runs)) != NULL) {
+		fr = free_run_entry(node, 0);
+		rb_erase(&fr->fr_node, &(*fi)->fi_runs);
+		ocfs2_free(&fr);
+	}
+
+	ocfs2_free(fi);
+}
+
+static errcode_t free_index_add_region(struct ocfs2_bitmap_region *br,
+				       void *private_data)
+{
+	struct ocfs2_free_index *fi = private_data;
+	errcode_t ret;
+	int start, end;
+
+	if (br->br_set_bits == br->br_valid_bits)
+		return 0;
+
+	for (start = br->br_bitmap_start; start < br->br_total_bits;
+	     start = end) {
+		start = ocfs2_find_next_bit_clear(br->br_bitmap,
+						  br->br_total_bits, start);
+		if (start >= br->br_total_bits)
+			break;
+
+		end = ocfs2_find_next_bit_set(br->br_bitmap,
+					      br->br_total_bits, start);
+		ret = free_run_add(fi,
+				   br->br_start_bit + start -
+				   br->br_bitmap_start,
+				   end - start);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+errcode_t ocfs2_free_index_build(ocfs2_bitmap *bitmap,
+				 struct ocfs2_free_index **ret_fi)
+{
+	errcode_t ret;
+	struct ocfs2_free_index *fi;
+	int i;
+
+	ret = ocfs2_malloc0(sizeof(struct ocfs2_free_index), &fi);
+	if (ret)
+		return ret;
+
+	fi->fi_runs = RB_ROOT;
+	for (i = 0; i < OCFS2_FREE_INDEX_BUCKETS; i++)
+		fi->fi_buckets[i] = RB_ROOT;
+
+	ret = ocfs2_bitmap_foreach_region(bitmap, free_index_add_region, fi);
+	if (ret) {
+		ocfs2_free_index_free(&fi);
+		return ret;
+	}
+
+	*ret_fi = fi;
+	return 0;
+}
+
+/*
+ * Bit bitno has just been set.  It must come out of the run that
+ * holds it, which shrinks, splits in two, or goes away.
+ */
+static errcode_t free_index_set(struct ocfs2_free_index *fi,
+				uint64_t bitno)
+{
+	struct ocfs2_free_run *fr;
+	uint64_t end;
+
+	fr = free_run_floor(fi, bitno);
+	if (!fr || (fr->fr_start + fr->fr_len) <= bitno)
+		return 0;
+
+	end = fr->fr_start + fr->fr_len;
+	if (fr->fr_len == 1) {
+		free_run_del(fi, fr);
+	} else if (bitno == fr->fr_start) {
+		fr->fr_start++;
+		free_run_resize(fi, fr, fr->fr_len - 1);
+	} else if (bitno == end - 1) {
+		free_run_resize(fi, fr, fr->fr_len - 1);
+	} else {
+		free_run_resize(fi, fr, bitno - fr->fr_start);
+		return free_run_add(fi, bitno + 1, end - bitno - 1);
+	}
+
+	return 0;
+}
+
+/*
+ * Bit bitno of region br has just been cleared.  It joins the runs on
+ * either side of it, as long as they are in the same region.
+ */
+static errcode_t free_index_clear(struct ocfs2_free_index *fi,
+				  struct ocfs2_bitmap_region *br,
+				  uint64_t bitno)
+{
+	struct ocfs2_free_run *left = NULL, *right = NULL;
+
+	if (bitno > br->br_start_bit) {
+		left = free_run_floor(fi, bitno - 1);
+		if (left && (left->fr_start + left->fr_len) != bitno)
+			left = NULL;
+	}
+	if ((bitno + 1) < (br->br_start_bit + br->br_valid_bits)) {
+		right = free_run_ceil(&fi->fi_runs, bitno + 1, 0);
+		if (right && right->fr_start != (bitno + 1))
+			right = NULL;
+	}
+
+	if (left && right) {
+		free_run_resize(fi, left, left->fr_len + 1 + right->fr_len);
+		free_run_del(fi, right);
+	} else if (left) {
+		free_run_resize(fi, left, left->fr_len + 1);
+	} else if (right) {
+		right->fr_start--;
+		free_run_resize(fi, right, right->fr_len + 1);
+	} else
+		return free_run_add(fi, bitno, 1);
+
+	return 0;
+}
+
+errcode_t ocfs2_free_index_update(struct ocfs2_free_index *fi,
+				  struct ocfs2_bitmap_region *br,
+				  uint64_t bitno, int new_val)
+{
+	if (new_val)
+		return free_index_set(fi, bitno);
+	return free_index_clear(fi, br, bitno);
+}
+
+/*
+ * The first run of bucket b in [from, limit) that is at least len
+ * long.  Every run of a bucket above len's is long enough, so only
+ * len's own bucket is ever walked past its first candidate.
+ */
+static struct ocfs2_free_run *free_index_first_fit(struct ocfs2_free_index *fi,
+						   int b, uint64_t from,
+						   uint64_t limit,
+						   uint64_t len)
+{
+	struct ocfs2_free_run *fr;
+	struct rb_node *node;
+
+	fr = free_run_ceil(&fi->fi_buckets[b], from, 1);
+	while (fr && fr->fr_start < limit) {
+		if (fr->fr_len >= len)
+			return fr;
+		node = rb_next(&fr->fr_bucket_node);
+		fr = free_run_entry(node, 1);
+	}
+
+	return NULL;
+}
+
+/*
+ * Find a free run for an allocation of len bits, preferring the first
+ * one at or after goal and wrapping around to the start of the bitmap.
+ * A goal of zero is plain first-fit.  If no run holds len bits, the
+ * longest runs are tried, nearest the goal first, as long as they hold
+ * at least min_len.  The index is not changed; the caller sets the
+ * bits and the index follows along.
+ */
+errcode_t ocfs2_free_index_find(struct ocfs2_free_index *fi, uint64_t goal,
+				uint64_t min_len, uint64_t len,
+				uint64_t *first_bit, uint64_t *bits_found)
+{
+	struct ocfs2_free_run *fr, *best;
+	uint64_t from, limit;
+	int b, pass, want;
+
+	want = free_run_bucket(len);
+	for (pass = 0; pass < 2; pass++) {
+		from = pass ? 0 : goal;
+		limit = pass ? goal : UINT64_MAX;
+		best = NULL;
+
+		for (b = want; b < OCFS2_FREE_INDEX_BUCKETS; b++) {
+			if (best)
+				limit = best->fr_start;
+			fr = free_index_first_fit(fi, b, from, limit, len);
+			if (fr)
+				best = fr;
+		}
+
+		if (best) {
+			*first_bit = best->fr_start;
+			*bits_found = len;
+			return 0;
+		}
+		if (!goal)
+			break;
+	}
+
+	/* Nothing holds len bits, so every run is in a bucket below want */
+	for (b = want; b >= free_run_bucket(min_len); b--) {
+		if (!fi->fi_buckets[b].rb_node)
+			continue;
+
+		fr = free_index_first_fit(fi, b, goal, UINT64_MAX, min_len);
+		if (!fr && goal)
+			fr = free_index_first_fit(fi, b, 0, goal, min_len);
+		if (fr) {
+			*first_bit = fr->fr_start;
+			*bits_found = fr->fr_len;
+			return 0;
+		}
+	}
+
+	return OCFS2_ET_BIT_NOT_FOUND;
+}
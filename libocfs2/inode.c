@@ -142,6 +142,8 @@ static void ocfs2_swap_inode_second(struct ocfs2_dinode *di)
 		sb->s_dx_seed[0]          = bswap_32(sb->s_dx_seed[0]);
 		sb->s_dx_seed[1]          = bswap_32(sb->s_dx_seed[1]);
 		sb->s_dx_seed[2]          = bswap_32(sb->s_dx_seed[2]);
+		sb->s_raid_stride         = bswap_32(sb->s_raid_stride);
+		sb->s_raid_stripe_width   = bswap_32(sb->s_raid_stripe_width);
 
 	} else if (di->i_flags & OCFS2_LOCAL_ALLOC_FL) {
 		struct ocfs2_local_alloc *la = &di->id2.i_lab;
@@ -50,6 +50,10 @@ struct _ocfs2_inode_scan {
 	unsigned int blocks_left;
 	uint64_t b_offset;		/* bit offset in the group bitmap. */
 	uint16_t cur_discontig_rec;	/* Only valid in discontig group. */
+	struct io_vec_read *ra_ivr;	/* NULL if not reading ahead */
+	struct io_vec_unit ra_ivu;
+	char *ra_buffer;
+	int ra_pending;
 };
 
 
@@ -180,6 +184,109 @@ out:
 	return num_blocks;
 }
 
+/*
+ * Readahead keeps the next chunk of inodes in flight while the caller
+ * works through the current one.  Within a group the next chunk is
+ * known.  At the end of a contiguous group, the next group is the
+ * next one in this chain or the head of the next chain, and we guess
+ * that it is the same size, which is how inode groups are allocated.
+ * A wrong guess only costs the read, because take_readahead() checks
+ * it against what fill_group_buffer() wants.
+ */
+static void start_readahead(ocfs2_inode_scan *scan, int num_blocks)
+{
+	struct ocfs2_group_desc *desc = scan->cur_desc;
+	struct ocfs2_chain_list *cl =
+		&scan->cur_inode_alloc->ci_inode->id2.i_chain;
+	uint64_t blkno;
+	int count;
+
+	if (!scan->ra_ivr || desc->bg_list.l_next_free_rec)
+		return;
+
+	if (scan->b_offset < desc->bg_bits) {
+		blkno = scan->cur_blkno + num_blocks;
+		count = desc->bg_bits - scan->b_offset;
+	} else {
+		/* Skip the descriptor, get_next_group() reads that */
+		if (scan->count + num_blocks < scan->cur_rec->c_total)
+			blkno = desc->bg_next_group + 1;
+		else if (scan->next_rec < cl->cl_next_free_rec)
+			blkno = cl->cl_recs[scan->next_rec].c_blkno + 1;
+		else
+			return;
+		count = desc->bg_bits - 1;
+	}
+
+	if (count > scan->buffer_blocks)
+		count = scan->buffer_blocks;
+	if (count <= 0)
+		return;
+
+	scan->ra_ivu.ivu_blkno = blkno;
+	scan->ra_ivu.ivu_buf = scan->ra_buffer;
+	scan->ra_ivu.ivu_buflen = count * scan->fs->fs_blocksize;
+	if (!io_vec_read_start(scan->ra_ivr, &scan->ra_ivu, 1))
+		scan->ra_pending = 1;
+}
+
+/* Returns 1 if the readahead holds the num_blocks at cur_blkno */
+static int take_readahead(ocfs2_inode_scan *scan, int num_blocks)
+{
+	char *buf;
+
+	if (!scan->ra_pending)
+		return 0;
+
+	scan->ra_pending = 0;
+	if (io_vec_read_finish(scan->ra_ivr))
+		return 0;
+
+	if ((scan->ra_ivu.ivu_blkno != scan->cur_blkno) ||
+	    (scan->ra_ivu.ivu_buflen <
+	     (uint32_t)num_blocks * scan->fs->fs_blocksize))
+		return 0;
+
+	buf = scan->group_buffer;
+	scan->group_buffer = scan->ra_buffer;
+	scan->ra_buffer = buf;
+
+	return 1;
+}
+
+/*
+ * Readahead is only an optimization, so the scan goes on without it if
+ * it can't be set up.  Image files map block numbers, and the async
+ * reads go straight to the device, so those never get it.
+ *
+ * Readahead also bypasses the I/O cache.  When the cache can hold every
+ * inode group, we read through it instead.  A caller that scans again,
+ * like tunefs running one feature after another, then finds the groups
+ * in the cache.  Its writes go through the same cache, so what it finds
+ * is current.
+ */
+static void enable_readahead(ocfs2_inode_scan *scan)
+{
+	uint64_t inode_bytes;
+
+	if (scan->fs->fs_flags & OCFS2_FLAG_IMAGE_FILE)
+		return;
+
+	inode_bytes = ocfs2_get_max_inode_count(scan) *
+		scan->fs->fs_blocksize;
+	if (inode_bytes <= io_get_cache_size(scan->fs->fs_io))
+		return;
+
+	if (ocfs2_malloc_blocks(scan->fs->fs_io, scan->buffer_blocks,
+				&scan->ra_buffer))
+		return;
+
+	if (io_vec_read_init(scan->fs->fs_io, 1, &scan->ra_ivr)) {
+		scan->ra_ivr = NULL;
+		ocfs2_free(&scan->ra_buffer);
+	}
+}
+
 /*
  * This function is called by ocfs2_get_next_inode when it needs
  * to read in more clusters from the current inode alloc file.  It
@@ -212,15 +319,19 @@ static errcode_t fill_group_buffer(ocfs2_inode_scan *scan)
 
 	num_blocks = get_next_read_blocks(scan);
 
-	ret = ocfs2_read_blocks(scan->fs, scan->cur_blkno, num_blocks,
-				scan->group_buffer);
-	if (ret)
-		return ret;
+	if (!take_readahead(scan, num_blocks)) {
+		ret = ocfs2_read_blocks(scan->fs, scan->cur_blkno, num_blocks,
+					scan->group_buffer);
+		if (ret)
+			return ret;
+	}
 
 	scan->b_offset += num_blocks;
 	scan->blocks_in_buffer = num_blocks;
 	scan->cur_block = scan->group_buffer;
 
+	start_readahead(scan, num_blocks);
+
 	return 0;
 }
 
@@ -405,6 +516,11 @@ void ocfs2_close_inode_scan(ocfs2_inode_scan *scan)
 		}
 	}
 
+	/* Waits out any readahead still landing in ra_buffer */
+	if (scan->ra_ivr)
+		io_vec_read_free(scan->ra_ivr);
+	if (scan->ra_buffer)
+		ocfs2_free(&scan->ra_buffer);
 	ocfs2_free(&scan->group_buffer);
 	ocfs2_free(&scan->cur_desc);
 	ocfs2_free(&scan->inode_alloc);
@@ -414,6 +530,161 @@ void ocfs2_close_inode_scan(ocfs2_inode_scan *scan)
 }
 
 
+/*
+ * A scan bus walks the inodes for one or more consumers.  Each consumer
+ * is handed every valid inode, already swapped to cpu order, in the
+ * order the consumers were added.  They all see the same buffer, so a
+ * consumer that changes the inode should leave the buffer up to date for
+ * the ones after it.  The bus reads the inode groups ahead of the
+ * consumers, unless the I/O cache can hold them all.
+ *
+ * A consumer returns OCFS2_ET_ITERATION_COMPLETE when it has seen all it
+ * needs.  The scan stops early once every consumer is done.  Any other
+ * error stops the scan and is returned by ocfs2_scan_bus_run().
+ */
+struct scan_consumer {
+	struct scan_consumer	*sc_next;
+	ocfs2_scan_bus_func	sc_func;
+	void			*sc_priv;
+	int			sc_flags;
+	int			sc_done;
+};
+
+struct _ocfs2_scan_bus {
+	ocfs2_filesys		*sb_fs;
+	struct scan_consumer	*sb_consumers;
+	int			sb_nr_active;
+};
+
+errcode_t ocfs2_open_scan_bus(ocfs2_filesys *fs, ocfs2_scan_bus **ret_bus)
+{
+	ocfs2_scan_bus *bus;
+	errcode_t ret;
+
+	ret = ocfs2_malloc0(sizeof(struct _ocfs2_scan_bus), &bus);
+	if (ret)
+		return ret;
+
+	bus->sb_fs = fs;
+	*ret_bus = bus;
+
+	return 0;
+}
+
+errcode_t ocfs2_scan_bus_add(ocfs2_scan_bus *bus, int flags,
+			     ocfs2_scan_bus_func func, void *priv_data)
+{
+	struct scan_consumer *sc, **p;
+	errcode_t ret;
+
+	ret = ocfs2_malloc0(sizeof(struct scan_consumer), &sc);
+	if (ret)
+		return ret;
+
+	sc->sc_func = func;
+	sc->sc_priv = priv_data;
+	sc->sc_flags = flags;
+
+	for (p = &bus->sb_consumers; *p; p = &(*p)->sc_next)
+		;
+	*p = sc;
+	bus->sb_nr_active++;
+
+	return 0;
+}
+
+static errcode_t scan_bus_deliver(ocfs2_scan_bus *bus, uint64_t blkno,
+				  struct ocfs2_dinode *di)
+{
+	ocfs2_filesys *fs = bus->sb_fs;
+	struct scan_consumer *sc;
+	int same_gen;
+	errcode_t ret;
+
+	same_gen = (di->i_fs_generation == fs->fs_super->i_fs_generation);
+
+	for (sc = bus->sb_consumers; sc; sc = sc->sc_next) {
+		if (sc->sc_done)
+			continue;
+		if (!same_gen &&
+		    !(sc->sc_flags & OCFS2_SCAN_BUS_ANY_GENERATION))
+			continue;
+
+		ret = sc->sc_func(fs, blkno, di, sc->sc_priv);
+		if (ret == OCFS2_ET_ITERATION_COMPLETE) {
+			sc->sc_done = 1;
+			bus->sb_nr_active--;
+		} else if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+errcode_t ocfs2_scan_bus_run(ocfs2_scan_bus *bus)
+{
+	ocfs2_filesys *fs = bus->sb_fs;
+	ocfs2_inode_scan *scan = NULL;
+	struct ocfs2_dinode *di;
+	uint64_t blkno;
+	char *buf = NULL;
+	errcode_t ret;
+
+	if (!bus->sb_nr_active)
+		return 0;
+
+	ret = ocfs2_malloc_block(fs->fs_io, &buf);
+	if (ret)
+		return ret;
+	di = (struct ocfs2_dinode *)buf;
+
+	ret = ocfs2_open_inode_scan(fs, &scan);
+	if (ret)
+		goto out;
+
+	enable_readahead(scan);
+
+	while (bus->sb_nr_active) {
+		ret = ocfs2_get_next_inode(scan, &blkno, buf);
+		if (ret || !blkno)
+			break;
+
+		if (memcmp(di->i_signature, OCFS2_INODE_SIGNATURE,
+			   strlen(OCFS2_INODE_SIGNATURE)))
+			continue;
+
+		ocfs2_swap_inode_to_cpu(fs, di);
+
+		if (!(di->i_flags & OCFS2_VALID_FL))
+			continue;
+
+		ret = scan_bus_deliver(bus, blkno, di);
+		if (ret)
+			break;
+	}
+
+out:
+	if (scan)
+		ocfs2_close_inode_scan(scan);
+	ocfs2_free(&buf);
+	return ret;
+}
+
+void ocfs2_close_scan_bus(ocfs2_scan_bus *bus)
+{
+	struct scan_consumer *sc;
+
+	if (!bus)
+		return;
+
+	while (bus->sb_consumers) {
+		sc = bus->sb_consumers;
+		bus->sb_consumers = sc->sc_next;
+		ocfs2_free(&sc);
+	}
+	ocfs2_free(&bus);
+}
+
 
 #ifdef DEBUG_EXE
 #include <string.h>
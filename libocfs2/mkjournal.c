@@ -29,6 +29,9 @@
 #define _LARGEFILE64_SOURCE
 
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
 #include <netinet/in.h>
 
 #include "ocfs2/byteorder.h"
@@ -305,35 +308,79 @@ out:
 	return ret;
 }
 
+/*
+ * Zero journal blocks [start, end) an extent at a time.
+ * io_zero_blocks() lets the device do it when it can, which keeps thin
+ * LUNs thin.
+ */
+static errcode_t ocfs2_zero_journal_blocks(ocfs2_filesys *fs,
+					   ocfs2_cached_inode *ci,
+					   uint64_t start, uint64_t end)
+{
+	errcode_t ret = 0;
+	uint64_t v_blkno, p_blkno, contig;
+	uint16_t flags;
+
+	for (v_blkno = start; v_blkno < end; v_blkno += contig) {
+		ret = ocfs2_extent_map_get_blocks(ci, v_blkno, 1, &p_blkno,
+						  &contig, &flags);
+		if (ret)
+			break;
+		/* A journal has no holes */
+		if (!p_blkno || !contig) {
+			ret = OCFS2_ET_INTERNAL_FAILURE;
+			break;
+		}
+
+		contig = ocfs2_min(contig, end - v_blkno);
+		ret = io_zero_blocks(fs->fs_io, p_blkno, contig);
+		if (ret)
+			break;
+	}
+
+	return ret;
+}
+
+/*
+ * A lazily created journal starts at a random transaction sequence.
+ * After a crash, replay walks the log until a block doesn't carry the
+ * next expected sequence; starting from a random one keeps it from
+ * walking on into whatever an old journal left in the unzeroed area.
+ */
+static uint32_t ocfs2_journal_random_sequence(void)
+{
+	uint32_t seq = 0;
+	int fd;
+
+	fd = open("/dev/urandom", O_RDONLY);
+	if (fd >= 0) {
+		if (read(fd, &seq, sizeof(seq)) != sizeof(seq))
+			seq = 0;
+		close(fd);
+	}
+	if (!seq)
+		seq = (uint32_t)time(NULL) ^ ((uint32_t)getpid() << 16);
+
+	return seq ? seq : 1;
+}
+
 static errcode_t ocfs2_format_journal(ocfs2_filesys *fs,
 				      ocfs2_cached_inode *ci,
-				      ocfs2_fs_options *features)
+				      ocfs2_fs_options *features,
+				      int lazy)
 {
 	errcode_t ret = 0;
-	char *buf = NULL, *jsb_buf = NULL;
-	int bs_bits = OCFS2_RAW_SB(fs->fs_super)->s_blocksize_bits;
+	char *jsb_buf = NULL;
+	journal_superblock_t *jsb;
 	uint64_t offset = 0;
-	uint32_t wrote, count, jrnl_blocks;
-
-#define BUFLEN	1048576
-	ret = ocfs2_malloc_blocks(fs->fs_io, (BUFLEN >> bs_bits), &buf);
-	if (ret)
-		goto out;
-	memset(buf, 0, BUFLEN);
+	uint32_t jrnl_blocks, ij_flags;
 
-	io_set_nocache(fs->fs_io, true);
-	count = (uint32_t) ci->ci_inode->i_size;
-	while (count) {
-		ret = ocfs2_file_write(ci, buf, ocfs2_min((uint32_t) BUFLEN, count),
-				       offset, &wrote);
+	if (!lazy) {
+		ret = ocfs2_zero_journal_blocks(fs, ci, 0,
+				ocfs2_blocks_in_bytes(fs, ci->ci_inode->i_size));
 		if (ret)
-			break;
-		offset += wrote;
-		count -= wrote;
+			goto out;
 	}
-	io_set_nocache(fs->fs_io, false);
-	if (ret)
-		goto out;
 
 	jrnl_blocks = ocfs2_clusters_to_blocks(fs, ci->ci_inode->i_clusters);
 	ret = ocfs2_create_journal_superblock(fs, jrnl_blocks, features,
@@ -341,23 +388,46 @@ static errcode_t ocfs2_format_journal(ocfs2_filesys *fs,
 	if (ret)
 		goto out;
 
+	/*
+	 * The log area still holds whatever was on disk.  Describe it as
+	 * empty (s_start == 0) so that mount and fsck.ocfs2 never scan
+	 * it.
+	 */
+	if (lazy) {
+		jsb = (journal_superblock_t *)jsb_buf;
+		jsb->s_start = 0;
+		jsb->s_sequence = ocfs2_journal_random_sequence();
+	}
+
 	/* re-use offset here for 1st journal block. */
 	ret = ocfs2_extent_map_get_blocks(ci, 0, 1, &offset, NULL, NULL);
 	if (ret)
 		goto out;
 
 	ret = ocfs2_write_journal_superblock(fs, offset, jsb_buf);
+	if (ret)
+		goto out;
+
+	ij_flags = ci->ci_inode->id1.journal1.ij_flags;
+	if (lazy)
+		ij_flags |= OCFS2_JOURNAL_UNZEROED_FL;
+	else
+		ij_flags &= ~OCFS2_JOURNAL_UNZEROED_FL;
+	if (ij_flags != ci->ci_inode->id1.journal1.ij_flags) {
+		ci->ci_inode->id1.journal1.ij_flags = ij_flags;
+		ret = ocfs2_write_cached_inode(fs, ci);
+	}
 out:
-	if (buf)
-		ocfs2_free(&buf);
 	if (jsb_buf)
 		ocfs2_free(&jsb_buf);
 
 	return ret;
 }
 
-errcode_t ocfs2_make_journal(ocfs2_filesys *fs, uint64_t blkno,
-			     uint32_t clusters, ocfs2_fs_options *features)
+static errcode_t ocfs2_make_journal_common(ocfs2_filesys *fs, uint64_t blkno,
+					   uint32_t clusters,
+					   ocfs2_fs_options *features,
+					   int lazy)
 {
 	errcode_t ret = 0;
 	ocfs2_cached_inode *ci = NULL;
@@ -421,8 +491,122 @@ errcode_t ocfs2_make_journal(ocfs2_filesys *fs, uint64_t blkno,
 		}
 	}
 
-	ret = ocfs2_format_journal(fs, ci, features);
+	ret = ocfs2_format_journal(fs, ci, features, lazy);
+out:
+	if (ci)
+		ocfs2_free_cached_inode(fs, ci);
+
+	return ret;
+}
+
+errcode_t ocfs2_make_journal(ocfs2_filesys *fs, uint64_t blkno,
+			     uint32_t clusters, ocfs2_fs_options *features)
+{
+	return ocfs2_make_journal_common(fs, blkno, clusters, features, 0);
+}
+
+/*
+ * Like ocfs2_make_journal(), but only the inode, its extents and the
+ * journal superblock are written.  The inode is flagged
+ * OCFS2_JOURNAL_UNZEROED_FL until ocfs2_zero_journal() clears the log
+ * area.
+ */
+errcode_t ocfs2_make_lazy_journal(ocfs2_filesys *fs, uint64_t blkno,
+				  uint32_t clusters,
+				  ocfs2_fs_options *features)
+{
+	return ocfs2_make_journal_common(fs, blkno, clusters, features, 1);
+}
+
+/*
+ * Finish a lazily created journal: zero everything after the journal
+ * superblock and clear OCFS2_JOURNAL_UNZEROED_FL.  The work is done in
+ * chunks of at most chunk_blocks; func, if given, is called after each
+ * with the blocks done so far and may return non-zero to stop.  The
+ * flag stays set until the whole log has been zeroed, so an
+ * interrupted run can simply be started again.
+ */
+errcode_t ocfs2_zero_journal(ocfs2_filesys *fs, uint64_t blkno,
+			     uint64_t chunk_blocks,
+			     errcode_t (*func)(ocfs2_filesys *fs,
+					       uint64_t done, uint64_t total,
+					       void *priv_data),
+			     void *priv_data)
+{
+	errcode_t ret;
+	ocfs2_cached_inode *ci = NULL;
+	char *jsb_buf = NULL;
+	journal_superblock_t *jsb;
+	struct ocfs2_dinode *di;
+	uint64_t jsb_blkno, total, done;
+
+	if (!(fs->fs_flags & OCFS2_FLAG_RW))
+		return OCFS2_ET_RO_FILESYS;
+
+	if (!chunk_blocks)
+		return OCFS2_ET_INVALID_ARGUMENT;
+
+	ret = ocfs2_read_cached_inode(fs, blkno, &ci);
+	if (ret)
+		goto out;
+
+	di = ci->ci_inode;
+	if (!(di->i_flags & OCFS2_VALID_FL) ||
+	    !(di->i_flags & OCFS2_SYSTEM_FL) ||
+	    !(di->i_flags & OCFS2_JOURNAL_FL)) {
+		ret = OCFS2_ET_INTERNAL_FAILURE;
+		goto out;
+	}
+
+	if (!(di->id1.journal1.ij_flags & OCFS2_JOURNAL_UNZEROED_FL))
+		goto out;
+
+	if (di->id1.journal1.ij_flags & OCFS2_JOURNAL_DIRTY_FL) {
+		ret = OCFS2_ET_JOURNAL_DIRTY;
+		goto out;
+	}
+
+	/* The log must be empty, or we'd be wiping live transactions */
+	ret = ocfs2_malloc_block(fs->fs_io, &jsb_buf);
+	if (ret)
+		goto out;
+
+	ret = ocfs2_extent_map_get_blocks(ci, 0, 1, &jsb_blkno, NULL, NULL);
+	if (ret)
+		goto out;
+
+	ret = ocfs2_read_journal_superblock(fs, jsb_blkno, jsb_buf);
+	if (ret)
+		goto out;
+
+	jsb = (journal_superblock_t *)jsb_buf;
+	if (jsb->s_start) {
+		ret = OCFS2_ET_JOURNAL_DIRTY;
+		goto out;
+	}
+
+	total = ocfs2_blocks_in_bytes(fs, di->i_size);
+	for (done = 1; done < total; ) {
+		uint64_t end = ocfs2_min(done + chunk_blocks, total);
+
+		ret = ocfs2_zero_journal_blocks(fs, ci, done, end);
+		if (ret)
+			goto out;
+		done = end;
+
+		if (func) {
+			ret = func(fs, done, total, priv_data);
+			if (ret)
+				goto out;
+		}
+	}
+
+	di->id1.journal1.ij_flags &= ~OCFS2_JOURNAL_UNZEROED_FL;
+	ret = ocfs2_write_cached_inode(fs, ci);
+
 out:
+	if (jsb_buf)
+		ocfs2_free(&jsb_buf);
 	if (ci)
 		ocfs2_free_cached_inode(fs, ci);
 
@@ -88,10 +88,23 @@ void ocfs2_swap_quota_leaf_block_header(struct qt_disk_dqdbheader *bheader)
 	bheader->dqdh_entries = bswap_16(bheader->dqdh_entries);
 }
 
-/* Should be power of two */
-#define DEFAULT_QUOTA_HASH_SIZE 8192
-/* Maxinum number of hash buckets - use at most 16 MB on a 64-bit arch */
-#define MAX_QUOTA_HASH_SIZE (1<<21)
+/*
+ * The quota hash is an open addressing table of dquot pointers.  Removed
+ * entries leave a tombstone behind so that ocfs2_iterate_quota_hash()
+ * callers may remove the dquot they are handed.  Tombstones are cleared
+ * whenever the table is rebuilt.
+ */
+
+/* Must be a power of two */
+#define DEFAULT_QUOTA_HASH_SIZE 1024
+
+static ocfs2_cached_dquot quota_hash_tombstone;
+#define QUOTA_HASH_DELETED (&quota_hash_tombstone)
+
+static inline int quota_hash_live(ocfs2_cached_dquot *dquot)
+{
+	return dquot && dquot != QUOTA_HASH_DELETED;
+}
 
 errcode_t ocfs2_new_quota_hash(ocfs2_quota_hash **hashp)
 {
@@ -103,7 +116,8 @@ errcode_t ocfs2_new_quota_hash(ocfs2_quota_hash **hashp)
 		return err;
 	hash->alloc_entries = DEFAULT_QUOTA_HASH_SIZE;
 	hash->used_entries = 0;
-	err = ocfs2_malloc0(sizeof(ocfs2_quota_hash *) *
+	hash->deleted_entries = 0;
+	err = ocfs2_malloc0(sizeof(ocfs2_cached_dquot *) *
 			    DEFAULT_QUOTA_HASH_SIZE, &hash->hash);
 	if (err) {
 		ocfs2_free(&hash);
@@ -128,21 +142,78 @@ errcode_t ocfs2_free_quota_hash(ocfs2_quota_hash *hash)
 	return err;
 }
 
-static int quota_hash(ocfs2_quota_hash *hash, qid_t id)
+/*
+ * Ids tend to be small and dense, so mix all of their bits into the
+ * low ones we index with (the murmur3 finalizer).
+ */
+static unsigned int quota_hash(ocfs2_quota_hash *hash, qid_t id)
 {
-	return (((unsigned long)id) * 5) & (hash->alloc_entries - 1);
+	uint32_t h = id;
+
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return h & (hash->alloc_entries - 1);
 }
 
-static void quota_add_hash_chain(ocfs2_quota_hash *hash,
-				 ocfs2_cached_dquot *dquot)
+/* Returns the slot holding id, or -1 */
+static int quota_hash_lookup(ocfs2_quota_hash *hash, qid_t id)
 {
-	int hash_val = quota_hash(hash, dquot->d_ddquot.dqb_id);
+	unsigned int mask = hash->alloc_entries - 1;
+	unsigned int i = quota_hash(hash, id);
+	ocfs2_cached_dquot *dquot;
+
+	while ((dquot = hash->hash[i])) {
+		if (dquot != QUOTA_HASH_DELETED && dquot->d_ddquot.dqb_id == id)
+			return i;
+		i = (i + 1) & mask;
+	}
+	return -1;
+}
 
-	dquot->d_next = hash->hash[hash_val];
-	if (dquot->d_next)
-		dquot->d_next->d_pprev = &dquot->d_next;
-	hash->hash[hash_val] = dquot;
-	dquot->d_pprev = hash->hash + hash_val;
+static void quota_hash_place(ocfs2_quota_hash *hash,
+			     ocfs2_cached_dquot *dquot)
+{
+	unsigned int mask = hash->alloc_entries - 1;
+	unsigned int i = quota_hash(hash, dquot->d_ddquot.dqb_id);
+
+	while (quota_hash_live(hash->hash[i]))
+		i = (i + 1) & mask;
+	if (hash->hash[i] == QUOTA_HASH_DELETED)
+		hash->deleted_entries--;
+	hash->hash[i] = dquot;
+}
+
+/* Rebuild the table with room for at least one more entry */
+static errcode_t quota_hash_resize(ocfs2_quota_hash *hash)
+{
+	ocfs2_cached_dquot **old_hash = hash->hash;
+	int old_entries = hash->alloc_entries;
+	int new_entries = old_entries;
+	errcode_t err;
+	int i;
+
+	/* Keep the load under a half; tombstones alone just get swept */
+	while ((hash->used_entries + 1) * 2 > new_entries)
+		new_entries *= 2;
+
+	err = ocfs2_malloc0(sizeof(ocfs2_cached_dquot *) * new_entries,
+			    &hash->hash);
+	if (err) {
+		hash->hash = old_hash;
+		return err;
+	}
+	hash->alloc_entries = new_entries;
+	hash->deleted_entries = 0;
+
+	for (i = 0; i < old_entries; i++)
+		if (quota_hash_live(old_hash[i]))
+			quota_hash_place(hash, old_hash[i]);
+
+	return ocfs2_free(&old_hash);
 }
 
 errcode_t ocfs2_insert_quota_hash(ocfs2_quota_hash *hash,
@@ -150,33 +221,13 @@ errcode_t ocfs2_insert_quota_hash(ocfs2_quota_hash *hash,
 {
 	errcode_t err;
 
-	if (hash->used_entries > hash->alloc_entries &&
-	    hash->alloc_entries * 2 < MAX_QUOTA_HASH_SIZE) {
-		ocfs2_cached_dquot **new_hash, **old_hash;
-		ocfs2_cached_dquot *h_dquot, *h_next;
-		int i;
-		int old_entries;
-
-		err = ocfs2_malloc0(sizeof(ocfs2_quota_hash *) *
-				    hash->alloc_entries * 2, &new_hash);
-		if (err)
-			return err;
-		old_entries = hash->alloc_entries;
-		old_hash = hash->hash;
-		hash->alloc_entries *= 2;
-		hash->hash = new_hash;
-		/* Rehash */
-		for (i = 0; i < old_entries; i++) {
-			for (h_dquot = old_hash[i]; h_dquot; h_dquot = h_next) {
-				h_next = h_dquot->d_next;
-				quota_add_hash_chain(hash, h_dquot);
-			}
-		}
-		err = ocfs2_free(&old_hash);
+	if ((hash->used_entries + hash->deleted_entries + 1) * 2 >
+	    hash->alloc_entries) {
+		err = quota_hash_resize(hash);
 		if (err)
 			return err;
 	}
-	quota_add_hash_chain(hash, dquot);
+	quota_hash_place(hash, dquot);
 	hash->used_entries++;
 	return 0;
 }
@@ -184,26 +235,23 @@ errcode_t ocfs2_insert_quota_hash(ocfs2_quota_hash *hash,
 errcode_t ocfs2_remove_quota_hash(ocfs2_quota_hash *hash,
 				  ocfs2_cached_dquot *dquot)
 {
-	*(dquot->d_pprev) = dquot->d_next;
-	if (dquot->d_next)
-		dquot->d_next->d_pprev = dquot->d_pprev;
+	int i = quota_hash_lookup(hash, dquot->d_ddquot.dqb_id);
+
+	if (i < 0 || hash->hash[i] != dquot)
+		return OCFS2_ET_INTERNAL_FAILURE;
+
+	hash->hash[i] = QUOTA_HASH_DELETED;
 	hash->used_entries--;
+	hash->deleted_entries++;
 	return 0;
 }
 
 errcode_t ocfs2_find_quota_hash(ocfs2_quota_hash *hash, qid_t id,
 				ocfs2_cached_dquot **dquotp)
 {
-	int hash_val = quota_hash(hash, id);
-	ocfs2_cached_dquot *dquot;
+	int i = quota_hash_lookup(hash, id);
 
-	for (dquot = hash->hash[hash_val]; dquot; dquot = dquot->d_next) {
-		if (dquot->d_ddquot.dqb_id == id) {
-			*dquotp = dquot;
-			return 0;
-		}
-	}
-	*dquotp = NULL;
+	*dquotp = i < 0 ? NULL : hash->hash[i];
 	return 0;
 }
 
@@ -253,70 +301,75 @@ errcode_t ocfs2_find_read_quota_hash(ocfs2_filesys *fs, ocfs2_quota_hash *hash,
 	return 0;
 }
 
+static errcode_t quota_usage_add(ocfs2_filesys *fs, ocfs2_quota_hash *hash,
+				 qid_t id, struct ocfs2_dinode *di)
+{
+	errcode_t err;
+	ocfs2_cached_dquot *dquot;
+
+	err = ocfs2_find_create_quota_hash(hash, id, &dquot);
+	if (err)
+		return err;
+	dquot->d_ddquot.dqb_curspace +=
+		ocfs2_clusters_to_bytes(fs, di->i_clusters);
+	dquot->d_ddquot.dqb_curinodes++;
+	return 0;
+}
+
+/* System files other than the root directory aren't charged to anyone */
+static int quota_usage_skip(ocfs2_filesys *fs, uint64_t blkno,
+			    struct ocfs2_dinode *di)
+{
+	return di->i_flags & OCFS2_SYSTEM_FL &&
+		blkno != OCFS2_RAW_SB(fs->fs_super)->s_root_blkno;
+}
+
+static errcode_t usr_quota_usage(ocfs2_filesys *fs, uint64_t blkno,
+				 struct ocfs2_dinode *di, void *priv_data)
+{
+	if (quota_usage_skip(fs, blkno, di))
+		return 0;
+	return quota_usage_add(fs, priv_data, di->i_uid, di);
+}
+
+static errcode_t grp_quota_usage(ocfs2_filesys *fs, uint64_t blkno,
+				 struct ocfs2_dinode *di, void *priv_data)
+{
+	if (quota_usage_skip(fs, blkno, di))
+		return 0;
+	return quota_usage_add(fs, priv_data, di->i_gid, di);
+}
+
+/* User and group usage are summed in the same pass over the inodes */
+static errcode_t quota_usage_add_consumers(ocfs2_scan_bus *bus,
+					   ocfs2_quota_hash *usr_hash,
+					   ocfs2_quota_hash *grp_hash)
+{
+	errcode_t err = 0;
+
+	if (usr_hash)
+		err = ocfs2_scan_bus_add(bus, 0, usr_quota_usage, usr_hash);
+	if (!err && grp_hash)
+		err = ocfs2_scan_bus_add(bus, 0, grp_quota_usage, grp_hash);
+	return err;
+}
+
 errcode_t ocfs2_compute_quota_usage(ocfs2_filesys *fs,
 				    ocfs2_quota_hash *usr_hash,
 				    ocfs2_quota_hash *grp_hash)
 {
-	errcode_t err = 0;
-	ocfs2_inode_scan *scan;
-	uint64_t blkno;
-	char *buf;
-	int close_scan = 0;
-	struct ocfs2_dinode *di;
-	ocfs2_cached_dquot *dquot;
+	errcode_t err;
+	ocfs2_scan_bus *bus;
 
-	err = ocfs2_malloc_block(fs->fs_io, &buf);
+	err = ocfs2_open_scan_bus(fs, &bus);
 	if (err)
 		return err;
-	di = (struct ocfs2_dinode *)buf;
 
-	err = ocfs2_open_inode_scan(fs, &scan);
-	if (err)
-		goto out;
-	close_scan = 1;
+	err = quota_usage_add_consumers(bus, usr_hash, grp_hash);
+	if (!err)
+		err = ocfs2_scan_bus_run(bus);
 
-	while (1) {
-		err = ocfs2_get_next_inode(scan, &blkno, buf);
-		if (err || !blkno)
-			break;
-		/*
-		 * Check whether the inode looks reasonable and interesting
-		 * for quota
-		 */
-		if (memcmp(di->i_signature, OCFS2_INODE_SIGNATURE,
-			   strlen(OCFS2_INODE_SIGNATURE)))
-			continue;
-		ocfs2_swap_inode_to_cpu(fs, di);
-		if (di->i_fs_generation != fs->fs_super->i_fs_generation)
-			continue;
-		if (!(di->i_flags & OCFS2_VALID_FL))
-			continue;
-		if (di->i_flags & OCFS2_SYSTEM_FL &&
-		    blkno != OCFS2_RAW_SB(fs->fs_super)->s_root_blkno)
-			continue;
-		if (usr_hash) {
-			err = ocfs2_find_create_quota_hash(usr_hash, di->i_uid,
-							   &dquot);
-			if (err)
-				break;
-			dquot->d_ddquot.dqb_curspace +=
-				ocfs2_clusters_to_bytes(fs, di->i_clusters);
-			dquot->d_ddquot.dqb_curinodes++;
-		}
-		if (grp_hash) {
-			err = ocfs2_find_create_quota_hash(grp_hash, di->i_gid,
-							   &dquot);
-			if (err)
-				break;
-			dquot->d_ddquot.dqb_curspace +=
-				ocfs2_clusters_to_bytes(fs, di->i_clusters);
-			dquot->d_ddquot.dqb_curinodes++;
-		}
-	}
-out:
-	if (close_scan)
-		ocfs2_close_inode_scan(scan);
-	ocfs2_free(&buf);
+	ocfs2_close_scan_bus(bus);
 	return err;
 }
 
@@ -407,56 +460,159 @@ errcode_t ocfs2_iterate_quota_hash(ocfs2_quota_hash *hash,
 {
 	errcode_t err = 0;
 	int i;
-	ocfs2_cached_dquot *dquot, *next;
 
-	for (i = 0; i < hash->alloc_entries; i++)
-		for (dquot = hash->hash[i]; dquot; dquot = next) {
-			next = dquot->d_next;
-			err = f(dquot, data);
-			if (err)
-				goto out;
-		}
-out:
+	/* f() may remove the dquot it is given; that only leaves a tombstone */
+	for (i = 0; i < hash->alloc_entries; i++) {
+		if (!quota_hash_live(hash->hash[i]))
+			continue;
+		err = f(hash->hash[i], data);
+		if (err)
+			break;
+	}
 	return err;
 }
 
-struct write_rel_ctx {
-	ocfs2_filesys *fs;
-	ocfs2_quota_hash *hash;
-	int type;
-};
-
-static errcode_t write_release_quota_hash(ocfs2_cached_dquot *dquot, void *p)
+static void quota_clear_grace_times(ocfs2_cached_dquot *dquot)
 {
-	struct write_rel_ctx *ctx = p;
-	errcode_t err;
-
 	if (!dquot->d_ddquot.dqb_isoftlimit ||
 	    dquot->d_ddquot.dqb_curinodes < dquot->d_ddquot.dqb_isoftlimit)
 		dquot->d_ddquot.dqb_itime = 0;
 	if (!dquot->d_ddquot.dqb_bsoftlimit ||
 	    dquot->d_ddquot.dqb_curspace < dquot->d_ddquot.dqb_bsoftlimit)
 		dquot->d_ddquot.dqb_btime = 0;
+}
 
-	err = ocfs2_write_dquot(ctx->fs, ctx->type, dquot);
-	if (err)
-		return err;
-	err = ocfs2_remove_quota_hash(ctx->hash, dquot);
+static void quota_fill_dqblk(ocfs2_filesys *fs, char *buf,
+			     ocfs2_cached_dquot *dquot)
+{
+	struct ocfs2_global_disk_dqblk *ddquot;
+
+	ddquot = (struct ocfs2_global_disk_dqblk *)(buf +
+					(dquot->d_off % fs->fs_blocksize));
+	memcpy(ddquot, &dquot->d_ddquot,
+	       sizeof(struct ocfs2_global_disk_dqblk));
+	ddquot->dqb_pad1 = 0;
+	ddquot->dqb_pad2 = 0;
+	ocfs2_swap_quota_global_dqblk(ddquot);
+}
+
+static errcode_t read_blk(ocfs2_filesys *fs, int type, unsigned int blk,
+			  char *buf);
+static errcode_t write_blk(ocfs2_filesys *fs, int type, unsigned int blk,
+			   char *buf);
+
+static int dquot_id_cmp(const void *a, const void *b)
+{
+	const ocfs2_cached_dquot *l = *(ocfs2_cached_dquot * const *)a;
+	const ocfs2_cached_dquot *r = *(ocfs2_cached_dquot * const *)b;
+
+	if (l->d_ddquot.dqb_id < r->d_ddquot.dqb_id)
+		return -1;
+	return l->d_ddquot.dqb_id > r->d_ddquot.dqb_id;
+}
+
+static int dquot_off_cmp(const void *a, const void *b)
+{
+	const ocfs2_cached_dquot *l = *(ocfs2_cached_dquot * const *)a;
+	const ocfs2_cached_dquot *r = *(ocfs2_cached_dquot * const *)b;
+
+	if (l->d_off < r->d_off)
+		return -1;
+	return l->d_off > r->d_off;
+}
+
+static errcode_t quota_release_dquot(ocfs2_quota_hash *hash,
+				     ocfs2_cached_dquot *dquot)
+{
+	errcode_t err;
+
+	err = ocfs2_remove_quota_hash(hash, dquot);
 	if (err)
 		return err;
 	return ocfs2_free(&dquot);
 }
 
+/*
+ * Write out every dquot in the hash and free them.
+ *
+ * Dquots that aren't in the file yet have to go through
+ * ocfs2_write_dquot() one at a time, because the tree insert finds a
+ * free entry by looking for zeroed ones.  We do those in id order so that
+ * neighbours share tree blocks.  Everything else is sorted by file
+ * offset, and each quota block is then read and written once no matter
+ * how many of its entries changed.
+ */
 errcode_t ocfs2_write_release_dquots(ocfs2_filesys *fs, int type,
 				     ocfs2_quota_hash *hash)
 {
-	struct write_rel_ctx ctx;
+	ocfs2_cached_dquot **list = NULL;
+	ocfs2_cached_dquot *dquot;
+	char *buf = NULL;
+	int i, j, count = 0, new = 0;
+	unsigned int blk;
+	errcode_t err;
+
+	if (!hash->used_entries)
+		return 0;
+
+	err = ocfs2_malloc_block(fs->fs_io, &buf);
+	if (err)
+		return err;
+	err = ocfs2_malloc(sizeof(ocfs2_cached_dquot *) * hash->used_entries,
+			   &list);
+	if (err)
+		goto out;
+
+	/* New dquots at the front, existing ones at the back */
+	j = hash->used_entries;
+	for (i = 0; i < hash->alloc_entries; i++) {
+		dquot = hash->hash[i];
+		if (!quota_hash_live(dquot))
+			continue;
+		quota_clear_grace_times(dquot);
+		if (dquot->d_off)
+			list[--j] = dquot;
+		else
+			list[new++] = dquot;
+	}
+	count = hash->used_entries;
 
-	ctx.fs = fs;
-	ctx.hash = hash;
-	ctx.type = type;
+	qsort(list, new, sizeof(ocfs2_cached_dquot *), dquot_id_cmp);
+	for (i = 0; i < new; i++) {
+		err = ocfs2_write_dquot(fs, type, list[i]);
+		if (err)
+			goto out;
+		err = quota_release_dquot(hash, list[i]);
+		if (err)
+			goto out;
+	}
 
-	return ocfs2_iterate_quota_hash(hash, write_release_quota_hash, &ctx);
+	qsort(list + new, count - new, sizeof(ocfs2_cached_dquot *),
+	      dquot_off_cmp);
+	for (i = new; i < count; i = j) {
+		blk = list[i]->d_off / fs->fs_blocksize;
+		err = read_blk(fs, type, blk, buf);
+		if (err)
+			goto out;
+		for (j = i;
+		     j < count && list[j]->d_off / fs->fs_blocksize == blk;
+		     j++)
+			quota_fill_dqblk(fs, buf, list[j]);
+		err = write_blk(fs, type, blk, buf);
+		if (err)
+			goto out;
+		for (; i < j; i++) {
+			err = quota_release_dquot(hash, list[i]);
+			if (err)
+				goto out;
+		}
+	}
+
+out:
+	if (list)
+		ocfs2_free(&list);
+	ocfs2_free(&buf);
+	return err;
 }
 
 static void mark_quotafile_info_dirty(ocfs2_filesys *fs, int type)
@@ -1107,7 +1263,6 @@ errcode_t ocfs2_write_dquot(ocfs2_filesys *fs, int type,
 {
 	errcode_t err;
 	char *buf;
-	struct ocfs2_global_disk_dqblk *ddquot;
 
 	err = ocfs2_malloc_block(fs->fs_io, &buf);
 	if (err)
@@ -1122,13 +1277,7 @@ errcode_t ocfs2_write_dquot(ocfs2_filesys *fs, int type,
 	err = read_blk(fs, type, dquot->d_off / fs->fs_blocksize, buf);
 	if (err)
 		goto bail;
-	ddquot = (struct ocfs2_global_disk_dqblk *)(buf +
-					(dquot->d_off % fs->fs_blocksize));
-	memcpy(ddquot, &dquot->d_ddquot,
-	       sizeof(struct ocfs2_global_disk_dqblk));
-	ddquot->dqb_pad1 = 0;
-	ddquot->dqb_pad2 = 0;
-	ocfs2_swap_quota_global_dqblk(ddquot);
+	quota_fill_dqblk(fs, buf, dquot);
 	err = write_blk(fs, type, dquot->d_off / fs->fs_blocksize, buf);
 bail:
 	ocfs2_free(&buf);
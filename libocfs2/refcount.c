@@ -1832,6 +1832,8 @@ errcode_t ocfs2_refcount_cow(ocfs2_cached_inode *cinode,
 		if (ext_flags & OCFS2_EXT_REFCOUNTED) {
 			ret = ocfs2_refcount_cow_hunk(cinode, cpos,
 						      num_clusters, max_cpos);
+			/* The hunk may reach past num_clusters */
+			ocfs2_drop_extent_map(cinode->ci_fs, cinode);
 			if (ret)
 				break;
 		}
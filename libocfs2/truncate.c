@@ -262,6 +262,7 @@ static errcode_t ocfs2_zero_tail_and_truncate_full(ocfs2_filesys *fs,
 					 OCFS2_EXTENT_FLAG_DEPTH_TRAVERSE,
 					 NULL, truncate_iterate,
 					 &ctxt);
+	ocfs2_drop_extent_map(fs, ci);
 	if (ret)
 		goto out;
 
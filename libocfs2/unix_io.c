@@ -34,6 +34,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -104,12 +105,17 @@ struct _io_channel {
 	int io_fd;
 	bool io_nocache;
 	struct io_cache *io_cache;
+	struct io_vec_read *io_spare_ivr;	/* see io_vec_read_free() */
 
 	/* stats */
 	uint64_t io_bytes_read;
 	uint64_t io_bytes_written;
+	uint64_t io_reads;
+	uint64_t io_writes;
 };
 
+static void io_vec_read_destroy(struct io_vec_read *ivr);
+
 /*
  * We open code this because we don't have the ocfs2_filesys to call
  * ocfs2_blocks_in_bytes().
@@ -130,6 +136,7 @@ static errcode_t unix_vec_read_blocks(io_channel *channel,
 	struct io_event *events = NULL;
 	int64_t offset;
 	int submitted, completed = 0;
+	uint64_t bytes = 0;
 
 	ret = OCFS2_ET_NO_MEMORY;
 	iocb = malloc((sizeof(struct iocb) * count));
@@ -148,6 +155,7 @@ static errcode_t unix_vec_read_blocks(io_channel *channel,
 		io_prep_pread(&(iocb[i]), channel->io_fd, ivus[i].ivu_buf,
 			      ivus[i].ivu_buflen, offset);
 		iocbs[i] = &iocb[i];
+		bytes += ivus[i].ivu_buflen;
 	}
 
 resubmit:
@@ -169,8 +177,10 @@ resubmit:
 out:
 	if (ret >= 0)
 		ret = 0;
-	if (!ret)
-		channel->io_bytes_read += (count * channel->io_blksize);
+	if (!ret) {
+		channel->io_bytes_read += bytes;
+		channel->io_reads += count;
+	}
 	free(iocb);
 	free(iocbs);
 	free(events);
@@ -215,6 +225,7 @@ out:
 	}
 
 	channel->io_bytes_read += tot;
+	channel->io_reads++;
 
 	return ret;
 }
@@ -255,6 +266,7 @@ out:
 		ret = OCFS2_ET_SHORT_WRITE;
 
 	channel->io_bytes_written += tot;
+	channel->io_writes++;
 
 	return ret;
 }
@@ -659,7 +671,8 @@ errcode_t io_mlock_cache(io_channel *channel)
 	return 0;
 }
 
-errcode_t io_init_cache(io_channel *channel, size_t nr_blocks)
+static errcode_t io_alloc_cache(io_channel *channel, size_t nr_blocks,
+				struct io_cache **ret_ic)
 {
 	int i;
 	struct io_cache *ic;
@@ -697,7 +710,7 @@ errcode_t io_init_cache(io_channel *channel, size_t nr_blocks)
 	}
 
 	ic->ic_use_count = 1;
-	channel->io_cache = ic;
+	*ret_ic = ic;
 
 out:
 	if (ret)
@@ -706,6 +719,79 @@ out:
 	return ret;
 }
 
+errcode_t io_init_cache(io_channel *channel, size_t nr_blocks)
+{
+	struct io_cache *ic;
+	errcode_t ret;
+
+	ret = io_alloc_cache(channel, nr_blocks, &ic);
+	if (!ret)
+		channel->io_cache = ic;
+
+	return ret;
+}
+
+/*
+ * Replace the cache with one of nr_blocks, carrying over as many of the
+ * most recently used blocks as fit.  The new cache isn't locked; call
+ * io_mlock_cache() again if you want it to be.  A cache shared with
+ * io_share_cache() can't be resized.
+ */
+errcode_t io_resize_cache(io_channel *channel, size_t nr_blocks)
+{
+	struct io_cache *old = channel->io_cache, *ic;
+	struct io_cache_block *icb, *new_icb;
+	struct list_head *pos;
+	size_t skip, valid = 0;
+	errcode_t ret;
+
+	if (!old)
+		return io_init_cache(channel, nr_blocks);
+	if (old->ic_use_count > 1)
+		return OCFS2_ET_INVALID_ARGUMENT;
+	if (old->ic_nr_blocks == nr_blocks)
+		return 0;
+
+	ret = io_alloc_cache(channel, nr_blocks, &ic);
+	if (ret)
+		return ret;
+
+	list_for_each(pos, &old->ic_lru) {
+		icb = list_entry(pos, struct io_cache_block, icb_list);
+		if (icb->icb_blkno != UINT64_MAX)
+			valid++;
+	}
+	skip = valid > nr_blocks ? valid - nr_blocks : 0;
+
+	/* Oldest first, so the order of the LRU survives */
+	list_for_each(pos, &old->ic_lru) {
+		icb = list_entry(pos, struct io_cache_block, icb_list);
+		if (icb->icb_blkno == UINT64_MAX)
+			continue;
+		if (skip) {
+			skip--;
+			continue;
+		}
+
+		new_icb = list_entry(ic->ic_lru.next, struct io_cache_block,
+				     icb_list);
+		memcpy(new_icb->icb_buf, icb->icb_buf, channel->io_blksize);
+		new_icb->icb_blkno = icb->icb_blkno;
+		io_cache_insert(ic, new_icb);
+		io_cache_seen(ic, new_icb);
+	}
+
+	ic->ic_hits = old->ic_hits;
+	ic->ic_misses = old->ic_misses;
+	ic->ic_inserts = old->ic_inserts;
+	ic->ic_removes = old->ic_removes;
+
+	io_free_cache(old);
+	channel->io_cache = ic;
+
+	return 0;
+}
+
 errcode_t io_init_cache_size(io_channel *channel, size_t bytes)
 {
 	size_t blocks;
@@ -869,6 +955,9 @@ errcode_t io_close(io_channel *channel)
 
 	io_destroy_cache(channel);
 
+	if (channel->io_spare_ivr)
+		io_vec_read_destroy(channel->io_spare_ivr);
+
 	if (close(channel->io_fd) < 0)
 		ret = errno;
 
@@ -914,6 +1003,8 @@ void io_get_stats(io_channel *channel, struct ocfs2_io_stats *stats)
 	memset(stats, 0, sizeof(struct ocfs2_io_stats));
 	stats->is_bytes_read = channel->io_bytes_read;
 	stats->is_bytes_written = channel->io_bytes_written;
+	stats->is_reads = channel->io_reads;
+	stats->is_writes = channel->io_writes;
 	if (ioc) {
 		stats->is_cache_hits = ioc->ic_hits;
 		stats->is_cache_misses = ioc->ic_misses;
@@ -944,6 +1035,209 @@ errcode_t io_vec_read_blocks(io_channel *channel, struct io_vec_unit *ivus,
 		return unix_vec_read_blocks(channel, ivus, count);
 }
 
+/*
+ * Asynchronous vectored reads.  io_vec_read_init() sets up a handle
+ * for up to max_count units, and the handle can be used for any number
+ * of reads.  io_vec_read_start() submits the reads in ivus and returns
+ * without waiting.  io_vec_read_finish() waits for all of them.  ivus
+ * must stay around until then.  Every started read must be finished,
+ * even if the caller no longer wants the data, so that nothing is
+ * still landing in the buffers when they are freed.
+ *
+ * The reads go straight to the device.  The cache is always up to
+ * date with the disk, so there is nothing in it that we would miss.
+ */
+struct io_vec_read {
+	io_channel		*ivr_channel;
+	io_context_t		ivr_ctx;
+	int			ivr_max;
+	struct io_vec_unit	*ivr_ivus;
+	int			ivr_count;
+	int			ivr_submitted;
+	int			ivr_completed;
+	int			ivr_broken;
+	struct iocb		*ivr_iocb;
+	struct iocb		**ivr_iocbs;
+	struct io_event		*ivr_events;
+};
+
+static void io_vec_read_destroy(struct io_vec_read *ivr)
+{
+	if (ivr->ivr_ctx)
+		io_queue_release(ivr->ivr_ctx);
+	free(ivr->ivr_iocb);
+	free(ivr->ivr_iocbs);
+	free(ivr->ivr_events);
+	free(ivr);
+}
+
+/*
+ * Tearing down an aio context waits on the kernel, which adds up when
+ * reading many small files.  So the channel keeps one handle around
+ * for the next io_vec_read_init() to pick up.
+ */
+void io_vec_read_free(struct io_vec_read *ivr)
+{
+	io_channel *channel;
+
+	if (!ivr)
+		return;
+
+	if (ivr->ivr_completed < ivr->ivr_submitted)
+		io_vec_read_finish(ivr);
+
+	channel = ivr->ivr_channel;
+	if (ivr->ivr_broken)
+		io_vec_read_destroy(ivr);
+	else if (!channel->io_spare_ivr)
+		channel->io_spare_ivr = ivr;
+	else if (channel->io_spare_ivr->ivr_max < ivr->ivr_max) {
+		io_vec_read_destroy(channel->io_spare_ivr);
+		channel->io_spare_ivr = ivr;
+	} else
+		io_vec_read_destroy(ivr);
+}
+
+errcode_t io_vec_read_init(io_channel *channel, int max_count,
+			   struct io_vec_read **ret_ivr)
+{
+	struct io_vec_read *ivr = channel->io_spare_ivr;
+
+	if (ivr && (ivr->ivr_max >= max_count)) {
+		channel->io_spare_ivr = NULL;
+		*ret_ivr = ivr;
+		return 0;
+	}
+
+	ivr = calloc(1, sizeof(struct io_vec_read));
+	if (!ivr)
+		return OCFS2_ET_NO_MEMORY;
+
+	ivr->ivr_channel = channel;
+	ivr->ivr_max = max_count;
+	ivr->ivr_iocb = malloc(sizeof(struct iocb) * max_count);
+	ivr->ivr_iocbs = malloc(sizeof(struct iocb *) * max_count);
+	ivr->ivr_events = malloc(sizeof(struct io_event) * max_count);
+	if (!ivr->ivr_iocb || !ivr->ivr_iocbs || !ivr->ivr_events) {
+		io_vec_read_destroy(ivr);
+		return OCFS2_ET_NO_MEMORY;
+	}
+
+	if (io_queue_init(max_count, &ivr->ivr_ctx)) {
+		ivr->ivr_ctx = 0;
+		io_vec_read_destroy(ivr);
+		return OCFS2_ET_IO;
+	}
+
+	*ret_ivr = ivr;
+	return 0;
+}
+
+static errcode_t io_vec_read_submit(struct io_vec_read *ivr)
+{
+	int ret;
+
+	ret = io_submit(ivr->ivr_ctx, ivr->ivr_count - ivr->ivr_submitted,
+			&ivr->ivr_iocbs[ivr->ivr_submitted]);
+	if (ret < 0) {
+		ivr->ivr_channel->io_error = -ret;
+		return OCFS2_ET_IO;
+	}
+
+	ivr->ivr_submitted += ret;
+	return 0;
+}
+
+errcode_t io_vec_read_start(struct io_vec_read *ivr,
+			    struct io_vec_unit *ivus, int count)
+{
+	int i;
+	errcode_t ret;
+	io_channel *channel = ivr->ivr_channel;
+
+	if ((count > ivr->ivr_max) ||
+	    (ivr->ivr_completed < ivr->ivr_submitted))
+		return OCFS2_ET_INVALID_ARGUMENT;
+
+	ivr->ivr_ivus = ivus;
+	ivr->ivr_count = count;
+	ivr->ivr_submitted = 0;
+	ivr->ivr_completed = 0;
+
+	for (i = 0; i < count; i++) {
+		io_prep_pread(&ivr->ivr_iocb[i], channel->io_fd,
+			      ivus[i].ivu_buf, ivus[i].ivu_buflen,
+			      ivus[i].ivu_blkno * channel->io_blksize);
+		ivr->ivr_iocbs[i] = &ivr->ivr_iocb[i];
+	}
+
+	ret = io_vec_read_submit(ivr);
+	if (ret)
+		/* Take back whatever did go out */
+		io_vec_read_finish(ivr);
+
+	return ret;
+}
+
+errcode_t io_vec_read_finish(struct io_vec_read *ivr)
+{
+	int i, nr;
+	errcode_t ret = 0;
+	uint64_t bytes = 0;
+	struct io_vec_unit *ivu;
+	struct iocb *iocb;
+	io_channel *channel = ivr->ivr_channel;
+
+	while (ivr->ivr_completed < ivr->ivr_count) {
+		/* io_submit() may not have taken all of them at once */
+		if (!ret && (ivr->ivr_submitted < ivr->ivr_count))
+			ret = io_vec_read_submit(ivr);
+		if (ivr->ivr_completed == ivr->ivr_submitted) {
+			if (!ret)
+				ret = OCFS2_ET_SHORT_READ;
+			break;
+		}
+
+		nr = io_getevents(ivr->ivr_ctx, 1,
+				  ivr->ivr_submitted - ivr->ivr_completed,
+				  ivr->ivr_events, NULL);
+		if (nr == -EINTR)
+			continue;
+		if (nr < 0) {
+			/*
+			 * We no longer know what is in flight.  The handle
+			 * can't be reused, and io_queue_release() will
+			 * wait out the rest.
+			 */
+			channel->io_error = -nr;
+			ivr->ivr_completed = ivr->ivr_submitted;
+			ivr->ivr_broken = 1;
+			ret = OCFS2_ET_IO;
+			break;
+		}
+
+		for (i = 0; i < nr; i++) {
+			iocb = (struct iocb *)ivr->ivr_events[i].obj;
+			ivu = &ivr->ivr_ivus[iocb - ivr->ivr_iocb];
+			if ((long)ivr->ivr_events[i].res < 0) {
+				channel->io_error = -ivr->ivr_events[i].res;
+				ret = OCFS2_ET_IO;
+			} else if (ivr->ivr_events[i].res != ivu->ivu_buflen) {
+				if (!ret)
+					ret = OCFS2_ET_SHORT_READ;
+			} else
+				bytes += ivu->ivu_buflen;
+		}
+		ivr->ivr_completed += nr;
+	}
+
+	channel->io_bytes_read += bytes;
+	channel->io_reads += ivr->ivr_completed;
+	ivr->ivr_count = ivr->ivr_completed = ivr->ivr_submitted = 0;
+
+	return ret;
+}
+
 errcode_t io_read_block(io_channel *channel, int64_t blkno, int count,
 			char *data)
 {
@@ -985,6 +1279,233 @@ errcode_t io_write_block_nocache(io_channel *channel, int64_t blkno, int count,
 }
 
 
+/*
+ * Ask the device or file to zero a range for us.  Returns
+ * OCFS2_ET_UNSUPP_FEATURE if it can't, so the caller can write zeroes.
+ *
+ * A block device gets BLKZEROOUT, which a thin LUN can turn into an
+ * unmap or a WRITE SAME.  If that isn't there but the device promises
+ * that discarded blocks read back as zeroes, a discard is as good.  A
+ * file gets its range punched out, or zeroed in place if the filesystem
+ * can't punch.  On OCFS2_ET_IO, *errp is the errno of the failed call.
+ */
+static errcode_t unix_zero_offload(int fd, uint64_t offset, uint64_t len,
+				   int *errp)
+{
+#ifdef __linux__
+	struct stat stat_buf;
+	uint64_t range[2] = { offset, len };
+	int rc = -1, err = 0;
+
+	if (fstat(fd, &stat_buf)) {
+		*errp = errno;
+		return OCFS2_ET_IO;
+	}
+
+	if (S_ISBLK(stat_buf.st_mode)) {
+#ifdef BLKZEROOUT
+		rc = ioctl(fd, BLKZEROOUT, range);
+		if (rc)
+			err = errno;
+#endif
+#if defined(BLKDISCARD) && defined(BLKDISCARDZEROES)
+		if (rc) {
+			unsigned int zeroes = 0;
+
+			if (!ioctl(fd, BLKDISCARDZEROES, &zeroes) && zeroes) {
+				rc = ioctl(fd, BLKDISCARD, range);
+				if (rc)
+					err = errno;
+			}
+		}
+#endif
+	} else if (S_ISREG(stat_buf.st_mode)) {
+#ifdef FALLOC_FL_PUNCH_HOLE
+		rc = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			       offset, len);
+		if (rc)
+			err = errno;
+#endif
+#ifdef FALLOC_FL_ZERO_RANGE
+		if (rc) {
+			rc = fallocate(fd, FALLOC_FL_ZERO_RANGE |
+				       FALLOC_FL_KEEP_SIZE, offset, len);
+			if (rc)
+				err = errno;
+		}
+#endif
+	}
+
+	/*
+	 * err is the errno of the last call that tried to zero, and
+	 * stays 0 if none ran.  Only a real I/O error is fatal; anything
+	 * else falls back to writing.
+	 */
+	if (!rc)
+		return 0;
+	if (err == EIO) {
+		*errp = err;
+		return OCFS2_ET_IO;
+	}
+#endif
+	return OCFS2_ET_UNSUPP_FEATURE;
+}
+
+/*
+ * The slow way, in large aligned writes so O_DIRECT is happy.  On
+ * OCFS2_ET_IO, *errp is the errno of the failed write.
+ */
+static errcode_t unix_zero_write(int fd, uint64_t offset, uint64_t len,
+				 int *errp)
+{
+	char *buf;
+	ssize_t wr;
+	size_t size;
+	errcode_t ret = 0;
+
+	if (posix_memalign((void **)&buf, OCFS2_MAX_BLOCKSIZE, ONE_MEGABYTE))
+		return OCFS2_ET_NO_MEMORY;
+	memset(buf, 0, ONE_MEGABYTE);
+
+	while (len) {
+		size = ocfs2_min(len, (uint64_t)ONE_MEGABYTE);
+		wr = pwrite64(fd, buf, size, offset);
+		if (wr < 0) {
+			*errp = errno;
+			ret = OCFS2_ET_IO;
+			break;
+		}
+		if (!wr) {
+			ret = OCFS2_ET_SHORT_WRITE;
+			break;
+		}
+		offset += wr;
+		len -= wr;
+	}
+
+	free(buf);
+	return ret;
+}
+
+/*
+ * Zero len bytes of fd at offset, without writing the zeroes if the
+ * device or file can do it for us.  offset and len must be multiples of
+ * the device's sector size.  With IO_ZERO_NOFALLBACK, we return
+ * OCFS2_ET_UNSUPP_FEATURE rather than write them ourselves.
+ */
+errcode_t io_zero_range(int fd, uint64_t offset, uint64_t len, int flags)
+{
+	errcode_t ret;
+	int err;
+
+	if (!len)
+		return 0;
+
+	ret = unix_zero_offload(fd, offset, len, &err);
+	if (ret != OCFS2_ET_UNSUPP_FEATURE || (flags & IO_ZERO_NOFALLBACK))
+		return ret;
+
+	return unix_zero_write(fd, offset, len, &err);
+}
+
+/*
+ * Tell the device it may forget a range.  Unlike io_zero_range(), the
+ * range isn't promised to read back as zeroes.
+ */
+errcode_t io_discard_range(int fd, uint64_t offset, uint64_t len)
+{
+#ifdef __linux__
+	struct stat stat_buf;
+	uint64_t range[2] = { offset, len };
+	int rc = -1, err = 0;
+
+	if (fstat(fd, &stat_buf))
+		return OCFS2_ET_IO;
+
+	if (S_ISBLK(stat_buf.st_mode)) {
+#ifdef BLKDISCARD
+		rc = ioctl(fd, BLKDISCARD, range);
+		if (rc)
+			err = errno;
+#endif
+	} else if (S_ISREG(stat_buf.st_mode)) {
+#ifdef FALLOC_FL_PUNCH_HOLE
+		rc = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			       offset, len);
+		if (rc)
+			err = errno;
+#endif
+	}
+
+	/* err stays 0 if nothing could discard */
+	if (!rc)
+		return 0;
+	if (err == EIO)
+		return OCFS2_ET_IO;
+#endif
+	return OCFS2_ET_UNSUPP_FEATURE;
+}
+
+/*
+ * Any cached copies of the range must read as zeroes now.  A short walk
+ * of the LRU beats looking up each block of a large range.
+ */
+static void io_cache_zero_range(io_channel *channel, int64_t blkno,
+				int64_t count)
+{
+	struct io_cache *ic = channel->io_cache;
+	struct io_cache_block *icb;
+	struct list_head *pos;
+	int64_t i;
+
+	if (!ic)
+		return;
+
+	if (count > ic->ic_nr_blocks) {
+		list_for_each(pos, &ic->ic_lru) {
+			icb = list_entry(pos, struct io_cache_block, icb_list);
+			if ((icb->icb_blkno >= blkno) &&
+			    (icb->icb_blkno < (blkno + count)))
+				memset(icb->icb_buf, 0, channel->io_blksize);
+		}
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		icb = io_cache_lookup(ic, blkno + i);
+		if (icb)
+			memset(icb->icb_buf, 0, channel->io_blksize);
+	}
+}
+
+errcode_t io_zero_blocks(io_channel *channel, int64_t blkno, int64_t count)
+{
+	errcode_t ret;
+	uint64_t offset = blkno * channel->io_blksize;
+	uint64_t len = count * channel->io_blksize;
+	int err = 0;
+
+	ret = unix_zero_offload(channel->io_fd, offset, len, &err);
+	if (!ret)
+		channel->io_writes++;
+	else if (ret == OCFS2_ET_UNSUPP_FEATURE) {
+		ret = unix_zero_write(channel->io_fd, offset, len, &err);
+		if (!ret) {
+			channel->io_bytes_written += len;
+			channel->io_writes++;
+		}
+	}
+	if (ret == OCFS2_ET_IO)
+		channel->io_error = err;
+
+	/* On failure the disk may still hold the old data */
+	if (!ret)
+		io_cache_zero_range(channel, blkno, count);
+
+	return ret;
+}
+
+
 #ifdef DEBUG_EXE
 #include <stdio.h>
 #include <stdlib.h>
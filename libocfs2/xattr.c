@@ -470,6 +470,58 @@ out:
 	return ret;
 }
 
+/*
+ * Read *nr_buckets contiguous buckets starting at blkno with a single
+ * I/O.  Every bucket is validated and swapped in place.  If a bucket
+ * fails validation, *nr_buckets is set to the number of good buckets
+ * before it and the error is returned.  An I/O error on the large read
+ * falls back to reading one bucket at a time, so the caller still gets
+ * every bucket that can be read.
+ */
+errcode_t ocfs2_read_xattr_buckets(ocfs2_filesys *fs,
+				   uint64_t blkno,
+				   uint32_t *nr_buckets,
+				   char *buckets_buf)
+{
+	errcode_t ret;
+	uint32_t i;
+	char *bucket = buckets_buf;
+	struct ocfs2_xattr_header *xh;
+	int blk_per_bucket = ocfs2_blocks_per_xattr_bucket(fs);
+
+	ret = ocfs2_read_blocks(fs, blkno, *nr_buckets * blk_per_bucket,
+				buckets_buf);
+	if (ret) {
+		for (i = 0; i < *nr_buckets; i++) {
+			ret = ocfs2_read_xattr_bucket(fs, blkno, bucket);
+			if (ret)
+				break;
+			blkno += blk_per_bucket;
+			bucket += OCFS2_XATTR_BUCKET_SIZE;
+		}
+		*nr_buckets = i;
+		return ret;
+	}
+
+	for (i = 0; i < *nr_buckets; i++) {
+		xh = (struct ocfs2_xattr_header *)bucket;
+		if (ocfs2_meta_ecc(OCFS2_RAW_SB(fs->fs_super)) &&
+		    !(fs->fs_flags & OCFS2_FLAG_NO_ECC_CHECKS)) {
+			ret = ocfs2_block_check_validate(bucket,
+						OCFS2_XATTR_BUCKET_SIZE,
+						&xh->xh_check);
+			if (ret)
+				break;
+		}
+		__ocfs2_swap_xattrs_to_cpu(fs, xh, OCFS2_XATTR_BUCKET_SIZE,
+					   xh);
+		bucket += OCFS2_XATTR_BUCKET_SIZE;
+	}
+
+	*nr_buckets = i;
+	return ret;
+}
+
 errcode_t ocfs2_write_xattr_bucket(ocfs2_filesys *fs,
 				   uint64_t blkno,
 				   char *bucket_buf)
@@ -25,12 +25,16 @@ static int get_number(char *arg, uint64_t *res);
 static void parse_journal_opts(char *progname, const char *opts,
 			       uint64_t *journal_size_in_bytes,
 			       int *journal64);
+static void parse_extended_opts(char *progname, const char *opts,
+				uint64_t *raid_stride,
+				uint64_t *raid_stripe_width,
+				int *lazy_journal_init);
 static void usage(const char *progname);
 static void version(const char *progname);
 static void fill_defaults(State *s);
+static void figure_raid_geometry(State *s);
 static int get_bits(State *s, int num);
 static uint64_t get_valid_size(uint64_t num, uint64_t lo, uint64_t hi);
-static void *do_malloc(State *s, size_t size);
 static void do_pwrite(State *s, const void *buf, size_t count, 
 		      uint64_t offset);
 static AllocBitmap *initialize_bitmap(State *s, uint32_t bits,
@@ -69,6 +73,7 @@ static void create_generation(State *s);
 static void init_record(State *s, SystemFileDiskRecord *rec, int type, int mode);
 static void print_state(State *s);
 static void clear_both_ends(State *s);
+static void discard_device(State *s);
 static int ocfs2_clusters_per_group(int block_size,
 				    int cluster_size_bits);
 static AllocGroup * initialize_alloc_group(State *s, const char *name,
@@ -124,6 +129,7 @@ enum {
 	CLUSTER_STACK_OPTION,
 	CLUSTER_NAME_OPTION,
 	GLOBAL_HEARTBEAT_OPTION,
+	DISCARD_OPTION,
 };
 
 static uint64_t align_bytes_to_clusters_ceil(State *s,
@@ -610,6 +616,9 @@ main(int argc, char **argv)
 		return 0;
 	}
 
+	if (s->discard)
+		discard_device(s);
+
 	clear_both_ends(s);
 
 	init_record(s, &superblock_rec, SFI_OTHER, S_IFREG | 0644);
@@ -667,6 +676,7 @@ main(int argc, char **argv)
 	tmprec->chain_off =
 		tmprec->group->gd->bg_blkno << s->blocksize_bits;
 
+	write_plan_flush(s);
 	fsync(s->fd);
 	if (!s->quiet)
 		printf("done\n");
@@ -756,6 +766,7 @@ main(int argc, char **argv)
 		}
 	}
 
+	write_plan_flush(s);
 	fsync(s->fd);
 	if (!s->quiet)
 		printf("done\n");
@@ -800,6 +811,7 @@ main(int argc, char **argv)
 	tmprec = &(record[HEARTBEAT_SYSTEM_INODE][0]);
 	write_metadata(s, tmprec, NULL);
 
+	write_plan_flush(s);
 	fsync(s->fd);
 	if (!s->quiet)
 		printf("done\n");
@@ -810,6 +822,8 @@ main(int argc, char **argv)
 	block_signals(SIG_BLOCK);
 	format_leading_space(s);
 	format_superblock(s, &superblock_rec, &root_dir_rec, &system_dir_rec);
+	write_plan_flush(s);
+	fsync(s->fd);
 	block_signals(SIG_UNBLOCK);
 
 	if (!s->quiet)
@@ -820,8 +834,13 @@ main(int argc, char **argv)
 
 	close_device(s);
 
-	if (!s->quiet)
+	if (!s->quiet) {
 		printf("%s successful\n\n", s->progname);
+		if (s->lazy_journal_init && !s->hb_dev)
+			printf("The journals were not zeroed. Run "
+			       "\"tunefs.ocfs2 --zero-journals\" to "
+			       "finish them.\n\n");
+	}
 
 	return 0;
 }
@@ -869,9 +888,12 @@ get_state(int argc, char **argv)
 	uint64_t val;
 	uint64_t journal_size_in_bytes = 0;
 	int journal64 = 0;
+	uint64_t raid_stride = 0, raid_stripe_width = 0;
+	int lazy_journal_init = 0;
 	enum ocfs2_mkfs_types fs_type = OCFS2_MKFSTYPE_DEFAULT;
 	int mount = -1;
 	int no_backup_super = -1;
+	int discard = 0;
 	enum ocfs2_feature_levels level = OCFS2_FEATURE_LEVEL_DEFAULT;
 	ocfs2_fs_options feature_flags = {0,0,0}, reverse_flags = {0,0,0};
 
@@ -884,6 +906,7 @@ get_state(int argc, char **argv)
 		{ "quiet", 0, 0, 'q' },
 		{ "version", 0, 0, 'V' },
 		{ "journal-options", 0, 0, 'J'},
+		{ "extended-options", 1, 0, 'E'},
 		{ "heartbeat-device", 0, 0, 'H'},
 		{ "force", 0, 0, 'F'},
 		{ "mount", 1, 0, 'M'},
@@ -894,6 +917,7 @@ get_state(int argc, char **argv)
 		{ "cluster-stack=", 1, 0, CLUSTER_STACK_OPTION },
 		{ "cluster-name=", 1, 0, CLUSTER_NAME_OPTION },
 		{ "global-heartbeat", 0, 0, GLOBAL_HEARTBEAT_OPTION },
+		{ "discard", 0, 0, DISCARD_OPTION },
 		{ 0, 0, 0, 0}
 	};
 
@@ -903,7 +927,7 @@ get_state(int argc, char **argv)
 		progname = strdup("mkfs.ocfs2");
 
 	while (1) {
-		c = getopt_long(argc, argv, "b:C:L:N:J:M:vnqVFHxT:U:",
+		c = getopt_long(argc, argv, "b:C:E:L:N:J:M:vnqVFHxT:U:",
 				long_options, NULL);
 
 		if (c == -1)
@@ -997,6 +1021,12 @@ get_state(int argc, char **argv)
 					   &journal64);
 			break;
 
+		case 'E':
+			parse_extended_opts(progname, optarg, &raid_stride,
+					    &raid_stripe_width,
+					    &lazy_journal_init);
+			break;
+
 		case 'U':
 			uuid = strdup(optarg);
 			break;
@@ -1037,6 +1067,10 @@ get_state(int argc, char **argv)
 			no_backup_super = 1;
 			break;
 
+		case DISCARD_OPTION:
+			discard = 1;
+			break;
+
 		case FEATURE_LEVEL:
 			ret = ocfs2_parse_feature_level(optarg, &level);
 			if (ret) {
@@ -1133,6 +1167,7 @@ get_state(int argc, char **argv)
 	s->quiet         = quiet;
 	s->force         = force;
 	s->dry_run       = dry_run;
+	s->discard       = discard;
 
 	s->prompt        = xtool ? 0 : 1;
 
@@ -1150,6 +1185,10 @@ get_state(int argc, char **argv)
 	s->journal_size_in_bytes = journal_size_in_bytes;
 	s->journal64 = journal64;
 
+	s->raid_stride = raid_stride;
+	s->raid_stripe_width = raid_stripe_width;
+	s->lazy_journal_init = lazy_journal_init;
+
 	s->hb_dev = hb_dev;
 
 	s->fs_type = fs_type;
@@ -1352,17 +1391,95 @@ parse_journal_opts(char *progname, const char *opts,
 	free(options);
 }
 
+static void
+parse_extended_opts(char *progname, const char *opts,
+		    uint64_t *raid_stride, uint64_t *raid_stripe_width,
+		    int *lazy_journal_init)
+{
+	char *options, *token, *next, *p, *arg;
+	int ret, extended_usage = 0;
+	uint64_t val, *field;
+
+	options = strdup(opts);
+
+	for (token = options; token && *token; token = next) {
+		p = strchr(token, ',');
+		next = NULL;
+
+		if (p) {
+			*p = '\0';
+			next = p + 1;
+		}
+
+		arg = strchr(token, '=');
+
+		if (arg) {
+			*arg = '\0';
+			arg++;
+		}
+
+		if (strcmp(token, "lazy_journal_init") == 0) {
+			if (!arg || !strcmp(arg, "1"))
+				*lazy_journal_init = 1;
+			else if (!strcmp(arg, "0"))
+				*lazy_journal_init = 0;
+			else
+				extended_usage++;
+			continue;
+		}
+
+		if (strcmp(token, "stride") == 0)
+			field = raid_stride;
+		else if ((strcmp(token, "stripe-width") == 0) ||
+			 (strcmp(token, "stripe_width") == 0))
+			field = raid_stripe_width;
+		else {
+			extended_usage++;
+			continue;
+		}
+
+		if (!arg) {
+			extended_usage++;
+			continue;
+		}
+
+		ret = get_number(arg, &val);
+		if (ret || !val || val > UINT32_MAX) {
+			com_err(progname, 0,
+				"Invalid %s: %s\nSize must be between 1 "
+				"and %u bytes", token, arg, UINT32_MAX);
+			exit(1);
+		}
+
+		*field = val;
+	}
+
+	if (extended_usage) {
+		com_err(progname, 0,
+			"Bad extended options specified. Valid extended "
+			"options are:\n"
+			"\tstride=<RAID chunk size>\n"
+			"\tstripe-width=<RAID full stripe size>\n"
+			"\tlazy_journal_init[=0|1]\n");
+		exit(1);
+	}
+
+	free(options);
+}
+
 static void
 usage(const char *progname)
 {
 	fprintf(stderr, "usage: %s [-b block-size] [-C cluster-size] "
-		"[-J journal-options]\n\t\t[-L volume-label] [-M mount-type] "
+		"[-J journal-options]\n\t\t[-E extended-options] "
+		"[-L volume-label] [-M mount-type] "
 		"[-N number-of-node-slots]\n\t\t[-T filesystem-type] [-U uuid]"
 		"[-HFnqvV] [--dry-run]"
 		"\n\t\t[--fs-feature-level=[default|max-compat|max-features]] "
 		"\n\t\t[--fs-features=[[no]sparse,...]] [--global-heartbeat]"
 		"\n\t\t[--cluster-stack=stackname] [--cluster-name=clustername]"
-		"\n\t\t[--no-backup-super] device [blocks-count]\n", progname);
+		"\n\t\t[--no-backup-super] [--discard] device [blocks-count]\n",
+		progname);
 	exit(1);
 }
 
@@ -1694,6 +1811,8 @@ fill_defaults(State *s)
 
 	s->cluster_size_bits = get_bits(s, s->cluster_size);
 
+	figure_raid_geometry(s);
+
 	/* volume size needs to be cluster aligned */
 	s->volume_size_in_clusters = s->volume_size_in_bytes >> s->cluster_size_bits;
 	tmp = (uint64_t)s->volume_size_in_clusters;
@@ -1735,6 +1854,87 @@ fill_defaults(State *s)
 	s->extent_alloc_size_in_clusters = figure_extent_alloc_size(s);
 }
 
+/*
+ * Read one of the I/O limits the kernel exports for a block device.
+ * A partition has no queue directory of its own; it shares the one of
+ * the whole disk, a level up.
+ */
+static uint64_t read_queue_limit(dev_t rdev, const char *name)
+{
+	char path[PATH_MAX];
+	unsigned long long val = 0;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/queue/%s",
+		 major(rdev), minor(rdev), name);
+	f = fopen(path, "r");
+	if (!f) {
+		snprintf(path, sizeof(path),
+			 "/sys/dev/block/%u:%u/../queue/%s",
+			 major(rdev), minor(rdev), name);
+		f = fopen(path, "r");
+	}
+	if (!f)
+		return 0;
+
+	if (fscanf(f, "%llu", &val) != 1)
+		val = 0;
+	fclose(f);
+
+	return val;
+}
+
+/*
+ * The RAID geometry comes from -E, or failing that from the minimum and
+ * optimal I/O sizes the device advertises.  Allocations of a full stripe
+ * or more are aligned to it when it is a whole number of clusters.
+ */
+static void
+figure_raid_geometry(State *s)
+{
+	struct stat st;
+	uint64_t min_io, opt_io;
+
+	if (!s->raid_stride && !s->raid_stripe_width) {
+		if (stat(s->device_name, &st) || !S_ISBLK(st.st_mode))
+			return;
+
+		min_io = read_queue_limit(st.st_rdev, "minimum_io_size");
+		opt_io = read_queue_limit(st.st_rdev, "optimal_io_size");
+
+		/* Plain disks report nothing, or just their sector size */
+		if (!min_io || opt_io <= s->blocksize || (opt_io % min_io) ||
+		    (opt_io % s->blocksize) || (opt_io > UINT32_MAX))
+			return;
+
+		if ((min_io > s->blocksize) && !(min_io % s->blocksize))
+			s->raid_stride = min_io;
+		s->raid_stripe_width = opt_io;
+	} else {
+		if ((s->raid_stride % s->blocksize) ||
+		    (s->raid_stripe_width % s->blocksize)) {
+			com_err(s->progname, 0,
+				"RAID stride and stripe width must be "
+				"multiples of the block size (%u)",
+				s->blocksize);
+			exit(1);
+		}
+
+		if (s->raid_stride && s->raid_stripe_width &&
+		    (s->raid_stripe_width % s->raid_stride)) {
+			com_err(s->progname, 0,
+				"RAID stripe width (%"PRIu64") must be a "
+				"multiple of the stride (%"PRIu64")",
+				s->raid_stripe_width, s->raid_stride);
+			exit(1);
+		}
+	}
+
+	if ((s->raid_stripe_width > s->cluster_size) &&
+	    !(s->raid_stripe_width % s->cluster_size))
+		s->stripe_clusters = s->raid_stripe_width >> s->cluster_size_bits;
+}
+
 static int
 get_bits(State *s, int num)
 {
@@ -1772,7 +1972,7 @@ get_valid_size(uint64_t num, uint64_t lo, uint64_t hi)
 	return tmp;
 }
 
-static void *
+void *
 do_malloc(State *s, size_t size)
 {
 	void *buf;
@@ -1790,18 +1990,11 @@ do_malloc(State *s, size_t size)
 	return buf;
 }
 
+/* Writes go through the write plan; see write_plan.c */
 static void
 do_pwrite(State *s, const void *buf, size_t count, uint64_t offset)
 {
-	ssize_t ret;
-
-	ret = pwrite64(s->fd, buf, count, offset);
-
-	if (ret == -1) {
-		com_err(s->progname, 0, "Could not write: %s",
-			strerror(errno));
-		exit(1);
-	}
+	write_plan_add(s, buf, count, offset);
 }
 
 static AllocGroup *
@@ -1993,6 +2186,31 @@ bail:
 	return first_zero;
 }
 
+/*
+ * Like find_clear_bits(), but the run must start at a bit whose
+ * position on disk, base + bit, is a multiple of align.
+ */
+static uint32_t
+find_aligned_clear_bits(void *buf, unsigned int size, uint32_t num_bits,
+			uint64_t base, uint32_t align)
+{
+	uint32_t off = 0, start, rem;
+
+	while (off < size) {
+		start = find_clear_bits(buf, size, num_bits, off);
+		if (start == (uint32_t)-1)
+			break;
+
+		rem = (base + start) % align;
+		if (!rem)
+			return start;
+
+		off = start + align - rem;
+	}
+
+	return (uint32_t)-1;
+}
+
 static int
 alloc_bytes_from_bitmap(State *s, uint64_t bytes, AllocBitmap *bitmap,
 			uint64_t *start, uint64_t *num)
@@ -2009,12 +2227,20 @@ alloc_from_bitmap(State *s, uint64_t num_bits, AllocBitmap *bitmap,
 		  uint64_t *start, uint64_t *num)
 {
 	uint32_t start_bit = (uint32_t) - 1;
+	uint32_t align = 1;
+	uint64_t base;
 	void *buf = NULL;
 	int i, found, chain;
 	AllocGroup *group;
 	struct ocfs2_group_desc *gd = NULL;
 	unsigned int size;
 
+	/* Full stripes of the global bitmap start on a stripe boundary */
+	if ((bitmap == s->global_bm) && s->stripe_clusters &&
+	    (num_bits >= s->stripe_clusters))
+		align = s->stripe_clusters;
+
+again:
 	found = 0;
 	for(i = 0; i < bitmap->num_chains && !found; i++) {
 		group = bitmap->groups[i];
@@ -2023,15 +2249,29 @@ alloc_from_bitmap(State *s, uint64_t num_bits, AllocBitmap *bitmap,
 			if (gd->bg_free_bits_count >= num_bits) {
 				buf = gd->bg_bitmap;
 				size = gd->bg_bits;
-				start_bit = find_clear_bits(buf, size,
-							    num_bits, 0);
-				found = 1;
-				break;
+				base = 0;
+				if (gd->bg_blkno != s->first_cluster_group_blkno)
+					base = (gd->bg_blkno << s->blocksize_bits) >>
+						s->cluster_size_bits;
+				start_bit = find_aligned_clear_bits(buf, size,
+								    num_bits,
+								    base,
+								    align);
+				if ((start_bit != (uint32_t)-1) ||
+				    (align == 1)) {
+					found = 1;
+					break;
+				}
 			}
 			group = group->next;
 		} while (group);
 	}
 
+	if ((start_bit == (uint32_t)-1) && (align > 1)) {
+		align = 1;
+		goto again;
+	}
+
 	if (start_bit == (uint32_t)-1) {
 		com_err(s->progname, 0,
 			"Could not allocate %"PRIu64" bits from %s bitmap",
@@ -2403,6 +2643,10 @@ format_superblock(State *s, SystemFileDiskRecord *rec,
 		di->id2.i_super.s_xattr_inline_size =
 						OCFS2_MIN_XATTR_INLINE_SIZE;
 
+	di->id2.i_super.s_raid_stride = s->raid_stride >> s->blocksize_bits;
+	di->id2.i_super.s_raid_stripe_width =
+				s->raid_stripe_width >> s->blocksize_bits;
+
 	di->id2.i_super.s_feature_incompat = s->feature_flags.opt_incompat;
 	di->id2.i_super.s_feature_compat = s->feature_flags.opt_compat;
 	di->id2.i_super.s_feature_ro_compat = s->feature_flags.opt_ro_compat;
@@ -2613,6 +2857,19 @@ write_metadata(State *s, SystemFileDiskRecord *rec, void *src)
 	free(buf);
 }
 
+/*
+ * The first cluster of a bitmap group is the descriptor followed by
+ * zeroes.  The plan queues the zeroes as part of the descriptor's write.
+ */
+static void
+write_group_cluster(State *s, void *buf, uint64_t offset)
+{
+	do_pwrite(s, buf, s->blocksize, offset);
+	if (s->cluster_size > s->blocksize)
+		write_plan_add_zero(s, s->cluster_size - s->blocksize,
+				    offset + s->blocksize);
+}
+
 static void
 write_bitmap_data(State *s, AllocBitmap *bitmap)
 {
@@ -2638,8 +2895,7 @@ write_bitmap_data(State *s, AllocBitmap *bitmap)
 		gd_buf = (struct ocfs2_group_desc *)buf;
 		mkfs_swap_group_desc_from_cpu(s, gd_buf);
 		mkfs_compute_meta_ecc(s, buf, &gd_buf->bg_check);
-		do_pwrite(s, buf, s->cluster_size,
-			  gd->bg_blkno << s->blocksize_bits);
+		write_group_cluster(s, buf, gd->bg_blkno << s->blocksize_bits);
 	}
 	free(buf);
 }
@@ -2746,11 +3002,14 @@ open_device(State *s)
 			s->device_name, strerror (errno));
 		exit(1);
 	}
+
+	write_plan_init(s);
 }
 
 static void
 close_device(State *s)
 {
+	write_plan_exit(s);
 	fsync(s->fd);
 	close(s->fd);
 	s->fd = -1;
@@ -2878,9 +3137,37 @@ print_state(State *s)
 	else
 		printf("Journal size: %"PRIu64"\n",
 		       s->journal_size_in_bytes);
+	if (s->raid_stride || s->raid_stripe_width)
+		printf("RAID stride: %"PRIu64", stripe width: %"PRIu64"\n",
+		       s->raid_stride, s->raid_stripe_width);
 	printf("Node slots: %u\n", s->initial_slots);
 }
 
+/*
+ * Tell the device that the whole volume is free.  A thin LUN gives back
+ * what the old contents held.  Not every device can do this, so failure
+ * only gets a note.
+ */
+static void
+discard_device(State *s)
+{
+	errcode_t ret;
+
+	if (!s->quiet)
+		printf("Discarding device blocks: ");
+
+	ret = io_discard_range(s->fd, 0, s->volume_size_in_bytes);
+
+	if (!s->quiet) {
+		if (ret == OCFS2_ET_UNSUPP_FEATURE)
+			printf("not supported\n");
+		else if (ret)
+			printf("failed\n");
+		else
+			printf("done\n");
+	}
+}
+
 static void
 clear_both_ends(State *s)
 {
@@ -2895,6 +3182,7 @@ clear_both_ends(State *s)
 
 	/* end of volume */
 	do_pwrite(s, buf, CLEAR_CHUNK, (s->volume_size_in_bytes - CLEAR_CHUNK));
+	write_plan_flush(s);
 
 	free(buf);
 
@@ -2998,8 +3286,14 @@ static void format_journals(State *s, ocfs2_filesys *fs)
 			goto error;
 		}
 
-		ret = ocfs2_make_journal(fs, blkno, journal_size_in_clusters,
-					 &features);
+		if (s->lazy_journal_init)
+			ret = ocfs2_make_lazy_journal(fs, blkno,
+						      journal_size_in_clusters,
+						      &features);
+		else
+			ret = ocfs2_make_journal(fs, blkno,
+						 journal_size_in_clusters,
+						 &features);
 		if (ret) {
 			com_err(s->progname, ret,
 				"while formatting journal \"%.*s\"",
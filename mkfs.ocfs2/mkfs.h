@@ -41,6 +41,8 @@
 #include <inttypes.h>
 #include <ctype.h>
 #include <assert.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 
 #include <uuid/uuid.h>
 
@@ -193,6 +195,7 @@ struct _State {
 	int inline_data;
 	int dx_dirs;
 	int dry_run;
+	int discard;
 
 	uint32_t blocksize;
 	uint32_t blocksize_bits;
@@ -214,6 +217,12 @@ struct _State {
 	uint64_t journal_size_in_bytes;
 	int journal64;
 
+	uint64_t raid_stride;		/* bytes */
+	uint64_t raid_stripe_width;	/* bytes */
+	uint32_t stripe_clusters;
+
+	int lazy_journal_init;
+
 	uint32_t extent_alloc_size_in_clusters;
 
 	char *vol_label;
@@ -226,6 +235,7 @@ struct _State {
 	uint32_t vol_generation;
 
 	int fd;
+	struct write_plan *plan;
 
 	time_t format_time;
 
@@ -246,3 +256,12 @@ int is_classic_stack(char *stack_name);
 void cluster_fill(char **stack_name, char **cluster_name, uint8_t *stack_flags);
 int ocfs2_fill_cluster_information(State *s);
 int ocfs2_check_volume(State *s);
+
+void *do_malloc(State *s, size_t size);
+
+void write_plan_init(State *s);
+void write_plan_exit(State *s);
+void write_plan_add(State *s, const void *buf, size_t count,
+		    uint64_t offset);
+void write_plan_add_zero(State *s, uint64_t len, uint64_t offset);
+void write_plan_flush(State *s);
@@ -0,0 +1,536 @@
+/* -*- mode: c; c-basic-offset: 8; -*-
+ * vim: noexpandtab sw=8 ts=8 sts=0:
+ *
+ * write_plan.c
+ *
+ * Batches mkfs's writes to the device
+ *
+ * Copyright (C) 2026 Oracle.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License, version 2,  as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * --
+ *
+ * mkfs lays out a volume as a long list of small writes: an inode here,
+ * a group descriptor every few hundred megabytes there.  Issued one
+ * pwrite at a time, a large volume is bound by the latency of each
+ * write, not by the device.
+ *
+ * Instead, writes go into a plan.  The plan holds a copy of each buffer
+ * until it is flushed.  A flush sorts the writes by offset, merges
+ * neighbours into one vectored write and keeps up to
+ * PLAN_QUEUE_DEPTH of them in flight with libaio.
+ *
+ * Zeroing is done first.  A run of writes with no gaps on disk that
+ * zeroes at least PLAN_ZERO_OFFLOAD_MIN bytes is zeroed as one span by
+ * io_zero_range(), and the buffers inside the span are written over it
+ * afterwards.  Smaller zero ranges, and all of them when the device
+ * can't zero, are written from a zero buffer in the same merged writes
+ * as their neighbours.  A group descriptor and the zeroes after it are
+ * then one write in the queue, not one ioctl each.
+ *
+ * Later writes must win over earlier ones.  Writes that overlap are
+ * rare in mkfs, so when a flush finds some it waits for everything in
+ * flight and writes the overlapping ones in the order they were added.
+ */
+
+#include <sys/uio.h>
+#include <limits.h>
+#include <libaio.h>
+
+#include "mkfs.h"
+
+#define PLAN_QUEUE_DEPTH	64
+#define PLAN_MAX_IOVS		256		/* iovecs per merged write */
+#define PLAN_MAX_WRITE		(8 * 1024 * 1024)
+#define PLAN_MAX_BYTES		(64 * 1024 * 1024)	/* held before a flush */
+#define PLAN_ZERO_CHUNK		(1024 * 1024)
+#define PLAN_ZERO_OFFLOAD_MIN	PLAN_MAX_WRITE
+
+struct plan_write {
+	uint64_t	pw_offset;
+	uint64_t	pw_len;
+	char		*pw_buf;	/* NULL to zero the range */
+	uint64_t	pw_seq;
+	int		pw_zeroed;	/* already zeroed with its span */
+};
+
+struct plan_slot {
+	struct iocb	ps_iocb;
+	struct iovec	ps_iov[PLAN_MAX_IOVS];
+	uint64_t	ps_len;
+};
+
+struct write_plan {
+	struct plan_write	*wp_writes;
+	size_t			wp_nr_writes;
+	size_t			wp_max_writes;
+	uint64_t		wp_bytes;
+	uint64_t		wp_seq;
+
+	int			wp_no_zero_offload;
+	char			*wp_zero_buf;
+
+	/* Without aio we do the merged writes with pwritev() */
+	int			wp_aio;
+	io_context_t		wp_ctx;
+	struct plan_slot	wp_slots[PLAN_QUEUE_DEPTH];
+	struct iocb		*wp_pending[PLAN_QUEUE_DEPTH];
+	int			wp_free[PLAN_QUEUE_DEPTH];
+	int			wp_nr_free;
+	int			wp_nr_pending;
+	int			wp_in_flight;
+
+	/* stats */
+	uint64_t		wp_total_writes;
+	uint64_t		wp_total_ios;
+};
+
+static void plan_io_error(State *s, int err)
+{
+	com_err(s->progname, 0, "Could not write: %s", strerror(err));
+	exit(1);
+}
+
+void write_plan_init(State *s)
+{
+	struct write_plan *wp;
+	int i;
+
+	wp = do_malloc(s, sizeof(struct write_plan));
+	memset(wp, 0, sizeof(struct write_plan));
+
+	wp->wp_zero_buf = do_malloc(s, PLAN_ZERO_CHUNK);
+	memset(wp->wp_zero_buf, 0, PLAN_ZERO_CHUNK);
+
+	for (i = 0; i < PLAN_QUEUE_DEPTH; i++)
+		wp->wp_free[i] = i;
+	wp->wp_nr_free = PLAN_QUEUE_DEPTH;
+
+	wp->wp_aio = !io_queue_init(PLAN_QUEUE_DEPTH, &wp->wp_ctx);
+
+	s->plan = wp;
+}
+
+void write_plan_exit(State *s)
+{
+	struct write_plan *wp = s->plan;
+
+	if (!wp)
+		return;
+
+	write_plan_flush(s);
+
+	if (s->verbose)
+		printf("Wrote %"PRIu64" buffers in %"PRIu64" writes\n",
+		       wp->wp_total_writes, wp->wp_total_ios);
+
+	if (wp->wp_aio)
+		io_queue_release(wp->wp_ctx);
+	free(wp->wp_writes);
+	free(wp->wp_zero_buf);
+	free(wp);
+	s->plan = NULL;
+}
+
+static void plan_add(State *s, char *buf, uint64_t len, uint64_t offset)
+{
+	struct write_plan *wp = s->plan;
+	struct plan_write *pw;
+
+	if (wp->wp_nr_writes == wp->wp_max_writes) {
+		wp->wp_max_writes = wp->wp_max_writes ?
+			wp->wp_max_writes * 2 : 1024;
+		wp->wp_writes = realloc(wp->wp_writes, wp->wp_max_writes *
+					sizeof(struct plan_write));
+		if (!wp->wp_writes) {
+			com_err(s->progname, 0,
+				"Could not allocate the write plan");
+			exit(1);
+		}
+	}
+
+	pw = &wp->wp_writes[wp->wp_nr_writes++];
+	pw->pw_offset = offset;
+	pw->pw_len = len;
+	pw->pw_buf = buf;
+	pw->pw_seq = wp->wp_seq++;
+	pw->pw_zeroed = 0;
+	wp->wp_total_writes++;
+}
+
+void write_plan_add(State *s, const void *buf, size_t count,
+		    uint64_t offset)
+{
+	struct write_plan *wp = s->plan;
+	char *copy;
+
+	copy = do_malloc(s, count);
+	memcpy(copy, buf, count);
+	plan_add(s, copy, count, offset);
+
+	wp->wp_bytes += count;
+	if (wp->wp_bytes >= PLAN_MAX_BYTES)
+		write_plan_flush(s);
+}
+
+void write_plan_add_zero(State *s, uint64_t len, uint64_t offset)
+{
+	plan_add(s, NULL, len, offset);
+}
+
+static int plan_write_cmp(const void *a, const void *b)
+{
+	const struct plan_write *l = a, *r = b;
+
+	if (l->pw_offset != r->pw_offset)
+		return l->pw_offset < r->pw_offset ? -1 : 1;
+	if (l->pw_seq != r->pw_seq)
+		return l->pw_seq < r->pw_seq ? -1 : 1;
+	return 0;
+}
+
+static int plan_seq_cmp(const void *a, const void *b)
+{
+	const struct plan_write *l = a, *r = b;
+
+	if (l->pw_seq != r->pw_seq)
+		return l->pw_seq < r->pw_seq ? -1 : 1;
+	return 0;
+}
+
+/* Wait for at least min_nr writes in flight to finish */
+static void plan_reap(State *s, int min_nr)
+{
+	struct write_plan *wp = s->plan;
+	struct io_event events[PLAN_QUEUE_DEPTH];
+	struct plan_slot *slot;
+	int i, ret;
+
+	while (min_nr > 0 && wp->wp_in_flight) {
+		ret = io_getevents(wp->wp_ctx, 1, PLAN_QUEUE_DEPTH, events,
+				   NULL);
+		if (ret == -EINTR)
+			continue;
+		if (ret < 0)
+			plan_io_error(s, -ret);
+
+		for (i = 0; i < ret; i++) {
+			/* ps_iocb is the first member of the slot */
+			slot = (struct plan_slot *)events[i].obj;
+			if ((long)events[i].res < 0)
+				plan_io_error(s, -(long)events[i].res);
+			if (events[i].res != slot->ps_len)
+				plan_io_error(s, EIO);
+			wp->wp_free[wp->wp_nr_free++] = slot - wp->wp_slots;
+		}
+		wp->wp_in_flight -= ret;
+		min_nr -= ret;
+	}
+}
+
+static void plan_submit(State *s)
+{
+	struct write_plan *wp = s->plan;
+	int ret, done = 0;
+
+	while (done < wp->wp_nr_pending) {
+		ret = io_submit(wp->wp_ctx, wp->wp_nr_pending - done,
+				&wp->wp_pending[done]);
+		if (ret == -EAGAIN) {
+			plan_reap(s, 1);
+			continue;
+		}
+		if (ret <= 0)
+			plan_io_error(s, ret ? -ret : EIO);
+		wp->wp_in_flight += ret;
+		done += ret;
+	}
+	wp->wp_nr_pending = 0;
+}
+
+/* Let everything we've queued reach the device */
+static void plan_drain(State *s)
+{
+	struct write_plan *wp = s->plan;
+
+	if (!wp->wp_aio)
+		return;
+
+	plan_submit(s);
+	plan_reap(s, wp->wp_in_flight);
+}
+
+static struct plan_slot *plan_get_slot(State *s)
+{
+	struct write_plan *wp = s->plan;
+	struct plan_slot *slot;
+
+	if (!wp->wp_nr_free) {
+		plan_submit(s);
+		plan_reap(s, 1);
+	}
+
+	slot = &wp->wp_slots[wp->wp_free[--wp->wp_nr_free]];
+	slot->ps_len = 0;
+	return slot;
+}
+
+static void plan_start_write(State *s, struct plan_slot *slot, int nr_iov,
+			     uint64_t offset)
+{
+	struct write_plan *wp = s->plan;
+	ssize_t ret;
+
+	wp->wp_total_ios++;
+
+	if (!wp->wp_aio) {
+		ret = pwritev(s->fd, slot->ps_iov, nr_iov, offset);
+		if (ret < 0)
+			plan_io_error(s, errno);
+		if (ret != slot->ps_len)
+			plan_io_error(s, EIO);
+		wp->wp_free[wp->wp_nr_free++] = slot - wp->wp_slots;
+		return;
+	}
+
+	io_prep_pwritev(&slot->ps_iocb, s->fd, slot->ps_iov, nr_iov, offset);
+	wp->wp_pending[wp->wp_nr_pending++] = &slot->ps_iocb;
+}
+
+/*
+ * Ask the device to zero a range.  Returns 0 once it is zeroed, or
+ * non-zero if the device can't do it and the range must be written.
+ */
+static int plan_zero_offload(State *s, uint64_t offset, uint64_t len)
+{
+	struct write_plan *wp = s->plan;
+	errcode_t ret;
+
+	if (wp->wp_no_zero_offload)
+		return 1;
+
+	ret = io_zero_range(s->fd, offset, len, IO_ZERO_NOFALLBACK);
+	if (!ret) {
+		wp->wp_total_ios++;
+		return 0;
+	}
+	if (ret != OCFS2_ET_UNSUPP_FEATURE) {
+		com_err(s->progname, ret, "while zeroing %"PRIu64
+			" bytes at %"PRIu64, len, offset);
+		exit(1);
+	}
+	wp->wp_no_zero_offload = 1;
+	return 1;
+}
+
+/* Queue writes of our zero buffer over a range */
+static void plan_zero_write(State *s, uint64_t offset, uint64_t len)
+{
+	struct write_plan *wp = s->plan;
+	struct plan_slot *slot;
+	uint64_t chunk;
+	int nr_iov;
+
+	while (len) {
+		slot = plan_get_slot(s);
+		for (nr_iov = 0; len && nr_iov < PLAN_MAX_IOVS &&
+		     slot->ps_len < PLAN_MAX_WRITE; nr_iov++) {
+			chunk = ocfs2_min(len, (uint64_t)PLAN_ZERO_CHUNK);
+			slot->ps_iov[nr_iov].iov_base = wp->wp_zero_buf;
+			slot->ps_iov[nr_iov].iov_len = chunk;
+			slot->ps_len += chunk;
+			len -= chunk;
+		}
+		plan_start_write(s, slot, nr_iov, offset);
+		offset += slot->ps_len;
+	}
+}
+
+static void plan_zero(State *s, uint64_t offset, uint64_t len)
+{
+	if (plan_zero_offload(s, offset, len))
+		plan_zero_write(s, offset, len);
+}
+
+/* Does writes[i] overlap the write after it? */
+static int plan_overlaps_next(struct plan_write *writes, size_t nr, size_t i)
+{
+	return (i + 1 < nr) &&
+		(writes[i + 1].pw_offset < writes[i].pw_offset +
+		 writes[i].pw_len);
+}
+
+/* How many writes, from writes[i] on, overlap one another? */
+static size_t plan_overlap_run(struct plan_write *writes, size_t nr, size_t i)
+{
+	uint64_t end = writes[i].pw_offset + writes[i].pw_len;
+	size_t j;
+
+	for (j = i + 1; j < nr && writes[j].pw_offset < end; j++)
+		end = MAX(end, writes[j].pw_offset + writes[j].pw_len);
+
+	return j - i;
+}
+
+static int plan_nr_iovs(struct plan_write *pw)
+{
+	if (pw->pw_buf)
+		return 1;
+	return (pw->pw_len + PLAN_ZERO_CHUNK - 1) / PLAN_ZERO_CHUNK;
+}
+
+/*
+ * Start writes[0] and any writes right after it on disk as one write.
+ * Zero ranges come from our zero buffer.  A write that overlaps the
+ * one after it is left for plan_write_in_order(), and a range that was
+ * zeroed with its span is skipped.  Returns how many writes it took.
+ */
+static size_t plan_merge(State *s, struct plan_write *writes, size_t nr)
+{
+	struct write_plan *wp = s->plan;
+	struct plan_slot *slot;
+	uint64_t end = writes[0].pw_offset, left, chunk;
+	size_t i;
+	int nr_iov = 0;
+
+	slot = plan_get_slot(s);
+	for (i = 0; i < nr; i++) {
+		if (writes[i].pw_zeroed || writes[i].pw_offset != end)
+			break;
+		if (i && ((slot->ps_len + writes[i].pw_len > PLAN_MAX_WRITE) ||
+			  (nr_iov + plan_nr_iovs(&writes[i]) > PLAN_MAX_IOVS) ||
+			  plan_overlaps_next(writes, nr, i)))
+			break;
+
+		if (writes[i].pw_buf) {
+			slot->ps_iov[nr_iov].iov_base = writes[i].pw_buf;
+			slot->ps_iov[nr_iov++].iov_len = writes[i].pw_len;
+		} else {
+			for (left = writes[i].pw_len; left; left -= chunk) {
+				chunk = ocfs2_min(left,
+						  (uint64_t)PLAN_ZERO_CHUNK);
+				slot->ps_iov[nr_iov].iov_base = wp->wp_zero_buf;
+				slot->ps_iov[nr_iov++].iov_len = chunk;
+			}
+		}
+		slot->ps_len += writes[i].pw_len;
+		end += writes[i].pw_len;
+	}
+
+	plan_start_write(s, slot, nr_iov, writes[0].pw_offset);
+	return i;
+}
+
+/*
+ * Zero writes[0] and the writes after it that leave no gap on disk, as
+ * one span from the first zero range to the last.  The buffers in
+ * between are written over it later.  Runs with less than
+ * PLAN_ZERO_OFFLOAD_MIN to zero are left to plan_merge().  Returns how
+ * many writes it looked at.
+ */
+static size_t plan_zero_span(State *s, struct plan_write *writes, size_t nr)
+{
+	uint64_t end = writes[0].pw_offset, zero_bytes = 0;
+	size_t i, first = nr, last = 0;
+
+	for (i = 0; i < nr; i++) {
+		if (writes[i].pw_offset != end ||
+		    plan_overlap_run(writes, nr, i) > 1)
+			break;
+		if (!writes[i].pw_buf) {
+			if (first == nr)
+				first = i;
+			last = i;
+			zero_bytes += writes[i].pw_len;
+		}
+		end += writes[i].pw_len;
+	}
+	if (!i)
+		return 1;
+
+	if (zero_bytes < PLAN_ZERO_OFFLOAD_MIN)
+		return i;
+
+	end = writes[last].pw_offset + writes[last].pw_len;
+	if (plan_zero_offload(s, writes[first].pw_offset,
+			      end - writes[first].pw_offset))
+		return i;
+
+	for (; first <= last; first++)
+		if (!writes[first].pw_buf)
+			writes[first].pw_zeroed = 1;
+	return i;
+}
+
+/* Overlapping writes go out one by one, oldest first */
+static void plan_write_in_order(State *s, struct plan_write *writes,
+				size_t nr)
+{
+	size_t i;
+
+	plan_drain(s);
+	qsort(writes, nr, sizeof(struct plan_write), plan_seq_cmp);
+
+	for (i = 0; i < nr; i++) {
+		if (writes[i].pw_buf)
+			plan_merge(s, &writes[i], 1);
+		else
+			plan_zero(s, writes[i].pw_offset, writes[i].pw_len);
+		plan_drain(s);
+	}
+}
+
+void write_plan_flush(State *s)
+{
+	struct write_plan *wp = s->plan;
+	struct plan_write *writes = wp->wp_writes;
+	size_t i, run, nr = wp->wp_nr_writes;
+
+	if (!nr)
+		return;
+
+	qsort(writes, nr, sizeof(struct plan_write), plan_write_cmp);
+
+	/*
+	 * io_zero_range() is done by the time it returns, so the spans
+	 * are zeroed before any buffer inside them is queued.
+	 */
+	for (i = 0; i < nr && !wp->wp_no_zero_offload; ) {
+		run = plan_overlap_run(writes, nr, i);
+		if (run > 1)
+			i += run;
+		else
+			i += plan_zero_span(s, &writes[i], nr - i);
+	}
+
+	for (i = 0; i < nr; ) {
+		run = plan_overlap_run(writes, nr, i);
+		if (run > 1) {
+			plan_write_in_order(s, &writes[i], run);
+			i += run;
+		} else if (writes[i].pw_zeroed)
+			i++;
+		else if (!writes[i].pw_buf &&
+			 writes[i].pw_len > PLAN_MAX_WRITE) {
+			plan_zero_write(s, writes[i].pw_offset,
+					writes[i].pw_len);
+			i++;
+		} else
+			i += plan_merge(s, &writes[i], nr - i);
+	}
+
+	plan_drain(s);
+
+	for (i = 0; i < nr; i++)
+		free(writes[i].pw_buf);
+	wp->wp_nr_writes = 0;
+	wp->wp_bytes = 0;
+}
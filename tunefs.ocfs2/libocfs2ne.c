@@ -109,6 +109,9 @@ static unsigned int blocked_signals_count;
 /* For DEBUG_EXE programs */
 static const char *usage_string;
 
+/* Set by --lazy-journal-init */
+static int lazy_journal_init;
+
 
 /*
  * Code to manage the fs_private state.
@@ -331,6 +334,11 @@ errcode_t tunefs_clear_in_progress(ocfs2_filesys *fs, int flag)
 	return ocfs2_write_primary_super(fs);
 }
 
+void tunefs_set_lazy_journal_init(int lazy)
+{
+	lazy_journal_init = lazy;
+}
+
 errcode_t tunefs_set_journal_size(ocfs2_filesys *fs, uint64_t new_size,
 				  ocfs2_fs_options mask,
 				  ocfs2_fs_options options)
@@ -431,7 +439,12 @@ errcode_t tunefs_set_journal_size(ocfs2_filesys *fs, uint64_t new_size,
 		verbosef(VL_LIB,
 			 "Resizing journal \"%s\" to %"PRIu32" clusters\n",
 			 jrnl_file, num_clusters);
-		ret = ocfs2_make_journal(fs, blkno, num_clusters, newfeat);
+		if (lazy_journal_init)
+			ret = ocfs2_make_lazy_journal(fs, blkno, num_clusters,
+						      newfeat);
+		else
+			ret = ocfs2_make_journal(fs, blkno, num_clusters,
+						 newfeat);
 		if (ret) {
 			verbosef(VL_LIB,
 				 "%s while resizing \"%s\" at block "
@@ -456,37 +469,8 @@ bail:
 errcode_t tunefs_empty_clusters(ocfs2_filesys *fs, uint64_t start_blk,
 				uint32_t num_clusters)
 {
-	errcode_t ret;
-	char *buf = NULL;
-	uint64_t bpc = ocfs2_clusters_to_blocks(fs, 1);
-	uint64_t total_blocks = ocfs2_clusters_to_blocks(fs, num_clusters);
-	uint64_t io_blocks = total_blocks;
-
-	ret = ocfs2_malloc_blocks(fs->fs_io, io_blocks, &buf);
-	if (ret == OCFS2_ET_NO_MEMORY) {
-		io_blocks = bpc;
-		ret = ocfs2_malloc_blocks(fs->fs_io, io_blocks, &buf);
-	}
-	if (ret)
-		goto bail;
-
-	memset(buf, 0, io_blocks * fs->fs_blocksize);
-
-	while (total_blocks) {
-		ret = io_write_block_nocache(fs->fs_io, start_blk,
-					     io_blocks, buf);
-		if (ret)
-			goto bail;
-
-		total_blocks -= io_blocks;
-		start_blk += io_blocks;
-	}
-
-bail:
-	if (buf)
-		ocfs2_free(&buf);
-
-	return ret;
+	return io_zero_blocks(fs->fs_io, start_blk,
+			      ocfs2_clusters_to_blocks(fs, num_clusters));
 }
 
 errcode_t tunefs_get_free_clusters(ocfs2_filesys *fs, uint32_t *clusters)
@@ -518,24 +502,37 @@ bail:
 	return ret;
 }
 
-static errcode_t tunefs_validate_inode(ocfs2_filesys *fs,
-				       struct ocfs2_dinode *di)
-{
-	if (memcmp(di->i_signature, OCFS2_INODE_SIGNATURE,
-		    strlen(OCFS2_INODE_SIGNATURE)))
-		return OCFS2_ET_BAD_INODE_MAGIC;
-
-	ocfs2_swap_inode_to_cpu(fs, di);
+struct foreach_inode_ctxt {
+	errcode_t (*func)(ocfs2_filesys *fs, struct ocfs2_dinode *di,
+			  void *user_data);
+	void *user_data;
+	int complete;
+};
 
-	if (di->i_fs_generation != fs->fs_super->i_fs_generation)
-		return OCFS2_ET_INODE_NOT_VALID;
+static errcode_t foreach_inode_func(ocfs2_filesys *fs, uint64_t blkno,
+				    struct ocfs2_dinode *di, void *priv_data)
+{
+	struct foreach_inode_ctxt *ctxt = priv_data;
+	errcode_t ret;
 
-	if (!(di->i_flags & OCFS2_VALID_FL))
-		return OCFS2_ET_INODE_NOT_VALID;
+	ret = ctxt->func(fs, di, ctxt->user_data);
+	if (ret == OCFS2_ET_ITERATION_COMPLETE)
+		ctxt->complete = 1;
 
-	return 0;
+	return ret;
 }
 
+/*
+ * Each feature scans the inodes for itself.  The features in a run
+ * change the volume one after another, and a feature has to see what
+ * the ones before it left behind.  Disabling inline-data turns inline
+ * directories into dirblocks that enabling metaecc must then find, for
+ * example.  So the scans can't share one pass.  Instead, all the
+ * features in a run share one I/O cache, which is large if any of them
+ * asked for TUNEFS_FLAG_LARGECACHE.  When it can hold the inode groups,
+ * the scan reads through it, and only the first scan of the run has to
+ * go to the disk.
+ */
 errcode_t tunefs_foreach_inode(ocfs2_filesys *fs,
 			       errcode_t (*func)(ocfs2_filesys *fs,
 						 struct ocfs2_dinode *di,
@@ -543,54 +540,34 @@ errcode_t tunefs_foreach_inode(ocfs2_filesys *fs,
 			       void *user_data)
 {
 	errcode_t ret;
-	uint64_t blkno;
-	char *buf;
-	struct ocfs2_dinode *di;
-	ocfs2_inode_scan *scan;
-
-	ret = ocfs2_malloc_block(fs->fs_io, &buf);
-	if (ret) {
-		verbosef(VL_LIB,
-			 "%s while allocating a buffer for inode scanning\n",
-			 error_message(ret));
-		goto out;
-	}
+	ocfs2_scan_bus *bus;
+	struct foreach_inode_ctxt ctxt = {
+		.func = func,
+		.user_data = user_data,
+	};
 
-	di = (struct ocfs2_dinode *)buf;
+	if (!func)
+		return 0;
 
-	ret = ocfs2_open_inode_scan(fs, &scan);
+	ret = ocfs2_open_scan_bus(fs, &bus);
 	if (ret) {
 		verbosef(VL_LIB,
 			 "%s while opening inode scan\n",
 			 error_message(ret));
-		goto out_free;
-	}
-
-	for(;;) {
-		ret = ocfs2_get_next_inode(scan, &blkno, buf);
-		if (ret) {
-			verbosef(VL_LIB, "%s while getting next inode\n",
-				 error_message(ret));
-			break;
-		}
-		if (blkno == 0)
-			break;
-
-		ret = tunefs_validate_inode(fs, di);
-		if (ret)
-			continue;
-
-		if (func) {
-			ret = func(fs, di, user_data);
-			if (ret)
-				break;
-		}
+		goto out;
 	}
 
-	ocfs2_close_inode_scan(scan);
-out_free:
-	ocfs2_free(&buf);
+	ret = ocfs2_scan_bus_add(bus, 0, foreach_inode_func, &ctxt);
+	if (!ret)
+		ret = ocfs2_scan_bus_run(bus);
+	if (ret)
+		verbosef(VL_LIB, "%s while scanning inodes\n",
+			 error_message(ret));
+	else if (ctxt.complete)
+		/* The bus swallows this, but our callers get func's return */
+		ret = OCFS2_ET_ITERATION_COMPLETE;
 
+	ocfs2_close_scan_bus(bus);
 out:
 	return ret;
 }
@@ -224,6 +224,12 @@ errcode_t tunefs_set_journal_size(ocfs2_filesys *fs, uint64_t new_size,
 				  ocfs2_fs_options mask,
 				  ocfs2_fs_options options);
 
+/*
+ * Have tunefs_set_journal_size() skip zeroing the journals it formats.
+ * They are left for the --zero-journals operation.
+ */
+void tunefs_set_lazy_journal_init(int lazy);
+
 /* Determine how many clusters the filesystem has free */
 errcode_t tunefs_get_free_clusters(ocfs2_filesys *fs, uint32_t *clusters);
 
@@ -102,6 +102,7 @@ extern struct tunefs_operation update_cluster_stack_op;
 extern struct tunefs_operation cloned_volume_op;
 extern struct tunefs_operation set_usrquota_sync_interval_op;
 extern struct tunefs_operation set_grpquota_sync_interval_op;
+extern struct tunefs_operation zero_journals_op;
 
 /* List of operations we're going to run */
 static LIST_HEAD(tunefs_run_list);
@@ -332,6 +333,12 @@ static int mount_type_handle_arg(struct tunefs_option *opt, char *arg)
 	return rc;
 }
 
+static int lazy_journal_init_handle_arg(struct tunefs_option *opt, char *arg)
+{
+	tunefs_set_lazy_journal_init(1);
+	return 0;
+}
+
 static int backup_super_handle_arg(struct tunefs_option *opt, char *arg)
 {
 	return strdup_handle_arg(opt, "backup-super");
@@ -639,6 +646,26 @@ static struct tunefs_option set_grpquota_sync_interval_option = {
 	.opt_op		= &set_grpquota_sync_interval_op,
 };
 
+static struct tunefs_option zero_journals_option = {
+	.opt_option	= {
+		.name		= "zero-journals",
+		.val		= CHAR_MAX,
+		.has_arg	= 2,
+	},
+	.opt_help	= "   --zero-journals[=<bytes-per-second>]",
+	.opt_handle	= generic_handle_arg,
+	.opt_op		= &zero_journals_op,
+};
+
+static struct tunefs_option lazy_journal_init_option = {
+	.opt_option	= {
+		.name	= "lazy-journal-init",
+		.val	= CHAR_MAX,
+	},
+	.opt_help	= "   --lazy-journal-init",
+	.opt_handle	= lazy_journal_init_handle_arg,
+};
+
 /* The order here creates the order in print_usage() */
 static struct tunefs_option *options[] = {
 	&help_option,
@@ -661,6 +688,8 @@ static struct tunefs_option *options[] = {
 	&cloned_volume_option,
 	&set_usrquota_sync_interval_option,
 	&set_grpquota_sync_interval_option,
+	&zero_journals_option,
+	&lazy_journal_init_option,
 	&yes_option,
 	&no_option,
 	NULL,
@@ -0,0 +1,291 @@
+/* -*- mode: c; c-basic-offset: 8; -*-
+ * vim: noexpandtab sw=8 ts=8 sts=0:
+ *
+ * op_zero_journals.c
+ *
+ * ocfs2 tune utility for zeroing journals that were created lazily.
+ *
+ * Copyright (C) 2026 Oracle.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "o2dlm/o2dlm.h"
+#include "ocfs2/ocfs2.h"
+
+#include "libocfs2ne.h"
+
+
+/* Zero this much between progress updates and rate checks */
+#define ZERO_JOURNAL_CHUNK	(4 * 1024 * 1024)
+
+struct zero_journals_context {
+	uint64_t		zc_rate;	/* bytes per second, 0 is
+						   unlimited */
+	uint64_t		zc_bytes;	/* zeroed so far */
+	struct timeval		zc_start;
+	uint64_t		zc_last;	/* blocks done in the current
+						   journal at the last call */
+	struct tools_progress	*zc_prog;
+};
+
+static uint64_t elapsed_usecs(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000000ULL +
+		now.tv_usec - start->tv_usec;
+}
+
+/*
+ * Called by ocfs2_zero_journal() after each chunk.  If we are ahead
+ * of the requested rate, sleep until we aren't.
+ */
+static errcode_t zero_journals_progress(ocfs2_filesys *fs, uint64_t done,
+					uint64_t total, void *priv_data)
+{
+	struct zero_journals_context *zc = priv_data;
+	uint64_t want, spent;
+
+	zc->zc_bytes += (done - zc->zc_last) * fs->fs_blocksize;
+	zc->zc_last = done;
+	tools_progress_step(zc->zc_prog, 1);
+
+	if (!zc->zc_rate)
+		return 0;
+
+	want = zc->zc_bytes * 1000000ULL / zc->zc_rate;
+	spent = elapsed_usecs(&zc->zc_start);
+	if (want > spent)
+		usleep(want - spent);
+
+	return 0;
+}
+
+/*
+ * Online, a mounted node holds the cluster lock on its slot's journal
+ * for as long as it is mounted, and a node recovering a slot takes it
+ * too.  Holding it ourselves keeps both away while we zero.  Once we
+ * have it, the slot map is checked as well, and a slot that is in use
+ * is left alone whatever the lock said.  in_use is set when the journal
+ * must be skipped; otherwise the lock is held on return.
+ */
+static errcode_t zero_journals_lock(ocfs2_filesys *fs, int slot,
+				    uint64_t blkno, uint32_t generation,
+				    char *lockid, int *in_use)
+{
+	struct ocfs2_slot_map_data *map = NULL;
+	errcode_t err;
+
+	*in_use = 0;
+	ocfs2_encode_lockres(OCFS2_LOCK_TYPE_META, blkno, generation, 0,
+			     lockid);
+	err = tunefs_dlm_lock(fs, lockid, O2DLM_TRYLOCK, O2DLM_LEVEL_EXMODE);
+	if (err == O2DLM_ET_TRYLOCK_FAILED) {
+		*in_use = 1;
+		return 0;
+	}
+	if (err)
+		return err;
+
+	err = ocfs2_load_slot_map(fs, &map);
+	if (!err) {
+		if ((slot < map->md_num_slots) && map->md_slots[slot].sd_valid)
+			*in_use = 1;
+		ocfs2_free(&map);
+	}
+
+	if (err || *in_use)
+		tunefs_dlm_unlock(fs, lockid);
+
+	return err;
+}
+
+static int zero_journals_parse_option(struct tunefs_operation *op, char *arg)
+{
+	errcode_t err;
+	uint64_t *rate;
+
+	err = ocfs2_malloc0(sizeof(uint64_t), &rate);
+	if (err) {
+		tcom_err(err, "while processing the zero-journals option");
+		return 1;
+	}
+
+	if (arg) {
+		err = tunefs_get_number(arg, rate);
+		if (err) {
+			tcom_err(err, "- invalid rate: %s", arg);
+			ocfs2_free(&rate);
+			return 1;
+		}
+	}
+
+	op->to_private = rate;
+	return 0;
+}
+
+static int zero_journals_run(struct tunefs_operation *op, ocfs2_filesys *fs,
+			     int flags)
+{
+	errcode_t err = 0;
+	int i, rc = 0, pending = 0, zeroed = 0, in_use;
+	int online = flags & TUNEFS_FLAG_ONLINE;
+	int max_slots = OCFS2_RAW_SB(fs->fs_super)->s_max_slots;
+	uint64_t *argp = (uint64_t *)op->to_private;
+	uint64_t blkno, chunk_blocks, steps = 0;
+	uint64_t jblknos[OCFS2_MAX_SLOTS];
+	uint32_t jgens[OCFS2_MAX_SLOTS];
+	int jslots[OCFS2_MAX_SLOTS];
+	char lockid[OCFS2_LOCK_ID_MAX_LEN];
+	char *buf = NULL;
+	struct ocfs2_dinode *di;
+	struct zero_journals_context zc = {
+		.zc_rate = argp ? *argp : 0,
+	};
+
+	if (argp)
+		ocfs2_free(&argp);
+	op->to_private = NULL;
+
+	/*
+	 * Mounted nodes change the journal inodes and the slot map
+	 * under us, so none of it may come out of our cache.
+	 */
+	if (online)
+		io_destroy_cache(fs->fs_io);
+
+	err = ocfs2_malloc_block(fs->fs_io, &buf);
+	if (err) {
+		tcom_err(err, "while allocating an inode buffer");
+		return 1;
+	}
+
+	chunk_blocks = ZERO_JOURNAL_CHUNK / fs->fs_blocksize;
+	for (i = 0; i < max_slots; i++) {
+		err = ocfs2_lookup_system_inode(fs, JOURNAL_SYSTEM_INODE, i,
+						&blkno);
+		if (!err)
+			err = ocfs2_read_inode(fs, blkno, buf);
+		if (err) {
+			tcom_err(err, "while reading the journal for slot %d "
+				 "on device \"%s\"", i, fs->fs_devname);
+			rc = 1;
+			goto out;
+		}
+
+		di = (struct ocfs2_dinode *)buf;
+		if (!(di->id1.journal1.ij_flags & OCFS2_JOURNAL_UNZEROED_FL))
+			continue;
+
+		jslots[pending] = i;
+		jgens[pending] = di->i_generation;
+		jblknos[pending++] = blkno;
+		/* Block 0 is the journal superblock and is left alone */
+		steps += (ocfs2_blocks_in_bytes(fs, di->i_size) - 1 +
+			  chunk_blocks - 1) / chunk_blocks;
+	}
+
+	if (!pending) {
+		verbosef(VL_APP,
+			 "All journals on device \"%s\" are already zeroed; "
+			 "nothing to do\n", fs->fs_devname);
+		goto out;
+	}
+
+	if (!tools_interact("Zero %d journal(s) on device \"%s\"? ",
+			    pending, fs->fs_devname))
+		goto out;
+
+	zc.zc_prog = tools_progress_start("Zeroing journals", "zeroing",
+					  steps);
+	if (!zc.zc_prog) {
+		tcom_err(TUNEFS_ET_NO_MEMORY,
+			 "while initializing the progress display");
+		rc = 1;
+		goto out;
+	}
+
+	/*
+	 * A journal keeps its mark until all of it has been zeroed, so
+	 * signals are left alone.  If we are interrupted, running again
+	 * starts over on the journals that are still marked.
+	 */
+	gettimeofday(&zc.zc_start, NULL);
+	for (i = 0; i < pending; i++) {
+		if (online) {
+			err = zero_journals_lock(fs, jslots[i], jblknos[i],
+						 jgens[i], lockid, &in_use);
+			if (err) {
+				tcom_err(err, "while locking the journal for "
+					 "slot %d on device \"%s\"",
+					 jslots[i], fs->fs_devname);
+				rc = 1;
+				break;
+			}
+			if (in_use) {
+				verbosef(VL_APP, "Slot %d is in use; not "
+					 "zeroing its journal\n", jslots[i]);
+				continue;
+			}
+		}
+
+		zc.zc_last = 1;
+		err = ocfs2_zero_journal(fs, jblknos[i], chunk_blocks,
+					 zero_journals_progress, &zc);
+		if (online)
+			tunefs_dlm_unlock(fs, lockid);
+		if (err) {
+			tcom_err(err, "while zeroing journal inode %"PRIu64
+				 " on device \"%s\"", jblknos[i],
+				 fs->fs_devname);
+			rc = 1;
+			break;
+		}
+		zeroed++;
+	}
+
+	tools_progress_stop(zc.zc_prog);
+
+	if (!rc)
+		verbosef(VL_APP, "Zeroed %d journal(s), %"PRIu64" bytes\n",
+			 zeroed, zc.zc_bytes);
+	if (!rc && (zeroed < pending))
+		verbosef(VL_OUT, "%d journal(s) on device \"%s\" belong to "
+			"slots in use and were not zeroed; run again once "
+			"they are free\n", pending - zeroed, fs->fs_devname);
+
+out:
+	if (buf)
+		ocfs2_free(&buf);
+
+	return rc;
+}
+
+
+DEFINE_TUNEFS_OP(zero_journals,
+		 "Usage: op_zero_journals [opts] <device> [rate]\n",
+		 TUNEFS_FLAG_RW | TUNEFS_FLAG_ONLINE,
+		 zero_journals_parse_option,
+		 zero_journals_run);
+
+#ifdef DEBUG_EXE
+int main(int argc, char *argv[])
+{
+	return tunefs_op_main(argc, argv, &zero_journals_op);
+}
+#endif